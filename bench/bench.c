@@ -0,0 +1,398 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+//needed for clock_gettime with -std=c99
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "../lib/common.h"
+
+#ifdef __GLIBC__
+/*
+ * Count heap allocations by interposing the allocator functions and
+ * forwarding them to glibc.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void __libc_free(void *pointer);
+
+static uint64_t allocation_count = 0;
+static uint64_t allocated_bytes = 0;
+
+void *malloc(size_t size) {
+	allocation_count++;
+	allocated_bytes += size;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+	allocation_count++;
+	allocated_bytes += count * size;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+	if (pointer == NULL) {
+		allocation_count++;
+		allocated_bytes += size;
+	}
+	return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) {
+	__libc_free(pointer);
+}
+
+bool bench_allocation_counter(uint64_t * const allocations, uint64_t * const bytes) {
+	*allocations = allocation_count;
+	*bytes = allocated_bytes;
+
+	return true;
+}
+#else
+bool bench_allocation_counter(uint64_t * const allocations, uint64_t * const bytes) {
+	*allocations = 0;
+	*bytes = 0;
+
+	return false;
+}
+#endif
+
+uint64_t bench_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+return_status bench_samples_create(bench_samples ** const samples, const size_t capacity) {
+	return_status status = return_status_init();
+
+	if ((samples == NULL) || (capacity == 0)) {
+		throw(INVALID_INPUT, "Invalid input to bench_samples_create.");
+	}
+
+	*samples = malloc(sizeof(bench_samples));
+	throw_on_failed_alloc(*samples);
+
+	(*samples)->durations = malloc(capacity * sizeof(uint64_t));
+	if ((*samples)->durations == NULL) {
+		free_and_null_if_valid(*samples);
+		throw(ALLOCATION_FAILED, "Failed to allocate samples.");
+	}
+	(*samples)->capacity = capacity;
+	bench_samples_clear(*samples);
+
+cleanup:
+	return status;
+}
+
+void bench_samples_destroy(bench_samples * const samples) {
+	if (samples == NULL) {
+		return;
+	}
+
+	free(samples->durations);
+	free(samples);
+}
+
+void bench_samples_clear(bench_samples * const samples) {
+	samples->count = 0;
+	samples->started = 0;
+	samples->allocations = 0;
+	samples->allocated_bytes = 0;
+	samples->started_allocations = 0;
+	samples->started_allocated_bytes = 0;
+}
+
+void bench_start(bench_samples * const samples) {
+	bench_allocation_counter(&samples->started_allocations, &samples->started_allocated_bytes);
+	samples->started = bench_now();
+}
+
+void bench_stop(bench_samples * const samples) {
+	uint64_t stopped = bench_now();
+	uint64_t allocations;
+	uint64_t bytes;
+	bench_allocation_counter(&allocations, &bytes);
+	if (samples->count >= samples->capacity) {
+		return;
+	}
+
+	samples->durations[samples->count] = stopped - samples->started;
+	samples->allocations += allocations - samples->started_allocations;
+	samples->allocated_bytes += bytes - samples->started_allocated_bytes;
+	samples->count++;
+}
+
+static int compare_durations(const void *a, const void *b) {
+	uint64_t first = *(const uint64_t*)a;
+	uint64_t second = *(const uint64_t*)b;
+
+	if (first < second) {
+		return -1;
+	}
+	if (first > second) {
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Nearest rank percentile of sorted samples.
+ */
+static uint64_t percentile(const bench_samples * const samples, const unsigned int percent) {
+	if (samples->count == 0) {
+		return 0;
+	}
+
+	size_t rank = (samples->count * percent + 99) / 100;
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	return samples->durations[rank - 1];
+}
+
+void bench_summarize(bench_summary * const summary, bench_samples * const samples) {
+	memset(summary, 0, sizeof(bench_summary));
+	if (samples->count == 0) {
+		return;
+	}
+
+	qsort(samples->durations, samples->count, sizeof(uint64_t), compare_durations);
+
+	summary->iterations = samples->count;
+	for (size_t i = 0; i < samples->count; i++) {
+		summary->total += samples->durations[i];
+	}
+	summary->minimum = samples->durations[0];
+	summary->maximum = samples->durations[samples->count - 1];
+	summary->p50 = percentile(samples, 50);
+	summary->p99 = percentile(samples, 99);
+	summary->mean = (double)summary->total / (double)summary->iterations;
+	summary->allocations = (double)samples->allocations / (double)summary->iterations;
+	summary->allocated_bytes = (double)samples->allocated_bytes / (double)summary->iterations;
+	if (summary->total != 0) {
+		summary->operations_per_second = (double)summary->iterations * 1e9 / (double)summary->total;
+	}
+}
+
+return_status bench_run(
+		bench_summary * const summary,
+		bench_samples * const samples,
+		bench_operation operation,
+		void * const context,
+		const size_t warmup,
+		const size_t repetitions,
+		const size_t batch) {
+	return_status status = return_status_init();
+
+	if ((summary == NULL) || (samples == NULL) || (operation == NULL) || (batch == 0)) {
+		throw(INVALID_INPUT, "Invalid input to bench_run.");
+	}
+
+	bench_samples_clear(samples);
+
+	for (size_t i = 0; i < warmup; i++) {
+		status = operation(context);
+		throw_on_error(GENERIC_ERROR, "Failed to run operation during warmup.");
+	}
+
+	for (size_t i = 0; (i < repetitions) && (i < samples->capacity); i++) {
+		bench_start(samples);
+		for (size_t j = 0; j < batch; j++) {
+			status = operation(context);
+			on_error {
+				bench_stop(samples);
+				throw(GENERIC_ERROR, "Failed to run operation.");
+			}
+		}
+		bench_stop(samples);
+
+		//average over the batch
+		samples->durations[samples->count - 1] /= batch;
+	}
+
+	bench_summarize(summary, samples);
+	summary->iterations *= batch;
+	summary->allocations /= (double)batch;
+	summary->allocated_bytes /= (double)batch;
+
+cleanup:
+	return status;
+}
+
+bool bench_selected(const bench_options * const options, const char * const benchmark) {
+	if (options->filter == NULL) {
+		return true;
+	}
+
+	return strstr(benchmark, options->filter) != NULL;
+}
+
+return_status bench_parse_options(bench_options * const options, int argc, char **argv) {
+	return_status status = return_status_init();
+
+	options->format = BENCH_FORMAT_CSV;
+	options->output_filename = NULL;
+	options->filter = NULL;
+	options->quick = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--quick") == 0) {
+			options->quick = true;
+		} else if ((strcmp(argv[i], "--format") == 0) && ((i + 1) < argc)) {
+			i++;
+			if (strcmp(argv[i], "csv") == 0) {
+				options->format = BENCH_FORMAT_CSV;
+			} else if (strcmp(argv[i], "json") == 0) {
+				options->format = BENCH_FORMAT_JSON;
+			} else {
+				throw(INVALID_INPUT, "Unknown output format, use 'csv' or 'json'.");
+			}
+		} else if ((strcmp(argv[i], "--output") == 0) && ((i + 1) < argc)) {
+			i++;
+			options->output_filename = argv[i];
+		} else if ((strcmp(argv[i], "--filter") == 0) && ((i + 1) < argc)) {
+			i++;
+			options->filter = argv[i];
+		} else {
+			fprintf(stderr, "Usage: %s [--format csv|json] [--output <file>] [--filter <substring>] [--quick]\n", argv[0]);
+			throw(INVALID_INPUT, "Invalid command line arguments.");
+		}
+	}
+
+cleanup:
+	return status;
+}
+
+return_status bench_reporter_begin(bench_reporter * const reporter, const bench_options * const options) {
+	return_status status = return_status_init();
+
+	reporter->format = options->format;
+	reporter->results = 0;
+	reporter->output = stdout;
+	if (options->output_filename != NULL) {
+		reporter->output = fopen(options->output_filename, "w");
+		if (reporter->output == NULL) {
+			reporter->output = stdout;
+			throw(GENERIC_ERROR, "Failed to open output file.");
+		}
+	}
+
+	if (reporter->format == BENCH_FORMAT_CSV) {
+		fprintf(reporter->output, "benchmark,parameter_name,parameter,iterations,ops_per_second,mean_ns,p50_ns,p99_ns,min_ns,max_ns,allocations_per_op,allocated_bytes_per_op,extra_name,extra\n");
+	} else {
+		fprintf(reporter->output, "[");
+	}
+
+cleanup:
+	return status;
+}
+
+void bench_reporter_end(bench_reporter * const reporter) {
+	if (reporter->format == BENCH_FORMAT_JSON) {
+		fprintf(reporter->output, "\n]\n");
+	}
+
+	fflush(reporter->output);
+	if (reporter->output != stdout) {
+		fclose(reporter->output);
+		reporter->output = stdout;
+	}
+}
+
+void bench_report(
+		bench_reporter * const reporter,
+		const char * const benchmark,
+		const char * const parameter_name,
+		const uint64_t parameter,
+		const bench_summary * const summary,
+		const char * const extra_name,
+		const double extra) {
+	const char *parameter_string = (parameter_name != NULL) ? parameter_name : "";
+	const char *extra_string = (extra_name != NULL) ? extra_name : "";
+
+	if (reporter->format == BENCH_FORMAT_CSV) {
+		fprintf(reporter->output,
+				"%s,%s,%llu,%zu,%.2f,%.0f,%llu,%llu,%llu,%llu,%.2f,%.2f,%s,%.2f\n",
+				benchmark,
+				parameter_string,
+				(unsigned long long)parameter,
+				summary->iterations,
+				summary->operations_per_second,
+				summary->mean,
+				(unsigned long long)summary->p50,
+				(unsigned long long)summary->p99,
+				(unsigned long long)summary->minimum,
+				(unsigned long long)summary->maximum,
+				summary->allocations,
+				summary->allocated_bytes,
+				extra_string,
+				extra);
+	} else {
+		fprintf(reporter->output,
+				"%s\n\t{\"benchmark\": \"%s\", \"parameter_name\": \"%s\", \"parameter\": %llu, \"iterations\": %zu, "
+				"\"ops_per_second\": %.2f, \"mean_ns\": %.0f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"min_ns\": %llu, \"max_ns\": %llu, "
+				"\"allocations_per_op\": %.2f, \"allocated_bytes_per_op\": %.2f",
+				(reporter->results == 0) ? "" : ",",
+				benchmark,
+				parameter_string,
+				(unsigned long long)parameter,
+				summary->iterations,
+				summary->operations_per_second,
+				summary->mean,
+				(unsigned long long)summary->p50,
+				(unsigned long long)summary->p99,
+				(unsigned long long)summary->minimum,
+				(unsigned long long)summary->maximum,
+				summary->allocations,
+				summary->allocated_bytes);
+		if (extra_name != NULL) {
+			fprintf(reporter->output, ", \"%s\": %.2f", extra_name, extra);
+		}
+		fprintf(reporter->output, "}");
+	}
+
+	fflush(reporter->output);
+	reporter->results++;
+}
+
+void bench_print_errors(return_status * const status) {
+	if ((status == NULL) || (status->status == SUCCESS)) {
+		return;
+	}
+
+	fprintf(stderr, "ERROR: %s\n", return_status_get_name(status->status));
+	error_message *error = status->error;
+	for (size_t i = 1; error != NULL; i++, error = error->next) {
+		fprintf(stderr, "%zu: %s\n", i, error->message);
+	}
+
+	return_status_destroy_errors(status);
+}
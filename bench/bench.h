@@ -0,0 +1,169 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*! \file
+ * Timing, statistics and reporting helpers shared by the benchmarks.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../lib/return-status.h"
+
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+typedef enum bench_format { BENCH_FORMAT_CSV, BENCH_FORMAT_JSON } bench_format;
+
+/*
+ * Latency samples of one benchmark in nanoseconds.
+ */
+typedef struct bench_samples {
+	size_t count;
+	size_t capacity;
+	uint64_t *durations;
+	uint64_t started; //timestamp of the currently running measurement
+	//heap allocations during the measurements
+	uint64_t allocations;
+	uint64_t allocated_bytes;
+	uint64_t started_allocations;
+	uint64_t started_allocated_bytes;
+} bench_samples;
+
+typedef struct bench_summary {
+	size_t iterations;
+	uint64_t total; //nanoseconds
+	uint64_t minimum;
+	uint64_t maximum;
+	uint64_t p50;
+	uint64_t p99;
+	double mean;
+	double operations_per_second;
+	//heap allocations per operation
+	double allocations;
+	double allocated_bytes;
+} bench_summary;
+
+/*
+ * Writes the results of all benchmarks in a machine readable format
+ * (one CSV line or one JSON object per result).
+ */
+typedef struct bench_reporter {
+	FILE *output;
+	bench_format format;
+	size_t results;
+} bench_reporter;
+
+/*
+ * Common command line options of the benchmark executables.
+ *
+ * --format csv|json, --output <file>, --quick (fewer iterations and
+ * smaller sweeps, used as a smoke test) and --filter <substring> (only
+ * run benchmarks whose name contains the substring).
+ */
+typedef struct bench_options {
+	bench_format format;
+	const char *output_filename;
+	const char *filter;
+	bool quick;
+} bench_options;
+
+/*
+ * One operation to be measured by bench_run.
+ */
+typedef return_status (*bench_operation)(void * const context);
+
+/*
+ * Monotonic timestamp in nanoseconds.
+ */
+uint64_t bench_now(void);
+
+return_status bench_samples_create(bench_samples ** const samples, const size_t capacity) __attribute__((warn_unused_result));
+void bench_samples_destroy(bench_samples * const samples);
+void bench_samples_clear(bench_samples * const samples);
+
+/*
+ * Number of heap allocations (malloc, calloc, realloc with NULL) and
+ * allocated bytes since the start of the process. Only available with
+ * glibc, returns false otherwise. Memory from sodium_malloc isn't counted.
+ *
+ * The counters aren't thread safe.
+ */
+bool bench_allocation_counter(uint64_t * const allocations, uint64_t * const bytes);
+
+/*
+ * Start and stop one measurement. The samples silently stop recording
+ * once their capacity is exhausted.
+ */
+void bench_start(bench_samples * const samples);
+void bench_stop(bench_samples * const samples);
+
+/*
+ * Sort the samples and calculate the summary.
+ */
+void bench_summarize(bench_summary * const summary, bench_samples * const samples);
+
+/*
+ * Run an operation 'warmup' times without measuring it, then measure
+ * 'repetitions' samples. Every sample runs the operation 'batch' times
+ * and records the average per operation, this amortizes the cost of
+ * taking the time for very fast operations.
+ */
+return_status bench_run(
+		bench_summary * const summary,
+		bench_samples * const samples,
+		bench_operation operation,
+		void * const context,
+		const size_t warmup,
+		const size_t repetitions,
+		const size_t batch) __attribute__((warn_unused_result));
+
+/*
+ * Check if a benchmark was selected with --filter.
+ */
+bool bench_selected(const bench_options * const options, const char * const benchmark);
+
+return_status bench_parse_options(bench_options * const options, int argc, char **argv) __attribute__((warn_unused_result));
+
+return_status bench_reporter_begin(bench_reporter * const reporter, const bench_options * const options) __attribute__((warn_unused_result));
+void bench_reporter_end(bench_reporter * const reporter);
+
+/*
+ * Report the summary of a benchmark.
+ *
+ * 'parameter' is the swept value (message size, number of skipped keys, ...),
+ * 'extra_name'/'extra' an optional additional metric (can be NULL/0).
+ */
+void bench_report(
+		bench_reporter * const reporter,
+		const char * const benchmark,
+		const char * const parameter_name,
+		const uint64_t parameter,
+		const bench_summary * const summary,
+		const char * const extra_name,
+		const double extra);
+
+/*
+ * Print the errors of a benchmark to stderr and destroy them.
+ */
+void bench_print_errors(return_status * const status);
+#endif
@@ -0,0 +1,830 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * End to end benchmarks of the public molch API.
+ *
+ * Usage: molch-bench [--format csv|json] [--output <file>] [--quick]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "bench.h"
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "../lib/common.h"
+
+#define MAX_SAMPLES 1000
+
+static bench_options options;
+static bench_reporter reporter;
+static bench_samples *samples = NULL;
+static bench_samples *other_samples = NULL;
+
+static unsigned char backup_key[BACKUP_KEY_SIZE];
+
+/*
+ * libsodium's default random number generator, but counting how often
+ * it is called. Every call is at least one syscall.
+ */
+static uint64_t os_random_calls = 0;
+
+static const char *counting_random_name(void) {
+	return "counting sysrandom";
+}
+
+static uint32_t counting_random(void) {
+	__atomic_add_fetch(&os_random_calls, 1, __ATOMIC_RELAXED);
+	return randombytes_sysrandom_implementation.random();
+}
+
+static void counting_random_stir(void) {
+	randombytes_sysrandom_implementation.stir();
+}
+
+static void counting_random_buf(void * const buffer, const size_t size) {
+	__atomic_add_fetch(&os_random_calls, 1, __ATOMIC_RELAXED);
+	randombytes_sysrandom_implementation.buf(buffer, size);
+}
+
+static int counting_random_close(void) {
+	return randombytes_sysrandom_implementation.close();
+}
+
+static randombytes_implementation counting_random_implementation = {
+	counting_random_name,
+	counting_random,
+	counting_random_stir,
+	NULL, //libsodium builds randombytes_uniform on top of counting_random
+	counting_random_buf,
+	counting_random_close
+};
+
+typedef struct bench_user {
+	unsigned char public_master_key[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char *prekey_list;
+	size_t prekey_list_length;
+} bench_user;
+
+static return_status create_user(bench_user * const user, const char * const spice) {
+	return_status status = return_status_init();
+
+	user->prekey_list = NULL;
+	user->prekey_list_length = 0;
+
+	status = molch_create_user(
+			user->public_master_key,
+			sizeof(user->public_master_key),
+			&user->prekey_list,
+			&user->prekey_list_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			(const unsigned char*)spice,
+			strlen(spice));
+	throw_on_error(CREATION_ERROR, "Failed to create user.");
+
+cleanup:
+	return status;
+}
+
+static void destroy_user(bench_user * const user) {
+	return_status status = molch_destroy_user(user->public_master_key, sizeof(user->public_master_key), NULL, NULL);
+	return_status_destroy_errors(&status);
+	free_and_null_if_valid(user->prekey_list);
+}
+
+/*
+ * Start a conversation from sender to receiver and let the receiver
+ * accept it. The receivers prekey list is replaced with the new one.
+ */
+static return_status start_conversation(
+		unsigned char * const sender_conversation_id, //CONVERSATION_ID_SIZE
+		unsigned char * const receiver_conversation_id, //CONVERSATION_ID_SIZE
+		bench_user * const sender,
+		bench_user * const receiver,
+		bench_samples * const send_samples, //optional
+		bench_samples * const receive_samples) { //optional
+	return_status status = return_status_init();
+
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	unsigned char *new_prekey_list = NULL;
+	size_t new_prekey_list_length = 0;
+
+	static const char start_message[] = "Hello, this is a benchmark.";
+
+	if (send_samples != NULL) {
+		bench_start(send_samples);
+	}
+	status = molch_start_send_conversation(
+			sender_conversation_id,
+			CONVERSATION_ID_SIZE,
+			&packet,
+			&packet_length,
+			sender->public_master_key,
+			sizeof(sender->public_master_key),
+			receiver->public_master_key,
+			sizeof(receiver->public_master_key),
+			receiver->prekey_list,
+			receiver->prekey_list_length,
+			(const unsigned char*)start_message,
+			sizeof(start_message),
+			NULL,
+			NULL);
+	if (send_samples != NULL) {
+		bench_stop(send_samples);
+	}
+	throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+
+	if (receiver_conversation_id == NULL) {
+		goto cleanup;
+	}
+
+	if (receive_samples != NULL) {
+		bench_start(receive_samples);
+	}
+	status = molch_start_receive_conversation(
+			receiver_conversation_id,
+			CONVERSATION_ID_SIZE,
+			&new_prekey_list,
+			&new_prekey_list_length,
+			&message,
+			&message_length,
+			receiver->public_master_key,
+			sizeof(receiver->public_master_key),
+			sender->public_master_key,
+			sizeof(sender->public_master_key),
+			packet,
+			packet_length,
+			NULL,
+			NULL);
+	if (receive_samples != NULL) {
+		bench_stop(receive_samples);
+	}
+	throw_on_error(CREATION_ERROR, "Failed to start receive conversation.");
+
+	free_and_null_if_valid(receiver->prekey_list);
+	receiver->prekey_list = new_prekey_list;
+	receiver->prekey_list_length = new_prekey_list_length;
+	new_prekey_list = NULL;
+
+cleanup:
+	free_and_null_if_valid(packet);
+	free_and_null_if_valid(message);
+	free_and_null_if_valid(new_prekey_list);
+
+	return status;
+}
+
+static void end_conversation(unsigned char * const conversation_id) {
+	return_status status = molch_end_conversation(conversation_id, CONVERSATION_ID_SIZE, NULL, NULL);
+	return_status_destroy_errors(&status);
+}
+
+static return_status encrypt(
+		unsigned char ** const packet,
+		size_t * const packet_length,
+		unsigned char * const conversation_id,
+		const unsigned char * const message,
+		const size_t message_length) {
+	return molch_encrypt_message(
+			packet,
+			packet_length,
+			conversation_id,
+			CONVERSATION_ID_SIZE,
+			message,
+			message_length,
+			NULL,
+			NULL);
+}
+
+static return_status decrypt(
+		unsigned char * const conversation_id,
+		const unsigned char * const packet,
+		const size_t packet_length) {
+	return_status status = return_status_init();
+
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	uint32_t message_number = 0;
+	uint32_t previous_message_number = 0;
+
+	status = molch_decrypt_message(
+			&message,
+			&message_length,
+			&message_number,
+			&previous_message_number,
+			conversation_id,
+			CONVERSATION_ID_SIZE,
+			packet,
+			packet_length,
+			NULL,
+			NULL);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
+
+cleanup:
+	free_and_null_if_valid(message);
+
+	return status;
+}
+
+/*
+ * molch_create_user, including the spiced random key generation
+ * and the creation of the prekey list.
+ */
+static return_status bench_create_user(void) {
+	return_status status = return_status_init();
+
+	const size_t iterations = options.quick ? 2 : 20;
+
+	bench_user user;
+	bool user_exists = false;
+
+	bench_samples_clear(samples);
+	for (size_t i = 0; i < iterations; i++) {
+		bench_start(samples);
+		status = create_user(&user, "benchmark user spice");
+		bench_stop(samples);
+		throw_on_error(CREATION_ERROR, "Failed to create user.");
+		user_exists = true;
+
+		destroy_user(&user);
+		user_exists = false;
+	}
+
+	bench_summary summary;
+	bench_summarize(&summary, samples);
+	bench_report(&reporter, "create_user", NULL, 0, &summary, NULL, 0);
+
+cleanup:
+	if (user_exists) {
+		destroy_user(&user);
+	}
+
+	return status;
+}
+
+/*
+ * molch_start_send_conversation and molch_start_receive_conversation.
+ */
+static return_status bench_conversation_start(void) {
+	return_status status = return_status_init();
+
+	const size_t iterations = options.quick ? 5 : 200;
+
+	bench_user alice;
+	bench_user bob;
+	bool alice_exists = false;
+	bool bob_exists = false;
+	unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+	status = create_user(&alice, "alice");
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	alice_exists = true;
+	status = create_user(&bob, "bob");
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+	bob_exists = true;
+
+	bench_samples_clear(samples);
+	bench_samples_clear(other_samples);
+	for (size_t i = 0; i < iterations; i++) {
+		status = start_conversation(alice_conversation, bob_conversation, &alice, &bob, samples, other_samples);
+		throw_on_error(CREATION_ERROR, "Failed to start conversation.");
+
+		//keep the conversation stores small
+		end_conversation(alice_conversation);
+		end_conversation(bob_conversation);
+	}
+
+	bench_summary summary;
+	bench_summarize(&summary, samples);
+	bench_report(&reporter, "start_send_conversation", NULL, 0, &summary, NULL, 0);
+	bench_summarize(&summary, other_samples);
+	bench_report(&reporter, "start_receive_conversation", NULL, 0, &summary, NULL, 0);
+
+cleanup:
+	if (alice_exists) {
+		destroy_user(&alice);
+	}
+	if (bob_exists) {
+		destroy_user(&bob);
+	}
+
+	return status;
+}
+
+/*
+ * In order molch_encrypt_message/molch_decrypt_message from 16 B to 1 MiB.
+ */
+static return_status bench_encrypt_decrypt(void) {
+	return_status status = return_status_init();
+
+	static const size_t sizes[] = {16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576};
+
+	bench_user alice;
+	bench_user bob;
+	bool alice_exists = false;
+	bool bob_exists = false;
+	unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+	unsigned char *message = NULL;
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+
+	status = create_user(&alice, "alice");
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	alice_exists = true;
+	status = create_user(&bob, "bob");
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+	bob_exists = true;
+
+	status = start_conversation(alice_conversation, bob_conversation, &alice, &bob, NULL, NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start conversation.");
+
+	message = malloc(sizes[sizeof(sizes)/sizeof(*sizes) - 1]);
+	throw_on_failed_alloc(message);
+	randombytes_buf(message, sizes[sizeof(sizes)/sizeof(*sizes) - 1]);
+
+	for (size_t size_index = 0; size_index < (sizeof(sizes)/sizeof(*sizes)); size_index++) {
+		const size_t size = sizes[size_index];
+		size_t iterations = (size <= 4096) ? 1000 : ((size <= 65536) ? 200 : 20);
+		if (options.quick) {
+			iterations = 5;
+		}
+
+		bench_samples_clear(samples);
+		bench_samples_clear(other_samples);
+		size_t wire_bytes = 0;
+		for (size_t i = 0; i < iterations; i++) {
+			bench_start(samples);
+			status = encrypt(&packet, &packet_length, alice_conversation, message, size);
+			bench_stop(samples);
+			throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+			wire_bytes = packet_length;
+
+			bench_start(other_samples);
+			status = decrypt(bob_conversation, packet, packet_length);
+			bench_stop(other_samples);
+			throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
+
+			free_and_null_if_valid(packet);
+		}
+
+		bench_summary summary;
+		bench_summarize(&summary, samples);
+		bench_report(&reporter, "encrypt", "message_size", size, &summary, "wire_bytes", (double)wire_bytes);
+		bench_summarize(&summary, other_samples);
+		bench_report(&reporter, "decrypt", "message_size", size, &summary, "wire_bytes", (double)wire_bytes);
+	}
+
+cleanup:
+	free_and_null_if_valid(packet);
+	free_and_null_if_valid(message);
+	if (alice_exists) {
+		destroy_user(&alice);
+	}
+	if (bob_exists) {
+		destroy_user(&bob);
+	}
+
+	return status;
+}
+
+/*
+ * Small messages back and forth (a ratchet step for every message) with
+ * the buffered random number generator and with the OS one. Reports how
+ * often the OS random number generator is called per message.
+ */
+static return_status bench_random_sources(void) {
+	return_status status = return_status_init();
+
+	static const molch_random_source sources[] = {MOLCH_RANDOM_SYSTEM, MOLCH_RANDOM_BUFFERED};
+	static const unsigned char message[] = "ping";
+
+	bench_user alice;
+	bench_user bob;
+	bool alice_exists = false;
+	bool bob_exists = false;
+	unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+
+	status = create_user(&alice, "alice");
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	alice_exists = true;
+	status = create_user(&bob, "bob");
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+	bob_exists = true;
+
+	status = start_conversation(alice_conversation, bob_conversation, &alice, &bob, NULL, NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start conversation.");
+
+	const size_t iterations = options.quick ? 5 : 500;
+	for (size_t source = 0; source < (sizeof(sources) / sizeof(*sources)); source++) {
+		molch_set_random_source(sources[source]);
+
+		bench_samples_clear(samples);
+		const uint64_t calls_before = __atomic_load_n(&os_random_calls, __ATOMIC_RELAXED);
+		for (size_t i = 0; i < iterations; i++) {
+			//alternate the direction
+			unsigned char * const sender = (i % 2) ? bob_conversation : alice_conversation;
+			unsigned char * const receiver = (i % 2) ? alice_conversation : bob_conversation;
+
+			bench_start(samples);
+			status = encrypt(&packet, &packet_length, sender, message, sizeof(message));
+			bench_stop(samples);
+			throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+
+			status = decrypt(receiver, packet, packet_length);
+			throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
+
+			free_and_null_if_valid(packet);
+		}
+		const uint64_t calls = __atomic_load_n(&os_random_calls, __ATOMIC_RELAXED) - calls_before;
+
+		bench_summary summary;
+		bench_summarize(&summary, samples);
+		bench_report(&reporter, "encrypt_random_source", "buffered", sources[source] == MOLCH_RANDOM_BUFFERED, &summary, "os_random_calls_per_message", (double)calls / iterations);
+	}
+
+cleanup:
+	molch_set_random_source(MOLCH_RANDOM_BUFFERED);
+	free_and_null_if_valid(packet);
+	if (alice_exists) {
+		destroy_user(&alice);
+	}
+	if (bob_exists) {
+		destroy_user(&bob);
+	}
+
+	return status;
+}
+
+/*
+ * Out of order decryption.
+ *
+ * "decrypt_skip_ahead" receives message N first and has to stage N skipped
+ * keys, "decrypt_skipped" then receives message N-1 which is found at the end
+ * of the skipped key store.
+ */
+static return_status bench_out_of_order(void) {
+	return_status status = return_status_init();
+
+	static const size_t skipped_counts[] = {1, 10, 100, 1000};
+	static const unsigned char message[] = "out of order";
+
+	bench_user alice;
+	bench_user bob;
+	bool alice_exists = false;
+	bool bob_exists = false;
+	unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+	unsigned char **packets = NULL;
+	size_t *packet_lengths = NULL;
+	size_t packet_count = 0;
+
+	const size_t maximum_skipped = skipped_counts[sizeof(skipped_counts)/sizeof(*skipped_counts) - 1];
+	packets = calloc(maximum_skipped + 1, sizeof(unsigned char*));
+	throw_on_failed_alloc(packets);
+	packet_lengths = calloc(maximum_skipped + 1, sizeof(size_t));
+	throw_on_failed_alloc(packet_lengths);
+
+	status = create_user(&alice, "alice");
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	alice_exists = true;
+	status = create_user(&bob, "bob");
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+	bob_exists = true;
+
+	status = start_conversation(alice_conversation, bob_conversation, &alice, &bob, NULL, NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start conversation.");
+
+	for (size_t count_index = 0; count_index < (sizeof(skipped_counts)/sizeof(*skipped_counts)); count_index++) {
+		const size_t skipped = skipped_counts[count_index];
+		const size_t iterations = options.quick ? 2 : 20;
+
+		bench_samples_clear(samples);
+		bench_samples_clear(other_samples);
+		for (size_t i = 0; i < iterations; i++) {
+			for (packet_count = 0; packet_count <= skipped; packet_count++) {
+				status = encrypt(&packets[packet_count], &packet_lengths[packet_count], alice_conversation, message, sizeof(message));
+				throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+			}
+
+			bench_start(samples);
+			status = decrypt(bob_conversation, packets[skipped], packet_lengths[skipped]);
+			bench_stop(samples);
+			throw_on_error(DECRYPT_ERROR, "Failed to decrypt the newest message.");
+
+			bench_start(other_samples);
+			status = decrypt(bob_conversation, packets[skipped - 1], packet_lengths[skipped - 1]);
+			bench_stop(other_samples);
+			throw_on_error(DECRYPT_ERROR, "Failed to decrypt a skipped message.");
+
+			//drain the remaining skipped keys
+			for (size_t j = 0; (j + 1) < skipped; j++) {
+				status = decrypt(bob_conversation, packets[j], packet_lengths[j]);
+				throw_on_error(DECRYPT_ERROR, "Failed to decrypt a skipped message.");
+			}
+
+			for (size_t j = 0; j < packet_count; j++) {
+				free_and_null_if_valid(packets[j]);
+			}
+			packet_count = 0;
+		}
+
+		bench_summary summary;
+		bench_summarize(&summary, samples);
+		bench_report(&reporter, "decrypt_skip_ahead", "skipped_keys", skipped, &summary, NULL, 0);
+		bench_summarize(&summary, other_samples);
+		bench_report(&reporter, "decrypt_skipped", "skipped_keys", skipped, &summary, NULL, 0);
+	}
+
+cleanup:
+	if (packets != NULL) {
+		for (size_t j = 0; j <= maximum_skipped; j++) {
+			free_and_null_if_valid(packets[j]);
+		}
+	}
+	free_and_null_if_valid(packets);
+	free_and_null_if_valid(packet_lengths);
+	if (alice_exists) {
+		destroy_user(&alice);
+	}
+	if (bob_exists) {
+		destroy_user(&bob);
+	}
+
+	return status;
+}
+
+/*
+ * Rejection of packets that can't be decrypted: random bytes, a
+ * corrupted packet, a replayed packet and a corrupted packet once the
+ * budget of trial decryptions is exhausted. Single threaded, so the
+ * operations per second are rejected packets per second and core, the
+ * allocations per rejection are part of the report.
+ */
+static return_status bench_invalid_packets(void) {
+	return_status status = return_status_init();
+
+	static const unsigned char message[] = "replay me";
+	static const char * const names[] = {"reject_random", "reject_corrupted", "reject_replayed", "reject_over_budget"};
+
+	bench_user alice;
+	bench_user bob;
+	bool alice_exists = false;
+	bool bob_exists = false;
+	unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+	unsigned char *invalid_packets[3] = {NULL, NULL, NULL};
+
+	status = create_user(&alice, "alice");
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	alice_exists = true;
+	status = create_user(&bob, "bob");
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+	bob_exists = true;
+
+	status = start_conversation(alice_conversation, bob_conversation, &alice, &bob, NULL, NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start conversation.");
+
+	status = encrypt(&packet, &packet_length, alice_conversation, message, sizeof(message));
+	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+	status = decrypt(bob_conversation, packet, packet_length);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
+
+	for (size_t i = 0; i < 3; i++) {
+		invalid_packets[i] = malloc(packet_length);
+		throw_on_failed_alloc(invalid_packets[i]);
+	}
+	randombytes_buf(invalid_packets[0], packet_length);
+	memcpy(invalid_packets[2], packet, packet_length);
+
+	//corrupt a packet that hasn't been received yet, so it isn't a replay
+	free_and_null_if_valid(packet);
+	status = encrypt(&packet, &packet_length, alice_conversation, message, sizeof(message));
+	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+	memcpy(invalid_packets[1], packet, packet_length);
+	invalid_packets[1][packet_length / 2] ^= 0x01;
+
+	const size_t iterations = options.quick ? 10 : 1000;
+	for (size_t kind = 0; kind < 4; kind++) {
+		if (kind == 3) {
+			//one trial per hour, used up by the first corrupted packet
+			status = molch_conversation_set_trial_budget(bob_conversation, CONVERSATION_ID_SIZE, 1, 3600000);
+			throw_on_error(DATA_SET_ERROR, "Failed to set the budget of trial decryptions.");
+		}
+
+		const unsigned char * const invalid_packet = invalid_packets[(kind == 3) ? 1 : kind];
+		bench_samples_clear(samples);
+		for (size_t i = 0; i < iterations; i++) {
+			bench_start(samples);
+			return_status rejected = decrypt(bob_conversation, invalid_packet, packet_length);
+			return_status_destroy_errors(&rejected);
+			bench_stop(samples);
+			if (rejected.status == SUCCESS) {
+				throw(INCORRECT_DATA, "Decrypted an invalid packet.");
+			}
+		}
+
+		bench_summary summary;
+		bench_summarize(&summary, samples);
+		bench_report(&reporter, names[kind], NULL, 0, &summary, NULL, 0);
+	}
+
+cleanup:
+	free_and_null_if_valid(packet);
+	for (size_t i = 0; i < 3; i++) {
+		free_and_null_if_valid(invalid_packets[i]);
+	}
+	if (alice_exists) {
+		destroy_user(&alice);
+	}
+	if (bob_exists) {
+		destroy_user(&bob);
+	}
+
+	return status;
+}
+
+/*
+ * molch_export and molch_import of the whole library state with
+ * an increasing number of conversations.
+ */
+static return_status bench_export_import(void) {
+	return_status status = return_status_init();
+
+	static const size_t full_sweep[] = {1000, 10000, 100000};
+	static const size_t quick_sweep[] = {100};
+	const size_t *sweep = options.quick ? quick_sweep : full_sweep;
+	const size_t sweep_length = options.quick ? (sizeof(quick_sweep)/sizeof(*quick_sweep)) : (sizeof(full_sweep)/sizeof(*full_sweep));
+
+	bench_user alice;
+	bench_user bob;
+	bool alice_exists = false;
+	bool bob_exists = false;
+	unsigned char conversation_id[CONVERSATION_ID_SIZE];
+	size_t conversation_count = 0;
+
+	unsigned char *backup = NULL;
+	size_t backup_length = 0;
+
+	status = create_user(&alice, "alice");
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	alice_exists = true;
+	status = create_user(&bob, "bob");
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+	bob_exists = true;
+
+	for (size_t sweep_index = 0; sweep_index < sweep_length; sweep_index++) {
+		const size_t conversations = sweep[sweep_index];
+		const size_t iterations = options.quick ? 2 : 5;
+
+		//only the senders side is needed to fill the state
+		fprintf(stderr, "Creating %zu conversations ...\n", conversations);
+		for (; conversation_count < conversations; conversation_count++) {
+			status = start_conversation(conversation_id, NULL, &alice, &bob, NULL, NULL);
+			on_error {
+				//most likely ran out of locked memory or memory mappings, skip the rest of the sweep
+				fprintf(stderr, "Stopping the export/import sweep at %zu conversations.\n", conversation_count);
+				bench_print_errors(&status);
+				goto cleanup;
+			}
+		}
+
+		bench_samples_clear(samples);
+		bench_samples_clear(other_samples);
+		for (size_t i = 0; i < iterations; i++) {
+			bench_start(samples);
+			status = molch_export(&backup, &backup_length);
+			bench_stop(samples);
+			throw_on_error(EXPORT_ERROR, "Failed to export.");
+
+			bench_start(other_samples);
+			status = molch_import(
+					backup_key,
+					sizeof(backup_key),
+					backup,
+					backup_length,
+					backup_key,
+					sizeof(backup_key));
+			bench_stop(other_samples);
+			throw_on_error(IMPORT_ERROR, "Failed to import.");
+
+			free_and_null_if_valid(backup);
+		}
+
+		bench_summary summary;
+		bench_summarize(&summary, samples);
+		bench_report(&reporter, "export", "conversations", conversations, &summary, "backup_bytes", (double)backup_length);
+		bench_summarize(&summary, other_samples);
+		bench_report(&reporter, "import", "conversations", conversations, &summary, "backup_bytes", (double)backup_length);
+	}
+
+cleanup:
+	free_and_null_if_valid(backup);
+	//this also removes all the conversations
+	if (alice_exists) {
+		destroy_user(&alice);
+	}
+	if (bob_exists) {
+		destroy_user(&bob);
+	}
+
+	return status;
+}
+
+int main(int argc, char **argv) {
+	//has to be set before sodium_init
+	if (randombytes_set_implementation(&counting_random_implementation) != 0) {
+		return -1;
+	}
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	bool reporter_started = false;
+
+	status = bench_parse_options(&options, argc, argv);
+	throw_on_error(INVALID_INPUT, "Failed to parse options.");
+
+	status = bench_samples_create(&samples, MAX_SAMPLES);
+	throw_on_error(CREATION_ERROR, "Failed to create samples.");
+	status = bench_samples_create(&other_samples, MAX_SAMPLES);
+	throw_on_error(CREATION_ERROR, "Failed to create samples.");
+
+	status = bench_reporter_begin(&reporter, &options);
+	throw_on_error(INIT_ERROR, "Failed to start reporting.");
+	reporter_started = true;
+
+	status = bench_create_user();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark user creation.");
+
+	status = bench_conversation_start();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark conversation start.");
+
+	status = bench_encrypt_decrypt();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark encryption and decryption.");
+
+	status = bench_random_sources();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark the random sources.");
+
+	status = bench_out_of_order();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark out of order decryption.");
+
+	status = bench_invalid_packets();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark the rejection of invalid packets.");
+
+	status = bench_export_import();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark export and import.");
+
+cleanup:
+	if (reporter_started) {
+		bench_reporter_end(&reporter);
+	}
+	bench_samples_destroy(samples);
+	bench_samples_destroy(other_samples);
+	molch_destroy_all_users();
+
+	on_error {
+		bench_print_errors(&status);
+	}
+
+	return status.status;
+}
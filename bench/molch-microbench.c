@@ -0,0 +1,965 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Microbenchmarks of the primitives the library is built from.
+ *
+ * Usage: molch-microbench [--format csv|json] [--output <file>] [--filter <substring>] [--quick]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+#include <packet.pb-c.h>
+#include <header.pb-c.h>
+#include <key.pb-c.h>
+
+#include "bench.h"
+#include "../lib/constants.h"
+#include "../lib/common.h"
+#include "../lib/key-derivation.h"
+#include "../lib/diffie-hellman.h"
+#include "../lib/header.h"
+#include "../lib/packet.h"
+#include "../lib/spiced-random.h"
+#include "../lib/wire.h"
+#include "../lib/zeroed_malloc.h"
+
+#define MAX_SAMPLES 1000
+
+static bench_options options;
+static bench_reporter reporter;
+static bench_samples *samples = NULL;
+
+/*
+ * Iteration counts for operations of a certain cost.
+ */
+typedef struct bench_cost {
+	size_t warmup;
+	size_t repetitions;
+	size_t batch;
+} bench_cost;
+
+static const bench_cost cheap = {1000, 1000, 100}; //< 1 microsecond
+static const bench_cost medium = {100, 1000, 1}; //microseconds
+static const bench_cost expensive = {2, 20, 1}; //milliseconds
+
+/*
+ * Like measure, but reports an additional metric.
+ */
+static return_status measure_with_extra(
+		const char * const benchmark,
+		const char * const parameter_name,
+		const uint64_t parameter,
+		bench_operation operation,
+		void * const context,
+		const bench_cost * const cost,
+		const char * const extra_name,
+		const double extra) {
+	return_status status = return_status_init();
+
+	if (!bench_selected(&options, benchmark)) {
+		goto cleanup;
+	}
+
+	bench_cost actual_cost = *cost;
+	if (options.quick) {
+		actual_cost.warmup = 1;
+		actual_cost.repetitions = 3;
+		actual_cost.batch = 1;
+	}
+
+	bench_summary summary;
+	status = bench_run(
+			&summary,
+			samples,
+			operation,
+			context,
+			actual_cost.warmup,
+			actual_cost.repetitions,
+			actual_cost.batch);
+	throw_on_error(GENERIC_ERROR, benchmark);
+
+	bench_report(&reporter, benchmark, parameter_name, parameter, &summary, extra_name, extra);
+
+cleanup:
+	return status;
+}
+
+static return_status measure(
+		const char * const benchmark,
+		const char * const parameter_name,
+		const uint64_t parameter,
+		bench_operation operation,
+		void * const context,
+		const bench_cost * const cost) {
+	return measure_with_extra(benchmark, parameter_name, parameter, operation, context, cost, NULL, 0);
+}
+
+/*
+ * Key derivation
+ */
+typedef struct key_context {
+	buffer_t *input_key;
+	buffer_t *output_key;
+	//inputs for the ratchet steps
+	buffer_t *our_private_ephemeral;
+	buffer_t *our_public_ephemeral;
+	buffer_t *their_public_ephemeral;
+	buffer_t *their_public_identity;
+	buffer_t *root_key;
+	buffer_t *next_header_key;
+	buffer_t *chain_key;
+} key_context;
+
+static return_status operation_derive_key(void * const context) {
+	key_context *keys = context;
+	return derive_key(keys->output_key, CHAIN_KEY_SIZE, keys->input_key, 0);
+}
+
+static return_status operation_derive_chain_key(void * const context) {
+	key_context *keys = context;
+	return derive_chain_key(keys->output_key, keys->input_key);
+}
+
+static return_status operation_derive_message_key(void * const context) {
+	key_context *keys = context;
+	return derive_message_key(keys->output_key, keys->input_key);
+}
+
+static return_status operation_derive_root_next_header_and_chain_keys(void * const context) {
+	key_context *keys = context;
+	return derive_root_next_header_and_chain_keys(
+			keys->root_key,
+			keys->next_header_key,
+			keys->chain_key,
+			keys->our_private_ephemeral,
+			keys->our_public_ephemeral,
+			keys->their_public_ephemeral,
+			keys->input_key,
+			true);
+}
+
+static return_status operation_diffie_hellman(void * const context) {
+	key_context *keys = context;
+	return diffie_hellman(
+			keys->output_key,
+			keys->our_private_ephemeral,
+			keys->our_public_ephemeral,
+			keys->their_public_ephemeral,
+			true);
+}
+
+static return_status operation_triple_diffie_hellman(void * const context) {
+	key_context *keys = context;
+	//reuse the ephemeral keypair as identity keypair, only the cost matters here
+	return triple_diffie_hellman(
+			keys->output_key,
+			keys->our_private_ephemeral,
+			keys->our_public_ephemeral,
+			keys->our_private_ephemeral,
+			keys->our_public_ephemeral,
+			keys->their_public_identity,
+			keys->their_public_ephemeral,
+			true);
+}
+
+static return_status bench_keys(void) {
+	return_status status = return_status_init();
+
+	key_context keys;
+	memset(&keys, 0, sizeof(keys));
+	keys.input_key = buffer_create_on_heap(CHAIN_KEY_SIZE, CHAIN_KEY_SIZE);
+	throw_on_failed_alloc(keys.input_key);
+	keys.output_key = buffer_create_on_heap(DIFFIE_HELLMAN_SIZE, DIFFIE_HELLMAN_SIZE);
+	throw_on_failed_alloc(keys.output_key);
+	keys.our_private_ephemeral = buffer_create_on_heap(PRIVATE_KEY_SIZE, PRIVATE_KEY_SIZE);
+	throw_on_failed_alloc(keys.our_private_ephemeral);
+	keys.our_public_ephemeral = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	throw_on_failed_alloc(keys.our_public_ephemeral);
+	keys.their_public_ephemeral = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	throw_on_failed_alloc(keys.their_public_ephemeral);
+	keys.their_public_identity = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	throw_on_failed_alloc(keys.their_public_identity);
+	keys.root_key = buffer_create_on_heap(ROOT_KEY_SIZE, ROOT_KEY_SIZE);
+	throw_on_failed_alloc(keys.root_key);
+	keys.next_header_key = buffer_create_on_heap(HEADER_KEY_SIZE, HEADER_KEY_SIZE);
+	throw_on_failed_alloc(keys.next_header_key);
+	keys.chain_key = buffer_create_on_heap(CHAIN_KEY_SIZE, CHAIN_KEY_SIZE);
+	throw_on_failed_alloc(keys.chain_key);
+
+	if (buffer_fill_random(keys.input_key, keys.input_key->buffer_length) != 0) {
+		throw(KEYGENERATION_FAILED, "Failed to generate input key.");
+	}
+	unsigned char throwaway_private_key[PRIVATE_KEY_SIZE];
+	if ((crypto_box_keypair(keys.our_public_ephemeral->content, keys.our_private_ephemeral->content) != 0)
+			|| (crypto_box_keypair(keys.their_public_ephemeral->content, throwaway_private_key) != 0)
+			|| (crypto_box_keypair(keys.their_public_identity->content, throwaway_private_key) != 0)) {
+		throw(KEYGENERATION_FAILED, "Failed to generate keypairs.");
+	}
+	sodium_memzero(throwaway_private_key, sizeof(throwaway_private_key));
+
+	status = measure("derive_key", NULL, 0, operation_derive_key, &keys, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark derive_key.");
+	status = measure("derive_chain_key", NULL, 0, operation_derive_chain_key, &keys, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark derive_chain_key.");
+	status = measure("derive_message_key", NULL, 0, operation_derive_message_key, &keys, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark derive_message_key.");
+	status = measure("derive_root_next_header_and_chain_keys", NULL, 0, operation_derive_root_next_header_and_chain_keys, &keys, &medium);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark derive_root_next_header_and_chain_keys.");
+	status = measure("diffie_hellman", NULL, 0, operation_diffie_hellman, &keys, &medium);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark diffie_hellman.");
+	status = measure("triple_diffie_hellman", NULL, 0, operation_triple_diffie_hellman, &keys, &medium);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark triple_diffie_hellman.");
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(keys.input_key);
+	buffer_destroy_from_heap_and_null_if_valid(keys.output_key);
+	buffer_destroy_from_heap_and_null_if_valid(keys.our_private_ephemeral);
+	buffer_destroy_from_heap_and_null_if_valid(keys.our_public_ephemeral);
+	buffer_destroy_from_heap_and_null_if_valid(keys.their_public_ephemeral);
+	buffer_destroy_from_heap_and_null_if_valid(keys.their_public_identity);
+	buffer_destroy_from_heap_and_null_if_valid(keys.root_key);
+	buffer_destroy_from_heap_and_null_if_valid(keys.next_header_key);
+	buffer_destroy_from_heap_and_null_if_valid(keys.chain_key);
+
+	return status;
+}
+
+/*
+ * Header and packet layer
+ */
+typedef struct packet_context {
+	buffer_t *public_ephemeral;
+	buffer_t *header;
+	buffer_t *header_key;
+	buffer_t *message;
+	buffer_t *message_key;
+	buffer_t *packet;
+	buffer_t *extracted_public_ephemeral;
+	//the packet and header decoded with Protobuf-C and the wire codec
+	Packet *protobuf_packet;
+	Header *protobuf_header;
+	packet_view packet_view;
+	header_view header_view;
+	buffer_t *packed; //output of the pack benchmarks
+	uint32_t protocol_version; //of packet_encrypt
+} packet_context;
+
+static return_status operation_header_construct(void * const context) {
+	packet_context *packet = context;
+	return_status status = return_status_init();
+
+	buffer_t *header = NULL;
+	status = header_construct(&header, packet->public_ephemeral, 1, 2, PROTOCOL_VERSION_LENGTH_PREFIX, HIGHEST_SUPPORTED_PROTOCOL_VERSION);
+	buffer_destroy_from_heap_and_null_if_valid(header);
+
+	return status;
+}
+
+static return_status operation_header_extract(void * const context) {
+	packet_context *packet = context;
+	uint32_t message_number;
+	uint32_t previous_message_number;
+	uint32_t current_protocol_version;
+	uint32_t highest_supported_protocol_version;
+	return header_extract(packet->extracted_public_ephemeral, &message_number, &previous_message_number, &current_protocol_version, &highest_supported_protocol_version, packet->header);
+}
+
+static return_status operation_packet_encrypt(void * const context) {
+	packet_context *packet = context;
+	return_status status = return_status_init();
+
+	buffer_t *encrypted = NULL;
+	status = packet_encrypt(
+			&encrypted,
+			NORMAL_MESSAGE,
+			packet->protocol_version,
+			MOLCH_PADDING_BLOCKS,
+			packet->header,
+			packet->header_key,
+			packet->message,
+			packet->message_key,
+			NULL,
+			NULL,
+			NULL,
+			NULL);
+	buffer_destroy_from_heap_and_null_if_valid(encrypted);
+
+	return status;
+}
+
+static return_status operation_packet_decrypt(void * const context) {
+	packet_context *packet = context;
+	return_status status = return_status_init();
+
+	uint32_t current_protocol_version;
+	uint32_t highest_supported_protocol_version;
+	molch_message_type packet_type;
+	buffer_t *header = NULL;
+	buffer_t *message = NULL;
+	status = packet_decrypt(
+			&current_protocol_version,
+			&highest_supported_protocol_version,
+			&packet_type,
+			&header,
+			&message,
+			packet->packet,
+			packet->header_key,
+			packet->message_key,
+			NULL,
+			NULL,
+			NULL);
+	buffer_destroy_from_heap_and_null_if_valid(header);
+	buffer_destroy_from_heap_and_null_if_valid(message);
+
+	return status;
+}
+
+static return_status operation_packet_get_metadata_without_verification(void * const context) {
+	packet_context *packet = context;
+
+	uint32_t current_protocol_version;
+	uint32_t highest_supported_protocol_version;
+	molch_message_type packet_type;
+	return packet_get_metadata_without_verification(
+			&current_protocol_version,
+			&highest_supported_protocol_version,
+			&packet_type,
+			packet->packet,
+			NULL,
+			NULL,
+			NULL);
+}
+
+/*
+ * Protobuf-C compared to the hand written wire codec
+ */
+static return_status operation_protobuf_c_packet_pack(void * const context) {
+	packet_context *packet = context;
+	packet->packed->content_length = packet__pack(packet->protobuf_packet, packet->packed->content);
+
+	return return_status_init();
+}
+
+static return_status operation_wire_packet_pack(void * const context) {
+	packet_context *packet = context;
+	packet->packed->content_length = wire_packet_pack(&packet->packet_view, packet->packed->content);
+
+	return return_status_init();
+}
+
+static return_status operation_protobuf_c_packet_unpack(void * const context) {
+	packet_context *packet = context;
+	return_status status = return_status_init();
+
+	Packet *unpacked = packet__unpack(&protobuf_c_allocators, packet->packet->content_length, packet->packet->content);
+	if (unpacked == NULL) {
+		throw(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+	}
+
+cleanup:
+	if (unpacked != NULL) {
+		packet__free_unpacked(unpacked, &protobuf_c_allocators);
+	}
+
+	return status;
+}
+
+static return_status operation_wire_packet_unpack(void * const context) {
+	packet_context *packet = context;
+	packet_view view;
+	return wire_packet_unpack(&view, packet->packet);
+}
+
+static return_status operation_protobuf_c_header_pack(void * const context) {
+	packet_context *packet = context;
+	packet->packed->content_length = header__pack(packet->protobuf_header, packet->packed->content);
+
+	return return_status_init();
+}
+
+static return_status operation_wire_header_pack(void * const context) {
+	packet_context *packet = context;
+	packet->packed->content_length = wire_header_pack(&packet->header_view, packet->packed->content);
+
+	return return_status_init();
+}
+
+static return_status operation_protobuf_c_header_unpack(void * const context) {
+	packet_context *packet = context;
+	return_status status = return_status_init();
+
+	Header *unpacked = header__unpack(&protobuf_c_allocators, packet->header->content_length, packet->header->content);
+	if (unpacked == NULL) {
+		throw(PROTOBUF_UNPACK_ERROR, "Failed to unpack header.");
+	}
+
+cleanup:
+	if (unpacked != NULL) {
+		header__free_unpacked(unpacked, &protobuf_c_allocators);
+	}
+
+	return status;
+}
+
+static return_status operation_wire_header_unpack(void * const context) {
+	packet_context *packet = context;
+	header_view view;
+	return wire_header_unpack(&view, packet->header);
+}
+
+/*
+ * Wire size of the packets for a distribution of message sizes,
+ * for every padding policy.
+ */
+#define WIRE_SIZE_MESSAGES 1024
+
+typedef struct message_size_distribution {
+	const char *name; //name of the benchmark
+	const char *compact_name; //name of the benchmark with compact packets
+	size_t minimum;
+	size_t maximum;
+	bool logarithmic; //uniform in the exponent (many small, few large messages)
+} message_size_distribution;
+
+typedef struct wire_size_context {
+	packet_context *packet;
+	uint32_t protocol_version;
+	molch_padding padding;
+	size_t lengths[WIRE_SIZE_MESSAGES];
+	size_t next;
+} wire_size_context;
+
+static return_status operation_packet_encrypt_distribution(void * const context) {
+	wire_size_context *wire_size = context;
+	return_status status = return_status_init();
+
+	buffer_create_with_existing_array(message, wire_size->packet->message->content, wire_size->lengths[wire_size->next]);
+	wire_size->next = (wire_size->next + 1) % WIRE_SIZE_MESSAGES;
+
+	buffer_t *encrypted = NULL;
+	status = packet_encrypt(
+			&encrypted,
+			NORMAL_MESSAGE,
+			wire_size->protocol_version,
+			wire_size->padding,
+			wire_size->packet->header,
+			wire_size->packet->header_key,
+			message,
+			wire_size->packet->message_key,
+			NULL,
+			NULL,
+			NULL,
+			NULL);
+	buffer_destroy_from_heap_and_null_if_valid(encrypted);
+
+	return status;
+}
+
+/*
+ * Message sizes from a fixed seed, so every run measures the same messages.
+ */
+static void generate_message_sizes(size_t * const lengths, const message_size_distribution * const distribution) {
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	for (size_t i = 0; i < WIRE_SIZE_MESSAGES; i++) {
+		//xorshift64
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+
+		if (distribution->logarithmic) {
+			unsigned int bits = 0;
+			while (((size_t)2 << bits) <= distribution->maximum) {
+				bits++;
+			}
+			const unsigned int exponent = (unsigned int)(state % (bits + 1));
+			const size_t base = (size_t)1 << exponent;
+			size_t length = base + (size_t)((state >> 8) % base);
+			if (length < distribution->minimum) {
+				length = distribution->minimum;
+			} else if (length > distribution->maximum) {
+				length = distribution->maximum;
+			}
+			lengths[i] = length;
+		} else {
+			lengths[i] = distribution->minimum + (size_t)(state % (distribution->maximum - distribution->minimum + 1));
+		}
+	}
+}
+
+static return_status bench_wire_sizes(packet_context * const packet) {
+	return_status status = return_status_init();
+
+	static const message_size_distribution distributions[] = {
+		{"wire_size_acks", "wire_size_compact_acks", 1, 16, false},
+		{"wire_size_telemetry", "wire_size_compact_telemetry", 40, 200, false},
+		{"wire_size_chat", "wire_size_compact_chat", 1, 1024, true},
+		{"wire_size_mixed", "wire_size_compact_mixed", 1, 65536, true}
+	};
+	static const molch_padding policies[] = {MOLCH_PADDING_BLOCKS, MOLCH_PADDING_POWER_OF_TWO, MOLCH_PADDING_PADME, MOLCH_PADDING_BUCKETS};
+
+	wire_size_context *wire_size = malloc(sizeof(wire_size_context));
+	throw_on_failed_alloc(wire_size);
+	wire_size->packet = packet;
+
+	for (size_t i = 0; i < (sizeof(distributions) / sizeof(*distributions)); i++) {
+		generate_message_sizes(wire_size->lengths, &distributions[i]);
+
+		//protobuf packets (PKCS7 for blocks) and compact packets
+		for (unsigned int compact = 0; compact < 2; compact++) {
+			for (size_t policy = 0; policy < (sizeof(policies) / sizeof(*policies)); policy++) {
+				if (compact) {
+					wire_size->protocol_version = PROTOCOL_VERSION_COMPACT;
+				} else if (policies[policy] == MOLCH_PADDING_BLOCKS) {
+					wire_size->protocol_version = PROTOCOL_VERSION_PKCS7_PADDING;
+				} else {
+					wire_size->protocol_version = PROTOCOL_VERSION_LENGTH_PREFIX;
+				}
+				wire_size->padding = policies[policy];
+				wire_size->next = 0;
+
+				//average size of a packet on the wire
+				uint64_t wire_bytes = 0;
+				for (size_t message = 0; message < WIRE_SIZE_MESSAGES; message++) {
+					wire_bytes += packet_get_encrypted_length(NORMAL_MESSAGE, wire_size->protocol_version, policies[policy], packet->header->content_length, wire_size->lengths[message]);
+				}
+
+				status = measure_with_extra(
+						compact ? distributions[i].compact_name : distributions[i].name,
+						"padding",
+						(uint64_t)policies[policy],
+						operation_packet_encrypt_distribution,
+						wire_size,
+						&medium,
+						"wire_bytes_per_message",
+						(double)wire_bytes / WIRE_SIZE_MESSAGES);
+				throw_on_error(GENERIC_ERROR, "Failed to benchmark wire sizes.");
+			}
+		}
+	}
+
+cleanup:
+	free_and_null_if_valid(wire_size);
+
+	return status;
+}
+
+static return_status bench_packets(void) {
+	return_status status = return_status_init();
+
+	static const size_t sizes[] = {16, 1024, 65536, 1048576};
+
+	packet_context packet;
+	memset(&packet, 0, sizeof(packet));
+	packet.public_ephemeral = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	throw_on_failed_alloc(packet.public_ephemeral);
+	packet.extracted_public_ephemeral = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	throw_on_failed_alloc(packet.extracted_public_ephemeral);
+	packet.header_key = buffer_create_on_heap(HEADER_KEY_SIZE, HEADER_KEY_SIZE);
+	throw_on_failed_alloc(packet.header_key);
+	packet.message_key = buffer_create_on_heap(MESSAGE_KEY_SIZE, MESSAGE_KEY_SIZE);
+	throw_on_failed_alloc(packet.message_key);
+	packet.message = buffer_create_on_heap(sizes[sizeof(sizes)/sizeof(*sizes) - 1], 0);
+	throw_on_failed_alloc(packet.message);
+
+	if ((buffer_fill_random(packet.public_ephemeral, PUBLIC_KEY_SIZE) != 0)
+			|| (buffer_fill_random(packet.header_key, HEADER_KEY_SIZE) != 0)
+			|| (buffer_fill_random(packet.message_key, MESSAGE_KEY_SIZE) != 0)) {
+		throw(KEYGENERATION_FAILED, "Failed to generate keys.");
+	}
+
+	status = header_construct(&packet.header, packet.public_ephemeral, 1, 2, PROTOCOL_VERSION_LENGTH_PREFIX, HIGHEST_SUPPORTED_PROTOCOL_VERSION);
+	throw_on_error(CREATION_ERROR, "Failed to construct header.");
+
+	status = measure("header_construct", NULL, 0, operation_header_construct, &packet, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark header_construct.");
+	status = measure("header_extract", NULL, 0, operation_header_extract, &packet, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark header_extract.");
+
+	packet.protobuf_header = header__unpack(&protobuf_c_allocators, packet.header->content_length, packet.header->content);
+	if (packet.protobuf_header == NULL) {
+		throw(PROTOBUF_UNPACK_ERROR, "Failed to unpack header.");
+	}
+	status = wire_header_unpack(&packet.header_view, packet.header);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack header.");
+	//big enough for the largest packet
+	packet.packed = buffer_create_on_heap(2 * sizes[sizeof(sizes)/sizeof(*sizes) - 1], 0);
+	throw_on_failed_alloc(packet.packed);
+
+	status = measure("protobuf_c_header_pack", NULL, 0, operation_protobuf_c_header_pack, &packet, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark protobuf_c_header_pack.");
+	status = measure("wire_header_pack", NULL, 0, operation_wire_header_pack, &packet, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark wire_header_pack.");
+	status = measure("protobuf_c_header_unpack", NULL, 0, operation_protobuf_c_header_unpack, &packet, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark protobuf_c_header_unpack.");
+	status = measure("wire_header_unpack", NULL, 0, operation_wire_header_unpack, &packet, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark wire_header_unpack.");
+
+	for (size_t i = 0; i < (sizeof(sizes)/sizeof(*sizes)); i++) {
+		if (buffer_fill_random(packet.message, sizes[i]) != 0) {
+			throw(GENERIC_ERROR, "Failed to generate message.");
+		}
+
+		buffer_destroy_from_heap_and_null_if_valid(packet.packet);
+		packet.protocol_version = PROTOCOL_VERSION_PKCS7_PADDING;
+		status = packet_encrypt(
+				&packet.packet,
+				NORMAL_MESSAGE,
+				packet.protocol_version,
+				MOLCH_PADDING_BLOCKS,
+				packet.header,
+				packet.header_key,
+				packet.message,
+				packet.message_key,
+				NULL,
+				NULL,
+				NULL,
+				NULL);
+		throw_on_error(ENCRYPT_ERROR, "Failed to encrypt packet.");
+
+		status = measure_with_extra("packet_encrypt", "message_size", sizes[i], operation_packet_encrypt, &packet, &medium, "wire_bytes", (double)packet.packet->content_length);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark packet_encrypt.");
+		status = measure("packet_decrypt", "message_size", sizes[i], operation_packet_decrypt, &packet, &medium);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark packet_decrypt.");
+		status = measure("packet_get_metadata_without_verification", "message_size", sizes[i], operation_packet_get_metadata_without_verification, &packet, &medium);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark packet_get_metadata_without_verification.");
+
+		if (packet.protobuf_packet != NULL) {
+			packet__free_unpacked(packet.protobuf_packet, &protobuf_c_allocators);
+		}
+		packet.protobuf_packet = packet__unpack(&protobuf_c_allocators, packet.packet->content_length, packet.packet->content);
+		if (packet.protobuf_packet == NULL) {
+			throw(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+		}
+		status = wire_packet_unpack(&packet.packet_view, packet.packet);
+		throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+
+		status = measure("protobuf_c_packet_pack", "message_size", sizes[i], operation_protobuf_c_packet_pack, &packet, &cheap);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark protobuf_c_packet_pack.");
+		status = measure("wire_packet_pack", "message_size", sizes[i], operation_wire_packet_pack, &packet, &cheap);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark wire_packet_pack.");
+		status = measure("protobuf_c_packet_unpack", "message_size", sizes[i], operation_protobuf_c_packet_unpack, &packet, &cheap);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark protobuf_c_packet_unpack.");
+		status = measure("wire_packet_unpack", "message_size", sizes[i], operation_wire_packet_unpack, &packet, &cheap);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark wire_packet_unpack.");
+
+		//the same with compact packets
+		buffer_destroy_from_heap_and_null_if_valid(packet.packet);
+		packet.protocol_version = PROTOCOL_VERSION_COMPACT;
+		status = packet_encrypt(
+				&packet.packet,
+				NORMAL_MESSAGE,
+				packet.protocol_version,
+				MOLCH_PADDING_BLOCKS,
+				packet.header,
+				packet.header_key,
+				packet.message,
+				packet.message_key,
+				NULL,
+				NULL,
+				NULL,
+				NULL);
+		throw_on_error(ENCRYPT_ERROR, "Failed to encrypt compact packet.");
+
+		status = measure_with_extra("packet_encrypt_compact", "message_size", sizes[i], operation_packet_encrypt, &packet, &medium, "wire_bytes", (double)packet.packet->content_length);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark packet_encrypt_compact.");
+		status = measure("packet_decrypt_compact", "message_size", sizes[i], operation_packet_decrypt, &packet, &medium);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark packet_decrypt_compact.");
+	}
+
+	status = bench_wire_sizes(&packet);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark wire sizes.");
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(packet.public_ephemeral);
+	buffer_destroy_from_heap_and_null_if_valid(packet.extracted_public_ephemeral);
+	buffer_destroy_from_heap_and_null_if_valid(packet.header);
+	buffer_destroy_from_heap_and_null_if_valid(packet.header_key);
+	buffer_destroy_from_heap_and_null_if_valid(packet.message);
+	buffer_destroy_from_heap_and_null_if_valid(packet.message_key);
+	buffer_destroy_from_heap_and_null_if_valid(packet.packet);
+	buffer_destroy_from_heap_and_null_if_valid(packet.packed);
+	if (packet.protobuf_packet != NULL) {
+		packet__free_unpacked(packet.protobuf_packet, &protobuf_c_allocators);
+	}
+	if (packet.protobuf_header != NULL) {
+		header__free_unpacked(packet.protobuf_header, &protobuf_c_allocators);
+	}
+
+	return status;
+}
+
+/*
+ * Spiced random (scrypt)
+ */
+typedef struct spiced_random_context {
+	buffer_t *output;
+	buffer_t *spice;
+	molch_spice_cost cost;
+} spiced_random_context;
+
+static return_status operation_spiced_random(void * const context) {
+	spiced_random_context *random = context;
+	return spiced_random(random->output, random->spice, random->output->buffer_length, random->cost);
+}
+
+static return_status bench_spiced_random(void) {
+	return_status status = return_status_init();
+
+	//same length as the seeds in master_keys_create
+	buffer_create_from_string(spice, "benchmark spice");
+	spiced_random_context random = {
+		buffer_create_on_heap(crypto_sign_SEEDBYTES + crypto_box_SEEDBYTES, 0),
+		spice,
+		MOLCH_SPICE_COST_INTERACTIVE
+	};
+	throw_on_failed_alloc(random.output);
+
+	status = measure("spiced_random", NULL, 0, operation_spiced_random, &random, &expensive);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark spiced_random.");
+
+	random.cost = MOLCH_SPICE_COST_MINIMAL;
+	status = measure("spiced_random_minimal", NULL, 0, operation_spiced_random, &random, &expensive);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark spiced_random with minimal cost.");
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(random.output);
+
+	return status;
+}
+
+/*
+ * Allocations of the Protobuf-C structs during an export, a Key with its
+ * data for every key, like in master_keys_export or ratchet_export.
+ */
+typedef struct export_allocations_context {
+	size_t keys;
+	bool arena;
+	void **pointers; //2 * keys
+} export_allocations_context;
+
+static return_status operation_export_allocations(void * const context) {
+	return_status status = return_status_init();
+	export_allocations_context *allocations = context;
+
+	if (allocations->arena) {
+		zeroed_arena_begin();
+	}
+
+	for (size_t i = 0; i < allocations->keys; i++) {
+		allocations->pointers[2 * i] = protobuf_c_allocator(NULL, sizeof(Key));
+		allocations->pointers[2 * i + 1] = protobuf_c_allocator(NULL, CHAIN_KEY_SIZE);
+	}
+	for (size_t i = 0; i < (2 * allocations->keys); i++) {
+		protobuf_c_free(NULL, allocations->pointers[i]);
+	}
+
+	if (allocations->arena) {
+		zeroed_arena_end();
+	}
+
+	return status;
+}
+
+static return_status bench_export_allocations(void) {
+	return_status status = return_status_init();
+
+	static const size_t key_counts[] = {10, 1000, 100000};
+	export_allocations_context allocations = {0, false, NULL};
+
+	allocations.pointers = malloc(2 * key_counts[2] * sizeof(void*));
+	throw_on_failed_alloc(allocations.pointers);
+
+	for (size_t i = 0; i < (sizeof(key_counts) / sizeof(*key_counts)); i++) {
+		allocations.keys = key_counts[i];
+
+		allocations.arena = false;
+		status = measure("export_allocations", "keys", allocations.keys, operation_export_allocations, &allocations, &expensive);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark export allocations.");
+
+		allocations.arena = true;
+		status = measure("export_allocations_arena", "keys", allocations.keys, operation_export_allocations, &allocations, &expensive);
+		throw_on_error(GENERIC_ERROR, "Failed to benchmark export allocations in an arena.");
+	}
+
+cleanup:
+	free_and_null_if_valid(allocations.pointers);
+
+	return status;
+}
+
+/*
+ * Buffer primitives on key sized buffers
+ */
+typedef struct buffers_context {
+	buffer_t *source;
+	buffer_t *copy; //same content as source
+	buffer_t *destination;
+} buffers_context;
+
+static return_status operation_buffer_create_on_heap(void * const context) {
+	return_status status = return_status_init();
+	(void)context;
+
+	buffer_t *buffer = buffer_create_on_heap(CHAIN_KEY_SIZE, CHAIN_KEY_SIZE);
+	throw_on_failed_alloc(buffer);
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(buffer);
+
+	return status;
+}
+
+static return_status operation_buffer_clone(void * const context) {
+	return_status status = return_status_init();
+	buffers_context *buffers = context;
+
+	if (buffer_clone(buffers->destination, buffers->source) != 0) {
+		throw(BUFFER_ERROR, "Failed to clone buffer.");
+	}
+
+cleanup:
+	return status;
+}
+
+static return_status operation_buffer_compare(void * const context) {
+	return_status status = return_status_init();
+	buffers_context *buffers = context;
+
+	if (buffer_compare(buffers->copy, buffers->source) != 0) {
+		throw(INCORRECT_DATA, "Buffers aren't equal.");
+	}
+
+cleanup:
+	return status;
+}
+
+static return_status operation_buffer_xor(void * const context) {
+	return_status status = return_status_init();
+	buffers_context *buffers = context;
+
+	if (buffer_xor(buffers->destination, buffers->source) != 0) {
+		throw(BUFFER_ERROR, "Failed to xor buffers.");
+	}
+
+cleanup:
+	return status;
+}
+
+static return_status operation_buffer_fill_random(void * const context) {
+	return_status status = return_status_init();
+	buffers_context *buffers = context;
+
+	//nonce sized, like in packet_encrypt
+	if (buffer_fill_random(buffers->destination, MESSAGE_NONCE_SIZE) != 0) {
+		throw(BUFFER_ERROR, "Failed to fill buffer with random data.");
+	}
+
+cleanup:
+	return status;
+}
+
+static return_status bench_buffers(void) {
+	return_status status = return_status_init();
+
+	buffers_context buffers = {
+		buffer_create_on_heap(CHAIN_KEY_SIZE, CHAIN_KEY_SIZE),
+		buffer_create_on_heap(CHAIN_KEY_SIZE, CHAIN_KEY_SIZE),
+		buffer_create_on_heap(CHAIN_KEY_SIZE, CHAIN_KEY_SIZE)
+	};
+	throw_on_failed_alloc(buffers.source);
+	throw_on_failed_alloc(buffers.copy);
+	throw_on_failed_alloc(buffers.destination);
+
+	if (buffer_fill_random(buffers.source, buffers.source->buffer_length) != 0) {
+		throw(BUFFER_ERROR, "Failed to fill buffer with random data.");
+	}
+	if (buffer_clone(buffers.copy, buffers.source) != 0) {
+		throw(BUFFER_ERROR, "Failed to copy buffer.");
+	}
+
+	status = measure("buffer_create_on_heap", "size", CHAIN_KEY_SIZE, operation_buffer_create_on_heap, &buffers, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark buffer_create_on_heap.");
+	status = measure("buffer_clone", "size", CHAIN_KEY_SIZE, operation_buffer_clone, &buffers, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark buffer_clone.");
+	status = measure("buffer_compare", "size", CHAIN_KEY_SIZE, operation_buffer_compare, &buffers, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark buffer_compare.");
+	status = measure("buffer_xor", "size", CHAIN_KEY_SIZE, operation_buffer_xor, &buffers, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark buffer_xor.");
+	status = measure("buffer_fill_random", "size", MESSAGE_NONCE_SIZE, operation_buffer_fill_random, &buffers, &cheap);
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark buffer_fill_random.");
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(buffers.source);
+	buffer_destroy_from_heap_and_null_if_valid(buffers.copy);
+	buffer_destroy_from_heap_and_null_if_valid(buffers.destination);
+
+	return status;
+}
+
+int main(int argc, char **argv) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	bool reporter_started = false;
+
+	status = bench_parse_options(&options, argc, argv);
+	throw_on_error(INVALID_INPUT, "Failed to parse options.");
+
+	status = bench_samples_create(&samples, MAX_SAMPLES);
+	throw_on_error(CREATION_ERROR, "Failed to create samples.");
+
+	status = bench_reporter_begin(&reporter, &options);
+	throw_on_error(INIT_ERROR, "Failed to start reporting.");
+	reporter_started = true;
+
+	status = bench_keys();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark key derivation and Diffie Hellman.");
+
+	status = bench_packets();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark header and packet.");
+
+	status = bench_spiced_random();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark spiced random.");
+
+	status = bench_buffers();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark buffers.");
+
+	status = bench_export_allocations();
+	throw_on_error(GENERIC_ERROR, "Failed to benchmark export allocations.");
+
+cleanup:
+	if (reporter_started) {
+		bench_reporter_end(&reporter);
+	}
+	bench_samples_destroy(samples);
+
+	on_error {
+		bench_print_errors(&status);
+	}
+
+	return status.status;
+}
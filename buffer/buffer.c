@@ -23,6 +23,20 @@
 
 #include "buffer.h"
 
+//used by the *_on_heap functions
+static void *(*heap_allocator)(size_t size) = malloc;
+static void (*heap_deallocator)(void *pointer) = free;
+
+/*
+ * Set the functions that the *_on_heap functions allocate and free with.
+ */
+void buffer_set_heap_allocator(
+		void *(*allocator)(size_t size),
+		void (*deallocator)(void *pointer)) {
+	heap_allocator = allocator;
+	heap_deallocator = deallocator;
+}
+
 /*
  * Initialize a molch buffer with a given length.
  *
@@ -80,16 +94,16 @@ buffer_t* buffer_init_with_pointer(
 buffer_t *buffer_create_on_heap(
 		const size_t buffer_length,
 		const size_t content_length) {
-	buffer_t *buffer = malloc(sizeof(buffer_t));
+	buffer_t *buffer = heap_allocator(sizeof(buffer_t));
 	if (buffer == NULL) {
 		return NULL;
 	}
 
 	unsigned char *content = NULL;
 	if (buffer_length != 0) {
-		content = malloc(buffer_length);
+		content = heap_allocator(buffer_length);
 		if (content == NULL) {
-			free(buffer);
+			heap_deallocator(buffer);
 			return NULL;
 		}
 	}
@@ -154,8 +168,8 @@ int buffer_to_hex(buffer_t * const hex, const buffer_t * const data) {
  */
 void buffer_destroy_from_heap(buffer_t * const buffer) {
 	buffer_clear(buffer);
-	free(buffer->content);
-	free(buffer);
+	heap_deallocator(buffer->content);
+	heap_deallocator(buffer);
 }
 
 /*
@@ -703,7 +717,7 @@ int buffer_grow_on_heap(
 	}
 
 	//allocate new content
-	unsigned char *content = malloc(new_size);
+	unsigned char *content = heap_allocator(new_size);
 	if (content == NULL) {
 		return -11;
 	}
@@ -712,13 +726,13 @@ int buffer_grow_on_heap(
 	int status = buffer_copy_to_raw(content, 0, buffer, 0, buffer->content_length);
 	if (status != 0) {
 		sodium_memzero(content, buffer->content_length);
-		free(content);
+		heap_deallocator(content);
 		return status;
 	}
 
 	//replace content pointer
 	sodium_memzero(buffer->content, buffer->buffer_length);
-	free(buffer->content);
+	heap_deallocator(buffer->content);
 	unsigned char **writable_content_pointer = (unsigned char**) &buffer->content;
 	*writable_content_pointer = content;
 
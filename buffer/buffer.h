@@ -60,6 +60,15 @@ buffer_t* buffer_init_with_pointer(
  */
 #define buffer_create(buffer_length, content_length) buffer_init(alloca(sizeof(buffer_t) + buffer_length), buffer_length, content_length)
 
+/*
+ * Set the functions that the *_on_heap functions allocate and free with,
+ * malloc and free by default. Buffers have to be destroyed with the
+ * functions they were created with.
+ */
+void buffer_set_heap_allocator(
+		void *(*allocator)(size_t size),
+		void (*deallocator)(void *pointer));
+
 /*
  * Create a new buffer on the heap.
  */
@@ -0,0 +1,208 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "allocators.h"
+#include "../buffer/buffer.h"
+
+/*
+ * Header in front of secret data and key objects from custom allocators,
+ * so the size is known when they are erased. The union keeps the alignment
+ * that malloc guarantees.
+ */
+typedef union wiped_header {
+	size_t size;
+	intmax_t integer;
+	long double floating_point;
+	void *pointer;
+} wiped_header;
+
+//allocators without functions are the defaults
+static molch_allocators allocators = {
+	{NULL, NULL, NULL},
+	{NULL, NULL, NULL},
+	{NULL, NULL, NULL}
+};
+
+//set by the first allocation, memory must be freed by the allocator it came from
+static bool allocated = false;
+
+static void mark_allocated() {
+	//only written once, so the cache line stays shared between the threads
+	if (!__atomic_load_n(&allocated, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&allocated, true, __ATOMIC_RELAXED);
+	}
+}
+
+static bool is_custom(const molch_allocator * const allocator) {
+	return allocator->allocate != NULL;
+}
+
+bool allocators_set(const molch_allocators * const new_allocators) {
+	if (__atomic_load_n(&allocated, __ATOMIC_RELAXED)) {
+		return false;
+	}
+
+	if (new_allocators == NULL) {
+		memset(&allocators, 0, sizeof(allocators));
+	} else {
+		allocators = *new_allocators;
+	}
+
+	//heap buffers are handed out as output of the API calls
+	if (is_custom(&allocators.public_data)) {
+		buffer_set_heap_allocator(public_malloc, public_free);
+	} else {
+		buffer_set_heap_allocator(malloc, free);
+	}
+
+	return true;
+}
+
+void *public_malloc(size_t size) {
+	mark_allocated();
+	if (!is_custom(&allocators.public_data)) {
+		return malloc(size);
+	}
+
+	return allocators.public_data.allocate(allocators.public_data.context, size);
+}
+
+void *public_calloc(size_t count, size_t size) {
+	mark_allocated();
+	if (!is_custom(&allocators.public_data)) {
+		return calloc(count, size);
+	}
+
+	if ((size != 0) && (count > (SIZE_MAX / size))) {
+		return NULL;
+	}
+
+	void * const memory = allocators.public_data.allocate(allocators.public_data.context, count * size);
+	if (memory != NULL) {
+		memset(memory, 0, count * size);
+	}
+
+	return memory;
+}
+
+void public_free(void *pointer) {
+	if (pointer == NULL) {
+		return;
+	}
+
+	if (!is_custom(&allocators.public_data)) {
+		free(pointer);
+		return;
+	}
+
+	allocators.public_data.deallocate(allocators.public_data.context, pointer);
+}
+
+static void *allocate_wiped(const molch_allocator * const allocator, const size_t size) {
+	if (size > (SIZE_MAX - sizeof(wiped_header))) {
+		return NULL;
+	}
+
+	wiped_header * const header = allocator->allocate(allocator->context, sizeof(wiped_header) + size);
+	if (header == NULL) {
+		return NULL;
+	}
+	header->size = size;
+
+	return header + 1;
+}
+
+static void free_wiped(const molch_allocator * const allocator, void * const pointer) {
+	if (pointer == NULL) {
+		return;
+	}
+
+	wiped_header * const header = ((wiped_header*)pointer) - 1;
+	sodium_memzero(header, sizeof(wiped_header) + header->size);
+	allocator->deallocate(allocator->context, header);
+}
+
+void *secret_malloc(size_t size) {
+	mark_allocated();
+	if (!is_custom(&allocators.secret_data)) {
+		return malloc(size);
+	}
+
+	return allocate_wiped(&allocators.secret_data, size);
+}
+
+void secret_free(void *pointer) {
+	if (!is_custom(&allocators.secret_data)) {
+		free(pointer);
+		return;
+	}
+
+	free_wiped(&allocators.secret_data, pointer);
+}
+
+void *key_malloc(size_t size) {
+	mark_allocated();
+	if (!is_custom(&allocators.key_objects)) {
+		return sodium_malloc(size);
+	}
+
+	return allocate_wiped(&allocators.key_objects, size);
+}
+
+void key_free(void *pointer) {
+	if (!is_custom(&allocators.key_objects)) {
+		sodium_free(pointer);
+		return;
+	}
+
+	free_wiped(&allocators.key_objects, pointer);
+}
+
+//memory from custom allocators can't be protected, it has no guard pages
+int key_protect_noaccess(void *pointer) {
+	if (is_custom(&allocators.key_objects)) {
+		return 0;
+	}
+
+	return sodium_mprotect_noaccess(pointer);
+}
+
+int key_protect_readonly(void *pointer) {
+	if (is_custom(&allocators.key_objects)) {
+		return 0;
+	}
+
+	return sodium_mprotect_readonly(pointer);
+}
+
+int key_protect_readwrite(void *pointer) {
+	if (is_custom(&allocators.key_objects)) {
+		return 0;
+	}
+
+	return sodium_mprotect_readwrite(pointer);
+}
@@ -0,0 +1,87 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*! \file
+ * Hooks for all memory of the library, see molch_set_allocators.
+ *
+ * There are three kinds of memory:
+ * - public data: everything that isn't secret, including the output of
+ *   API calls, malloc and free by default
+ * - secret data: what zeroed_malloc and the Protobuf-C allocator hand out
+ *   (temporary keys, serialized state), malloc and free by default
+ * - key objects: long lived keys (users, conversations, ratchets, prekeys),
+ *   sodium_malloc and sodium_free by default
+ *
+ * With custom allocators the library erases secret data and key objects
+ * with zeroes before it is deallocated.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef LIB_ALLOCATORS_H
+#define LIB_ALLOCATORS_H
+
+/*
+ * Functions the library gets one kind of memory from.
+ * 'context' is passed to both of them.
+ */
+typedef struct molch_allocator {
+	void *(*allocate)(void *context, size_t size);
+	void (*deallocate)(void *context, void *pointer);
+	void *context;
+} molch_allocator;
+
+typedef struct molch_allocators {
+	molch_allocator public_data;
+	molch_allocator secret_data;
+	molch_allocator key_objects;
+} molch_allocators;
+
+/*
+ * Replace the allocators, NULL restores the defaults. A kind of memory
+ * whose functions are both NULL keeps its default.
+ *
+ * Returns false if the library has already allocated memory.
+ */
+bool allocators_set(const molch_allocators * const allocators) __attribute__((warn_unused_result));
+
+void *public_malloc(size_t size) __attribute__((warn_unused_result));
+//like calloc, the memory is zeroed
+void *public_calloc(size_t count, size_t size) __attribute__((warn_unused_result));
+void public_free(void *pointer);
+
+//memory for zeroed_malloc, everything else uses zeroed_malloc itself
+void *secret_malloc(size_t size) __attribute__((warn_unused_result));
+void secret_free(void *pointer);
+
+void *key_malloc(size_t size) __attribute__((warn_unused_result));
+void key_free(void *pointer);
+
+/*
+ * Like sodium_mprotect_*, only protects the memory of the default
+ * key allocator. Returns 0 on success.
+ */
+int key_protect_noaccess(void *pointer);
+int key_protect_readonly(void *pointer);
+int key_protect_readwrite(void *pointer);
+
+#endif
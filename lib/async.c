@@ -0,0 +1,678 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "molch.h"
+
+typedef struct async_request async_request;
+struct async_request {
+	molch_async_result *result;
+	molch_async_callback callback;
+	unsigned char user_public_master_key[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char peer_public_master_key[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char *prekey_list;
+	size_t prekey_list_length;
+	unsigned char *data; //random data, message or packet
+	size_t data_length;
+	async_request *next;
+	unsigned char inputs[]; //prekey list and data are copied here
+};
+
+typedef struct async_worker {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t condition;
+	async_request *head;
+	async_request *tail;
+	bool stopping;
+} async_worker;
+
+//protects the pool itself, held while starting, stopping and submitting
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static async_worker *workers = NULL;
+static size_t worker_count = 0;
+static size_t next_worker = 0;
+static bool pool_stopping = false;
+
+/*
+ * Completed requests without a callback. The pipe contains one byte
+ * while the queue isn't empty, so it can be watched for readability.
+ */
+static pthread_mutex_t completion_mutex = PTHREAD_MUTEX_INITIALIZER;
+static async_request *completed_head = NULL;
+static async_request *completed_tail = NULL;
+static int completion_pipe[2] = {-1, -1};
+
+static void destroy_request(async_request * const request) {
+	if (request->result != NULL) {
+		molch_async_destroy_result(request->result);
+	}
+	//the copied data can be a plaintext message
+	sodium_memzero(request->inputs, request->prekey_list_length + request->data_length);
+	public_free(request);
+}
+
+/*
+ * Take the result out of the request and free the request.
+ */
+static molch_async_result *finish_request(async_request * const request) {
+	molch_async_result * const result = request->result;
+	request->result = NULL;
+	destroy_request(request);
+
+	return result;
+}
+
+static void execute(async_request * const request) {
+	molch_async_result * const result = request->result;
+
+	switch (result->operation) {
+		case MOLCH_ASYNC_CREATE_USER:
+			result->status = molch_create_user(
+					result->public_master_key,
+					sizeof(result->public_master_key),
+					&result->prekey_list,
+					&result->prekey_list_length,
+					result->backup_key,
+					sizeof(result->backup_key),
+					NULL,
+					NULL,
+					request->data,
+					request->data_length);
+			break;
+
+		case MOLCH_ASYNC_START_SEND_CONVERSATION:
+			result->status = molch_start_send_conversation(
+					result->conversation_id,
+					sizeof(result->conversation_id),
+					&result->packet,
+					&result->packet_length,
+					request->user_public_master_key,
+					sizeof(request->user_public_master_key),
+					request->peer_public_master_key,
+					sizeof(request->peer_public_master_key),
+					request->prekey_list,
+					request->prekey_list_length,
+					request->data,
+					request->data_length,
+					NULL,
+					NULL);
+			break;
+
+		case MOLCH_ASYNC_START_RECEIVE_CONVERSATION:
+			result->status = molch_start_receive_conversation(
+					result->conversation_id,
+					sizeof(result->conversation_id),
+					&result->prekey_list,
+					&result->prekey_list_length,
+					&result->message,
+					&result->message_length,
+					request->user_public_master_key,
+					sizeof(request->user_public_master_key),
+					request->peer_public_master_key,
+					sizeof(request->peer_public_master_key),
+					request->data,
+					request->data_length,
+					NULL,
+					NULL);
+			break;
+
+		case MOLCH_ASYNC_ENCRYPT_MESSAGE:
+			result->status = molch_encrypt_message(
+					&result->packet,
+					&result->packet_length,
+					result->conversation_id,
+					sizeof(result->conversation_id),
+					request->data,
+					request->data_length,
+					NULL,
+					NULL);
+			break;
+
+		case MOLCH_ASYNC_DECRYPT_MESSAGE:
+			result->status = molch_decrypt_message(
+					&result->message,
+					&result->message_length,
+					&result->receive_message_number,
+					&result->previous_receive_message_number,
+					result->conversation_id,
+					sizeof(result->conversation_id),
+					request->data,
+					request->data_length,
+					NULL,
+					NULL);
+			break;
+
+		case MOLCH_ASYNC_EXPORT:
+			result->status = molch_export(&result->backup, &result->backup_length);
+			break;
+	}
+}
+
+static void complete(async_request * const request) {
+	if (request->callback != NULL) {
+		const molch_async_callback callback = request->callback;
+		callback(finish_request(request));
+		return;
+	}
+
+	pthread_mutex_lock(&completion_mutex);
+	request->next = NULL;
+	if (completed_tail == NULL) {
+		completed_head = request;
+		//the queue isn't empty anymore, make the pipe readable
+		const unsigned char byte = 0;
+		while ((write(completion_pipe[1], &byte, sizeof(byte)) == -1) && (errno == EINTR)) {}
+	} else {
+		completed_tail->next = request;
+	}
+	completed_tail = request;
+	pthread_mutex_unlock(&completion_mutex);
+}
+
+static void *work(void *argument) {
+	async_worker * const worker = (async_worker*)argument;
+
+	pthread_mutex_lock(&worker->mutex);
+	while (true) {
+		while ((worker->head == NULL) && !worker->stopping) {
+			pthread_cond_wait(&worker->condition, &worker->mutex);
+		}
+		//only stop after the queue is empty
+		if (worker->head == NULL) {
+			break;
+		}
+
+		async_request * const request = worker->head;
+		worker->head = request->next;
+		if (worker->head == NULL) {
+			worker->tail = NULL;
+		}
+		pthread_mutex_unlock(&worker->mutex);
+
+		execute(request);
+		complete(request);
+
+		pthread_mutex_lock(&worker->mutex);
+	}
+	pthread_mutex_unlock(&worker->mutex);
+
+	return NULL;
+}
+
+/*
+ * Let the workers finish their queues, join and free them.
+ */
+static void stop_workers(async_worker * const pool, const size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		pthread_mutex_lock(&pool[i].mutex);
+		pool[i].stopping = true;
+		pthread_cond_signal(&pool[i].condition);
+		pthread_mutex_unlock(&pool[i].mutex);
+	}
+	for (size_t i = 0; i < count; i++) {
+		pthread_join(pool[i].thread, NULL);
+		pthread_cond_destroy(&pool[i].condition);
+		pthread_mutex_destroy(&pool[i].mutex);
+	}
+	public_free(pool);
+}
+
+static void close_completion_pipe() {
+	for (size_t i = 0; i < 2; i++) {
+		if (completion_pipe[i] != -1) {
+			close(completion_pipe[i]);
+			completion_pipe[i] = -1;
+		}
+	}
+}
+
+static int open_completion_pipe() {
+	if (pipe(completion_pipe) != 0) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < 2; i++) {
+		const int flags = fcntl(completion_pipe[i], F_GETFL);
+		if ((flags == -1)
+				|| (fcntl(completion_pipe[i], F_SETFL, flags | O_NONBLOCK) == -1)
+				|| (fcntl(completion_pipe[i], F_SETFD, FD_CLOEXEC) == -1)) {
+			close_completion_pipe();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+return_status molch_async_start(const size_t count) {
+	return_status status = return_status_init();
+
+	async_worker *pool = NULL;
+	size_t started = 0;
+	bool pipe_opened = false;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	if (count == 0) {
+		throw(INVALID_INPUT, "At least one worker is needed.");
+	}
+	if (workers != NULL) {
+		throw(INVALID_STATE, "The workers are already running.");
+	}
+
+	if (open_completion_pipe() != 0) {
+		throw(INIT_ERROR, "Failed to create the completion pipe.");
+	}
+	pipe_opened = true;
+
+	pool = public_calloc(count, sizeof(async_worker));
+	throw_on_failed_alloc(pool);
+
+	for (; started < count; started++) {
+		async_worker * const worker = &pool[started];
+		if (pthread_mutex_init(&worker->mutex, NULL) != 0) {
+			throw(INIT_ERROR, "Failed to initialize the mutex of a worker.");
+		}
+		if (pthread_cond_init(&worker->condition, NULL) != 0) {
+			pthread_mutex_destroy(&worker->mutex);
+			throw(INIT_ERROR, "Failed to initialize the condition variable of a worker.");
+		}
+		if (pthread_create(&worker->thread, NULL, work, worker) != 0) {
+			pthread_cond_destroy(&worker->condition);
+			pthread_mutex_destroy(&worker->mutex);
+			throw(INIT_ERROR, "Failed to start a worker.");
+		}
+	}
+	workers = pool;
+	worker_count = count;
+	next_worker = 0;
+
+cleanup:
+	on_error {
+		if (pool != NULL) {
+			stop_workers(pool, started);
+		}
+		if (pipe_opened) {
+			close_completion_pipe();
+		}
+	}
+	pthread_mutex_unlock(&pool_mutex);
+
+	return status;
+}
+
+void molch_async_stop() {
+	pthread_mutex_lock(&pool_mutex);
+	if ((workers == NULL) || pool_stopping) {
+		pthread_mutex_unlock(&pool_mutex);
+		return;
+	}
+	//callbacks might submit calls while the workers are finishing, so don't hold the lock
+	pool_stopping = true;
+	pthread_mutex_unlock(&pool_mutex);
+
+	stop_workers(workers, worker_count);
+
+	pthread_mutex_lock(&pool_mutex);
+	workers = NULL;
+	worker_count = 0;
+	pool_stopping = false;
+
+	pthread_mutex_lock(&completion_mutex);
+	while (completed_head != NULL) {
+		async_request * const request = completed_head;
+		completed_head = request->next;
+		destroy_request(request);
+	}
+	completed_tail = NULL;
+	close_completion_pipe();
+	pthread_mutex_unlock(&completion_mutex);
+
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+int molch_async_get_fd() {
+	pthread_mutex_lock(&completion_mutex);
+	const int fd = completion_pipe[0];
+	pthread_mutex_unlock(&completion_mutex);
+
+	return fd;
+}
+
+molch_async_result *molch_async_poll() {
+	pthread_mutex_lock(&completion_mutex);
+	async_request * const request = completed_head;
+	if (request != NULL) {
+		completed_head = request->next;
+		if (completed_head == NULL) {
+			completed_tail = NULL;
+			//empty now, drain the pipe
+			unsigned char byte;
+			while ((read(completion_pipe[0], &byte, sizeof(byte)) == -1) && (errno == EINTR)) {}
+		}
+	}
+	pthread_mutex_unlock(&completion_mutex);
+
+	if (request == NULL) {
+		return NULL;
+	}
+
+	return finish_request(request);
+}
+
+void molch_async_destroy_result(molch_async_result * const result) {
+	if (result == NULL) {
+		return;
+	}
+
+	free_and_null_if_valid(result->packet);
+	if (result->message != NULL) {
+		sodium_memzero(result->message, result->message_length);
+	}
+	free_and_null_if_valid(result->message);
+	free_and_null_if_valid(result->prekey_list);
+	free_and_null_if_valid(result->backup);
+	return_status_destroy_errors(&result->status);
+	sodium_memzero(result, sizeof(molch_async_result));
+	public_free(result);
+}
+
+/*
+ * Create a request with space for copies of the prekey list and data.
+ */
+static return_status create_request(
+		async_request ** const request,
+		const molch_async_operation operation,
+		const unsigned char * const prekey_list,
+		const size_t prekey_list_length,
+		const unsigned char * const data,
+		const size_t data_length,
+		const molch_async_callback callback,
+		void * const user_data) {
+	return_status status = return_status_init();
+
+	if ((data_length > (SIZE_MAX - sizeof(async_request)))
+			|| (prekey_list_length > (SIZE_MAX - sizeof(async_request) - data_length))
+			|| ((prekey_list == NULL) && (prekey_list_length != 0))
+			|| ((data == NULL) && (data_length != 0))) {
+		throw(INVALID_INPUT, "Invalid input to create_request.");
+	}
+
+	*request = public_malloc(sizeof(async_request) + prekey_list_length + data_length);
+	throw_on_failed_alloc(*request);
+	memset(*request, 0, sizeof(async_request));
+
+	(*request)->result = public_calloc(1, sizeof(molch_async_result));
+	throw_on_failed_alloc((*request)->result);
+	(*request)->result->operation = operation;
+	(*request)->result->user_data = user_data;
+	(*request)->result->status = return_status_init();
+	(*request)->callback = callback;
+
+	(*request)->prekey_list_length = prekey_list_length;
+	if (prekey_list_length != 0) {
+		(*request)->prekey_list = (*request)->inputs;
+		memcpy((*request)->prekey_list, prekey_list, prekey_list_length);
+	}
+	(*request)->data_length = data_length;
+	if (data_length != 0) {
+		(*request)->data = (*request)->inputs + prekey_list_length;
+		memcpy((*request)->data, data, data_length);
+	}
+
+cleanup:
+	on_error {
+		if ((request != NULL) && (*request != NULL)) {
+			destroy_request(*request);
+			*request = NULL;
+		}
+	}
+
+	return status;
+}
+
+/*
+ * Queue a request at a worker. Requests with the same key always end up
+ * at the same worker, requests without a key (NULL) are distributed
+ * round robin.
+ */
+static return_status submit(async_request * const request, const unsigned char * const key) {
+	return_status status = return_status_init();
+
+	pthread_mutex_lock(&pool_mutex);
+
+	if ((workers == NULL) || pool_stopping) {
+		throw(INVALID_STATE, "The workers aren't running.");
+	}
+
+	size_t index;
+	if (key != NULL) {
+		//conversation ids are random, the first bytes are as good as a hash
+		uint32_t hash = 0;
+		memcpy(&hash, key, sizeof(hash));
+		index = hash % worker_count;
+	} else {
+		index = next_worker;
+		next_worker = (next_worker + 1) % worker_count;
+	}
+
+	async_worker * const worker = &workers[index];
+	pthread_mutex_lock(&worker->mutex);
+	request->next = NULL;
+	if (worker->tail == NULL) {
+		worker->head = request;
+	} else {
+		worker->tail->next = request;
+	}
+	worker->tail = request;
+	pthread_cond_signal(&worker->condition);
+	pthread_mutex_unlock(&worker->mutex);
+
+cleanup:
+	pthread_mutex_unlock(&pool_mutex);
+
+	return status;
+}
+
+return_status molch_async_create_user(
+		const unsigned char * const random_data,
+		const size_t random_data_length,
+		const molch_async_callback callback,
+		void * const user_data) {
+	return_status status = return_status_init();
+
+	async_request *request = NULL;
+
+	status = create_request(&request, MOLCH_ASYNC_CREATE_USER, NULL, 0, random_data, random_data_length, callback, user_data);
+	throw_on_error(CREATION_ERROR, "Failed to create request.");
+
+	status = submit(request, NULL);
+	throw_on_error(ADDITION_ERROR, "Failed to submit request.");
+	request = NULL;
+
+cleanup:
+	if (request != NULL) {
+		destroy_request(request);
+	}
+
+	return status;
+}
+
+return_status molch_async_start_send_conversation(
+		const unsigned char * const sender_public_master_key,
+		const size_t sender_public_master_key_length,
+		const unsigned char * const receiver_public_master_key,
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const prekey_list,
+		const size_t prekey_list_length,
+		const unsigned char * const message,
+		const size_t message_length,
+		const molch_async_callback callback,
+		void * const user_data) {
+	return_status status = return_status_init();
+
+	async_request *request = NULL;
+
+	if ((sender_public_master_key == NULL) || (sender_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+			|| (receiver_public_master_key == NULL) || (receiver_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)) {
+		throw(INVALID_INPUT, "Invalid input to molch_async_start_send_conversation.");
+	}
+
+	status = create_request(&request, MOLCH_ASYNC_START_SEND_CONVERSATION, prekey_list, prekey_list_length, message, message_length, callback, user_data);
+	throw_on_error(CREATION_ERROR, "Failed to create request.");
+	memcpy(request->user_public_master_key, sender_public_master_key, PUBLIC_MASTER_KEY_SIZE);
+	memcpy(request->peer_public_master_key, receiver_public_master_key, PUBLIC_MASTER_KEY_SIZE);
+
+	status = submit(request, NULL);
+	throw_on_error(ADDITION_ERROR, "Failed to submit request.");
+	request = NULL;
+
+cleanup:
+	if (request != NULL) {
+		destroy_request(request);
+	}
+
+	return status;
+}
+
+return_status molch_async_start_receive_conversation(
+		const unsigned char * const receiver_public_master_key,
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const sender_public_master_key,
+		const size_t sender_public_master_key_length,
+		const unsigned char * const packet,
+		const size_t packet_length,
+		const molch_async_callback callback,
+		void * const user_data) {
+	return_status status = return_status_init();
+
+	async_request *request = NULL;
+
+	if ((receiver_public_master_key == NULL) || (receiver_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+			|| (sender_public_master_key == NULL) || (sender_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)) {
+		throw(INVALID_INPUT, "Invalid input to molch_async_start_receive_conversation.");
+	}
+
+	status = create_request(&request, MOLCH_ASYNC_START_RECEIVE_CONVERSATION, NULL, 0, packet, packet_length, callback, user_data);
+	throw_on_error(CREATION_ERROR, "Failed to create request.");
+	memcpy(request->user_public_master_key, receiver_public_master_key, PUBLIC_MASTER_KEY_SIZE);
+	memcpy(request->peer_public_master_key, sender_public_master_key, PUBLIC_MASTER_KEY_SIZE);
+
+	status = submit(request, NULL);
+	throw_on_error(ADDITION_ERROR, "Failed to submit request.");
+	request = NULL;
+
+cleanup:
+	if (request != NULL) {
+		destroy_request(request);
+	}
+
+	return status;
+}
+
+/*
+ * Encryption and decryption, ordered by conversation.
+ */
+static return_status submit_conversation_request(
+		const molch_async_operation operation,
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const unsigned char * const data,
+		const size_t data_length,
+		const molch_async_callback callback,
+		void * const user_data) {
+	return_status status = return_status_init();
+
+	async_request *request = NULL;
+
+	if ((conversation_id == NULL) || (conversation_id_length != CONVERSATION_ID_SIZE)) {
+		throw(INVALID_INPUT, "Invalid conversation id.");
+	}
+
+	status = create_request(&request, operation, NULL, 0, data, data_length, callback, user_data);
+	throw_on_error(CREATION_ERROR, "Failed to create request.");
+	memcpy(request->result->conversation_id, conversation_id, CONVERSATION_ID_SIZE);
+
+	status = submit(request, conversation_id);
+	throw_on_error(ADDITION_ERROR, "Failed to submit request.");
+	request = NULL;
+
+cleanup:
+	if (request != NULL) {
+		destroy_request(request);
+	}
+
+	return status;
+}
+
+return_status molch_async_encrypt_message(
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const unsigned char * const message,
+		const size_t message_length,
+		const molch_async_callback callback,
+		void * const user_data) {
+	return submit_conversation_request(MOLCH_ASYNC_ENCRYPT_MESSAGE, conversation_id, conversation_id_length, message, message_length, callback, user_data);
+}
+
+return_status molch_async_decrypt_message(
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const unsigned char * const packet,
+		const size_t packet_length,
+		const molch_async_callback callback,
+		void * const user_data) {
+	return submit_conversation_request(MOLCH_ASYNC_DECRYPT_MESSAGE, conversation_id, conversation_id_length, packet, packet_length, callback, user_data);
+}
+
+return_status molch_async_export(
+		const molch_async_callback callback,
+		void * const user_data) {
+	return_status status = return_status_init();
+
+	async_request *request = NULL;
+
+	status = create_request(&request, MOLCH_ASYNC_EXPORT, NULL, 0, NULL, 0, callback, user_data);
+	throw_on_error(CREATION_ERROR, "Failed to create request.");
+
+	status = submit(request, NULL);
+	throw_on_error(ADDITION_ERROR, "Failed to submit request.");
+	request = NULL;
+
+cleanup:
+	if (request != NULL) {
+		destroy_request(request);
+	}
+
+	return status;
+}
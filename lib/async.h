@@ -0,0 +1,86 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*! \file
+ * Asynchronous calls for event loops.
+ *
+ * The calls are executed by a pool of worker threads, every call is
+ * queued at one of the workers. Calls that belong to a conversation are
+ * always queued at the same worker, so they are executed in the order
+ * they have been submitted, other calls are distributed round robin.
+ *
+ * Calls on different workers run in parallel, they only wait for each
+ * other if they need the same shard of the user store.
+ *
+ * When a call is done, its result is either passed to the callback (on
+ * the worker thread) or put into a completion queue. The completion queue
+ * has a file descriptor that is readable while it isn't empty, so it can
+ * be watched with epoll, poll or select.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "return-status.h"
+#include "constants.h"
+
+#ifndef LIB_ASYNC_H
+#define LIB_ASYNC_H
+
+typedef enum molch_async_operation {
+	MOLCH_ASYNC_CREATE_USER,
+	MOLCH_ASYNC_START_SEND_CONVERSATION,
+	MOLCH_ASYNC_START_RECEIVE_CONVERSATION,
+	MOLCH_ASYNC_ENCRYPT_MESSAGE,
+	MOLCH_ASYNC_DECRYPT_MESSAGE,
+	MOLCH_ASYNC_EXPORT
+} molch_async_operation;
+
+/*
+ * Outcome of an asynchronous call, only the outputs of the
+ * respective synchronous function are set.
+ */
+typedef struct molch_async_result {
+	molch_async_operation operation;
+	void *user_data; //as passed when submitting
+	return_status status;
+	unsigned char public_master_key[PUBLIC_MASTER_KEY_SIZE]; //create_user
+	unsigned char backup_key[BACKUP_KEY_SIZE]; //create_user
+	unsigned char conversation_id[CONVERSATION_ID_SIZE]; //start_*_conversation, encrypt_message, decrypt_message
+	unsigned char *packet; //start_send_conversation, encrypt_message
+	size_t packet_length;
+	unsigned char *message; //start_receive_conversation, decrypt_message
+	size_t message_length;
+	unsigned char *prekey_list; //create_user, start_receive_conversation
+	size_t prekey_list_length;
+	unsigned char *backup; //export
+	size_t backup_length;
+	uint32_t receive_message_number; //decrypt_message
+	uint32_t previous_receive_message_number; //decrypt_message
+} molch_async_result;
+
+/*
+ * Called on a worker thread when a call is done. The result belongs
+ * to the callback and has to be destroyed with molch_async_destroy_result.
+ */
+typedef void (*molch_async_callback)(molch_async_result * const result);
+#endif
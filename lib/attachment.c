@@ -0,0 +1,262 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "attachment.h"
+#include "constants.h"
+#include "common.h"
+#include "key-derivation.h"
+#include "trace.h"
+
+//subkey of the message key that is used as stream key
+#define ATTACHMENT_SUBKEY 0
+
+struct attachment_stream {
+	crypto_secretstream_xchacha20poly1305_state state;
+	bool sending;
+	bool finished;
+};
+
+/*
+ * Allocate a stream and derive its key from the message key.
+ */
+static return_status create_stream(
+		attachment_stream ** const stream,
+		buffer_t * const stream_key,
+		const buffer_t * const message_key,
+		const bool sending) {
+	return_status status = return_status_init();
+
+	if ((message_key == NULL) || (message_key->content_length != MESSAGE_KEY_SIZE)) {
+		throw(INVALID_INPUT, "Invalid message key.");
+	}
+
+	*stream = key_malloc(sizeof(attachment_stream));
+	throw_on_failed_alloc(*stream);
+	(*stream)->sending = sending;
+	(*stream)->finished = false;
+
+	status = derive_key(stream_key, ATTACHMENT_KEY_SIZE, message_key, ATTACHMENT_SUBKEY);
+	throw_on_error(KEYDERIVATION_FAILED, "Failed to derive stream key.");
+
+cleanup:
+	on_error {
+		key_free_and_null_if_valid(*stream);
+	}
+
+	return status;
+}
+
+return_status attachment_start_send(
+		attachment_stream ** const stream,
+		buffer_t * const header,
+		const buffer_t * const message_key) {
+	return_status status = return_status_init();
+
+	buffer_t *stream_key = NULL;
+
+	if ((stream == NULL)
+			|| (header == NULL) || (header->buffer_length < ATTACHMENT_HEADER_SIZE)) {
+		throw(INVALID_INPUT, "Invalid input to attachment_start_send.");
+	}
+	*stream = NULL;
+
+	stream_key = buffer_create_with_custom_allocator(ATTACHMENT_KEY_SIZE, ATTACHMENT_KEY_SIZE, key_malloc, key_free);
+	throw_on_failed_alloc(stream_key);
+
+	status = create_stream(stream, stream_key, message_key, true);
+	throw_on_error(CREATION_ERROR, "Failed to create attachment stream.");
+
+	int status_int = crypto_secretstream_xchacha20poly1305_init_push(
+			&(*stream)->state,
+			header->content,
+			stream_key->content);
+	if (status_int != 0) {
+		throw(INIT_ERROR, "Failed to initialize the attachment stream.");
+	}
+	header->content_length = ATTACHMENT_HEADER_SIZE;
+
+cleanup:
+	on_error {
+		if (stream != NULL) {
+			key_free_and_null_if_valid(*stream);
+		}
+		if (header != NULL) {
+			header->content_length = 0;
+		}
+	}
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(stream_key, key_free);
+
+	return status;
+}
+
+return_status attachment_start_receive(
+		attachment_stream ** const stream,
+		const buffer_t * const header,
+		const buffer_t * const message_key) {
+	return_status status = return_status_init();
+
+	buffer_t *stream_key = NULL;
+
+	if ((stream == NULL) || (header == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to attachment_start_receive.");
+	}
+	*stream = NULL;
+
+	if (header->content_length != ATTACHMENT_HEADER_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Attachment header has an incorrect size.");
+	}
+
+	stream_key = buffer_create_with_custom_allocator(ATTACHMENT_KEY_SIZE, ATTACHMENT_KEY_SIZE, key_malloc, key_free);
+	throw_on_failed_alloc(stream_key);
+
+	status = create_stream(stream, stream_key, message_key, false);
+	throw_on_error(CREATION_ERROR, "Failed to create attachment stream.");
+
+	int status_int = crypto_secretstream_xchacha20poly1305_init_pull(
+			&(*stream)->state,
+			header->content,
+			stream_key->content);
+	if (status_int != 0) {
+		throw(INIT_ERROR, "Failed to initialize the attachment stream.");
+	}
+
+cleanup:
+	on_error {
+		if (stream != NULL) {
+			key_free_and_null_if_valid(*stream);
+		}
+	}
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(stream_key, key_free);
+
+	return status;
+}
+
+return_status attachment_push(
+		attachment_stream * const stream,
+		buffer_t * const chunk,
+		const buffer_t * const data,
+		const bool last) {
+	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+
+	if ((stream == NULL) || (chunk == NULL) || (data == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to attachment_push.");
+	}
+
+	if (!stream->sending || stream->finished) {
+		throw(INVALID_STATE, "Can't push to this attachment stream.");
+	}
+
+	if ((data->content_length > (SIZE_MAX - ATTACHMENT_CHUNK_OVERHEAD))
+			|| (chunk->buffer_length < (data->content_length + ATTACHMENT_CHUNK_OVERHEAD))) {
+		throw(INCORRECT_BUFFER_SIZE, "Chunk buffer is too short.");
+	}
+
+	const unsigned char tag = last ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE;
+	int status_int = crypto_secretstream_xchacha20poly1305_push(
+			&stream->state,
+			chunk->content,
+			NULL,
+			data->content,
+			data->content_length,
+			NULL,
+			0,
+			tag);
+	if (status_int != 0) {
+		throw(ENCRYPT_ERROR, "Failed to encrypt chunk.");
+	}
+	chunk->content_length = data->content_length + ATTACHMENT_CHUNK_OVERHEAD;
+
+	stream->finished = last;
+
+cleanup:
+	on_error {
+		if (chunk != NULL) {
+			chunk->content_length = 0;
+		}
+	}
+
+	trace_end("attachment_push", trace_start);
+
+	return status;
+}
+
+return_status attachment_pull(
+		attachment_stream * const stream,
+		buffer_t * const data,
+		bool * const last,
+		const buffer_t * const chunk) {
+	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+
+	if ((stream == NULL) || (data == NULL) || (last == NULL) || (chunk == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to attachment_pull.");
+	}
+
+	if (stream->sending || stream->finished) {
+		throw(INVALID_STATE, "Can't pull from this attachment stream.");
+	}
+
+	if ((chunk->content_length < ATTACHMENT_CHUNK_OVERHEAD)
+			|| (data->buffer_length < (chunk->content_length - ATTACHMENT_CHUNK_OVERHEAD))) {
+		throw(INCORRECT_BUFFER_SIZE, "Data buffer is too short.");
+	}
+
+	unsigned char tag = 0;
+	int status_int = crypto_secretstream_xchacha20poly1305_pull(
+			&stream->state,
+			data->content,
+			NULL,
+			&tag,
+			chunk->content,
+			chunk->content_length,
+			NULL,
+			0);
+	if (status_int != 0) {
+		throw(DECRYPT_ERROR, "Failed to decrypt chunk.");
+	}
+	if ((tag != crypto_secretstream_xchacha20poly1305_TAG_MESSAGE) && (tag != crypto_secretstream_xchacha20poly1305_TAG_FINAL)) {
+		throw(INVALID_VALUE, "Chunk has an invalid tag.");
+	}
+	data->content_length = chunk->content_length - ATTACHMENT_CHUNK_OVERHEAD;
+
+	stream->finished = (tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL);
+	*last = stream->finished;
+
+cleanup:
+	on_error {
+		if (data != NULL) {
+			buffer_clear(data);
+			data->content_length = 0;
+		}
+	}
+
+	trace_end("attachment_pull", trace_start);
+
+	return status;
+}
+
+void attachment_destroy(attachment_stream * const stream) {
+	if (stream != NULL) {
+		key_free(stream);
+	}
+}
@@ -0,0 +1,137 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*! \file
+ * Streaming encryption of large messages (attachments).
+ *
+ * An attachment consumes one message key of the ratchet. A key for
+ * libsodium's crypto_secretstream_xchacha20poly1305 is derived from it,
+ * the stream header is sent as the message of a normal packet and the
+ * data follows in chunks that are authenticated one by one. Chunks have
+ * to be pulled in the order they were pushed and the last one is tagged,
+ * so reordering, dropping or truncating the stream is detected.
+ *
+ * Memory usage only depends on the chunk size, not on the size of the
+ * attachment.
+ */
+
+#include <stdbool.h>
+#include <sodium.h>
+
+#include "../buffer/buffer.h"
+#include "return-status.h"
+
+#ifndef LIB_ATTACHMENT_H
+#define LIB_ATTACHMENT_H
+
+#define ATTACHMENT_HEADER_SIZE crypto_secretstream_xchacha20poly1305_HEADERBYTES
+#define ATTACHMENT_KEY_SIZE crypto_secretstream_xchacha20poly1305_KEYBYTES
+//a chunk is this much longer than the data it contains
+#define ATTACHMENT_CHUNK_OVERHEAD crypto_secretstream_xchacha20poly1305_ABYTES
+
+typedef struct attachment_stream attachment_stream;
+
+/*!
+ * Start sending an attachment.
+ *
+ * \param stream
+ *   The new stream, destroy with attachment_destroy.
+ * \param header
+ *   Output, ATTACHMENT_HEADER_SIZE, has to be sent to the receiver before the first chunk.
+ * \param message_key
+ *   The message key the stream key is derived from.
+ *
+ * \return
+ *   Error status, destroy with return_status_destroy_errors if an error occurs.
+ */
+return_status attachment_start_send(
+		attachment_stream ** const stream,
+		buffer_t * const header,
+		const buffer_t * const message_key) __attribute__((warn_unused_result));
+
+/*!
+ * Start receiving an attachment.
+ *
+ * \param stream
+ *   The new stream, destroy with attachment_destroy.
+ * \param header
+ *   The header created by attachment_start_send.
+ * \param message_key
+ *   The message key the stream key is derived from.
+ *
+ * \return
+ *   Error status, destroy with return_status_destroy_errors if an error occurs.
+ */
+return_status attachment_start_receive(
+		attachment_stream ** const stream,
+		const buffer_t * const header,
+		const buffer_t * const message_key) __attribute__((warn_unused_result));
+
+/*!
+ * Encrypt the next chunk of an attachment.
+ *
+ * \param stream
+ *   A stream created by attachment_start_send.
+ * \param chunk
+ *   Output, needs room for data->content_length + ATTACHMENT_CHUNK_OVERHEAD.
+ * \param data
+ *   The data of the chunk, can be empty.
+ * \param last
+ *   Marks the end of the attachment, the stream can't be used anymore afterwards.
+ *
+ * \return
+ *   Error status, destroy with return_status_destroy_errors if an error occurs.
+ */
+return_status attachment_push(
+		attachment_stream * const stream,
+		buffer_t * const chunk,
+		const buffer_t * const data,
+		const bool last) __attribute__((warn_unused_result));
+
+/*!
+ * Decrypt and verify the next chunk of an attachment.
+ *
+ * The attachment is only complete once a chunk has been pulled
+ * with 'last' set.
+ *
+ * \param stream
+ *   A stream created by attachment_start_receive.
+ * \param data
+ *   Output, needs room for chunk->content_length - ATTACHMENT_CHUNK_OVERHEAD.
+ * \param last
+ *   Output, true if this was the last chunk.
+ * \param chunk
+ *   The chunk created by attachment_push.
+ *
+ * \return
+ *   Error status, destroy with return_status_destroy_errors if an error occurs.
+ */
+return_status attachment_pull(
+		attachment_stream * const stream,
+		buffer_t * const data,
+		bool * const last,
+		const buffer_t * const chunk) __attribute__((warn_unused_result));
+
+/*!
+ * Destroy a stream and erase its key.
+ */
+void attachment_destroy(attachment_stream * const stream);
+#endif
@@ -25,6 +25,7 @@
 #define LIB_COMMON_H
 
 #include "return-status.h"
+#include "allocators.h"
 #include "zeroed_malloc.h"
 
 // execute code if a pointer is not NULL
@@ -35,12 +36,12 @@
 // macros that free memory and delete the pointer afterwards
 #define free_and_null_if_valid(pointer)\
 	if_valid(pointer,\
-		free(pointer);\
+		public_free(pointer);\
 		pointer = NULL;\
 	)
-#define sodium_free_and_null_if_valid(pointer)\
+#define key_free_and_null_if_valid(pointer)\
 	if_valid(pointer,\
-		sodium_free(pointer);\
+		key_free(pointer);\
 		pointer = NULL;\
 	)
 #define zeroed_free_and_null_if_valid(pointer)\
@@ -43,6 +43,14 @@
 #define PRIVATE_MASTER_KEY_SIZE crypto_sign_SECRETKEYBYTES
 #define BACKUP_KEY_SIZE crypto_secretbox_KEYBYTES
 
+//protocol versions
+#define PROTOCOL_VERSION_PKCS7_PADDING 0U //messages are padded to 255 byte blocks (PKCS7)
+#define PROTOCOL_VERSION_LENGTH_PREFIX 1U //messages are prefixed with their length and padded with zeroes
+#define PROTOCOL_VERSION_COMPACT 2U //fixed binary layout instead of protobuf, derived message nonce (see wire.h)
+#define PROTOCOL_VERSION_ROUTED 3U //compact packets with a routing tag (see routing.h)
+#define HIGHEST_SUPPORTED_PROTOCOL_VERSION PROTOCOL_VERSION_ROUTED
+#define PADDING_PREFIX_SIZE 4U //big endian message length
+
 //nonce sizes
 #define MESSAGE_NONCE_SIZE crypto_secretbox_NONCEBYTES
 #define HEADER_NONCE_SIZE crypto_secretbox_NONCEBYTES
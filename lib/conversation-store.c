@@ -23,13 +23,18 @@
 
 #include "conversation-store.h"
 
+//every store starts at a different generation, so cursors don't match a replaced store
+static uint64_t next_generation = 0;
+
 /*
  * Init new conversation store.
  */
 void conversation_store_init(conversation_store * const store) {
 	store->length = 0;
+	store->generation = __atomic_add_fetch(&next_generation, UINT64_C(1) << 32, __ATOMIC_RELAXED);
 	store->head = NULL;
 	store->tail = NULL;
+	routing_table_init(store->routes);
 }
 
 /*
@@ -45,6 +50,15 @@ return_status conversation_store_add(
 		throw(INVALID_INPUT, "Invalid input to conversation_store_add");
 	}
 
+	//a conversation that isn't in a store has no routing tags yet
+	conversation->routes = store->routes;
+	conversation->routing_tag_count = 0;
+	status = conversation_update_routes(conversation);
+	on_error {
+		conversation->routes = NULL;
+		throw(ADDITION_ERROR, "Failed to add the routing tags of the conversation.");
+	}
+
 	if (store->head == NULL) { //first conversation in the list
 		conversation->previous = NULL;
 		conversation->next = NULL;
@@ -53,6 +67,7 @@ return_status conversation_store_add(
 
 		//update length
 		store->length++;
+		store->generation++;
 
 		goto cleanup;
 	}
@@ -65,6 +80,7 @@ return_status conversation_store_add(
 
 	//update length
 	store->length++;
+	store->generation++;
 
 cleanup:
 
@@ -93,6 +109,7 @@ void conversation_store_remove(conversation_store * const store, conversation_t
 	}
 
 	store->length--;
+	store->generation++;
 
 	conversation_destroy(node);
 }
@@ -147,8 +164,12 @@ cleanup:
 	return status;
 }
 
+conversation_t *conversation_store_route(const conversation_store * const store, const unsigned char * const routing_tag) {
+	return routing_table_find(store->routes, routing_tag);
+}
+
 /*
- * Remove all entries from a conversation store.
+ * Remove all entries from a conversation store and free its routing table.
  */
 void conversation_store_clear(conversation_store * const store) {
 	if (store == NULL) {
@@ -158,6 +179,7 @@ void conversation_store_clear(conversation_store * const store) {
 	while (store->length > 0) {
 		conversation_store_remove(store, store->tail);
 	}
+	routing_table_clear(store->routes);
 }
 
 /*
@@ -203,6 +225,25 @@ cleanup:
 	return status;
 }
 
+size_t conversation_store_list_page(
+		const conversation_store * const store,
+		const size_t position,
+		unsigned char * const page,
+		const size_t capacity) {
+	size_t count = 0;
+	const conversation_t *node = store->head;
+	for (size_t index = 0; (node != NULL) && (count < capacity); index++, node = node->next) {
+		if (index < position) {
+			continue;
+		}
+
+		memcpy(page + count * CONVERSATION_ID_SIZE, node->id->content, CONVERSATION_ID_SIZE);
+		count++;
+	}
+
+	return count;
+}
+
 return_status conversation_store_export(
 		const conversation_store * const conversation_store,
 		Conversation *** const conversations,
@@ -27,8 +27,10 @@
 
 typedef struct conversation_store {
 	size_t length;
+	uint64_t generation; //changes whenever a conversation is added or removed
 	conversation_t *head;
 	conversation_t *tail;
+	routing_table routes[1]; //routing tags of all the conversations
 } conversation_store;
 
 /*
@@ -37,7 +39,8 @@ typedef struct conversation_store {
 void conversation_store_init(conversation_store * const store);
 
 /*
- * add a conversation to the conversation store.
+ * add a conversation to the conversation store and its routing tags
+ * to the routing table.
  */
 return_status conversation_store_add(
 		conversation_store * const store,
@@ -66,7 +69,14 @@ return_status conversation_store_find_node(
 		const buffer_t * const id) __attribute__((warn_unused_result));
 
 /*
- * Remove all entries from a conversation store.
+ * Find the conversation that expects a packet with a routing tag.
+ *
+ * Returns NULL if no conversation was found.
+ */
+conversation_t *conversation_store_route(const conversation_store * const store, const unsigned char * const routing_tag);
+
+/*
+ * Remove all entries from a conversation store and free its routing table.
  */
 void conversation_store_clear(conversation_store * const store);
 
@@ -92,6 +102,18 @@ void conversation_store_clear(conversation_store * const store);
  */
 return_status conversation_store_list(buffer_t ** const list, conversation_store * const store) __attribute__((warn_unused_result));
 
+/*
+ * Copy the ids of up to 'capacity' conversations into 'page', starting
+ * with the conversation at 'position'.
+ *
+ * Returns the number of copied ids.
+ */
+size_t conversation_store_list_page(
+		const conversation_store * const store,
+		const size_t position,
+		unsigned char * const page,
+		const size_t capacity);
+
 /*! Export a conversation store to Protobuf-C
  * \param conversation_store The conversation store to export.
  * \param conversations An array of Protobuf-C structs to export it to.
@@ -24,6 +24,10 @@
 #include "molch.h"
 #include "packet.h"
 #include "header.h"
+#include "attachment.h"
+#include "random.h"
+#include "parallel.h"
+#include "zeroed_malloc.h"
 
 /*
  * Create a new conversation struct and initialise the buffer pointer.
@@ -33,6 +37,11 @@ void init_struct(conversation_t *conversation) {
 	conversation->ratchet = NULL;
 	conversation->previous = NULL;
 	conversation->next = NULL;
+	conversation->padding = MOLCH_PADDING_BLOCKS;
+	conversation->their_highest_supported_protocol_version = PROTOCOL_VERSION_PKCS7_PADDING;
+	receive_guard_init(conversation->guard);
+	conversation->routes = NULL;
+	conversation->routing_tag_count = 0;
 }
 
 /*
@@ -71,13 +80,14 @@ return_status conversation_create(
 		throw(INVALID_INPUT, "Invalid input for conversation_create.");
 	}
 
-	*conversation = malloc(sizeof(conversation_t));
+	*conversation = public_malloc(sizeof(conversation_t));
 	throw_on_failed_alloc(*conversation);
+	stats_allocation(MOLCH_STATS_CONVERSATIONS, sizeof(conversation_t));
 
 	init_struct(*conversation);
 
 	//create random id
-	if (buffer_fill_random((*conversation)->id, CONVERSATION_ID_SIZE) != 0) {
+	if (random_fill_buffer((*conversation)->id, CONVERSATION_ID_SIZE) != 0) {
 		throw(BUFFER_ERROR, "Failed to create random conversation id.");
 	}
 
@@ -105,10 +115,11 @@ cleanup:
  * Destroy a conversation.
  */
 void conversation_destroy(conversation_t * const conversation) {
+	conversation_remove_routes(conversation);
 	if (conversation->ratchet != NULL) {
 		ratchet_destroy(conversation->ratchet);
 	}
-	free(conversation);
+	public_free(conversation);
 }
 
 /*
@@ -132,9 +143,9 @@ return_status conversation_start_send_conversation(
 	buffer_t *sender_public_ephemeral = NULL;
 	buffer_t *sender_private_ephemeral = NULL;
 
-	sender_public_ephemeral = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	sender_public_ephemeral = buffer_create_with_custom_allocator(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(sender_public_ephemeral);
-	sender_private_ephemeral = buffer_create_on_heap(PRIVATE_KEY_SIZE, PRIVATE_KEY_SIZE);
+	sender_private_ephemeral = buffer_create_with_custom_allocator(PRIVATE_KEY_SIZE, PRIVATE_KEY_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(sender_private_ephemeral);
 
 	//check many error conditions
@@ -152,13 +163,13 @@ return_status conversation_start_send_conversation(
 
 	int status_int = 0;
 	//create an ephemeral keypair
-	status_int = crypto_box_keypair(sender_public_ephemeral->content, sender_private_ephemeral->content);
+	status_int = random_box_keypair(sender_public_ephemeral->content, sender_private_ephemeral->content);
 	if (status_int != 0) {
 		throw(KEYGENERATION_FAILED, "Failed to generate ephemeral keypair.");
 	}
 
 	//choose a prekey
-	uint32_t prekey_number = randombytes_uniform(PREKEY_AMOUNT);
+	uint32_t prekey_number = random_uniform(PREKEY_AMOUNT);
 	buffer_create_with_existing_array(
 			receiver_public_prekey,
 			&(receiver_prekey_list->content[prekey_number * PUBLIC_KEY_SIZE]),
@@ -185,8 +196,8 @@ return_status conversation_start_send_conversation(
 	throw_on_error(SEND_ERROR, "Failed to send message using newly created conversation.");
 
 cleanup:
-	buffer_destroy_from_heap_and_null_if_valid(sender_public_ephemeral);
-	buffer_destroy_from_heap_and_null_if_valid(sender_private_ephemeral);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(sender_public_ephemeral, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(sender_private_ephemeral, zeroed_free);
 
 	on_error {
 		if (conversation != NULL) {
@@ -200,6 +211,95 @@ cleanup:
 	return status;
 }
 
+/*
+ * Unpack a prekey message and get the senders keys and our public prekey from it.
+ */
+static return_status read_prekey_message(
+		packet_view * const packet_struct, //output
+		const buffer_t * const packet,
+		buffer_t * const sender_public_identity, //output
+		buffer_t * const sender_public_ephemeral, //output
+		buffer_t * const receiver_public_prekey //output
+		) {
+	return_status status = return_status_init();
+
+	//unpack the packet once for the metadata and the decryption
+	status = packet_unpack(packet_struct, packet);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+
+	molch_message_type packet_type;
+	uint32_t current_protocol_version;
+	uint32_t highest_supported_protocol_version;
+	status = packet_get_metadata_from_view(
+			&current_protocol_version,
+			&highest_supported_protocol_version,
+			&packet_type,
+			packet_struct,
+			sender_public_identity,
+			sender_public_ephemeral,
+			receiver_public_prekey);
+	throw_on_error(GENERIC_ERROR, "Failed to get packet metadata.");
+
+	if (packet_type != PREKEY_MESSAGE) {
+		throw(INVALID_VALUE, "Packet is not a prekey message.");
+	}
+
+cleanup:
+	return status;
+}
+
+/*
+ * Create the conversation of a prekey message whose private prekey has
+ * already been taken out of the prekey store and receive the message.
+ * Doesn't touch the prekey store or any other shared state.
+ */
+static return_status receive_prekey_message(
+		conversation_t ** const conversation, //output
+		const packet_view * const packet_struct,
+		buffer_t ** const message, //output, free after use!
+		const buffer_t * const receiver_public_identity,
+		const buffer_t * const receiver_private_identity,
+		const buffer_t * const receiver_public_prekey,
+		const buffer_t * const receiver_private_prekey,
+		const buffer_t * const sender_public_identity,
+		const buffer_t * const sender_public_ephemeral
+		) {
+	uint32_t receive_message_number = 0;
+	uint32_t previous_receive_message_number = 0;
+
+	return_status status = return_status_init();
+
+	*conversation = NULL;
+
+	status = conversation_create(
+			conversation,
+			receiver_private_identity,
+			receiver_public_identity,
+			sender_public_identity,
+			receiver_private_prekey,
+			receiver_public_prekey,
+			sender_public_ephemeral);
+	throw_on_error(CREATION_ERROR, "Failed to create conversation.");
+
+	status = conversation_receive_from_view(
+			*conversation,
+			packet_struct,
+			&receive_message_number,
+			&previous_receive_message_number,
+			message);
+	throw_on_error(RECEIVE_ERROR, "Failed to receive message.");
+
+cleanup:
+	on_error {
+		if (*conversation != NULL) {
+			conversation_destroy(*conversation);
+			*conversation = NULL;
+		}
+	}
+
+	return status;
+}
+
 /*
  * Start a new conversation where we are the receiver.
  *
@@ -214,9 +314,6 @@ return_status conversation_start_receive_conversation(
 		const buffer_t * const receiver_private_identity,
 		prekey_store * const receiver_prekeys //prekeys of the receiver
 		) {
-	uint32_t receive_message_number = 0;
-	uint32_t previous_receive_message_number = 0;
-
 	return_status status = return_status_init();
 
 	//key buffers
@@ -225,13 +322,13 @@ return_status conversation_start_receive_conversation(
 	buffer_t *sender_public_ephemeral = NULL;
 	buffer_t *sender_public_identity = NULL;
 
-	receiver_public_prekey = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	receiver_public_prekey = buffer_create_with_custom_allocator(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(receiver_public_prekey);
-	receiver_private_prekey = buffer_create_on_heap(PRIVATE_KEY_SIZE, PRIVATE_KEY_SIZE);
+	receiver_private_prekey = buffer_create_with_custom_allocator(PRIVATE_KEY_SIZE, PRIVATE_KEY_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(receiver_private_prekey);
-	sender_public_ephemeral = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	sender_public_ephemeral = buffer_create_with_custom_allocator(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(sender_public_ephemeral);
-	sender_public_identity = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	sender_public_identity = buffer_create_with_custom_allocator(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(sender_public_identity);
 
 	if ((conversation == NULL)
@@ -245,23 +342,14 @@ return_status conversation_start_receive_conversation(
 
 	*conversation = NULL;
 
-	//get the senders keys and our public prekey from the packet
-	molch_message_type packet_type;
-	uint32_t current_protocol_version;
-	uint32_t highest_supported_protocol_version;
-	status = packet_get_metadata_without_verification(
-			&current_protocol_version,
-			&highest_supported_protocol_version,
-			&packet_type,
+	packet_view packet_struct;
+	status = read_prekey_message(
+			&packet_struct,
 			packet,
 			sender_public_identity,
 			sender_public_ephemeral,
 			receiver_public_prekey);
-	throw_on_error(GENERIC_ERROR, "Failed to get packet metadata.");
-
-	if (packet_type != PREKEY_MESSAGE) {
-		throw(INVALID_VALUE, "Packet is not a prekey message.");
-	}
+	throw_on_error(GENERIC_ERROR, "Failed to read prekey message.");
 
 	//get the private prekey that corresponds to the public prekey used in the message
 	status = prekey_store_get_prekey(
@@ -270,29 +358,23 @@ return_status conversation_start_receive_conversation(
 			receiver_private_prekey);
 	throw_on_error(DATA_FETCH_ERROR, "Failed to get public prekey.");
 
-	status = conversation_create(
+	status = receive_prekey_message(
 			conversation,
-			receiver_private_identity,
+			&packet_struct,
+			message,
 			receiver_public_identity,
-			sender_public_identity,
-			receiver_private_prekey,
+			receiver_private_identity,
 			receiver_public_prekey,
+			receiver_private_prekey,
+			sender_public_identity,
 			sender_public_ephemeral);
-	throw_on_error(CREATION_ERROR, "Failed to create conversation.");
-
-	status = conversation_receive(
-			*conversation,
-			packet,
-			&receive_message_number,
-			&previous_receive_message_number,
-			message);
-	throw_on_error(RECEIVE_ERROR, "Failed to receive message.");
+	throw_on_error(RECEIVE_ERROR, "Failed to receive prekey message.");
 
 cleanup:
-	buffer_destroy_from_heap_and_null_if_valid(receiver_public_prekey);
-	buffer_destroy_from_heap_and_null_if_valid(receiver_private_prekey);
-	buffer_destroy_from_heap_and_null_if_valid(sender_public_ephemeral);
-	buffer_destroy_from_heap_and_null_if_valid(sender_public_identity);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(receiver_public_prekey, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(receiver_private_prekey, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(sender_public_ephemeral, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(sender_public_identity, zeroed_free);
 
 	on_error {
 		if (conversation != NULL) {
@@ -307,38 +389,180 @@ cleanup:
 }
 
 /*
- * Send a message using an existing conversation.
- *
- * Don't forget to destroy the return status with return_status_destroy_errors()
- * if an error has occurred.
+ * A prekey message of a batch, see conversation_start_receive_conversations.
  */
-return_status conversation_send(
+typedef struct prekey_intake {
+	packet_view packet;
+	buffer_t receiver_public_prekey[1];
+	unsigned char receiver_public_prekey_storage[PUBLIC_KEY_SIZE];
+	buffer_t receiver_private_prekey[1];
+	unsigned char receiver_private_prekey_storage[PRIVATE_KEY_SIZE];
+	buffer_t sender_public_identity[1];
+	unsigned char sender_public_identity_storage[PUBLIC_KEY_SIZE];
+	buffer_t sender_public_ephemeral[1];
+	unsigned char sender_public_ephemeral_storage[PUBLIC_KEY_SIZE];
+} prekey_intake;
+
+/*
+ * Everything the threads of a batch need.
+ */
+typedef struct intake_batch {
+	prekey_intake *intakes;
+	conversation_t **conversations;
+	buffer_t **messages;
+	return_status *statuses;
+	const buffer_t *receiver_public_identity;
+	const buffer_t *receiver_private_identity;
+} intake_batch;
+
+static void receive_intake(const size_t index, void * const argument) {
+	intake_batch * const batch = (intake_batch*)argument;
+
+	if (batch->statuses[index].status != SUCCESS) {
+		return;
+	}
+
+	const prekey_intake * const intake = &batch->intakes[index];
+	batch->statuses[index] = receive_prekey_message(
+			&batch->conversations[index],
+			&intake->packet,
+			&batch->messages[index],
+			batch->receiver_public_identity,
+			batch->receiver_private_identity,
+			intake->receiver_public_prekey,
+			intake->receiver_private_prekey,
+			intake->sender_public_identity,
+			intake->sender_public_ephemeral);
+}
+
+return_status conversation_start_receive_conversations(
+		conversation_t ** const conversations, //output, 'count' long
+		buffer_t ** const messages, //output, 'count' long, free after use!
+		return_status * const statuses, //output, 'count' long
+		const buffer_t * const * const packets, //'count' long
+		const size_t count,
+		const buffer_t * const receiver_public_identity,
+		const buffer_t * const receiver_private_identity,
+		prekey_store * const receiver_prekeys,
+		const size_t thread_count
+		) {
+	return_status status = return_status_init();
+
+	intake_batch batch;
+	batch.intakes = NULL;
+	bool statuses_initialized = false;
+
+	if ((conversations == NULL) || (messages == NULL) || (statuses == NULL)
+			|| (packets == NULL) || (count == 0) || (count > (SIZE_MAX / sizeof(prekey_intake)))
+			|| (receiver_public_identity == NULL) || (receiver_public_identity->content_length != PUBLIC_KEY_SIZE)
+			|| (receiver_private_identity == NULL) || (receiver_private_identity->content_length != PRIVATE_KEY_SIZE)
+			|| (receiver_prekeys == NULL) || (thread_count == 0)) {
+		throw(INVALID_INPUT, "Invalid input to conversation_start_receive_conversations.");
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if ((packets[i] == NULL) || (packets[i]->content == NULL) || (packets[i]->content_length == 0)) {
+			throw(INVALID_INPUT, "Packet of a batch is empty.");
+		}
+	}
+	for (size_t i = 0; i < count; i++) {
+		conversations[i] = NULL;
+		messages[i] = NULL;
+		statuses[i] = return_status_init();
+	}
+	statuses_initialized = true;
+
+	//the intakes contain private prekeys
+	batch.intakes = key_malloc(count * sizeof(prekey_intake));
+	throw_on_failed_alloc(batch.intakes);
+	batch.conversations = conversations;
+	batch.messages = messages;
+	batch.statuses = statuses;
+	batch.receiver_public_identity = receiver_public_identity;
+	batch.receiver_private_identity = receiver_private_identity;
+
+	//read all messages and take their prekeys, every used prekey is deprecated once afterwards
+	bool used_prekeys[PREKEY_AMOUNT] = {false};
+	for (size_t i = 0; i < count; i++) {
+		prekey_intake * const intake = &batch.intakes[i];
+		buffer_init_with_pointer(intake->receiver_public_prekey, intake->receiver_public_prekey_storage, PUBLIC_KEY_SIZE, 0);
+		buffer_init_with_pointer(intake->receiver_private_prekey, intake->receiver_private_prekey_storage, PRIVATE_KEY_SIZE, 0);
+		buffer_init_with_pointer(intake->sender_public_identity, intake->sender_public_identity_storage, PUBLIC_KEY_SIZE, 0);
+		buffer_init_with_pointer(intake->sender_public_ephemeral, intake->sender_public_ephemeral_storage, PUBLIC_KEY_SIZE, 0);
+
+		statuses[i] = read_prekey_message(
+				&intake->packet,
+				packets[i],
+				intake->sender_public_identity,
+				intake->sender_public_ephemeral,
+				intake->receiver_public_prekey);
+		if (statuses[i].status != SUCCESS) {
+			continue;
+		}
+
+		statuses[i] = prekey_store_peek_prekey(
+				receiver_prekeys,
+				intake->receiver_public_prekey,
+				intake->receiver_private_prekey,
+				used_prekeys);
+	}
+	status = prekey_store_deprecate_used(receiver_prekeys, used_prekeys);
+	throw_on_error(GENERIC_ERROR, "Failed to deprecate the used prekeys.");
+
+	//the key agreements
+	parallel_for(count, thread_count, receive_intake, &batch);
+
+cleanup:
+	on_error {
+		//no conversations have been created yet
+		if (statuses_initialized) {
+			for (size_t i = 0; i < count; i++) {
+				return_status_destroy_errors(&statuses[i]);
+			}
+		}
+	}
+	key_free_and_null_if_valid(batch.intakes);
+
+	return status;
+}
+
+/*
+ * Send a message or, if 'attachment' isn't NULL, start an attachment
+ * with the message key and send its header as the message.
+ */
+static return_status send_packet(
 		conversation_t * const conversation,
-		const buffer_t * const message,
+		const buffer_t * message, //NULL when starting an attachment
+		attachment_stream ** const attachment, //output, can be NULL
 		buffer_t **packet, //output, free after use!
 		const buffer_t * const public_identity_key, //can be NULL, if not NULL, this will be a prekey message
 		const buffer_t * const public_ephemeral_key, //can be NULL, if not NULL, this will be a prekey message
 		const buffer_t * const public_prekey //can be NULL, if not NULL, this will be a prekey message
 		) {
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
 
 	//create buffers
 	buffer_t *send_header_key = NULL;
 	buffer_t *send_message_key = NULL;
 	buffer_t *send_ephemeral_key = NULL;
 	buffer_t *header = NULL;
+	unsigned char attachment_header_storage[ATTACHMENT_HEADER_SIZE];
+	buffer_create_with_existing_array(attachment_header, attachment_header_storage, sizeof(attachment_header_storage));
+	unsigned char routing_tag_storage[ROUTING_TAG_SIZE];
+	buffer_create_with_existing_array(routing_tag, routing_tag_storage, sizeof(routing_tag_storage));
 
-	send_header_key = buffer_create_on_heap(HEADER_KEY_SIZE, HEADER_KEY_SIZE);
+	send_header_key = buffer_create_with_custom_allocator(HEADER_KEY_SIZE, HEADER_KEY_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(send_header_key);
-	send_message_key = buffer_create_on_heap(MESSAGE_KEY_SIZE, MESSAGE_KEY_SIZE);
+	send_message_key = buffer_create_with_custom_allocator(MESSAGE_KEY_SIZE, MESSAGE_KEY_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(send_message_key);
-	send_ephemeral_key = buffer_create_on_heap(PUBLIC_KEY_SIZE, 0);
+	send_ephemeral_key = buffer_create_with_custom_allocator(PUBLIC_KEY_SIZE, 0, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(send_ephemeral_key);
 
 
 	//check input
 	if ((conversation == NULL)
-			|| (message == NULL)
+			|| ((message == NULL) == (attachment == NULL))
 			|| (packet == NULL)) {
 		throw(INVALID_INPUT, "Invalid input to conversation_send.");
 	}
@@ -372,24 +596,42 @@ return_status conversation_send(
 			send_message_key);
 	throw_on_error(SEND_ERROR, "Failed to get send keys.");
 
-	//create the header
+	const uint32_t protocol_version = conversation_get_send_protocol_version(conversation);
+
+	//create the header, it authenticates the protocol versions of the packet
 	status = header_construct(
 			&header,
 			send_ephemeral_key,
 			send_message_number,
-			previous_send_message_number);
+			previous_send_message_number,
+			protocol_version,
+			HIGHEST_SUPPORTED_PROTOCOL_VERSION);
 	throw_on_error(CREATION_ERROR, "Failed to construct header.");
 
+	if (attachment != NULL) {
+		status = attachment_start_send(attachment, attachment_header, send_message_key);
+		throw_on_error(CREATION_ERROR, "Failed to start attachment.");
+		message = attachment_header;
+	}
+
+	if (protocol_version >= PROTOCOL_VERSION_ROUTED) {
+		status = routing_derive_tags(routing_tag->content, send_header_key, send_message_number, 1);
+		throw_on_error(KEYDERIVATION_FAILED, "Failed to derive routing tag.");
+	}
+
 	status = packet_encrypt(
 			packet,
 			packet_type,
+			protocol_version,
+			conversation_get_send_padding(conversation),
 			header,
 			send_header_key,
 			message,
 			send_message_key,
 			public_identity_key,
 			public_ephemeral_key,
-			public_prekey);
+			public_prekey,
+			(protocol_version >= PROTOCOL_VERSION_ROUTED) ? routing_tag : NULL);
 	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt packet.");
 
 cleanup:
@@ -397,12 +639,143 @@ cleanup:
 		if (packet != NULL) {
 			buffer_destroy_from_heap_and_null_if_valid(*packet);
 		}
+		if (attachment != NULL) {
+			attachment_destroy(*attachment);
+			*attachment = NULL;
+		}
 	}
-	buffer_destroy_from_heap_and_null_if_valid(send_header_key);
-	buffer_destroy_from_heap_and_null_if_valid(send_message_key);
-	buffer_destroy_from_heap_and_null_if_valid(send_ephemeral_key);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(send_header_key, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(send_message_key, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(send_ephemeral_key, zeroed_free);
 	buffer_destroy_from_heap_and_null_if_valid(header);
 
+	trace_end("conversation_send", trace_start);
+
+	return status;
+}
+
+molch_padding conversation_get_send_padding(const conversation_t * const conversation) {
+	if (conversation->their_highest_supported_protocol_version < PROTOCOL_VERSION_LENGTH_PREFIX) {
+		return MOLCH_PADDING_BLOCKS;
+	}
+
+	return conversation->padding;
+}
+
+uint32_t conversation_get_send_protocol_version(const conversation_t * const conversation) {
+	if (conversation->their_highest_supported_protocol_version >= PROTOCOL_VERSION_ROUTED) {
+		return PROTOCOL_VERSION_ROUTED;
+	}
+
+	if (conversation->their_highest_supported_protocol_version >= PROTOCOL_VERSION_COMPACT) {
+		return PROTOCOL_VERSION_COMPACT;
+	}
+
+	if (conversation_get_send_padding(conversation) == MOLCH_PADDING_BLOCKS) {
+		return PROTOCOL_VERSION_PKCS7_PADDING;
+	}
+
+	return PROTOCOL_VERSION_LENGTH_PREFIX;
+}
+
+return_status conversation_update_routes(conversation_t * const conversation) {
+	return_status status = return_status_init();
+
+	if ((conversation == NULL) || (conversation->ratchet == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to conversation_update_routes.");
+	}
+
+	conversation_remove_routes(conversation);
+	if (conversation->routes == NULL) {
+		goto cleanup;
+	}
+
+	const ratchet_state * const ratchet = conversation->ratchet;
+	unsigned char * const tags = conversation->routing_tags;
+
+	//both sides of the next expected message number in the current chain, the start of the next one
+	//a chain without a header key can't receive anything and its tags would be the same in every conversation
+	size_t count = 0;
+	if (!is_none(ratchet->receive_header_key)) {
+		const uint32_t first = (ratchet->receive_message_number > ROUTING_WINDOW) ? (ratchet->receive_message_number - ROUTING_WINDOW) : 0;
+		const size_t current_count = (size_t)(ratchet->receive_message_number - first) + ROUTING_WINDOW;
+		status = routing_derive_tags(tags, ratchet->receive_header_key, first, current_count);
+		throw_on_error(KEYDERIVATION_FAILED, "Failed to derive routing tags of the current receive chain.");
+		count += current_count;
+	}
+	if (!is_none(ratchet->next_receive_header_key)) {
+		status = routing_derive_tags(tags + count * ROUTING_TAG_SIZE, ratchet->next_receive_header_key, 0, ROUTING_WINDOW);
+		throw_on_error(KEYDERIVATION_FAILED, "Failed to derive routing tags of the next receive chain.");
+		count += ROUTING_WINDOW;
+	}
+
+	if (routing_table_reserve(conversation->routes, count) != 0) {
+		throw(ALLOCATION_FAILED, "Failed to grow the routing table.");
+	}
+	for (size_t i = 0; i < count; i++) {
+		routing_table_add(conversation->routes, tags + i * ROUTING_TAG_SIZE, conversation);
+	}
+	conversation->routing_tag_count = count;
+
+cleanup:
+	return status;
+}
+
+void conversation_remove_routes(conversation_t * const conversation) {
+	if (conversation->routes != NULL) {
+		for (size_t i = 0; i < conversation->routing_tag_count; i++) {
+			routing_table_remove(conversation->routes, conversation->routing_tags + i * ROUTING_TAG_SIZE, conversation);
+		}
+	}
+	conversation->routing_tag_count = 0;
+}
+
+/*
+ * Send a message using an existing conversation.
+ *
+ * Don't forget to destroy the return status with return_status_destroy_errors()
+ * if an error has occurred.
+ */
+return_status conversation_send(
+		conversation_t * const conversation,
+		const buffer_t * const message,
+		buffer_t **packet, //output, free after use!
+		const buffer_t * const public_identity_key, //can be NULL, if not NULL, this will be a prekey message
+		const buffer_t * const public_ephemeral_key, //can be NULL, if not NULL, this will be a prekey message
+		const buffer_t * const public_prekey //can be NULL, if not NULL, this will be a prekey message
+		) {
+	return send_packet(
+			conversation,
+			message,
+			NULL,
+			packet,
+			public_identity_key,
+			public_ephemeral_key,
+			public_prekey);
+}
+
+return_status conversation_send_attachment(
+		conversation_t * const conversation,
+		attachment_stream ** const attachment,
+		buffer_t ** const packet) {
+	return_status status = return_status_init();
+
+	if (attachment == NULL) {
+		throw(INVALID_INPUT, "Invalid input to conversation_send_attachment.");
+	}
+	*attachment = NULL;
+
+	status = send_packet(
+			conversation,
+			NULL,
+			attachment,
+			packet,
+			NULL,
+			NULL,
+			NULL);
+	throw_on_error(SEND_ERROR, "Failed to send attachment header.");
+
+cleanup:
 	return status;
 }
 
@@ -415,38 +788,57 @@ cleanup:
  */
 int try_skipped_header_and_message_keys(
 		header_and_message_keystore * const skipped_keys,
-		const buffer_t * const packet,
+		const packet_view * const packet,
 		buffer_t ** const message,
+		buffer_t * const used_message_key, //output, can be NULL
 		uint32_t * const receive_message_number,
-		uint32_t * const previous_receive_message_number) {
+		uint32_t * const previous_receive_message_number,
+		size_t * const trials) { //output, number of header decryption attempts
 	return_status status = return_status_init();
 
+	*trials = 0;
+
 	//create buffers
 	buffer_t *header = NULL;
 	buffer_t *their_signed_public_ephemeral = NULL;
-	their_signed_public_ephemeral = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	their_signed_public_ephemeral = buffer_create_with_custom_allocator(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(their_signed_public_ephemeral);
 
 	header_and_message_keystore_node* node = skipped_keys->head;
 	for (size_t i = 0; (i < skipped_keys->length) && (node != NULL); i++, node = node->next) {
-		status = packet_decrypt_header(
+		buffer_destroy_from_heap_and_null_if_valid(header);
+		status = packet_decrypt_header_from_view(
 				&header,
 				packet,
 				node->header_key);
+		(*trials)++;
+		stats_header_trial(status.status == SUCCESS);
+		if (status.status == SUCCESS) {
+			uint32_t current_protocol_version;
+			uint32_t highest_supported_protocol_version;
+			status = header_extract(
+					their_signed_public_ephemeral,
+					receive_message_number,
+					previous_receive_message_number,
+					&current_protocol_version,
+					&highest_supported_protocol_version,
+					header);
+			if ((status.status == SUCCESS) && (current_protocol_version != packet->packet_header.current_protocol_version)) {
+				//the protocol version of the packet has been tampered with
+				status.status = DECRYPT_ERROR;
+			}
+		}
 		if (status.status == SUCCESS) {
-			status = packet_decrypt_message(
+			status = packet_decrypt_message_from_view(
 					message,
 					packet,
 					node->message_key);
 			if (status.status == SUCCESS) {
+				if ((used_message_key != NULL) && (buffer_clone(used_message_key, node->message_key) != 0)) {
+					throw(BUFFER_ERROR, "Failed to copy message key.");
+				}
 				header_and_message_keystore_remove(skipped_keys, node);
-
-				status = header_extract(
-						their_signed_public_ephemeral,
-						receive_message_number,
-						previous_receive_message_number,
-						header);
-				throw_on_error(GENERIC_ERROR, "Failed to extract data from header.");
+				stats_skipped_keys_changed(-1);
 
 				goto cleanup;
 			}
@@ -464,7 +856,7 @@ cleanup:
 			buffer_destroy_from_heap_and_null_if_valid(*message);
 		}
 	}
-	buffer_destroy_from_heap_and_null_if_valid(their_signed_public_ephemeral);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(their_signed_public_ephemeral, zeroed_free);
 
 	return_status_destroy_errors(&status);
 
@@ -485,6 +877,43 @@ return_status conversation_receive(
 	buffer_t ** const message) { //output, free after use!
 	return_status status = return_status_init();
 
+	packet_view packet_struct;
+
+	if (packet == NULL) {
+		throw(INVALID_INPUT, "Invalid input to conversation_receive.");
+	}
+
+	status = packet_unpack(&packet_struct, packet);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+
+	status = conversation_receive_from_view(
+			conversation,
+			&packet_struct,
+			receive_message_number,
+			previous_receive_message_number,
+			message);
+	throw_on_error(RECEIVE_ERROR, "Failed to receive message.");
+
+cleanup:
+	return status;
+}
+
+/*
+ * Receive and decrypt an unpacked packet, the packet is only parsed once
+ * and every header key trial and the message decryption work on the view.
+ *
+ * If 'used_message_key' isn't NULL, the message key is copied to it.
+ */
+static return_status receive_packet(
+	conversation_t * const conversation,
+	const packet_view * const packet, //received packet
+	uint32_t * const receive_message_number,
+	uint32_t * const previous_receive_message_number,
+	buffer_t ** const message, //output, free after use!
+	buffer_t * const used_message_key) {
+	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+
 	//create buffers
 	buffer_t *current_receive_header_key = NULL;
 	buffer_t *next_receive_header_key = NULL;
@@ -492,33 +921,40 @@ return_status conversation_receive(
 	buffer_t *message_key = NULL;
 	buffer_t *their_signed_public_ephemeral = NULL;
 
-	current_receive_header_key = buffer_create_on_heap(HEADER_KEY_SIZE, HEADER_KEY_SIZE);
-	throw_on_failed_alloc(current_receive_header_key);
-	next_receive_header_key = buffer_create_on_heap(HEADER_KEY_SIZE, HEADER_KEY_SIZE);
-	throw_on_failed_alloc(next_receive_header_key);
-	their_signed_public_ephemeral = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
-	throw_on_failed_alloc(their_signed_public_ephemeral);
-	message_key = buffer_create_on_heap(MESSAGE_KEY_SIZE, MESSAGE_KEY_SIZE);
-	throw_on_failed_alloc(message_key);
+	size_t trials = 0;
 
 	if ((conversation == NULL)
 			|| (packet == NULL)
 			|| (message == NULL)
 			|| (receive_message_number == NULL)
 			|| (previous_receive_message_number == NULL)) {
-		throw(INVALID_INPUT, "Invalid input to conversation_receive.");
+		throw(INVALID_INPUT, "Invalid input to conversation_receive_from_view.");
 	}
 
-	*message = buffer_create_on_heap(packet->content_length, 0);
-	throw_on_failed_alloc(*message);
+	*message = NULL;
+
+	//reject garbage and replays before allocating or decrypting anything
+	status = receive_guard_check(conversation->guard, packet);
+	throw_on_error(DECRYPT_ERROR, "Packet rejected before decryption.");
+
+	current_receive_header_key = buffer_create_with_custom_allocator(HEADER_KEY_SIZE, HEADER_KEY_SIZE, zeroed_malloc, zeroed_free);
+	throw_on_failed_alloc(current_receive_header_key);
+	next_receive_header_key = buffer_create_with_custom_allocator(HEADER_KEY_SIZE, HEADER_KEY_SIZE, zeroed_malloc, zeroed_free);
+	throw_on_failed_alloc(next_receive_header_key);
+	their_signed_public_ephemeral = buffer_create_with_custom_allocator(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE, zeroed_malloc, zeroed_free);
+	throw_on_failed_alloc(their_signed_public_ephemeral);
+	message_key = buffer_create_with_custom_allocator(MESSAGE_KEY_SIZE, MESSAGE_KEY_SIZE, zeroed_malloc, zeroed_free);
+	throw_on_failed_alloc(message_key);
 
 	int status_int = 0;
 	status_int = try_skipped_header_and_message_keys(
 			conversation->ratchet->skipped_header_and_message_keys,
 			packet,
 			message,
+			used_message_key,
 			receive_message_number,
-			previous_receive_message_number);
+			previous_receive_message_number,
+			&trials);
 	if (status_int == 0) {
 		// found a key and successfully decrypted the message
 		goto cleanup;
@@ -531,10 +967,12 @@ return_status conversation_receive(
 	throw_on_error(DATA_FETCH_ERROR, "Failed to get receive header keys.");
 
 	//try to decrypt the packet header with the current receive header key
-	status = packet_decrypt_header(
+	status = packet_decrypt_header_from_view(
 			&header,
 			packet,
 			current_receive_header_key);
+	trials++;
+	stats_header_trial(status.status == SUCCESS);
 	if (status.status == SUCCESS) {
 		status = ratchet_set_header_decryptability(
 				conversation->ratchet,
@@ -544,10 +982,12 @@ return_status conversation_receive(
 		return_status_destroy_errors(&status); //free the error stack to avoid memory leak.
 
 		//since this failed, try to decrypt it with the next receive header key
-		status = packet_decrypt_header(
+		status = packet_decrypt_header_from_view(
 				&header,
 				packet,
 				next_receive_header_key);
+		trials++;
+		stats_header_trial(status.status == SUCCESS);
 		if (status.status == SUCCESS) {
 			status = ratchet_set_header_decryptability(
 					conversation->ratchet,
@@ -566,13 +1006,22 @@ return_status conversation_receive(
 	//extract data from the header
 	uint32_t local_receive_message_number;
 	uint32_t local_previous_receive_message_number;
+	uint32_t header_protocol_version;
+	uint32_t header_highest_supported_protocol_version;
 	status = header_extract(
 			their_signed_public_ephemeral,
 			&local_receive_message_number,
 			&local_previous_receive_message_number,
+			&header_protocol_version,
+			&header_highest_supported_protocol_version,
 			header);
 	throw_on_error(GENERIC_ERROR, "Failed to extract data from header.");
 
+	//the version in the packet header isn't authenticated in protobuf packets
+	if (header_protocol_version != packet->packet_header.current_protocol_version) {
+		throw(DECRYPT_ERROR, "Protocol version of the packet doesn't match the one in the header.");
+	}
+
 	//and now decrypt the message with the message key
 	//now we have all the data we need to advance the ratchet
 	//so let's do that
@@ -584,7 +1033,7 @@ return_status conversation_receive(
 			local_previous_receive_message_number);
 	throw_on_error(DECRYPT_ERROR, "Failed to get decryption keys.");
 
-	status = packet_decrypt_message(
+	status = packet_decrypt_message_from_view(
 			message,
 			packet,
 			message_key);
@@ -598,6 +1047,15 @@ return_status conversation_receive(
 	status = ratchet_set_last_message_authenticity(conversation->ratchet, true);
 	throw_on_error(DATA_SET_ERROR, "Failed to set message authenticity.");
 
+	if ((used_message_key != NULL) && (buffer_clone(used_message_key, message_key) != 0)) {
+		throw(BUFFER_ERROR, "Failed to copy message key.");
+	}
+
+	//only trust the authenticated version and never downgrade
+	if (header_highest_supported_protocol_version > conversation->their_highest_supported_protocol_version) {
+		conversation->their_highest_supported_protocol_version = header_highest_supported_protocol_version;
+	}
+
 	*receive_message_number = local_receive_message_number;
 	*previous_receive_message_number = local_previous_receive_message_number;
 
@@ -611,13 +1069,81 @@ cleanup:
 		if (message != NULL) {
 			buffer_destroy_from_heap_and_null_if_valid(*message);
 		}
+	} else {
+		receive_guard_remember(conversation->guard, packet);
+
+		//the packet is received anyway, the conversation just can't be routed until the next one
+		return_status routes_status = conversation_update_routes(conversation);
+		return_status_destroy_errors(&routes_status);
+	}
+	if (conversation != NULL) {
+		receive_guard_charge(conversation->guard, trials);
 	}
 
-	buffer_destroy_from_heap_and_null_if_valid(current_receive_header_key);
-	buffer_destroy_from_heap_and_null_if_valid(next_receive_header_key);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(current_receive_header_key, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(next_receive_header_key, zeroed_free);
 	buffer_destroy_from_heap_and_null_if_valid(header);
-	buffer_destroy_from_heap_and_null_if_valid(their_signed_public_ephemeral);
-	buffer_destroy_from_heap_and_null_if_valid(message_key);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(their_signed_public_ephemeral, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(message_key, zeroed_free);
+
+	trace_end("conversation_receive", trace_start);
+
+	return status;
+}
+
+return_status conversation_receive_from_view(
+	conversation_t * const conversation,
+	const packet_view * const packet, //received packet
+	uint32_t * const receive_message_number,
+	uint32_t * const previous_receive_message_number,
+	buffer_t ** const message) { //output, free after use!
+	return receive_packet(
+			conversation,
+			packet,
+			receive_message_number,
+			previous_receive_message_number,
+			message,
+			NULL);
+}
+
+return_status conversation_receive_attachment(
+	conversation_t * const conversation,
+	attachment_stream ** const attachment, //output
+	const buffer_t * const packet, //received packet
+	uint32_t * const receive_message_number,
+	uint32_t * const previous_receive_message_number) {
+	return_status status = return_status_init();
+
+	packet_view packet_struct;
+	buffer_t *attachment_header = NULL;
+	buffer_t *message_key = NULL;
+
+	if ((attachment == NULL) || (packet == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to conversation_receive_attachment.");
+	}
+	*attachment = NULL;
+
+	message_key = buffer_create_with_custom_allocator(MESSAGE_KEY_SIZE, 0, key_malloc, key_free);
+	throw_on_failed_alloc(message_key);
+
+	status = packet_unpack(&packet_struct, packet);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+
+	status = receive_packet(
+			conversation,
+			&packet_struct,
+			receive_message_number,
+			previous_receive_message_number,
+			&attachment_header,
+			message_key);
+	throw_on_error(RECEIVE_ERROR, "Failed to receive attachment header.");
+
+	status = attachment_start_receive(attachment, attachment_header, message_key);
+	throw_on_error(CREATION_ERROR, "Failed to start attachment.");
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(attachment_header);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(message_key, key_free);
 
 	return status;
 }
@@ -646,6 +1172,20 @@ return_status conversation_export(
 	}
 	(*exported_conversation)->id.data = id;
 	(*exported_conversation)->id.len = CONVERSATION_ID_SIZE;
+
+	//export the padding
+	(*exported_conversation)->has_padding_policy = true;
+	(*exported_conversation)->padding_policy = (Conversation__PaddingPolicy)conversation->padding;
+
+	//export the budget of trial decryptions
+	if (conversation->guard->trial_limit != 0) {
+		(*exported_conversation)->has_trial_budget = true;
+		(*exported_conversation)->trial_budget = conversation->guard->trial_limit;
+		(*exported_conversation)->has_trial_budget_window = true;
+		(*exported_conversation)->trial_budget_window = conversation->guard->window;
+	}
+	(*exported_conversation)->has_their_highest_supported_protocol_version = true;
+	(*exported_conversation)->their_highest_supported_protocol_version = conversation->their_highest_supported_protocol_version;
 cleanup:
 	on_error {
 		zeroed_free_and_null_if_valid(id);
@@ -668,8 +1208,9 @@ return_status conversation_import(
 	}
 
 	//create the conversation
-	*conversation = malloc(sizeof(conversation_t));
+	*conversation = public_malloc(sizeof(conversation_t));
 	throw_on_failed_alloc(*conversation);
+	stats_allocation(MOLCH_STATS_CONVERSATIONS, sizeof(conversation_t));
 	init_struct(*conversation);
 
 	//copy the id
@@ -680,6 +1221,20 @@ return_status conversation_import(
 	//import the ratchet
 	status = ratchet_import(&((*conversation)->ratchet), conversation_protobuf);
 	throw_on_error(IMPORT_ERROR, "Failed to import ratchet.");
+
+	//import the padding, conversations from older versions don't have it
+	if (conversation_protobuf->has_padding_policy) {
+		if (conversation_protobuf->padding_policy > CONVERSATION__PADDING_POLICY__BUCKETS) {
+			throw(IMPORT_ERROR, "Invalid padding policy.");
+		}
+		(*conversation)->padding = (molch_padding)conversation_protobuf->padding_policy;
+	}
+	if (conversation_protobuf->has_their_highest_supported_protocol_version) {
+		(*conversation)->their_highest_supported_protocol_version = conversation_protobuf->their_highest_supported_protocol_version;
+	}
+	if (conversation_protobuf->has_trial_budget && conversation_protobuf->has_trial_budget_window) {
+		receive_guard_set_budget((*conversation)->guard, conversation_protobuf->trial_budget, conversation_protobuf->trial_budget_window);
+	}
 cleanup:
 	on_error {
 		if (conversation != NULL) {
@@ -23,6 +23,11 @@
 #include "ratchet.h"
 #include "prekey-store.h"
 #include "common.h"
+#include "wire.h"
+#include "attachment.h"
+#include "receive-guard.h"
+#include "routing.h"
+#include "molch.h"
 
 #ifndef LIB_CONVERSATION_H
 #define LIB_CONVERSATION_H
@@ -34,6 +39,12 @@ struct conversation_t {
 	buffer_t id[1]; //unique id of a conversation, generated randomly
 	unsigned char id_storage[CONVERSATION_ID_SIZE];
 	ratchet_state *ratchet;
+	molch_padding padding; //padding policy for sent messages
+	uint32_t their_highest_supported_protocol_version; //from the last received packet
+	receive_guard guard[1]; //rejects packets before trial decryption
+	routing_table *routes; //of the conversation store the conversation is in, NULL if it isn't in one
+	unsigned char routing_tags[ROUTING_TAGS * ROUTING_TAG_SIZE]; //the tags that are in 'routes'
+	size_t routing_tag_count;
 };
 
 /*
@@ -72,6 +83,33 @@ return_status conversation_start_receive_conversation(
 		prekey_store * const receiver_prekeys //prekeys of the receiver
 		) __attribute__((warn_unused_result));
 
+/*
+ * Start new conversations from a batch of prekey messages for the same
+ * receiver. Works like conversation_start_receive_conversation for every
+ * packet, but the prekeys are taken out of the store first and every
+ * used prekey is deprecated only once for the whole batch. The key
+ * agreements and first messages are then handled by up to 'thread_count'
+ * threads (including the calling one).
+ *
+ * 'statuses' contains the outcome of every packet, the conversation and
+ * message of a failed packet are NULL. The returned status is an error
+ * only if the batch as a whole failed, no conversations are created then.
+ *
+ * Don't forget to destroy the return status with return_status_destroy_errors()
+ * if an error has occurred.
+ */
+return_status conversation_start_receive_conversations(
+		conversation_t ** const conversations, //output, 'count' long
+		buffer_t ** const messages, //output, 'count' long, free after use!
+		return_status * const statuses, //output, 'count' long
+		const buffer_t * const * const packets, //'count' long
+		const size_t count,
+		const buffer_t * const receiver_public_identity,
+		const buffer_t * const receiver_private_identity,
+		prekey_store * const receiver_prekeys, //prekeys of the receiver
+		const size_t thread_count
+		) __attribute__((warn_unused_result));
+
 /*
  * Send a message using an existing conversation.
  *
@@ -87,6 +125,51 @@ return_status conversation_send(
 		const buffer_t * const public_prekey //can be NULL, if not NULL, this will be a prekey message
 		) __attribute__((warn_unused_result));
 
+/*
+ * Start sending an attachment. This uses up one message key of the
+ * ratchet, the packet has to be sent to the receiver before the chunks.
+ *
+ * Don't forget to destroy the return status with return_status_destroy_errors()
+ * if an error has occurred.
+ */
+return_status conversation_send_attachment(
+		conversation_t * const conversation,
+		attachment_stream ** const attachment, //output, destroy with attachment_destroy
+		buffer_t ** const packet //output, free after use!
+		) __attribute__((warn_unused_result));
+
+/*
+ * Padding that is used for the next message, falls back to
+ * MOLCH_PADDING_BLOCKS if the other side doesn't support the
+ * padding policy of the conversation.
+ */
+molch_padding conversation_get_send_padding(const conversation_t * const conversation);
+
+/*
+ * Protocol version that is used for the next message, the highest one
+ * both sides support (PROTOCOL_VERSION_PKCS7_PADDING for MOLCH_PADDING_BLOCKS
+ * if the other side doesn't support compact packets).
+ */
+uint32_t conversation_get_send_protocol_version(const conversation_t * const conversation);
+
+/*
+ * Replace the routing tags of the conversation in its routing table with
+ * the ones of the messages that are expected next: ROUTING_WINDOW message
+ * numbers before and after the next expected one in the current receive
+ * chain and the first ROUTING_WINDOW ones of the next chain. Chains
+ * without a header key (e.g. before the first receive) have no tags.
+ *
+ * This is called whenever a packet was received. If it fails, the
+ * conversation has no tags until the next packet is received, it can
+ * still be found by its id.
+ */
+return_status conversation_update_routes(conversation_t * const conversation) __attribute__((warn_unused_result));
+
+/*
+ * Remove the routing tags of the conversation from its routing table.
+ */
+void conversation_remove_routes(conversation_t * const conversation);
+
 /*
  * Receive and decrypt a message using an existing conversation.
  *
@@ -101,6 +184,31 @@ return_status conversation_receive(
 	buffer_t ** const message //output, free after use!
 		) __attribute__((warn_unused_result));
 
+/*
+ * Same as conversation_receive, but with an already unpacked packet.
+ */
+return_status conversation_receive_from_view(
+	conversation_t * const conversation,
+	const packet_view * const packet, //received packet
+	uint32_t * const receive_message_number,
+	uint32_t * const previous_receive_message_number,
+	buffer_t ** const message //output, free after use!
+		) __attribute__((warn_unused_result));
+
+/*
+ * Receive the packet that starts an attachment.
+ *
+ * Don't forget to destroy the return status with return_status_destroy_errors()
+ * if an error has occurred.
+ */
+return_status conversation_receive_attachment(
+	conversation_t * const conversation,
+	attachment_stream ** const attachment, //output, destroy with attachment_destroy
+	const buffer_t * const packet, //received packet
+	uint32_t * const receive_message_number,
+	uint32_t * const previous_receive_message_number
+		) __attribute__((warn_unused_result));
+
 /*! Export a conversation to a Protobuf-C struct.
  * \param conversation The conversation to export
  * \param exported_conversation The exported conversation protobuf-c struct.
@@ -23,6 +23,7 @@
 
 #include "constants.h"
 #include "diffie-hellman.h"
+#include "zeroed_malloc.h"
 
 /*
  * Diffie Hellman key exchange using our private key and the
@@ -55,7 +56,7 @@ return_status diffie_hellman(
 	derived_key->content_length = 0;
 
 	//buffer for diffie hellman shared secret
-	buffer_t *dh_secret = buffer_create_on_heap(crypto_scalarmult_SCALARBYTES, crypto_scalarmult_SCALARBYTES);
+	buffer_t *dh_secret = buffer_create_with_custom_allocator(crypto_scalarmult_SCALARBYTES, crypto_scalarmult_SCALARBYTES, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(dh_secret);
 
 	crypto_generichash_state hash_state[1];
@@ -123,7 +124,7 @@ return_status diffie_hellman(
 	derived_key->content_length = DIFFIE_HELLMAN_SIZE;
 
 cleanup:
-	buffer_destroy_from_heap_and_null_if_valid(dh_secret);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(dh_secret, zeroed_free);
 	sodium_memzero(hash_state, sizeof(crypto_generichash_state));
 
 	return status;
@@ -163,11 +164,11 @@ return_status triple_diffie_hellman(
 	buffer_t *dh1 = NULL;
 	buffer_t *dh2 = NULL;
 	buffer_t *dh3 = NULL;
-	dh1 = buffer_create_on_heap(DIFFIE_HELLMAN_SIZE, DIFFIE_HELLMAN_SIZE);
+	dh1 = buffer_create_with_custom_allocator(DIFFIE_HELLMAN_SIZE, DIFFIE_HELLMAN_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(dh1);
-	dh2 = buffer_create_on_heap(DIFFIE_HELLMAN_SIZE, DIFFIE_HELLMAN_SIZE);
+	dh2 = buffer_create_with_custom_allocator(DIFFIE_HELLMAN_SIZE, DIFFIE_HELLMAN_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(dh2);
-	dh3 = buffer_create_on_heap(DIFFIE_HELLMAN_SIZE, DIFFIE_HELLMAN_SIZE);
+	dh3 = buffer_create_with_custom_allocator(DIFFIE_HELLMAN_SIZE, DIFFIE_HELLMAN_SIZE, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(dh3);
 
 	//check buffer sizes
@@ -274,9 +275,9 @@ return_status triple_diffie_hellman(
 	sodium_memzero(hash_state, sizeof(crypto_generichash_state));
 
 cleanup:
-	buffer_destroy_from_heap_and_null_if_valid(dh1);
-	buffer_destroy_from_heap_and_null_if_valid(dh2);
-	buffer_destroy_from_heap_and_null_if_valid(dh3);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(dh1, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(dh2, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(dh3, zeroed_free);
 
 	return status;
 }
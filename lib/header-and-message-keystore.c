@@ -25,6 +25,7 @@
 #include "constants.h"
 #include "header-and-message-keystore.h"
 #include "zeroed_malloc.h"
+#include "stats.h"
 
 #include <key.pb-c.h>
 #include <key_bundle.pb-c.h>
@@ -42,10 +43,11 @@ void header_and_message_keystore_init(header_and_message_keystore * const keysto
  * create an empty header_and_message_keystore_node and set up all the pointers.
  */
 header_and_message_keystore_node *create_node() {
-	header_and_message_keystore_node *node = sodium_malloc(sizeof(header_and_message_keystore_node));
+	header_and_message_keystore_node *node = key_malloc(sizeof(header_and_message_keystore_node));
 	if (node == NULL) {
 		return NULL;
 	}
+	stats_allocation(MOLCH_STATS_KEYSTORES, sizeof(header_and_message_keystore_node));
 
 	//initialise buffers with storage arrays
 	buffer_init_with_pointer(node->message_key, node->message_key_storage, MESSAGE_KEY_SIZE, 0);
@@ -119,7 +121,7 @@ return_status create_and_populate_node(
 cleanup:
 	on_error {
 		if (new_node != NULL) {
-			sodium_free_and_null_if_valid(*new_node);
+			key_free_and_null_if_valid(*new_node);
 		}
 	}
 
@@ -145,7 +147,7 @@ return_status header_and_message_keystore_add(
 
 cleanup:
 	on_error {
-		sodium_free_and_null_if_valid(new_node);
+		key_free_and_null_if_valid(new_node);
 	}
 	return status;
 }
@@ -168,7 +170,7 @@ void header_and_message_keystore_remove(header_and_message_keystore *keystore, h
 	}
 
 	//free node and overwrite with zero
-	sodium_free_and_null_if_valid(node);
+	key_free_and_null_if_valid(node);
 
 	//update length
 	keystore->length--;
@@ -363,7 +365,7 @@ cleanup:
 		}
 
 		if (current_node != NULL) {
-			sodium_free_and_null_if_valid(current_node);
+			key_free_and_null_if_valid(current_node);
 		}
 	}
 
@@ -19,10 +19,12 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <header.pb-c.h>
+#include <stdint.h>
+#include <stddef.h>
+
 #include "header.h"
 #include "constants.h"
-#include "zeroed_malloc.h"
+#include "wire.h"
 
 return_status header_construct(
 		//output
@@ -30,10 +32,13 @@ return_status header_construct(
 		//inputs
 		const buffer_t * const our_public_ephemeral, //PUBLIC_KEY_SIZE
 		const uint32_t message_number,
-		const uint32_t previous_message_number) {
+		const uint32_t previous_message_number,
+		const uint32_t current_protocol_version,
+		const uint32_t highest_supported_protocol_version) {
 	return_status status = return_status_init();
 
-	Header header_struct = HEADER__INIT;
+	header_view header_struct;
+	wire_header_init(&header_struct);
 
 	//check input
 	if ((header == NULL)
@@ -44,26 +49,26 @@ return_status header_construct(
 	//initialize the output buffer
 	*header = NULL;
 
-	//create buffer for our public ephemeral
-	ProtobufCBinaryData protobuf_our_public_ephemeral;
-	protobuf_our_public_ephemeral.len = our_public_ephemeral->content_length;
-	protobuf_our_public_ephemeral.data = our_public_ephemeral->content;
-
 	//fill the struct
 	header_struct.message_number = message_number;
 	header_struct.has_message_number = true;
 	header_struct.previous_message_number = previous_message_number;
 	header_struct.has_previous_message_number = true;
-	header_struct.public_ephemeral_key = protobuf_our_public_ephemeral;
+	header_struct.current_protocol_version = current_protocol_version;
+	header_struct.has_current_protocol_version = true;
+	header_struct.highest_supported_protocol_version = highest_supported_protocol_version;
+	header_struct.has_highest_supported_protocol_version = true;
+	header_struct.public_ephemeral_key.data = our_public_ephemeral->content;
+	header_struct.public_ephemeral_key.length = our_public_ephemeral->content_length;
 	header_struct.has_public_ephemeral_key = true;
 
 	//allocate the header buffer
-	size_t header_length = header__get_packed_size(&header_struct);
+	size_t header_length = wire_header_get_packed_size(&header_struct);
 	*header = buffer_create_on_heap(header_length, header_length);
 	throw_on_failed_alloc(*header);
 
 	//pack it
-	size_t packed_length = header__pack(&header_struct, (*header)->content);
+	size_t packed_length = wire_header_pack(&header_struct, (*header)->content);
 	if (packed_length != header_length) {
 		throw(PROTOBUF_PACK_ERROR, "Packed header has incorrect length.");
 	}
@@ -83,44 +88,48 @@ return_status header_extract(
 		buffer_t * const their_public_ephemeral, //PUBLIC_KEY_SIZE
 		uint32_t * const message_number,
 		uint32_t * const previous_message_number,
+		uint32_t * const current_protocol_version,
+		uint32_t * const highest_supported_protocol_version,
 		//intput
 		const buffer_t * const header) {
 	return_status status = return_status_init();
 
-	Header *header_struct = NULL;
+	header_view header_struct;
 
 	//check input
 	if ((their_public_ephemeral == NULL) || (their_public_ephemeral->buffer_length < PUBLIC_KEY_SIZE)
 			|| (message_number == NULL) || (previous_message_number == NULL)
+			|| (current_protocol_version == NULL) || (highest_supported_protocol_version == NULL)
 			|| (header == NULL)) {
 		throw(INVALID_INPUT, "Invalid input to header_extract.");
 	}
 
 	//unpack the message
-	header_struct = header__unpack(&protobuf_c_allocators, header->content_length, header->content);
-	if (header_struct == NULL) {
-		throw(PROTOBUF_UNPACK_ERROR, "Failed to unpack header.");
-	}
+	status = wire_header_unpack(&header_struct, header);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack header.");
 
-	if (!header_struct->has_message_number || !header_struct->has_previous_message_number || !header_struct->has_public_ephemeral_key) {
+	if (!header_struct.has_message_number || !header_struct.has_previous_message_number || !header_struct.has_public_ephemeral_key) {
 		throw(PROTOBUF_MISSING_ERROR, "Missing fields in header.");
 	}
 
-	if (header_struct->public_ephemeral_key.len != PUBLIC_KEY_SIZE) {
+	if (header_struct.public_ephemeral_key.length != PUBLIC_KEY_SIZE) {
 		throw(INCORRECT_BUFFER_SIZE, "The public ephemeral key in the header has an incorrect size.");
 	}
 
-	*message_number = header_struct->message_number;
-	*previous_message_number = header_struct->previous_message_number;
-
-	if (buffer_clone_from_raw(their_public_ephemeral, header_struct->public_ephemeral_key.data, header_struct->public_ephemeral_key.len) != 0) {
+	*message_number = header_struct.message_number;
+	*previous_message_number = header_struct.previous_message_number;
+	//only clients that don't know about the protocol versions leave them out
+	*current_protocol_version = header_struct.has_current_protocol_version
+		? header_struct.current_protocol_version
+		: PROTOCOL_VERSION_PKCS7_PADDING;
+	*highest_supported_protocol_version = header_struct.has_highest_supported_protocol_version
+		? header_struct.highest_supported_protocol_version
+		: PROTOCOL_VERSION_PKCS7_PADDING;
+
+	if (buffer_clone_from_raw(their_public_ephemeral, header_struct.public_ephemeral_key.data, header_struct.public_ephemeral_key.length) != 0) {
 		throw(BUFFER_ERROR, "Failed to copy public ephemeral key.")
 	}
 
 cleanup:
-	if (header_struct != NULL) {
-		header__free_unpacked(header_struct, &protobuf_c_allocators);
-	}
-
 	return status;
 }
@@ -44,6 +44,10 @@
  *   The number of the message in the current message chain.
  * \param previous_message_number
  *   The number of messages in the previous message chain.
+ * \param current_protocol_version
+ *   The protocol version of the packet the header is sent in.
+ * \param highest_supported_protocol_version
+ *   The highest protocol version the sender supports.
  *
  * \return
  *   Error status, destroy with return_status_destroy_errors if an error occurs.
@@ -54,7 +58,9 @@ return_status header_construct(
 		//inputs
 		const buffer_t * const our_public_ephemeral, //PUBLIC_KEY_SIZE
 		const uint32_t message_number,
-		const uint32_t previous_message_number) __attribute__((warn_unused_result));
+		const uint32_t previous_message_number,
+		const uint32_t current_protocol_version,
+		const uint32_t highest_supported_protocol_version) __attribute__((warn_unused_result));
 
 /*!
  * Extracts the data from an Axolotl-Header.
@@ -65,6 +71,10 @@ return_status header_construct(
  *   The number of the message in the current message chain.
  * \param previous_message_number
  *   The number of the messages in the previous message chain.
+ * \param current_protocol_version
+ *   The protocol version the sender used for the packet, PROTOCOL_VERSION_PKCS7_PADDING if missing.
+ * \param highest_supported_protocol_version
+ *   The highest protocol version the sender supports, PROTOCOL_VERSION_PKCS7_PADDING if missing.
  * \param header
  *   A buffer containing the Axolotl-Header.
  *
@@ -76,6 +86,8 @@ return_status header_extract(
 		buffer_t * const their_public_ephemeral, //PUBLIC_KEY_SIZE
 		uint32_t * const message_number,
 		uint32_t * const previous_message_number,
+		uint32_t * const current_protocol_version,
+		uint32_t * const highest_supported_protocol_version,
 		//intput
 		const buffer_t * const header) __attribute__((warn_unused_result));
 
@@ -26,6 +26,8 @@
 #include "key-derivation.h"
 #include "diffie-hellman.h"
 #include "endianness.h"
+#include "trace.h"
+#include "zeroed_malloc.h"
 
 /*
  * Derive a key of length between crypto_generichash_blake2b_BYTES_MIN (16 Bytes)
@@ -40,9 +42,10 @@ return_status derive_key(
 		const buffer_t * const input_key,
 		uint32_t subkey_counter) { //number of the current subkey, used to derive multiple keys from the same input key
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
 
 	//create a salt that contains the number of the subkey
-	buffer_t *salt = buffer_create_on_heap(crypto_generichash_blake2b_SALTBYTES, crypto_generichash_blake2b_SALTBYTES);
+	buffer_t *salt = buffer_create_with_custom_allocator(crypto_generichash_blake2b_SALTBYTES, crypto_generichash_blake2b_SALTBYTES, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(salt);
 	buffer_clear(salt); //fill with zeroes
 	salt->content_length = crypto_generichash_blake2b_SALTBYTES;
@@ -88,7 +91,9 @@ cleanup:
 			derived_key->content_length = 0;
 		}
 	}
-	buffer_destroy_from_heap_and_null_if_valid(salt);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(salt, zeroed_free);
+
+	trace_end("derive_key", trace_start);
 
 	return status;
 }
@@ -146,13 +151,14 @@ return_status derive_root_next_header_and_chain_keys(
 		const buffer_t * const previous_root_key,
 		bool am_i_alice) {
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
 
 	//create buffers
 	buffer_t *diffie_hellman_secret = NULL;
 	buffer_t *derivation_key = NULL;
-	diffie_hellman_secret = buffer_create_on_heap(DIFFIE_HELLMAN_SIZE, 0);
+	diffie_hellman_secret = buffer_create_with_custom_allocator(DIFFIE_HELLMAN_SIZE, 0, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(diffie_hellman_secret);
-	derivation_key = buffer_create_on_heap(crypto_generichash_BYTES, crypto_generichash_BYTES);
+	derivation_key = buffer_create_with_custom_allocator(crypto_generichash_BYTES, crypto_generichash_BYTES, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(derivation_key);
 
 	//check input
@@ -230,8 +236,10 @@ cleanup:
 		}
 	}
 
-	buffer_destroy_from_heap_and_null_if_valid(diffie_hellman_secret);
-	buffer_destroy_from_heap_and_null_if_valid(derivation_key);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(diffie_hellman_secret, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(derivation_key, zeroed_free);
+
+	trace_end("derive_root_next_header_and_chain_keys", trace_start);
 
 	return status;
 }
@@ -258,7 +266,7 @@ return_status derive_initial_root_chain_and_header_keys(
 		bool am_i_alice) {
 	return_status status = return_status_init();
 
-	buffer_t *master_key = buffer_create_on_heap(crypto_secretbox_KEYBYTES, crypto_secretbox_KEYBYTES);
+	buffer_t *master_key = buffer_create_with_custom_allocator(crypto_secretbox_KEYBYTES, crypto_secretbox_KEYBYTES, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(master_key);
 
 	//check buffer sizes
@@ -406,7 +414,7 @@ cleanup:
 		next_receive_header_key->content_length = 0;
 	}
 
-	buffer_destroy_from_heap_and_null_if_valid(master_key);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(master_key, zeroed_free);
 
 	return status;
 }
@@ -22,11 +22,13 @@
 #include <sodium.h>
 #include "master-keys.h"
 #include "spiced-random.h"
+#include "stats.h"
+#include "random.h"
 
 /*
  * Create a new set of master keys.
  *
- * Seed is optional, can be NULL. It can be of any length and doesn't
+ * Seed is optional, can be NULL or empty. It can be of any length and doesn't
  * require to have high entropy. It will be used as entropy source
  * in addition to the OSs CPRNG.
  *
@@ -35,6 +37,7 @@
 return_status master_keys_create(
 		master_keys ** const keys, //output
 		const buffer_t * const seed,
+		const molch_spice_cost spice_cost, //how expensive it is to derive random data from the seed
 		buffer_t * const public_signing_key, //output, optional, can be NULL
 		buffer_t * const public_identity_key //output, optional, can be NULL
 		) {
@@ -48,8 +51,9 @@ return_status master_keys_create(
 		throw(INVALID_INPUT, "Invalid input for master_keys_create.");
 	}
 
-	*keys = sodium_malloc(sizeof(master_keys));
+	*keys = key_malloc(sizeof(master_keys));
 	throw_on_failed_alloc(*keys);
+	stats_allocation(MOLCH_STATS_MASTER_KEYS, sizeof(master_keys));
 
 	//initialize the buffers
 	buffer_init_with_pointer((*keys)->public_signing_key, (*keys)->public_signing_key_storage, PUBLIC_MASTER_KEY_SIZE, PUBLIC_MASTER_KEY_SIZE);
@@ -57,16 +61,16 @@ return_status master_keys_create(
 	buffer_init_with_pointer((*keys)->public_identity_key, (*keys)->public_identity_key_storage, PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
 	buffer_init_with_pointer((*keys)->private_identity_key, (*keys)->private_identity_key_storage, PRIVATE_KEY_SIZE, PRIVATE_KEY_SIZE);
 
-	if (seed != NULL) { //use external seed
+	if ((seed != NULL) && (seed->content_length > 0)) { //use external seed
 		//create the seed buffer
 		crypto_seeds = buffer_create_with_custom_allocator(
 				crypto_sign_SEEDBYTES + crypto_box_SEEDBYTES,
 				crypto_sign_SEEDBYTES + crypto_box_SEEDBYTES,
-				sodium_malloc,
-				sodium_free);
+				key_malloc,
+				key_free);
 		throw_on_failed_alloc(crypto_seeds);
 
-		status = spiced_random(crypto_seeds, seed, crypto_seeds->buffer_length);
+		status = spiced_random(crypto_seeds, seed, crypto_seeds->buffer_length, spice_cost);
 		throw_on_error(GENERIC_ERROR, "Failed to create spiced random data.");
 
 		//generate the signing keypair
@@ -90,7 +94,7 @@ return_status master_keys_create(
 	} else { //don't use external seed
 		//generate the signing keypair
 		int status_int = 0;
-		status_int = crypto_sign_keypair(
+		status_int = random_sign_keypair(
 				(*keys)->public_signing_key->content,
 				(*keys)->private_signing_key->content);
 		if (status_int != 0) {
@@ -98,7 +102,7 @@ return_status master_keys_create(
 		}
 
 		//generate the identity keypair
-		status_int = crypto_box_keypair(
+		status_int = random_box_keypair(
 				(*keys)->public_identity_key->content,
 				(*keys)->private_identity_key->content);
 		if (status_int != 0) {
@@ -129,18 +133,18 @@ return_status master_keys_create(
 	}
 
 cleanup:
-	buffer_destroy_with_custom_deallocator_and_null_if_valid(crypto_seeds, sodium_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(crypto_seeds, key_free);
 
 	on_error {
 		if (keys != NULL) {
-			sodium_free_and_null_if_valid(*keys);
+			key_free_and_null_if_valid(*keys);
 		}
 
 		return status;
 	}
 
 	if ((keys != NULL) && (*keys != NULL)) {
-		sodium_mprotect_noaccess(*keys);
+		key_protect_noaccess(*keys);
 	}
 	return status;
 }
@@ -158,7 +162,7 @@ return_status master_keys_get_signing_key(
 		throw(INVALID_INPUT, "Invalid input to master_keys_get_signing_key.");
 	}
 
-	sodium_mprotect_readonly(keys);
+	key_protect_readonly(keys);
 
 	if (buffer_clone(public_signing_key, keys->public_signing_key) != 0) {
 		throw(BUFFER_ERROR, "Failed to copy public signing key.");
@@ -166,7 +170,7 @@ return_status master_keys_get_signing_key(
 
 cleanup:
 	if (keys != NULL) {
-		sodium_mprotect_noaccess(keys);
+		key_protect_noaccess(keys);
 	}
 
 	return status;
@@ -185,7 +189,7 @@ return_status master_keys_get_identity_key(
 		throw(INVALID_INPUT, "Invalid input to master_keys_get_identity_key.");
 	}
 
-	sodium_mprotect_readonly(keys);
+	key_protect_readonly(keys);
 
 	if (buffer_clone(public_identity_key, keys->public_identity_key) != 0) {
 		goto cleanup;
@@ -193,7 +197,7 @@ return_status master_keys_get_identity_key(
 
 cleanup:
 	if (keys != NULL) {
-		sodium_mprotect_noaccess(keys);
+		key_protect_noaccess(keys);
 	}
 
 	return status;
@@ -215,7 +219,7 @@ return_status master_keys_sign(
 		throw(INVALID_INPUT, "Invalid input to master_keys_sign.");
 	}
 
-	sodium_mprotect_readonly(keys);
+	key_protect_readonly(keys);
 
 	int status_int = 0;
 	unsigned long long signed_message_length;
@@ -233,7 +237,7 @@ return_status master_keys_sign(
 
 cleanup:
 	if (keys != NULL) {
-		sodium_mprotect_noaccess(keys);
+		key_protect_noaccess(keys);
 	}
 
 	on_error {
@@ -289,7 +293,7 @@ return_status master_keys_export(
 	(*private_identity_key)->key.len = PUBLIC_KEY_SIZE;
 
 	//unlock the master keys
-	sodium_mprotect_readonly(keys);
+	key_protect_readonly(keys);
 
 	//copy the keys
 	if (buffer_clone_to_raw((*public_signing_key)->key.data, (*public_signing_key)->key.len, keys->public_signing_key) != 0) {
@@ -330,7 +334,7 @@ cleanup:
 	}
 
 	if (keys != NULL) {
-		sodium_mprotect_noaccess(keys);
+		key_protect_noaccess(keys);
 	}
 
 	return status;
@@ -351,8 +355,9 @@ return_status master_keys_import(
 		throw(INVALID_INPUT, "Invalid input to master_keys_import.");
 	}
 
-	*keys = sodium_malloc(sizeof(master_keys));
+	*keys = key_malloc(sizeof(master_keys));
 	throw_on_failed_alloc(*keys);
+	stats_allocation(MOLCH_STATS_MASTER_KEYS, sizeof(master_keys));
 
 	//initialize the buffers
 	buffer_init_with_pointer((*keys)->public_signing_key, (*keys)->public_signing_key_storage, PUBLIC_MASTER_KEY_SIZE, 0);
@@ -374,12 +379,12 @@ return_status master_keys_import(
 		throw(BUFFER_ERROR, "Failed to copy private identity key.");
 	}
 
-	sodium_mprotect_noaccess(*keys);
+	key_protect_noaccess(*keys);
 
 cleanup:
 	on_error {
 		if (keys != NULL) {
-			sodium_free_and_null_if_valid(*keys);
+			key_free_and_null_if_valid(*keys);
 		}
 	}
 
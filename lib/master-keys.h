@@ -24,6 +24,7 @@
 #include "constants.h"
 #include "common.h"
 #include "../buffer/buffer.h"
+#include "molch.h"
 
 #ifndef LIB_MASTER_KEYS
 #define LIB_MASTER_KEYS
@@ -44,7 +45,7 @@ typedef struct master_keys {
 /*
  * Create a new set of master keys.
  *
- * Seed is optional, can be NULL. It can be of any length and doesn't
+ * Seed is optional, can be NULL or empty. It can be of any length and doesn't
  * require to have high entropy. It will be used as entropy source
  * in addition to the OSs CPRNG.
  *
@@ -53,6 +54,7 @@ typedef struct master_keys {
 return_status master_keys_create(
 		master_keys ** const keys, //output
 		const buffer_t * const seed,
+		const molch_spice_cost spice_cost, //how expensive it is to derive random data from the seed
 		buffer_t * const public_signing_key, //output, optional, can be NULL
 		buffer_t * const public_identity_key //output, optional, can be NULL
 		) __attribute__((warn_unused_result));
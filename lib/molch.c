@@ -23,10 +23,14 @@
  * WARNING: ALTHOUGH THIS IMPLEMENTS THE AXOLOTL PROTOCOL, IT ISN't CONSIDERED SECURE ENOUGH TO USE AT THIS POINT
  */
 
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
 #include <string.h>
 #include <assert.h>
 #include <alloca.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "constants.h"
 #include "molch.h"
@@ -36,6 +40,9 @@
 #include "endianness.h"
 #include "return-status.h"
 #include "zeroed_malloc.h"
+#include "random.h"
+#include "prekey-list.h"
+#include "parallel.h"
 
 #include <encrypted_backup.pb-c.h>
 #include <backup.pb-c.h>
@@ -45,10 +52,42 @@ static user_store *users = NULL;
 static buffer_t *backup_key = NULL;
 
 /*
- * Create a prekey list.
+ * Protects 'users' and 'backup_key'. Every call that uses them holds it
+ * for reading, it is only held for writing to replace or clear them.
+ * The users themselves are protected by the locks of their shards in the
+ * user store (see user-store.h), so calls for users in different shards
+ * don't have to wait for each other.
+ *
+ * Backups of the entire state are created after all locks of a call have
+ * been released, because molch_export locks all shards.
+ */
+static pthread_rwlock_t state_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void lock_state(const bool write) {
+	if (write) {
+		pthread_rwlock_wrlock(&state_lock);
+	} else {
+		pthread_rwlock_rdlock(&state_lock);
+	}
+}
+
+static void unlock_state() {
+	pthread_rwlock_unlock(&state_lock);
+}
+
+static return_status update_backup_key(unsigned char * const new_key, const size_t new_key_length) __attribute__((warn_unused_result));
+static return_status export_conversation(unsigned char ** const backup, size_t * const backup_length, const conversation_t * const conversation) __attribute__((warn_unused_result));
+static return_status lock_and_find_user(
+		user_store_node ** const user,
+		user_store_shard ** const shard,
+		const unsigned char * const public_master_key,
+		const size_t public_master_key_length) __attribute__((warn_unused_result));
+
+/*
+ * Create a prekey list. The shard of the user has to be locked.
  */
-return_status create_prekey_list(
-		const buffer_t * const public_signing_key,
+static return_status create_prekey_list(
+		user_store_node * const user,
 		unsigned char ** const prekey_list, //output, needs to be freed
 		size_t * const prekey_list_length) {
 
@@ -72,12 +111,6 @@ return_status create_prekey_list(
 	//buffer for the prekey part of unsigned_prekey_list
 	buffer_create_with_existing_array(prekeys, unsigned_prekey_list->content + PUBLIC_KEY_SIZE, PREKEY_AMOUNT * PUBLIC_KEY_SIZE);
 
-
-	//get the user
-	user_store_node *user = NULL;
-	status = user_store_find_node(&user, users, public_signing_key);
-	throw_on_error(NOT_FOUND, "Failed to find user.");
-
 	//rotate the prekeys
 	status = prekey_store_rotate(user->prekeys);
 	throw_on_error(GENERIC_ERROR, "Failed to rotate prekeys.");
@@ -117,7 +150,7 @@ return_status create_prekey_list(
 cleanup:
 	on_error {
 		if (prekey_list_buffer != NULL) {
-			free(prekey_list_buffer->content);
+			public_free(prekey_list_buffer->content);
 		}
 	}
 
@@ -162,7 +195,10 @@ return_status molch_create_user(
 		const unsigned char *const random_data,
 		const size_t random_data_length) {
 	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
 	bool user_store_created = false;
+	bool state_locked = false;
+	user_store_shard *shard = NULL;
 
 	if ((public_master_key == NULL)
 		|| (prekey_list == NULL) || (prekey_list_length == NULL)) {
@@ -181,6 +217,9 @@ return_status molch_create_user(
 	buffer_create_with_existing_array(random_data_buffer, (unsigned char*)random_data, random_data_length);
 	buffer_create_with_existing_array(public_master_key_buffer, public_master_key, PUBLIC_MASTER_KEY_SIZE);
 
+	lock_state(true);
+	state_locked = true;
+
 	//create user store if it doesn't exist already
 	if (users == NULL) {
 		if (sodium_init() == -1) {
@@ -191,9 +230,16 @@ return_status molch_create_user(
 	}
 
 	//create a new backup key
-	status = molch_update_backup_key(backup_key, backup_key_length);
+	status = update_backup_key(backup_key, backup_key_length);
 	throw_on_error(KEYGENERATION_FAILED, "Failed to update backup key.");
 
+	//the user is created with only the read lock, so other users can be created at the same time
+	unlock_state();
+	lock_state(false);
+	if (users == NULL) {
+		throw(INVALID_STATE, "All users have been destroyed in the meantime.");
+	}
+
 	//create the user
 	status = user_store_create_user(
 			users,
@@ -204,12 +250,22 @@ return_status molch_create_user(
 
 	user_store_created = true;
 
+	shard = user_store_lock_shard(users, public_master_key_buffer);
+	user_store_node *user = NULL;
+	status = user_store_find_node(&user, users, public_master_key_buffer);
+	throw_on_error(NOT_FOUND, "Failed to find the new user.");
+
 	status = create_prekey_list(
-			public_master_key_buffer,
+			user,
 			prekey_list,
 			prekey_list_length);
 	throw_on_error(CREATION_ERROR, "Failed to create prekey list.");
 
+	user_store_unlock_shard(shard);
+	shard = NULL;
+	unlock_state();
+	state_locked = false;
+
 	if (backup != NULL) {
 		if (backup_length == 0) {
 			*backup = NULL;
@@ -220,6 +276,13 @@ return_status molch_create_user(
 	}
 
 cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
 	on_error {
 		if (user_store_created) {
 			return_status new_status = molch_destroy_user(public_master_key, public_master_key_length, NULL, NULL);
@@ -227,6 +290,161 @@ cleanup:
 		}
 	}
 
+	stats_call_end(MOLCH_STATS_CREATE_USER, stats_start, status);
+
+	return status;
+}
+
+/*
+ * Everything the threads of molch_create_users need.
+ */
+typedef struct create_batch {
+	molch_created_user *users;
+	user_store_node **nodes;
+	const unsigned char * const *random_data;
+	const size_t *random_data_lengths;
+	molch_spice_cost spice_cost;
+} create_batch;
+
+static void create_batch_user(const size_t index, void * const argument) {
+	create_batch * const batch = (create_batch*)argument;
+	molch_created_user * const user = &batch->users[index];
+
+	const unsigned char *random_data = NULL;
+	size_t random_data_length = 0;
+	if (batch->random_data != NULL) {
+		random_data = batch->random_data[index];
+		random_data_length = (random_data == NULL) ? 0 : batch->random_data_lengths[index];
+	}
+	buffer_create_with_existing_array(random_data_buffer, (unsigned char*)random_data, random_data_length);
+
+	user->status = user_store_create_node(
+			&batch->nodes[index],
+			random_data_buffer,
+			batch->spice_cost,
+			NULL);
+	if (user->status.status != SUCCESS) {
+		return;
+	}
+
+	//the node isn't in the user store yet, so no shard needs to be locked
+	user->status = create_prekey_list(
+			batch->nodes[index],
+			&user->prekey_list,
+			&user->prekey_list_length);
+}
+
+return_status molch_create_users(
+		//outputs
+		molch_created_user * const created_users, //'count' long
+		const size_t count,
+		unsigned char * const backup_key, //BACKUP_KEY_SIZE
+		const size_t backup_key_length,
+		//optional input (can be NULL)
+		const unsigned char * const * const random_data, //'count' long, entries can be NULL too
+		const size_t * const random_data_lengths,
+		//inputs
+		const molch_spice_cost spice_cost,
+		const size_t thread_count, //0 for one per processor
+		//optional output (can be NULL)
+		unsigned char ** const backup, //exports the entire library state, free after use, check if NULL before use!
+		size_t * const backup_length
+		) {
+	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+	bool state_locked = false;
+	user_store_node **nodes = NULL;
+
+	if ((created_users == NULL) || (count == 0)
+			|| (count > (SIZE_MAX / sizeof(user_store_node*)))
+			|| ((random_data != NULL) && (random_data_lengths == NULL))) {
+		throw(INVALID_INPUT, "Invalid input to molch_create_users.");
+	}
+
+	if (backup_key_length != BACKUP_KEY_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Backup key has incorrect length.");
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		created_users[i].status = return_status_init();
+		created_users[i].prekey_list = NULL;
+		created_users[i].prekey_list_length = 0;
+	}
+
+	nodes = public_calloc(count, sizeof(user_store_node*));
+	throw_on_failed_alloc(nodes);
+
+	lock_state(true);
+	state_locked = true;
+
+	//create user store if it doesn't exist already
+	if (users == NULL) {
+		if (sodium_init() == -1) {
+			throw(INIT_ERROR, "Failed to init libsodium.");
+		}
+		status = user_store_create(&users);
+		throw_on_error(CREATION_ERROR, "Failed to create user store.")
+	}
+
+	//create one new backup key for all of the users
+	status = update_backup_key(backup_key, backup_key_length);
+	throw_on_error(KEYGENERATION_FAILED, "Failed to update backup key.");
+
+	unlock_state();
+	lock_state(false);
+	if (users == NULL) {
+		throw(INVALID_STATE, "All users have been destroyed in the meantime.");
+	}
+
+	//generate the keys without holding any shard locks
+	create_batch batch = {
+		created_users,
+		nodes,
+		random_data,
+		random_data_lengths,
+		spice_cost
+	};
+	parallel_for(count, (thread_count == 0) ? parallel_default_thread_count() : thread_count, create_batch_user, &batch);
+
+	for (size_t i = 0; i < count; i++) {
+		if (created_users[i].status.status != SUCCESS) {
+			free_and_null_if_valid(created_users[i].prekey_list);
+			created_users[i].prekey_list_length = 0;
+			continue;
+		}
+
+		memcpy(created_users[i].public_master_key, nodes[i]->public_signing_key->content, PUBLIC_MASTER_KEY_SIZE);
+		user_store_add_node(users, nodes[i]);
+		nodes[i] = NULL;
+	}
+
+	unlock_state();
+	state_locked = false;
+
+	if (backup != NULL) {
+		if (backup_length == 0) {
+			*backup = NULL;
+		} else {
+			status = molch_export(backup, backup_length);
+			throw_on_error(EXPORT_ERROR, "Failed to export.");
+		}
+	}
+
+cleanup:
+	if (state_locked) {
+		unlock_state();
+	}
+
+	//users that couldn't be created
+	if (nodes != NULL) {
+		for (size_t i = 0; i < count; i++) {
+			user_store_destroy_node(nodes[i]);
+		}
+	}
+	free_and_null_if_valid(nodes);
+
+	stats_call_end(MOLCH_STATS_CREATE_USERS, stats_start, status);
+
 	return status;
 }
 
@@ -244,21 +462,29 @@ return_status molch_destroy_user(
 		size_t *const backup_length
 ) {
 	return_status status = return_status_init();
-
-	if (users == NULL) {
-		throw(INVALID_INPUT, "\"users\" is NULL.")
-	}
+	const uint64_t stats_start = stats_call_begin();
+	bool state_locked = false;
 
 	if (public_master_key_length != PUBLIC_MASTER_KEY_SIZE) {
 		throw(INCORRECT_BUFFER_SIZE, "Public master key has incorrect size.");
 	}
 
+	lock_state(false);
+	state_locked = true;
+
+	if (users == NULL) {
+		throw(INVALID_INPUT, "\"users\" is NULL.")
+	}
+
 	//TODO maybe check beforehand if the user exists and return nonzero if not
 
 	buffer_create_with_existing_array(public_signing_key_buffer, (unsigned char*)public_master_key, PUBLIC_KEY_SIZE);
 	status = user_store_remove_by_key(users, public_signing_key_buffer);
 	throw_on_error(REMOVE_ERROR, "Failed to remoe user from user store by key.");
 
+	unlock_state();
+	state_locked = false;
+
 	if (backup != NULL) {
 		if (backup_length == 0) {
 			*backup = NULL;
@@ -269,6 +495,12 @@ return_status molch_destroy_user(
 	}
 
 cleanup:
+	if (state_locked) {
+		unlock_state();
+	}
+
+	stats_call_end(MOLCH_STATS_DESTROY_USER, stats_start, status);
+
 	return status;
 }
 
@@ -276,22 +508,24 @@ cleanup:
  * Get the number of users.
  */
 size_t molch_user_count() {
-	if (users == NULL) {
-		return 0;
-	}
+	lock_state(false);
+	const size_t count = (users == NULL) ? 0 : __atomic_load_n(&users->length, __ATOMIC_RELAXED);
+	unlock_state();
 
-	return users->length;
+	return count;
 }
 
 /*
  * Delete all users.
  */
 void molch_destroy_all_users() {
+	lock_state(true);
 	if (users != NULL) {
 		user_store_destroy(users);
 	}
 
 	users = NULL;
+	unlock_state();
 }
 
 /*
@@ -308,6 +542,9 @@ return_status molch_list_users(
 		size_t * const user_list_length, //length in bytes
 		size_t * const count) {
 	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	lock_state(false);
 
 	if ((users == NULL) || (user_list_length == NULL)) {
 		throw(INVALID_INPUT, "Invalid input to molch_list_users.");
@@ -318,13 +555,104 @@ return_status molch_list_users(
 	status = user_store_list(&user_list_buffer, users);
 	throw_on_error(CREATION_ERROR, "Failed to create user list.");
 
-	*count = molch_user_count();
+	*count = user_list_buffer->content_length / PUBLIC_MASTER_KEY_SIZE;
 
 	*user_list = user_list_buffer->content;
 	*user_list_length = user_list_buffer->content_length;
 	free_and_null_if_valid(user_list_buffer); //free the buffer_t struct while leaving content intact
 
 cleanup:
+	unlock_state();
+
+	stats_call_end(MOLCH_STATS_LIST_USERS, stats_start, status);
+
+	return status;
+}
+
+return_status molch_list_users_page(
+		unsigned char * const page,
+		const size_t page_length,
+		size_t * const count,
+		molch_list_cursor * const cursor) {
+	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	bool locked = false;
+
+	lock_state(false);
+
+	if ((page == NULL) || (page_length < PUBLIC_MASTER_KEY_SIZE) || (count == NULL) || (cursor == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_list_users_page.");
+	}
+
+	*count = 0;
+	if (users == NULL) {
+		cursor->done = true;
+		goto cleanup;
+	}
+
+	//a consistent page needs all shards
+	user_store_lock_all(users);
+	locked = true;
+
+	if (cursor->position == 0) {
+		cursor->generation = users->generation;
+	} else if (cursor->generation != users->generation) {
+		throw(INVALID_STATE, "The users have changed since the first page.");
+	}
+
+	*count = user_store_list_page(users, cursor->position, page, page_length / PUBLIC_MASTER_KEY_SIZE);
+	cursor->position += *count;
+	cursor->done = (cursor->position >= users->length);
+
+cleanup:
+	if (locked) {
+		user_store_unlock_all(users);
+	}
+	unlock_state();
+
+	stats_call_end(MOLCH_STATS_LIST_USERS, stats_start, status);
+
+	return status;
+}
+
+return_status molch_foreach_user(
+		const molch_list_callback callback,
+		void * const user_data) {
+	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	bool locked = false;
+
+	lock_state(false);
+
+	if (callback == NULL) {
+		throw(INVALID_INPUT, "Invalid input to molch_foreach_user.");
+	}
+
+	if (users == NULL) {
+		goto cleanup;
+	}
+
+	user_store_lock_all(users);
+	locked = true;
+
+	for (size_t shard = 0; shard < USER_STORE_SHARDS; shard++) {
+		for (const user_store_node *node = users->shards[shard].head; node != NULL; node = node->next) {
+			if (!callback(node->public_signing_key->content, PUBLIC_MASTER_KEY_SIZE, user_data)) {
+				goto cleanup;
+			}
+		}
+	}
+
+cleanup:
+	if (locked) {
+		user_store_unlock_all(users);
+	}
+	unlock_state();
+
+	stats_call_end(MOLCH_STATS_LIST_USERS, stats_start, status);
+
 	return status;
 }
 
@@ -360,65 +688,6 @@ molch_message_type molch_get_message_type(
 	return packet_type;
 }
 
-/*
- * Verify prekey list and extract the public identity
- * and choose a prekey.
- */
-return_status verify_prekey_list(
-		const unsigned char * const prekey_list,
-		const size_t prekey_list_length,
-		buffer_t * const public_identity_key, //output, PUBLIC_KEY_SIZE
-		const buffer_t * const public_signing_key
-		) {
-	return_status status = return_status_init();
-
-	buffer_t *verified_prekey_list = buffer_create_on_heap(prekey_list_length - SIGNATURE_SIZE, prekey_list_length - SIGNATURE_SIZE);
-	throw_on_failed_alloc(verified_prekey_list);
-
-	int status_int = 0;
-
-	//verify the signature
-	unsigned long long verified_length;
-	status_int = crypto_sign_open(
-			verified_prekey_list->content,
-			&verified_length,
-			prekey_list,
-			(unsigned long long)prekey_list_length,
-			public_signing_key->content);
-	if (status_int != 0) {
-		throw(VERIFICATION_FAILED, "Failed to verify prekey list signature.");
-	}
-	verified_prekey_list->content_length = verified_length;
-
-	//get the expiration date
-	time_t expiration_date;
-	buffer_create_with_existing_array(big_endian_expiration_date, verified_prekey_list->content + PUBLIC_KEY_SIZE + PREKEY_AMOUNT * PUBLIC_KEY_SIZE, sizeof(int64_t));
-	status = endianness_time_from_big_endian(&expiration_date, big_endian_expiration_date);
-	throw_on_error(CONVERSION_ERROR, "Failed to convert expiration date to big endian.");
-
-	//make sure the prekey list isn't too old
-	time_t current_time = time(NULL);
-	if (expiration_date < current_time) {
-		throw(OUTDATED, "Prekey list has expired (older than 3 months).");
-	}
-
-	//copy the public identity key
-	status_int = buffer_copy(
-			public_identity_key,
-			0,
-			verified_prekey_list,
-			0,
-			PUBLIC_KEY_SIZE);
-	if (status_int != 0) {
-		throw(BUFFER_ERROR, "Failed to copy public identity.");
-	}
-
-cleanup:
-	buffer_destroy_from_heap_and_null_if_valid(verified_prekey_list);
-
-	return status;
-}
-
 /*
  * Start a new conversation. (sending)
  *
@@ -459,8 +728,11 @@ return_status molch_start_send_conversation(
 	conversation_t *conversation = NULL;
 	buffer_t *packet_buffer = NULL;
 	user_store_node *user = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
 
 	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
 
 	//create buffers
 	buffer_t *sender_public_identity = NULL;
@@ -495,10 +767,6 @@ return_status molch_start_send_conversation(
 		throw(INCORRECT_BUFFER_SIZE, "receiver public master key has incorrect size.");
 	}
 
-	//get the user that matches the public signing key of the sender
-	status = user_store_find_node(&user, users, sender_public_master_key_buffer);
-	throw_on_error(NOT_FOUND, "User not found.");
-
 	int status_int = 0;
 
 	//get the receivers public ephemeral and identity
@@ -509,8 +777,19 @@ return_status molch_start_send_conversation(
 			receiver_public_master_key_buffer);
 	throw_on_error(VERIFICATION_FAILED, "Failed to verify prekey list.");
 
+	lock_state(false);
+	state_locked = true;
+	if (users == NULL) {
+		throw(NOT_FOUND, "There are no users.");
+	}
+
+	//get the user that matches the public signing key of the sender
+	shard = user_store_lock_shard(users, sender_public_master_key_buffer);
+	status = user_store_find_node(&user, users, sender_public_master_key_buffer);
+	throw_on_error(NOT_FOUND, "User not found.");
+
 	//unlock the master keys
-	sodium_mprotect_readonly(user->master_keys);
+	key_protect_readonly(user->master_keys);
 
 	//create the conversation and encrypt the message
 	status = conversation_start_send_conversation(
@@ -536,6 +815,13 @@ return_status molch_start_send_conversation(
 	*packet = packet_buffer->content;
 	*packet_length = packet_buffer->content_length;
 
+	key_protect_noaccess(user->master_keys);
+	user = NULL;
+	user_store_unlock_shard(shard);
+	shard = NULL;
+	unlock_state();
+	state_locked = false;
+
 	if (backup != NULL) {
 		if (backup_length == 0) {
 			*backup = NULL;
@@ -555,96 +841,339 @@ cleanup:
 	}
 
 	if (user != NULL) {
-		sodium_mprotect_noaccess(user->master_keys);
+		key_protect_noaccess(user->master_keys);
+	}
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
 	}
 
 	on_error {
 		if (packet_buffer != NULL) {
 			//not using free_and_null_if_valid because content is const
-			free(packet_buffer->content);
+			public_free(packet_buffer->content);
 		}
 	}
 
 	free_and_null_if_valid(packet_buffer);
 
+	stats_call_end(MOLCH_STATS_START_SEND_CONVERSATION, stats_start, status);
+
 	return status;
 }
 
 /*
- * Start a new conversation. (receiving)
- *
- * This also generates a new set of prekeys to be uploaded to the server.
- *
- * This function is called after receiving a prekey message.
- *
- * Don't forget to destroy the return status with return_status_destroy_errors()
- * if an error has occurred.
+ * Everything the threads of molch_start_send_conversations need.
  */
-return_status molch_start_receive_conversation(
+typedef struct send_batch {
+	return_status *statuses;
+	conversation_t **conversations;
+	buffer_t **packets;
+	const buffer_t *message;
+	const buffer_t *sender_public_identity;
+	const buffer_t *sender_private_identity;
+	buffer_t * const *receiver_public_identities;
+	const buffer_t *receiver_prekeys;
+} send_batch;
+
+static void start_batch_conversation(const size_t index, void * const argument) {
+	send_batch * const batch = (send_batch*)argument;
+
+	if (batch->statuses[index].status != SUCCESS) {
+		return;
+	}
+
+	batch->statuses[index] = conversation_start_send_conversation(
+			&batch->conversations[index],
+			batch->message,
+			&batch->packets[index],
+			batch->sender_public_identity,
+			batch->sender_private_identity,
+			batch->receiver_public_identities[index],
+			&batch->receiver_prekeys[index]);
+}
+
+return_status molch_start_send_conversations(
 		//outputs
-		unsigned char * const conversation_id, //CONVERSATION_ID_SIZE long (from conversation.h)
-		const size_t conversation_id_length,
-		unsigned char ** const prekey_list, //free after use
-		size_t * const prekey_list_length,
-		unsigned char ** const message, //free after use
-		size_t * const message_length,
+		molch_sent_conversation * const conversations, //'receiver_count' long
 		//inputs
-		const unsigned char * const receiver_public_master_key, //signing key of the receiver (user)
-		const size_t receiver_public_master_key_length,
-		const unsigned char * const sender_public_master_key, //signing key of the sender
+		const unsigned char * const sender_public_master_key, //signing key of the sender (user)
 		const size_t sender_public_master_key_length,
-		const unsigned char * const packet, //received prekey packet
-		const size_t packet_length,
+		const unsigned char * const * const receiver_public_master_keys, //signing keys of the receivers, PUBLIC_MASTER_KEY_SIZE each
+		const unsigned char * const * const prekey_lists, //prekey lists of the receivers
+		const size_t * const prekey_list_lengths,
+		const size_t receiver_count,
+		const unsigned char * const message,
+		const size_t message_length,
+		const size_t thread_count, //0 for one per processor
 		//optional output (can be NULL)
 		unsigned char ** const backup, //exports the entire library state, free after use, check if NULL before use!
 		size_t * const backup_length
 		) {
-
 	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
 
-	//create buffers to wrap the raw arrays
-	buffer_create_with_existing_array(conversation_id_buffer, (unsigned char*)conversation_id, CONVERSATION_ID_SIZE);
-	buffer_create_with_existing_array(packet_buffer, (unsigned char*)packet, packet_length);
-	buffer_create_with_existing_array(sender_public_master_key_buffer, (unsigned char*) sender_public_master_key, PUBLIC_MASTER_KEY_SIZE);
-	buffer_create_with_existing_array(receiver_public_master_key_buffer, (unsigned char*)receiver_public_master_key, PUBLIC_MASTER_KEY_SIZE);
+	buffer_create_with_existing_array(message_buffer, (unsigned char*)message, message_length);
 
-	conversation_t *conversation = NULL;
-	buffer_t *message_buffer = NULL;
+	buffer_t *receiver_master_keys = NULL;
+	const buffer_t **receiver_master_key_pointers = NULL;
+	buffer_t *receiver_identities = NULL;
+	buffer_t **receiver_identity_pointers = NULL;
+	unsigned char *receiver_identity_storage = NULL;
+	buffer_t *receiver_prekeys = NULL;
+	return_status *statuses = NULL;
+	conversation_t **new_conversations = NULL;
+	buffer_t **packets = NULL;
+	bool batch_started = false;
 	user_store_node *user = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
 
-	if ((conversation_id == NULL)
-		|| (message == NULL) || (message_length == NULL)
-		|| (packet == NULL)
-		|| (prekey_list == NULL) || (prekey_list_length == NULL)
-		|| (sender_public_master_key == NULL)
-		|| (receiver_public_master_key == NULL)) {
-		throw(INVALID_INPUT, "Invalid input to molch_start_receive_conversation.");
-	}
-
-	if (conversation_id_length != CONVERSATION_ID_SIZE) {
-		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect size.");
+	if ((conversations == NULL)
+			|| (sender_public_master_key == NULL)
+			|| (receiver_public_master_keys == NULL)
+			|| (prekey_lists == NULL) || (prekey_list_lengths == NULL)
+			|| (receiver_count == 0)
+			|| (receiver_count > (SIZE_MAX / sizeof(buffer_t))) //biggest element of the temporary arrays
+			|| (message == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_start_send_conversations.");
 	}
 
 	if (sender_public_master_key_length != PUBLIC_MASTER_KEY_SIZE) {
-		throw(INCORRECT_BUFFER_SIZE, "Senders public master key has an incorrect size.");
+		throw(INCORRECT_BUFFER_SIZE, "sender public master key has incorrect size.");
 	}
 
-	if (receiver_public_master_key_length != PUBLIC_MASTER_KEY_SIZE) {
-		throw(INCORRECT_BUFFER_SIZE, "Receivers public master key has an incorrect size.");
+	for (size_t i = 0; i < receiver_count; i++) {
+		if ((receiver_public_master_keys[i] == NULL) || (prekey_lists[i] == NULL)
+				|| (prekey_list_lengths[i] < (SIGNATURE_SIZE + PUBLIC_KEY_SIZE + sizeof(int64_t)))) {
+			throw(INVALID_INPUT, "Invalid receiver in molch_start_send_conversations.");
+		}
 	}
 
-	//get the user that matches the public signing key of the receiver
-	status = user_store_find_node(&user, users, receiver_public_master_key_buffer);
-	throw_on_error(NOT_FOUND, "User not found in the user store.");
+	const size_t threads = (thread_count == 0) ? parallel_default_thread_count() : thread_count;
+
+	receiver_master_keys = public_malloc(receiver_count * sizeof(buffer_t));
+	throw_on_failed_alloc(receiver_master_keys);
+	receiver_master_key_pointers = public_malloc(receiver_count * sizeof(buffer_t*));
+	throw_on_failed_alloc(receiver_master_key_pointers);
+	receiver_identities = public_malloc(receiver_count * sizeof(buffer_t));
+	throw_on_failed_alloc(receiver_identities);
+	receiver_identity_pointers = public_malloc(receiver_count * sizeof(buffer_t*));
+	throw_on_failed_alloc(receiver_identity_pointers);
+	receiver_identity_storage = public_malloc(receiver_count * PUBLIC_KEY_SIZE);
+	throw_on_failed_alloc(receiver_identity_storage);
+	receiver_prekeys = public_malloc(receiver_count * sizeof(buffer_t));
+	throw_on_failed_alloc(receiver_prekeys);
+	statuses = public_malloc(receiver_count * sizeof(return_status));
+	throw_on_failed_alloc(statuses);
+	new_conversations = public_calloc(receiver_count, sizeof(conversation_t*));
+	throw_on_failed_alloc(new_conversations);
+	packets = public_calloc(receiver_count, sizeof(buffer_t*));
+	throw_on_failed_alloc(packets);
+	for (size_t i = 0; i < receiver_count; i++) {
+		buffer_init_with_pointer(&receiver_master_keys[i], (unsigned char*)receiver_public_master_keys[i], PUBLIC_MASTER_KEY_SIZE, PUBLIC_MASTER_KEY_SIZE);
+		receiver_master_key_pointers[i] = &receiver_master_keys[i];
+		buffer_init_with_pointer(&receiver_identities[i], receiver_identity_storage + i * PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+		receiver_identity_pointers[i] = &receiver_identities[i];
+		const size_t prekeys_length = prekey_list_lengths[i] - PUBLIC_KEY_SIZE - SIGNATURE_SIZE - sizeof(int64_t);
+		buffer_init_with_pointer(&receiver_prekeys[i], (unsigned char*)prekey_lists[i] + PUBLIC_KEY_SIZE + SIGNATURE_SIZE, prekeys_length, prekeys_length);
+	}
+
+	//get the receivers public identities, doesn't need any locks
+	verify_prekey_lists(
+			statuses,
+			receiver_identity_pointers,
+			prekey_lists,
+			prekey_list_lengths,
+			receiver_master_key_pointers,
+			receiver_count,
+			threads);
+	batch_started = true;
+
+	lock_state(false);
+	state_locked = true;
+	status = lock_and_find_user(&user, &shard, sender_public_master_key, sender_public_master_key_length);
+	throw_on_error(NOT_FOUND, "User not found.");
 
 	//unlock the master keys
-	sodium_mprotect_readonly(user->master_keys);
+	key_protect_readonly(user->master_keys);
+
+	//create the conversations and encrypt the message
+	send_batch batch = {
+		statuses,
+		new_conversations,
+		packets,
+		message_buffer,
+		user->master_keys->public_identity_key,
+		user->master_keys->private_identity_key,
+		receiver_identity_pointers,
+		receiver_prekeys
+	};
+	parallel_for(receiver_count, threads, start_batch_conversation, &batch);
+
+	for (size_t i = 0; i < receiver_count; i++) {
+		molch_sent_conversation * const result = &conversations[i];
+		result->status = statuses[i];
+		statuses[i] = return_status_init();
+		result->packet = NULL;
+		result->packet_length = 0;
+		if (result->status.status != SUCCESS) {
+			continue;
+		}
 
-	int status_int = 0;
+		memcpy(result->conversation_id, new_conversations[i]->id->content, CONVERSATION_ID_SIZE);
+		result->status = conversation_store_add(user->conversations, new_conversations[i]);
+		if (result->status.status != SUCCESS) {
+			continue;
+		}
+		new_conversations[i] = NULL;
 
-	//create the conversation
-	status = conversation_start_receive_conversation(
-			&conversation,
+		result->packet = packets[i]->content;
+		result->packet_length = packets[i]->content_length;
+		free_and_null_if_valid(packets[i]);
+	}
+
+	key_protect_noaccess(user->master_keys);
+	user = NULL;
+	user_store_unlock_shard(shard);
+	shard = NULL;
+	unlock_state();
+	state_locked = false;
+
+	if (backup != NULL) {
+		if (backup_length == 0) {
+			*backup = NULL;
+		} else {
+			status = molch_export(backup, backup_length);
+			throw_on_error(EXPORT_ERROR, "Failed to export.");
+		}
+	}
+
+cleanup:
+	//everything that wasn't handed over to the caller or the conversation store
+	if (batch_started) {
+		for (size_t i = 0; i < receiver_count; i++) {
+			if (new_conversations[i] != NULL) {
+				conversation_destroy(new_conversations[i]);
+			}
+			if (packets[i] != NULL) {
+				buffer_destroy_from_heap_and_null_if_valid(packets[i]);
+			}
+			return_status_destroy_errors(&statuses[i]);
+		}
+	}
+	free_and_null_if_valid(receiver_master_keys);
+	free_and_null_if_valid(receiver_master_key_pointers);
+	free_and_null_if_valid(receiver_identities);
+	free_and_null_if_valid(receiver_identity_pointers);
+	free_and_null_if_valid(receiver_identity_storage);
+	free_and_null_if_valid(receiver_prekeys);
+	free_and_null_if_valid(statuses);
+	free_and_null_if_valid(new_conversations);
+	free_and_null_if_valid(packets);
+
+	if (user != NULL) {
+		key_protect_noaccess(user->master_keys);
+	}
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	stats_call_end(MOLCH_STATS_START_SEND_CONVERSATIONS, stats_start, status);
+
+	return status;
+}
+
+/*
+ * Start a new conversation. (receiving)
+ *
+ * This also generates a new set of prekeys to be uploaded to the server.
+ *
+ * This function is called after receiving a prekey message.
+ *
+ * Don't forget to destroy the return status with return_status_destroy_errors()
+ * if an error has occurred.
+ */
+return_status molch_start_receive_conversation(
+		//outputs
+		unsigned char * const conversation_id, //CONVERSATION_ID_SIZE long (from conversation.h)
+		const size_t conversation_id_length,
+		unsigned char ** const prekey_list, //free after use
+		size_t * const prekey_list_length,
+		unsigned char ** const message, //free after use
+		size_t * const message_length,
+		//inputs
+		const unsigned char * const receiver_public_master_key, //signing key of the receiver (user)
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const sender_public_master_key, //signing key of the sender
+		const size_t sender_public_master_key_length,
+		const unsigned char * const packet, //received prekey packet
+		const size_t packet_length,
+		//optional output (can be NULL)
+		unsigned char ** const backup, //exports the entire library state, free after use, check if NULL before use!
+		size_t * const backup_length
+		) {
+
+	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	//create buffers to wrap the raw arrays
+	buffer_create_with_existing_array(conversation_id_buffer, (unsigned char*)conversation_id, CONVERSATION_ID_SIZE);
+	buffer_create_with_existing_array(packet_buffer, (unsigned char*)packet, packet_length);
+	buffer_create_with_existing_array(sender_public_master_key_buffer, (unsigned char*) sender_public_master_key, PUBLIC_MASTER_KEY_SIZE);
+	buffer_create_with_existing_array(receiver_public_master_key_buffer, (unsigned char*)receiver_public_master_key, PUBLIC_MASTER_KEY_SIZE);
+
+	conversation_t *conversation = NULL;
+	buffer_t *message_buffer = NULL;
+	user_store_node *user = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	if ((conversation_id == NULL)
+		|| (message == NULL) || (message_length == NULL)
+		|| (packet == NULL)
+		|| (prekey_list == NULL) || (prekey_list_length == NULL)
+		|| (sender_public_master_key == NULL)
+		|| (receiver_public_master_key == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_start_receive_conversation.");
+	}
+
+	if (conversation_id_length != CONVERSATION_ID_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect size.");
+	}
+
+	if (sender_public_master_key_length != PUBLIC_MASTER_KEY_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Senders public master key has an incorrect size.");
+	}
+
+	if (receiver_public_master_key_length != PUBLIC_MASTER_KEY_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Receivers public master key has an incorrect size.");
+	}
+
+	lock_state(false);
+	state_locked = true;
+	if (users == NULL) {
+		throw(NOT_FOUND, "There are no users.");
+	}
+
+	//get the user that matches the public signing key of the receiver
+	shard = user_store_lock_shard(users, receiver_public_master_key_buffer);
+	status = user_store_find_node(&user, users, receiver_public_master_key_buffer);
+	throw_on_error(NOT_FOUND, "User not found in the user store.");
+
+	//unlock the master keys
+	key_protect_readonly(user->master_keys);
+
+	int status_int = 0;
+
+	//create the conversation
+	status = conversation_start_receive_conversation(
+			&conversation,
 			packet_buffer,
 			&message_buffer,
 			user->master_keys->public_identity_key,
@@ -660,7 +1189,7 @@ return_status molch_start_receive_conversation(
 
 	//create the prekey list
 	status = create_prekey_list(
-			receiver_public_master_key_buffer,
+			user,
 			prekey_list,
 			prekey_list_length);
 	throw_on_error(CREATION_ERROR, "Failed to create prekey list.");
@@ -673,6 +1202,13 @@ return_status molch_start_receive_conversation(
 	*message = message_buffer->content;
 	*message_length = message_buffer->content_length;
 
+	key_protect_noaccess(user->master_keys);
+	user = NULL;
+	user_store_unlock_shard(shard);
+	shard = NULL;
+	unlock_state();
+	state_locked = false;
+
 	if (backup != NULL) {
 		if (backup_length == 0) {
 			*backup = NULL;
@@ -685,7 +1221,7 @@ return_status molch_start_receive_conversation(
 cleanup:
 	on_error {
 		if (message_buffer != NULL) {
-			free(message_buffer->content);
+			public_free(message_buffer->content);
 		}
 	}
 
@@ -696,42 +1232,233 @@ cleanup:
 	}
 
 	if (user != NULL) {
-		sodium_mprotect_noaccess(user->master_keys);
+		key_protect_noaccess(user->master_keys);
+	}
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	stats_call_end(MOLCH_STATS_START_RECEIVE_CONVERSATION, stats_start, status);
+
+	return status;
+}
+
+return_status molch_start_receive_conversations(
+		//outputs
+		molch_received_conversation * const conversations, //'packet_count' long
+		unsigned char ** const prekey_list, //free after use
+		size_t * const prekey_list_length,
+		//inputs
+		const unsigned char * const receiver_public_master_key, //signing key of the receiver (user)
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const * const packets, //received prekey packets
+		const size_t * const packet_lengths,
+		const size_t packet_count,
+		const size_t thread_count, //0 for one per processor
+		//optional output (can be NULL)
+		unsigned char ** const backup, //exports the entire library state, free after use, check if NULL before use!
+		size_t * const backup_length
+		) {
+	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	buffer_t *packet_buffers = NULL;
+	const buffer_t **packet_pointers = NULL;
+	conversation_t **new_conversations = NULL;
+	buffer_t **messages = NULL;
+	return_status *statuses = NULL;
+	bool batch_received = false;
+	user_store_node *user = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	if ((conversations == NULL)
+		|| (prekey_list == NULL) || (prekey_list_length == NULL)
+		|| (receiver_public_master_key == NULL)
+		|| (packets == NULL) || (packet_lengths == NULL) || (packet_count == 0)
+		|| (packet_count > (SIZE_MAX / sizeof(buffer_t)))) { //biggest element of the temporary arrays
+		throw(INVALID_INPUT, "Invalid input to molch_start_receive_conversations.");
+	}
+
+	for (size_t i = 0; i < packet_count; i++) {
+		if ((packets[i] == NULL) || (packet_lengths[i] == 0)) {
+			throw(INVALID_INPUT, "Invalid packet in molch_start_receive_conversations.");
+		}
+	}
+
+	if (receiver_public_master_key_length != PUBLIC_MASTER_KEY_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Receivers public master key has an incorrect size.");
+	}
+
+	const size_t threads = (thread_count == 0) ? parallel_default_thread_count() : thread_count;
+
+	packet_buffers = public_malloc(packet_count * sizeof(buffer_t));
+	throw_on_failed_alloc(packet_buffers);
+	packet_pointers = public_malloc(packet_count * sizeof(buffer_t*));
+	throw_on_failed_alloc(packet_pointers);
+	new_conversations = public_malloc(packet_count * sizeof(conversation_t*));
+	throw_on_failed_alloc(new_conversations);
+	messages = public_malloc(packet_count * sizeof(buffer_t*));
+	throw_on_failed_alloc(messages);
+	statuses = public_malloc(packet_count * sizeof(return_status));
+	throw_on_failed_alloc(statuses);
+	for (size_t i = 0; i < packet_count; i++) {
+		buffer_init_with_pointer(&packet_buffers[i], (unsigned char*)packets[i], packet_lengths[i], packet_lengths[i]);
+		packet_pointers[i] = &packet_buffers[i];
+	}
+
+	lock_state(false);
+	state_locked = true;
+	status = lock_and_find_user(&user, &shard, receiver_public_master_key, receiver_public_master_key_length);
+	throw_on_error(NOT_FOUND, "User not found in the user store.");
+
+	//unlock the master keys
+	key_protect_readonly(user->master_keys);
+
+	status = conversation_start_receive_conversations(
+			new_conversations,
+			messages,
+			statuses,
+			packet_pointers,
+			packet_count,
+			user->master_keys->public_identity_key,
+			user->master_keys->private_identity_key,
+			user->prekeys,
+			threads);
+	throw_on_error(CREATION_ERROR, "Failed to start receive conversations.");
+	batch_received = true;
+
+	//create the prekey list once for all of them
+	status = create_prekey_list(
+			user,
+			prekey_list,
+			prekey_list_length);
+	throw_on_error(CREATION_ERROR, "Failed to create prekey list.");
+
+	for (size_t i = 0; i < packet_count; i++) {
+		molch_received_conversation * const result = &conversations[i];
+		result->status = statuses[i];
+		statuses[i] = return_status_init();
+		result->message = NULL;
+		result->message_length = 0;
+		if (result->status.status != SUCCESS) {
+			continue;
+		}
+
+		memcpy(result->conversation_id, new_conversations[i]->id->content, CONVERSATION_ID_SIZE);
+		result->status = conversation_store_add(user->conversations, new_conversations[i]);
+		if (result->status.status != SUCCESS) {
+			continue;
+		}
+		new_conversations[i] = NULL;
+
+		result->message = messages[i]->content;
+		result->message_length = messages[i]->content_length;
+		free_and_null_if_valid(messages[i]);
+	}
+
+	key_protect_noaccess(user->master_keys);
+	user = NULL;
+	user_store_unlock_shard(shard);
+	shard = NULL;
+	unlock_state();
+	state_locked = false;
+
+	if (backup != NULL) {
+		if (backup_length == 0) {
+			*backup = NULL;
+		} else {
+			status = molch_export(backup, backup_length);
+			throw_on_error(EXPORT_ERROR, "Failed to export.");
+		}
+	}
+
+cleanup:
+	//everything that wasn't handed over to the caller or the conversation store
+	if (batch_received) {
+		for (size_t i = 0; i < packet_count; i++) {
+			if (new_conversations[i] != NULL) {
+				conversation_destroy(new_conversations[i]);
+			}
+			if (messages[i] != NULL) {
+				buffer_destroy_from_heap_and_null_if_valid(messages[i]);
+			}
+			return_status_destroy_errors(&statuses[i]);
+		}
+	}
+	free_and_null_if_valid(packet_buffers);
+	free_and_null_if_valid(packet_pointers);
+	free_and_null_if_valid(new_conversations);
+	free_and_null_if_valid(messages);
+	free_and_null_if_valid(statuses);
+
+	if (user != NULL) {
+		key_protect_noaccess(user->master_keys);
+	}
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
 	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	stats_call_end(MOLCH_STATS_START_RECEIVE_CONVERSATIONS, stats_start, status);
 
 	return status;
 }
 
 /*
  * Find a conversation based on it's conversation id.
+ *
+ * The state lock has to be held. If the conversation is found, the shard
+ * of its user stays locked and has to be unlocked by the caller.
  */
-return_status find_conversation(
+static return_status find_conversation(
 		conversation_t ** const conversation, //output
 		const unsigned char * const conversation_id,
 		conversation_store ** const conversation_store, //optional, can be NULL, the conversation store where the conversation is in
-		user_store_node ** const user //optional, can be NULL, the user that the conversation belongs to
+		user_store_node ** const user, //optional, can be NULL, the user that the conversation belongs to
+		user_store_shard ** const shard //output, the locked shard, NULL if the conversation wasn't found
 		) {
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
 
 	conversation_t *conversation_node = NULL;
+	user_store_node *node = NULL;
 
-	if ((conversation == NULL) || (conversation_id == NULL)) {
+	if ((conversation == NULL) || (conversation_id == NULL) || (shard == NULL)) {
 		throw(INVALID_INPUT, "Invalid input for find_conversation.");
 	}
+	*shard = NULL;
+
+	if (users == NULL) {
+		goto cleanup;
+	}
 
 	buffer_create_with_existing_array(conversation_id_buffer, (unsigned char*)conversation_id, CONVERSATION_ID_SIZE);
 
-	//go through all the users
-	user_store_node *node = users->head;
-	while (node != NULL) {
-		status = conversation_store_find_node(&conversation_node, node->conversations, conversation_id_buffer);
-		throw_on_error(GENERIC_ERROR, "Failure while searching for node.");
-		if (conversation_node != NULL) {
-			//found the conversation we're searching for
-			break;
+	//go through all the users, one shard at a time
+	for (size_t i = 0; (i < USER_STORE_SHARDS) && (conversation_node == NULL); i++) {
+		user_store_shard * const current_shard = &users->shards[i];
+		pthread_mutex_lock(&current_shard->lock);
+		for (node = current_shard->head; node != NULL; node = node->next) {
+			status = conversation_store_find_node(&conversation_node, node->conversations, conversation_id_buffer);
+			on_error {
+				pthread_mutex_unlock(&current_shard->lock);
+				throw(GENERIC_ERROR, "Failure while searching for node.");
+			}
+			if (conversation_node != NULL) {
+				//found the conversation we're searching for
+				*shard = current_shard;
+				break;
+			}
+		}
+		if (conversation_node == NULL) {
+			pthread_mutex_unlock(&current_shard->lock);
 		}
-		user_store_node *next = node->next;
-		node = next;
 	}
 
 	if (conversation_node == NULL) {
@@ -756,6 +1483,8 @@ cleanup:
 		*conversation = conversation_node;
 	}
 
+	trace_end("find_conversation", trace_start);
+
 	return status;
 }
 
@@ -784,8 +1513,12 @@ return_status molch_encrypt_message(
 
 	buffer_t *packet_buffer = NULL;
 	conversation_t *conversation = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
 
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+	const uint64_t stats_start = stats_call_begin();
 
 	if ((packet == NULL) || (packet_length == NULL)
 		|| (message == NULL)
@@ -797,8 +1530,11 @@ return_status molch_encrypt_message(
 		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect size.");
 	}
 
+	lock_state(false);
+	state_locked = true;
+
 	//find the conversation
-	status = find_conversation(&conversation, conversation_id, NULL, NULL);
+	status = find_conversation(&conversation, conversation_id, NULL, NULL, &shard);
 	throw_on_error(GENERIC_ERROR, "Error while searching for conversation.");
 	if (conversation == NULL) {
 		throw(NOT_FOUND, "Failed to find a conversation for the given ID.");
@@ -820,21 +1556,32 @@ return_status molch_encrypt_message(
 		if (conversation_backup_length == 0) {
 			*conversation_backup = NULL;
 		} else {
-			status = molch_conversation_export(conversation_backup, conversation_backup_length, conversation->id->content, conversation->id->content_length);
+			status = export_conversation(conversation_backup, conversation_backup_length, conversation);
 			throw_on_error(EXPORT_ERROR, "Failed to export conversation as protocol buffer.");
 		}
 	}
 
 cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
 	on_error {
 		if (packet_buffer != NULL) {
 			// not using free_and_null_if_valid because content is const
-			free(packet_buffer->content);
+			public_free(packet_buffer->content);
 		}
 	}
 
 	free_and_null_if_valid(packet_buffer);
 
+	stats_call_end(MOLCH_STATS_ENCRYPT_MESSAGE, stats_start, status);
+
+	trace_end("molch_encrypt_message", trace_start);
+
 	return status;
 }
 
@@ -863,9 +1610,13 @@ return_status molch_decrypt_message(
 	buffer_create_with_existing_array(packet_buffer, (unsigned char*)packet, packet_length);
 
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+	const uint64_t stats_start = stats_call_begin();
 
 	buffer_t *message_buffer = NULL;
 	conversation_t *conversation = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
 
 	if ((message == NULL) || (message_length == NULL)
 		|| (packet == NULL)
@@ -879,8 +1630,11 @@ return_status molch_decrypt_message(
 		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect size.");
 	}
 
+	lock_state(false);
+	state_locked = true;
+
 	//find the conversation
-	status = find_conversation(&conversation, conversation_id, NULL, NULL);
+	status = find_conversation(&conversation, conversation_id, NULL, NULL, &shard);
 	throw_on_error(GENERIC_ERROR, "Error while searching for conversation.");
 	if (conversation == NULL) {
 		throw(NOT_FOUND, "Failed to find conversation with the given ID.");
@@ -901,57 +1655,512 @@ return_status molch_decrypt_message(
 		if (conversation_backup_length == 0) {
 			*conversation_backup = NULL;
 		} else {
-			status = molch_conversation_export(conversation_backup, conversation_backup_length, conversation->id->content, conversation->id->content_length);
+			status = export_conversation(conversation_backup, conversation_backup_length, conversation);
 			throw_on_error(EXPORT_ERROR, "Failed to export conversation as protocol buffer.");
 		}
 	}
 
 cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
 	on_error {
 		if (message_buffer != NULL) {
 			// not using free_and_null_if_valid because content is const
-			free(message_buffer->content);
+			public_free(message_buffer->content);
 		}
 	}
 
 	free_and_null_if_valid(message_buffer);
 
+	stats_call_end(MOLCH_STATS_DECRYPT_MESSAGE, stats_start, status);
+
+	trace_end("molch_decrypt_message", trace_start);
+
 	return status;
 }
 
-return_status molch_end_conversation(
-		//input
-		const unsigned char * const conversation_id,
+return_status molch_decrypt_message_any(
+		//outputs
+		unsigned char ** const message, //free after use
+		size_t *message_length,
+		uint32_t * const receive_message_number,
+		uint32_t * const previous_receive_message_number,
+		unsigned char * const conversation_id,
 		const size_t conversation_id_length,
+		//inputs
+		const unsigned char * const receiver_public_master_key,
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const packet,
+		const size_t packet_length,
 		//optional output (can be NULL)
-		unsigned char ** const backup,
-		size_t * const backup_length
-		) {
+		unsigned char ** const conversation_backup, //exports the conversation, free after use, check if NULL before use!
+		size_t * const conversation_backup_length
+	) {
+	//create buffer for the packet
+	buffer_create_with_existing_array(packet_buffer, (unsigned char*)packet, packet_length);
+
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+	const uint64_t stats_start = stats_call_begin();
 
-	if (conversation_id == NULL) {
-		throw(INVALID_INPUT, "Invalid input to molch_end_conversation.");
+	buffer_t *message_buffer = NULL;
+	user_store_node *user = NULL;
+	conversation_t *conversation = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	if ((message == NULL) || (message_length == NULL)
+		|| (packet == NULL)
+		|| (conversation_id == NULL)
+		|| (receive_message_number == NULL)
+		|| (previous_receive_message_number == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_decrypt_message_any.");
 	}
 
 	if (conversation_id_length != CONVERSATION_ID_SIZE) {
-		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect length.");
+		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect size.");
 	}
 
-	//find the conversation
-	conversation_t *conversation = NULL;
-	user_store_node *user = NULL;
-	status = find_conversation(&conversation, conversation_id, NULL, &user);
-	throw_on_error(NOT_FOUND, "Couldn't find converstion.");
+	//the packet is only parsed once, for the routing tag and the decryption
+	packet_view packet_struct;
+	status = packet_unpack(&packet_struct, packet_buffer);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+	if (!packet_struct.packet_header.has_routing_tag) {
+		throw(NOT_FOUND, "The packet has no routing tag.");
+	}
+
+	lock_state(false);
+	state_locked = true;
+
+	status = lock_and_find_user(&user, &shard, receiver_public_master_key, receiver_public_master_key_length);
+	throw_on_error(NOT_FOUND, "Failed to find the receiver.");
 
+	conversation = conversation_store_route(user->conversations, packet_struct.packet_header.routing_tag.data);
 	if (conversation == NULL) {
-		throw(NOT_FOUND, "Couldn'nt find conversation.");
+		throw(NOT_FOUND, "No conversation expects a packet with this routing tag.");
 	}
 
-	conversation_store_remove_by_id(user->conversations, conversation->id);
+	status = conversation_receive_from_view(
+			conversation,
+			&packet_struct,
+			receive_message_number,
+			previous_receive_message_number,
+			&message_buffer);
+	throw_on_error(GENERIC_ERROR, "Failed to receive message.");
 
-	if (backup != NULL) {
-		if (backup_length == 0) {
-			*backup = NULL;
+	memcpy(conversation_id, conversation->id->content, CONVERSATION_ID_SIZE);
+	*message = message_buffer->content;
+	*message_length = message_buffer->content_length;
+
+	if (conversation_backup != NULL) {
+		if (conversation_backup_length == 0) {
+			*conversation_backup = NULL;
+		} else {
+			status = export_conversation(conversation_backup, conversation_backup_length, conversation);
+			throw_on_error(EXPORT_ERROR, "Failed to export conversation as protocol buffer.");
+		}
+	}
+
+cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	on_error {
+		if (message_buffer != NULL) {
+			// not using free_and_null_if_valid because content is const
+			public_free(message_buffer->content);
+		}
+	}
+
+	free_and_null_if_valid(message_buffer);
+
+	stats_call_end(MOLCH_STATS_DECRYPT_MESSAGE_ANY, stats_start, status);
+
+	trace_end("molch_decrypt_message_any", trace_start);
+
+	return status;
+}
+
+/*
+ * Start sending an attachment.
+ *
+ * Don't forget to destroy the return status with return_status_destroy_errors()
+ * if an error has occurred.
+ */
+return_status molch_start_send_attachment(
+		//outputs
+		attachment_stream ** const attachment,
+		unsigned char ** const packet, //free after use
+		size_t * const packet_length,
+		//inputs
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		//optional output (can be NULL)
+		unsigned char ** const conversation_backup, //exports the conversation, free after use, check if NULL before use!
+		size_t * const conversation_backup_length
+		) {
+	buffer_t *packet_buffer = NULL;
+	conversation_t *conversation = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	if ((attachment == NULL)
+		|| (packet == NULL) || (packet_length == NULL)
+		|| (conversation_id == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_start_send_attachment.");
+	}
+	*attachment = NULL;
+
+	if (conversation_id_length != CONVERSATION_ID_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect size.");
+	}
+
+	lock_state(false);
+	state_locked = true;
+
+	//find the conversation
+	status = find_conversation(&conversation, conversation_id, NULL, NULL, &shard);
+	throw_on_error(GENERIC_ERROR, "Error while searching for conversation.");
+	if (conversation == NULL) {
+		throw(NOT_FOUND, "Failed to find a conversation for the given ID.");
+	}
+
+	status = conversation_send_attachment(conversation, attachment, &packet_buffer);
+	throw_on_error(GENERIC_ERROR, "Failed to start attachment.");
+
+	*packet = packet_buffer->content;
+	*packet_length = packet_buffer->content_length;
+
+	if (conversation_backup != NULL) {
+		if (conversation_backup_length == 0) {
+			*conversation_backup = NULL;
+		} else {
+			status = export_conversation(conversation_backup, conversation_backup_length, conversation);
+			throw_on_error(EXPORT_ERROR, "Failed to export conversation as protocol buffer.");
+		}
+	}
+
+cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	on_error {
+		if (packet_buffer != NULL) {
+			// not using free_and_null_if_valid because content is const
+			public_free(packet_buffer->content);
+		}
+		if (attachment != NULL) {
+			attachment_destroy(*attachment);
+			*attachment = NULL;
+		}
+	}
+
+	free_and_null_if_valid(packet_buffer);
+
+	stats_call_end(MOLCH_STATS_START_SEND_ATTACHMENT, stats_start, status);
+
+	return status;
+}
+
+/*
+ * Start receiving an attachment.
+ *
+ * Don't forget to destroy the return status with return_status_destroy_errors()
+ * if an error has occurred.
+ */
+return_status molch_start_receive_attachment(
+		//outputs
+		attachment_stream ** const attachment,
+		uint32_t * const receive_message_number,
+		uint32_t * const previous_receive_message_number,
+		//inputs
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const unsigned char * const packet,
+		const size_t packet_length,
+		//optional output (can be NULL)
+		unsigned char ** const conversation_backup, //exports the conversation, free after use, check if NULL before use!
+		size_t * const conversation_backup_length
+		) {
+	//create buffer for the packet
+	buffer_create_with_existing_array(packet_buffer, (unsigned char*)packet, packet_length);
+
+	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	conversation_t *conversation = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	if ((attachment == NULL)
+		|| (packet == NULL)
+		|| (conversation_id == NULL)
+		|| (receive_message_number == NULL)
+		|| (previous_receive_message_number == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_start_receive_attachment.");
+	}
+	*attachment = NULL;
+
+	if (conversation_id_length != CONVERSATION_ID_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect size.");
+	}
+
+	lock_state(false);
+	state_locked = true;
+
+	//find the conversation
+	status = find_conversation(&conversation, conversation_id, NULL, NULL, &shard);
+	throw_on_error(GENERIC_ERROR, "Error while searching for conversation.");
+	if (conversation == NULL) {
+		throw(NOT_FOUND, "Failed to find conversation with the given ID.");
+	}
+
+	status = conversation_receive_attachment(
+			conversation,
+			attachment,
+			packet_buffer,
+			receive_message_number,
+			previous_receive_message_number);
+	throw_on_error(GENERIC_ERROR, "Failed to receive attachment.");
+
+	if (conversation_backup != NULL) {
+		if (conversation_backup_length == 0) {
+			*conversation_backup = NULL;
+		} else {
+			status = export_conversation(conversation_backup, conversation_backup_length, conversation);
+			throw_on_error(EXPORT_ERROR, "Failed to export conversation as protocol buffer.");
+		}
+	}
+
+cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	on_error {
+		if (attachment != NULL) {
+			attachment_destroy(*attachment);
+			*attachment = NULL;
+		}
+	}
+
+	stats_call_end(MOLCH_STATS_START_RECEIVE_ATTACHMENT, stats_start, status);
+
+	return status;
+}
+
+return_status molch_attachment_push(
+		attachment_stream * const attachment,
+		//output
+		unsigned char * const chunk,
+		const size_t chunk_length,
+		//inputs
+		const unsigned char * const data,
+		const size_t data_length,
+		const bool last) {
+	return_status status = return_status_init();
+
+	if ((chunk == NULL) || (data == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_attachment_push.");
+	}
+
+	buffer_create_with_existing_array(chunk_buffer, chunk, chunk_length);
+	buffer_create_with_existing_array(data_buffer, (unsigned char*)data, data_length);
+
+	status = attachment_push(attachment, chunk_buffer, data_buffer, last);
+	throw_on_error(ENCRYPT_ERROR, "Failed to push attachment chunk.");
+
+cleanup:
+	return status;
+}
+
+return_status molch_attachment_pull(
+		attachment_stream * const attachment,
+		//outputs
+		unsigned char * const data,
+		const size_t data_length,
+		bool * const last,
+		//inputs
+		const unsigned char * const chunk,
+		const size_t chunk_length) {
+	return_status status = return_status_init();
+
+	if ((data == NULL) || (chunk == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_attachment_pull.");
+	}
+
+	buffer_create_with_existing_array(data_buffer, data, data_length);
+	buffer_create_with_existing_array(chunk_buffer, (unsigned char*)chunk, chunk_length);
+
+	status = attachment_pull(attachment, data_buffer, last, chunk_buffer);
+	throw_on_error(DECRYPT_ERROR, "Failed to pull attachment chunk.");
+
+cleanup:
+	return status;
+}
+
+void molch_destroy_attachment(attachment_stream * const attachment) {
+	attachment_destroy(attachment);
+}
+
+return_status molch_conversation_set_padding(
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const molch_padding padding) {
+	return_status status = return_status_init();
+
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	if (conversation_id == NULL) {
+		throw(INVALID_INPUT, "Invalid input to molch_conversation_set_padding.");
+	}
+
+	if (conversation_id_length != CONVERSATION_ID_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect size.");
+	}
+
+	if ((padding != MOLCH_PADDING_BLOCKS)
+			&& (padding != MOLCH_PADDING_POWER_OF_TWO)
+			&& (padding != MOLCH_PADDING_PADME)
+			&& (padding != MOLCH_PADDING_BUCKETS)) {
+		throw(INVALID_VALUE, "Invalid padding policy.");
+	}
+
+	lock_state(false);
+	state_locked = true;
+
+	//find the conversation
+	conversation_t *conversation = NULL;
+	status = find_conversation(&conversation, conversation_id, NULL, NULL, &shard);
+	throw_on_error(GENERIC_ERROR, "Error while searching for conversation.");
+	if (conversation == NULL) {
+		throw(NOT_FOUND, "Failed to find a conversation for the given ID.");
+	}
+
+	conversation->padding = padding;
+
+cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	return status;
+}
+
+return_status molch_conversation_set_trial_budget(
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const uint32_t trial_limit,
+		const uint32_t window) {
+	return_status status = return_status_init();
+
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	if (conversation_id == NULL) {
+		throw(INVALID_INPUT, "Invalid input to molch_conversation_set_trial_budget.");
+	}
+
+	if (conversation_id_length != CONVERSATION_ID_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect size.");
+	}
+
+	if ((trial_limit != 0) && (window == 0)) {
+		throw(INVALID_VALUE, "The time window of the budget is empty.");
+	}
+
+	lock_state(false);
+	state_locked = true;
+
+	//find the conversation
+	conversation_t *conversation = NULL;
+	status = find_conversation(&conversation, conversation_id, NULL, NULL, &shard);
+	throw_on_error(GENERIC_ERROR, "Error while searching for conversation.");
+	if (conversation == NULL) {
+		throw(NOT_FOUND, "Failed to find a conversation for the given ID.");
+	}
+
+	receive_guard_set_budget(conversation->guard, trial_limit, window);
+
+cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	return status;
+}
+
+return_status molch_end_conversation(
+		//input
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		//optional output (can be NULL)
+		unsigned char ** const backup,
+		size_t * const backup_length
+		) {
+	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	if (conversation_id == NULL) {
+		throw(INVALID_INPUT, "Invalid input to molch_end_conversation.");
+	}
+
+	if (conversation_id_length != CONVERSATION_ID_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Conversation ID has an incorrect length.");
+	}
+
+	lock_state(false);
+	state_locked = true;
+
+	//find the conversation
+	conversation_t *conversation = NULL;
+	user_store_node *user = NULL;
+	status = find_conversation(&conversation, conversation_id, NULL, &user, &shard);
+	throw_on_error(NOT_FOUND, "Couldn't find converstion.");
+
+	if (conversation == NULL) {
+		throw(NOT_FOUND, "Couldn'nt find conversation.");
+	}
+
+	conversation_store_remove_by_id(user->conversations, conversation->id);
+
+	user_store_unlock_shard(shard);
+	shard = NULL;
+	unlock_state();
+	state_locked = false;
+
+	if (backup != NULL) {
+		if (backup_length == 0) {
+			*backup = NULL;
 		} else {
 			return_status status = molch_export(backup, backup_length);
 			on_error {
@@ -961,6 +2170,14 @@ return_status molch_end_conversation(
 	}
 
 cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	stats_call_end(MOLCH_STATS_END_CONVERSATION, stats_start, status);
 
 	return status;
 }
@@ -986,8 +2203,11 @@ return_status molch_list_conversations(
 		const size_t user_public_master_key_length) {
 	buffer_create_with_existing_array(user_public_master_key_buffer, (unsigned char*)user_public_master_key, PUBLIC_KEY_SIZE);
 	buffer_t *conversation_list_buffer = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
 
 	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
 
 	if ((user_public_master_key == NULL) || (conversation_list == NULL) || (conversation_list_length == NULL) || (number == NULL)) {
 		throw(INVALID_INPUT, "Invalid input to molch_list_conversations.");
@@ -999,6 +2219,13 @@ return_status molch_list_conversations(
 
 	*conversation_list = NULL;
 
+	lock_state(false);
+	state_locked = true;
+	if (users == NULL) {
+		throw(NOT_FOUND, "There are no users.");
+	}
+
+	shard = user_store_lock_shard(users, user_public_master_key_buffer);
 	user_store_node *user = NULL;
 	status = user_store_find_node(&user, users, user_public_master_key_buffer);
 	throw_on_error(NOT_FOUND, "No user found for the given public identity.")
@@ -1021,10 +2248,17 @@ return_status molch_list_conversations(
 
 	*conversation_list = conversation_list_buffer->content;
 	*conversation_list_length = conversation_list_buffer->content_length;
-	free(conversation_list_buffer); //free buffer_t struct
+	public_free(conversation_list_buffer); //free buffer_t struct
 	conversation_list_buffer = NULL;
 
 cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
 	on_error {
 		if (number != NULL) {
 			*number = 0;
@@ -1033,6 +2267,118 @@ cleanup:
 		buffer_destroy_from_heap_and_null_if_valid(conversation_list_buffer);
 	}
 
+	stats_call_end(MOLCH_STATS_LIST_CONVERSATIONS, stats_start, status);
+
+	return status;
+}
+
+/*
+ * Lock the shard of a user and find it. The shard stays locked if it
+ * could be locked, even if the user wasn't found.
+ */
+static return_status lock_and_find_user(
+		user_store_node ** const user,
+		user_store_shard ** const shard,
+		const unsigned char * const public_master_key,
+		const size_t public_master_key_length) {
+	return_status status = return_status_init();
+
+	if ((public_master_key == NULL) || (public_master_key_length != PUBLIC_MASTER_KEY_SIZE)) {
+		throw(INVALID_INPUT, "Invalid public master key.");
+	}
+
+	if (users == NULL) {
+		throw(NOT_FOUND, "There are no users.");
+	}
+
+	buffer_create_with_existing_array(public_master_key_buffer, (unsigned char*)public_master_key, PUBLIC_MASTER_KEY_SIZE);
+	*shard = user_store_lock_shard(users, public_master_key_buffer);
+	status = user_store_find_node(user, users, public_master_key_buffer);
+	throw_on_error(NOT_FOUND, "No user found for the given public identity.");
+
+cleanup:
+	return status;
+}
+
+return_status molch_list_conversations_page(
+		unsigned char * const page,
+		const size_t page_length,
+		size_t * const count,
+		molch_list_cursor * const cursor,
+		const unsigned char * const user_public_master_key,
+		const size_t user_public_master_key_length) {
+	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	user_store_shard *shard = NULL;
+
+	lock_state(false);
+
+	if ((page == NULL) || (page_length < CONVERSATION_ID_SIZE) || (count == NULL) || (cursor == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_list_conversations_page.");
+	}
+
+	*count = 0;
+
+	user_store_node *user = NULL;
+	status = lock_and_find_user(&user, &shard, user_public_master_key, user_public_master_key_length);
+	throw_on_error(NOT_FOUND, "Failed to find the user.");
+
+	if (cursor->position == 0) {
+		cursor->generation = user->conversations->generation;
+	} else if (cursor->generation != user->conversations->generation) {
+		throw(INVALID_STATE, "The conversations have changed since the first page.");
+	}
+
+	*count = conversation_store_list_page(user->conversations, cursor->position, page, page_length / CONVERSATION_ID_SIZE);
+	cursor->position += *count;
+	cursor->done = (cursor->position >= user->conversations->length);
+
+cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	unlock_state();
+
+	stats_call_end(MOLCH_STATS_LIST_CONVERSATIONS, stats_start, status);
+
+	return status;
+}
+
+return_status molch_foreach_conversation(
+		const unsigned char * const user_public_master_key,
+		const size_t user_public_master_key_length,
+		const molch_list_callback callback,
+		void * const user_data) {
+	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	user_store_shard *shard = NULL;
+
+	lock_state(false);
+
+	if (callback == NULL) {
+		throw(INVALID_INPUT, "Invalid input to molch_foreach_conversation.");
+	}
+
+	user_store_node *user = NULL;
+	status = lock_and_find_user(&user, &shard, user_public_master_key, user_public_master_key_length);
+	throw_on_error(NOT_FOUND, "Failed to find the user.");
+
+	for (const conversation_t *conversation = user->conversations->head; conversation != NULL; conversation = conversation->next) {
+		if (!callback(conversation->id->content, CONVERSATION_ID_SIZE, user_data)) {
+			break;
+		}
+	}
+
+cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	unlock_state();
+
+	stats_call_end(MOLCH_STATS_LIST_CONVERSATIONS, stats_start, status);
+
 	return status;
 }
 
@@ -1061,6 +2407,98 @@ void molch_destroy_return_status(return_status * const status) {
 	return_status_destroy_errors(status);
 }
 
+/*
+ * Switch collecting runtime statistics on or off (off by default).
+ */
+void molch_enable_stats(const bool enable) {
+	stats_enable(enable);
+}
+
+/*
+ * Get the statistics collected since the start or the last call
+ * to molch_reset_stats.
+ */
+void molch_get_stats(molch_stats * const stats) {
+	stats_get(stats);
+}
+
+/*
+ * Start counting from zero again.
+ */
+void molch_reset_stats() {
+	stats_reset();
+}
+
+/*
+ * Print statistics as text or JSON.
+ *
+ * Don't forget to free the output after use.
+ */
+char *molch_print_stats(size_t * const output_length, const molch_stats * const stats, const molch_stats_format format) {
+	return stats_print(output_length, stats, format);
+}
+
+/*
+ * Start recording timestamped events at the tracepoints of the library.
+ */
+void molch_start_tracing() {
+	trace_start();
+}
+
+void molch_stop_tracing() {
+	trace_stop();
+}
+
+/*
+ * Print the events recorded since the last call to molch_start_tracing
+ * in the Chrome trace event format (JSON).
+ *
+ * Don't forget to free the output after use.
+ */
+char *molch_print_trace(size_t * const output_length) {
+	return trace_print(output_length);
+}
+
+/*
+ * Choose where the random numbers for keys and nonces come from.
+ */
+void molch_set_random_source(const molch_random_source source) {
+	random_set_source(source);
+}
+
+/*
+ * Route all memory of the library through your own allocators.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_set_allocators(const molch_allocators * const allocators) {
+	return_status status = return_status_init();
+
+	//no error messages, allocating them would prevent a corrected call from succeeding
+	if (allocators != NULL) {
+		const molch_allocator * const kinds[] = {
+			&allocators->public_data,
+			&allocators->secret_data,
+			&allocators->key_objects
+		};
+		for (size_t i = 0; i < (sizeof(kinds) / sizeof(*kinds)); i++) {
+			if ((kinds[i]->allocate == NULL) != (kinds[i]->deallocate == NULL)) {
+				//only one of allocate and deallocate
+				status.status = INVALID_INPUT;
+				return status;
+			}
+		}
+	}
+
+	if (!allocators_set(allocators)) {
+		//memory has already been allocated
+		status.status = INVALID_STATE;
+	}
+
+	return status;
+}
+
 /*
  * Serialize a conversation.
  *
@@ -1074,9 +2512,62 @@ return_status molch_conversation_export(
 		unsigned char ** const backup,
 		size_t * const backup_length,
 		//input
-		const unsigned char * const conversation_id,
-		const size_t conversation_id_length) {
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length) {
+	return_status status = return_status_init();
+
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	//check input
+	if ((backup == NULL) || (backup_length == NULL)
+			|| (conversation_id == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_conversation_export");
+	}
+	if ((conversation_id_length != CONVERSATION_ID_SIZE)) {
+		throw(INVALID_INPUT, "Conversation ID has an invalid size.");
+	}
+
+	lock_state(false);
+	state_locked = true;
+
+	//find the conversation
+	conversation_t *conversation = NULL;
+	status = find_conversation(&conversation, conversation_id, NULL, NULL, &shard);
+	throw_on_error(NOT_FOUND, "Failed to find the conversation.");
+	if (conversation == NULL) {
+		throw(NOT_FOUND, "Failed to find the conversation.");
+	}
+
+	status = export_conversation(backup, backup_length, conversation);
+	throw_on_error(EXPORT_ERROR, "Failed to export the conversation.");
+
+cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	return status;
+}
+
+/*
+ * Serialize a conversation, the shard of its user and the state
+ * lock have to be held.
+ */
+static return_status export_conversation(
+		//output
+		unsigned char ** const backup,
+		size_t * const backup_length,
+		//input
+		const conversation_t * const conversation) {
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+	const uint64_t stats_start = stats_call_begin();
+
+	zeroed_arena_begin();
 
 	buffer_t *conversation_buffer = NULL;
 	buffer_t *backup_nonce = NULL;
@@ -1087,26 +2578,16 @@ return_status molch_conversation_export(
 	Conversation *conversation_struct = NULL;
 
 	//check input
-	if ((backup == NULL) || (backup_length == NULL)
-			|| (conversation_id == NULL)) {
-		throw(INVALID_INPUT, "Invalid input to molch_conversation_export");
-	}
-	if ((conversation_id_length != CONVERSATION_ID_SIZE)) {
-		throw(INVALID_INPUT, "Conversation ID has an invalid size.");
+	if ((backup == NULL) || (backup_length == NULL) || (conversation == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to export_conversation");
 	}
 
 	if ((backup_key == NULL) || (backup_key->content_length != BACKUP_KEY_SIZE)) {
 		throw(INCORRECT_DATA, "No backup key found.");
 	}
 
-	//find the conversation
-	conversation_t *conversation = NULL;
-	status = find_conversation(&conversation, conversation_id, NULL, NULL);
-	throw_on_error(NOT_FOUND, "Failed to find the conversation.");
-
 	//export the conversation
 	status = conversation_export(conversation, &conversation_struct);
-	conversation = NULL; //remove alias
 	throw_on_error(EXPORT_ERROR, "Failed to export conversation to protobuf-c struct.");
 
 	//pack the struct
@@ -1122,7 +2603,7 @@ return_status molch_conversation_export(
 	//generate the nonce
 	backup_nonce = buffer_create_on_heap(BACKUP_NONCE_SIZE, 0);
 	throw_on_failed_alloc(backup_nonce);
-	if (buffer_fill_random(backup_nonce, BACKUP_NONCE_SIZE) != 0) {
+	if (random_fill_buffer(backup_nonce, BACKUP_NONCE_SIZE) != 0) {
 		throw(GENERIC_ERROR, "Failed to generaete backup nonce.");
 	}
 
@@ -1158,16 +2639,18 @@ return_status molch_conversation_export(
 
 	//now pack the entire backup
 	const size_t encrypted_backup_size = encrypted_backup__get_packed_size(&encrypted_backup_struct);
-	*backup = malloc(encrypted_backup_size);
+	*backup = public_malloc(encrypted_backup_size);
+	stats_allocation(MOLCH_STATS_BACKUPS, encrypted_backup_size);
 	*backup_length = encrypted_backup__pack(&encrypted_backup_struct, *backup);
 	if (*backup_length != encrypted_backup_size) {
 		throw(PROTOBUF_PACK_ERROR, "Failed to pack encrypted conversation.");
 	}
+	stats_export(*backup_length);
 
 cleanup:
 	on_error {
 		if ((backup != NULL) && (*backup != NULL)) {
-			free(*backup);
+			public_free(*backup);
 			*backup = NULL;
 		}
 		if (backup_length != NULL) {
@@ -1183,6 +2666,12 @@ cleanup:
 	buffer_destroy_from_heap_and_null_if_valid(backup_nonce);
 	buffer_destroy_from_heap_and_null_if_valid(backup_buffer);
 
+	zeroed_arena_end();
+
+	stats_call_end(MOLCH_STATS_CONVERSATION_EXPORT, stats_start, status);
+
+	trace_end("molch_conversation_export", trace_start);
+
 	return status;
 }
 
@@ -1202,11 +2691,16 @@ return_status molch_conversation_import(
 		const unsigned char * local_backup_key,
 		const size_t local_backup_key_length) {
 	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	zeroed_arena_begin();
 
 	EncryptedBackup *encrypted_backup_struct = NULL;
 	buffer_t *decrypted_backup = NULL;
 	Conversation *conversation_struct = NULL;
 	conversation_t *conversation = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
 
 	//check input
 	if ((backup == NULL) || (local_backup_key == NULL)) {
@@ -1263,9 +2757,13 @@ return_status molch_conversation_import(
 	status = conversation_import(&conversation, conversation_struct);
 	throw_on_error(IMPORT_ERROR, "Failed to import conversation from Protobuf-C struct.");
 
+	//the backup key is replaced as well
+	lock_state(true);
+	state_locked = true;
+
 	conversation_store *containing_store = NULL;
 	conversation_t *existing_conversation = NULL;
-	status = find_conversation(&existing_conversation, conversation->id->content, &containing_store, NULL);
+	status = find_conversation(&existing_conversation, conversation->id->content, &containing_store, NULL, &shard);
 	throw_on_error(NOT_FOUND, "Imported conversation has to exist, but it doesn't.");
 
 	status = conversation_store_add(containing_store, conversation);
@@ -1274,7 +2772,7 @@ return_status molch_conversation_import(
 
 
 	//update the backup key
-	status = molch_update_backup_key(new_backup_key, new_backup_key_length);
+	status = update_backup_key(new_backup_key, new_backup_key_length);
 	on_error {
 		//remove the new imported conversation
 		conversation_store_remove(containing_store, conversation);
@@ -1284,7 +2782,16 @@ return_status molch_conversation_import(
 	//everything worked, the old conversation can now be removed
 	conversation_store_remove(containing_store, existing_conversation);
 
+	stats_import(backup_length);
+
 cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
 	if (encrypted_backup_struct != NULL) {
 		encrypted_backup__free_unpacked(encrypted_backup_struct, &protobuf_c_allocators);
 		encrypted_backup_struct = NULL;
@@ -1299,6 +2806,301 @@ cleanup:
 		conversation = NULL;
 	}
 
+	zeroed_arena_end();
+
+	stats_call_end(MOLCH_STATS_CONVERSATION_IMPORT, stats_start, status);
+
+	return status;
+}
+
+/*
+ * Serialize a single user. The output is encrypted with the backup key.
+ *
+ * Don't forget to free the output after use.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_user_export(
+		//output
+		unsigned char ** const backup,
+		size_t * const backup_length,
+		//input
+		const unsigned char * const public_master_key,
+		const size_t public_master_key_length) {
+	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+	const uint64_t stats_start = stats_call_begin();
+
+	zeroed_arena_begin();
+
+	buffer_t *user_buffer = NULL;
+	buffer_t *backup_nonce = NULL;
+	buffer_t *backup_buffer = NULL;
+
+	EncryptedBackup encrypted_backup_struct;
+	encrypted_backup__init(&encrypted_backup_struct);
+	User *user_struct = NULL;
+
+	user_store_node *user = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	//check input
+	if ((backup == NULL) || (backup_length == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_user_export");
+	}
+
+	lock_state(false);
+	state_locked = true;
+
+	if ((backup_key == NULL) || (backup_key->content_length != BACKUP_KEY_SIZE)) {
+		throw(INCORRECT_DATA, "No backup key found.");
+	}
+
+	//only the shard of the user is locked while exporting it
+	status = lock_and_find_user(&user, &shard, public_master_key, public_master_key_length);
+	throw_on_error(NOT_FOUND, "User not found.");
+
+	status = user_store_node_export(user, &user_struct);
+	throw_on_error(EXPORT_ERROR, "Failed to export user to protobuf-c struct.");
+
+	//pack the struct
+	const size_t user_size = user__get_packed_size(user_struct);
+	user_buffer = buffer_create_with_custom_allocator(user_size, 0, zeroed_malloc, zeroed_free);
+	throw_on_failed_alloc(user_buffer);
+
+	user_buffer->content_length = user__pack(user_struct, user_buffer->content);
+	if (user_buffer->content_length != user_size) {
+		throw(PROTOBUF_PACK_ERROR, "Failed to pack user to protobuf-c.");
+	}
+
+	//generate the nonce
+	backup_nonce = buffer_create_on_heap(BACKUP_NONCE_SIZE, 0);
+	throw_on_failed_alloc(backup_nonce);
+	if (random_fill_buffer(backup_nonce, BACKUP_NONCE_SIZE) != 0) {
+		throw(GENERIC_ERROR, "Failed to generaete backup nonce.");
+	}
+
+	//allocate the output
+	backup_buffer = buffer_create_on_heap(user_size + crypto_secretbox_MACBYTES, user_size + crypto_secretbox_MACBYTES);
+	throw_on_failed_alloc(backup_buffer);
+
+	//encrypt the backup
+	int status_int = crypto_secretbox_easy(
+			backup_buffer->content,
+			user_buffer->content,
+			user_buffer->content_length,
+			backup_nonce->content,
+			backup_key->content);
+	if (status_int != 0) {
+		backup_buffer->content_length = 0;
+		throw(ENCRYPT_ERROR, "Failed to enrypt user state.");
+	}
+
+	//fill in the encrypted backup struct
+	//metadata
+	encrypted_backup_struct.backup_version = 0;
+	encrypted_backup_struct.has_backup_type = true;
+	encrypted_backup_struct.backup_type = ENCRYPTED_BACKUP__BACKUP_TYPE__USER_BACKUP;
+	//nonce
+	encrypted_backup_struct.has_encrypted_backup_nonce = true;
+	encrypted_backup_struct.encrypted_backup_nonce.data = backup_nonce->content;
+	encrypted_backup_struct.encrypted_backup_nonce.len = backup_nonce->content_length;
+	//encrypted backup
+	encrypted_backup_struct.has_encrypted_backup = true;
+	encrypted_backup_struct.encrypted_backup.data = backup_buffer->content;
+	encrypted_backup_struct.encrypted_backup.len = backup_buffer->content_length;
+
+	//now pack the entire backup
+	const size_t encrypted_backup_size = encrypted_backup__get_packed_size(&encrypted_backup_struct);
+	*backup = public_malloc(encrypted_backup_size);
+	throw_on_failed_alloc(*backup);
+	stats_allocation(MOLCH_STATS_BACKUPS, encrypted_backup_size);
+	*backup_length = encrypted_backup__pack(&encrypted_backup_struct, *backup);
+	if (*backup_length != encrypted_backup_size) {
+		throw(PROTOBUF_PACK_ERROR, "Failed to pack encrypted user.");
+	}
+	stats_export(*backup_length);
+
+cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	on_error {
+		if ((backup != NULL) && (*backup != NULL)) {
+			public_free(*backup);
+			*backup = NULL;
+		}
+		if (backup_length != NULL) {
+			*backup_length = 0;
+		}
+	}
+
+	if (user_struct != NULL) {
+		user__free_unpacked(user_struct, &protobuf_c_allocators);
+		user_struct = NULL;
+	}
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(user_buffer, zeroed_free);
+	buffer_destroy_from_heap_and_null_if_valid(backup_nonce);
+	buffer_destroy_from_heap_and_null_if_valid(backup_buffer);
+
+	zeroed_arena_end();
+
+	stats_call_end(MOLCH_STATS_USER_EXPORT, stats_start, status);
+
+	trace_end("molch_user_export", trace_start);
+
+	return status;
+}
+
+/*
+ * Import a user from a backup (overwrites the user if it already exists)
+ * and generates a new backup key.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_user_import(
+		//output
+		unsigned char * const new_backup_key,
+		const size_t new_backup_key_length,
+		//inputs
+		const unsigned char * const backup,
+		const size_t backup_length,
+		const unsigned char * const local_backup_key,
+		const size_t local_backup_key_length) {
+	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+	const uint64_t stats_start = stats_call_begin();
+
+	zeroed_arena_begin();
+
+	EncryptedBackup *encrypted_backup_struct = NULL;
+	buffer_t *decrypted_backup = NULL;
+	User *user_struct = NULL;
+	user_store_node *user = NULL;
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
+
+	//check input
+	if ((backup == NULL) || (local_backup_key == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to molch_user_import.");
+	}
+	if (local_backup_key_length != BACKUP_KEY_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "Backup key has an incorrect length.");
+	}
+	if (new_backup_key_length != BACKUP_KEY_SIZE) {
+		throw(INCORRECT_BUFFER_SIZE, "New backup key has an incorrect length.");
+	}
+
+	if (sodium_init() == -1) {
+		throw(INIT_ERROR, "Failed to init libsodium.");
+	}
+
+	//unpack the encrypted backup
+	encrypted_backup_struct = encrypted_backup__unpack(&protobuf_c_allocators, backup_length, backup);
+	if (encrypted_backup_struct == NULL) {
+		throw(PROTOBUF_UNPACK_ERROR, "Failed to unpack encrypted backup from protobuf.");
+	}
+
+	//check the backup
+	if (encrypted_backup_struct->backup_version != 0) {
+		throw(INCORRECT_DATA, "Incompatible backup.");
+	}
+	if (!encrypted_backup_struct->has_backup_type || (encrypted_backup_struct->backup_type != ENCRYPTED_BACKUP__BACKUP_TYPE__USER_BACKUP)) {
+		throw(INCORRECT_DATA, "Backup is not a user backup.");
+	}
+	if (!encrypted_backup_struct->has_encrypted_backup || (encrypted_backup_struct->encrypted_backup.len < crypto_secretbox_MACBYTES)) {
+		throw(PROTOBUF_MISSING_ERROR, "The backup is missing the encrypted user state.");
+	}
+	if (!encrypted_backup_struct->has_encrypted_backup_nonce || (encrypted_backup_struct->encrypted_backup_nonce.len != BACKUP_NONCE_SIZE)) {
+		throw(PROTOBUF_MISSING_ERROR, "The backup is missing the nonce.");
+	}
+
+	decrypted_backup = buffer_create_with_custom_allocator(encrypted_backup_struct->encrypted_backup.len - crypto_secretbox_MACBYTES, encrypted_backup_struct->encrypted_backup.len - crypto_secretbox_MACBYTES, zeroed_malloc, zeroed_free);
+	throw_on_failed_alloc(decrypted_backup);
+
+	//decrypt the backup
+	int status_int = crypto_secretbox_open_easy(
+			decrypted_backup->content,
+			encrypted_backup_struct->encrypted_backup.data,
+			encrypted_backup_struct->encrypted_backup.len,
+			encrypted_backup_struct->encrypted_backup_nonce.data,
+			local_backup_key);
+	if (status_int != 0) {
+		throw(DECRYPT_ERROR, "Failed to decrypt user backup.");
+	}
+
+	//unpack the struct
+	user_struct = user__unpack(&protobuf_c_allocators, decrypted_backup->content_length, decrypted_backup->content);
+	if (user_struct == NULL) {
+		throw(PROTOBUF_UNPACK_ERROR, "Failed to unpack user from protobuf-c.");
+	}
+
+	//import the user
+	status = user_store_node_import(&user, user_struct);
+	throw_on_error(IMPORT_ERROR, "Failed to import user from Protobuf-C struct.");
+
+	//the backup key is replaced as well
+	lock_state(true);
+	state_locked = true;
+
+	//create user store if it doesn't exist already
+	if (users == NULL) {
+		status = user_store_create(&users);
+		throw_on_error(CREATION_ERROR, "Failed to create user store.")
+	}
+
+	//update the backup key
+	status = update_backup_key(new_backup_key, new_backup_key_length);
+	throw_on_error(KEYGENERATION_FAILED, "Failed to update backup key.");
+
+	//replace the existing user
+	shard = user_store_lock_shard(users, user->public_signing_key);
+	user_store_node *existing_user = NULL;
+	return_status find_status = user_store_find_node(&existing_user, users, user->public_signing_key);
+	return_status_destroy_errors(&find_status);
+	if (existing_user != NULL) {
+		user_store_remove(users, existing_user);
+	}
+	user_store_unlock_shard(shard);
+	shard = NULL;
+
+	user_store_add_node(users, user);
+	user = NULL;
+
+	stats_import(backup_length);
+
+cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+	if (encrypted_backup_struct != NULL) {
+		encrypted_backup__free_unpacked(encrypted_backup_struct, &protobuf_c_allocators);
+		encrypted_backup_struct = NULL;
+	}
+	if (user_struct != NULL) {
+		user__free_unpacked(user_struct, &protobuf_c_allocators);
+		user_struct = NULL;
+	}
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(decrypted_backup, zeroed_free);
+	user_store_destroy_node(user);
+
+	zeroed_arena_end();
+
+	stats_call_end(MOLCH_STATS_USER_IMPORT, stats_start, status);
+
+	trace_end("molch_user_import", trace_start);
+
 	return status;
 }
 
@@ -1314,6 +3116,11 @@ return_status molch_export(
 		unsigned char ** const backup,
 		size_t *backup_length) {
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+	const uint64_t stats_start = stats_call_begin();
+
+	//the Protobuf-C structs of all users are freed at once at the end
+	zeroed_arena_begin();
 
 	buffer_t *users_buffer = NULL;
 	buffer_t *backup_nonce = NULL;
@@ -1323,6 +3130,8 @@ return_status molch_export(
 	encrypted_backup__init(&encrypted_backup_struct);
 	Backup *backup_struct = NULL;
 
+	lock_state(false);
+
 	//check input
 	if ((backup == NULL) || (backup_length == NULL)) {
 		throw(INVALID_INPUT, "Invalid input to molch_export");
@@ -1336,7 +3145,7 @@ return_status molch_export(
 	throw_on_failed_alloc(backup_struct);
 	backup__init(backup_struct);
 
-	//export the conversation
+	//export the user store, all shards are locked while doing so
 	status = user_store_export(users, &(backup_struct->users), &(backup_struct->n_users));
 	throw_on_error(EXPORT_ERROR, "Failed to export user store to protobuf-c struct.");
 
@@ -1353,7 +3162,7 @@ return_status molch_export(
 	//generate the nonce
 	backup_nonce = buffer_create_on_heap(BACKUP_NONCE_SIZE, 0);
 	throw_on_failed_alloc(backup_nonce);
-	if (buffer_fill_random(backup_nonce, BACKUP_NONCE_SIZE) != 0) {
+	if (random_fill_buffer(backup_nonce, BACKUP_NONCE_SIZE) != 0) {
 		throw(GENERIC_ERROR, "Failed to generaete backup nonce.");
 	}
 
@@ -1389,16 +3198,20 @@ return_status molch_export(
 
 	//now pack the entire backup
 	const size_t encrypted_backup_size = encrypted_backup__get_packed_size(&encrypted_backup_struct);
-	*backup = malloc(encrypted_backup_size);
+	*backup = public_malloc(encrypted_backup_size);
+	stats_allocation(MOLCH_STATS_BACKUPS, encrypted_backup_size);
 	*backup_length = encrypted_backup__pack(&encrypted_backup_struct, *backup);
 	if (*backup_length != encrypted_backup_size) {
 		throw(PROTOBUF_PACK_ERROR, "Failed to pack encrypted conversation.");
 	}
+	stats_export(*backup_length);
 
 cleanup:
+	unlock_state();
+
 	on_error {
 		if ((backup != NULL) && (*backup != NULL)) {
-			free(*backup);
+			public_free(*backup);
 			*backup = NULL;
 		}
 		if (backup_length != NULL) {
@@ -1414,6 +3227,12 @@ cleanup:
 	buffer_destroy_from_heap_and_null_if_valid(backup_nonce);
 	buffer_destroy_from_heap_and_null_if_valid(backup_buffer);
 
+	zeroed_arena_end();
+
+	stats_call_end(MOLCH_STATS_EXPORT, stats_start, status);
+
+	trace_end("molch_export", trace_start);
+
 	return status;
 }
 
@@ -1437,11 +3256,16 @@ return_status molch_import(
 		const size_t local_backup_key_length
 		) {
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
+	const uint64_t stats_start = stats_call_begin();
+
+	zeroed_arena_begin();
 
 	EncryptedBackup *encrypted_backup_struct = NULL;
 	buffer_t *decrypted_backup = NULL;
 	Backup *backup_struct = NULL;
 	user_store *store = NULL;
+	bool state_locked = false;
 
 	//check input
 	if ((backup == NULL) || (local_backup_key == NULL)) {
@@ -1504,8 +3328,11 @@ return_status molch_import(
 	status = user_store_import(&store, backup_struct->users, backup_struct->n_users);
 	throw_on_error(IMPORT_ERROR, "Failed to import user store from Protobuf-C struct.");
 
+	lock_state(true);
+	state_locked = true;
+
 	//update the backup key
-	status = molch_update_backup_key(new_backup_key, new_backup_key_length);
+	status = update_backup_key(new_backup_key, new_backup_key_length);
 	throw_on_error(KEYGENERATION_FAILED, "Failed to update backup key.");
 
 	//everyting worked, switch to the new user store
@@ -1513,7 +3340,13 @@ return_status molch_import(
 	users = store;
 	store = NULL;
 
+	stats_import(backup_length);
+
 cleanup:
+	if (state_locked) {
+		unlock_state();
+	}
+
 	if (encrypted_backup_struct != NULL) {
 		encrypted_backup__free_unpacked(encrypted_backup_struct, &protobuf_c_allocators);
 		encrypted_backup_struct = NULL;
@@ -1528,6 +3361,12 @@ cleanup:
 		store = NULL;
 	}
 
+	zeroed_arena_end();
+
+	stats_call_end(MOLCH_STATS_IMPORT, stats_start, status);
+
+	trace_end("molch_import", trace_start);
+
 	return status;
 }
 
@@ -1545,6 +3384,10 @@ return_status molch_get_prekey_list(
 		unsigned char * const public_master_key,
 		const size_t public_master_key_length) {
 	return_status status = return_status_init();
+	const uint64_t stats_start = stats_call_begin();
+
+	user_store_shard *shard = NULL;
+	bool state_locked = false;
 
 	// check input
 	if ((public_master_key == NULL) || (prekey_list == NULL) || (prekey_list_length == NULL)) {
@@ -1557,13 +3400,34 @@ return_status molch_get_prekey_list(
 
 	buffer_create_with_existing_array(public_signing_key_buffer, public_master_key, PUBLIC_MASTER_KEY_SIZE);
 
+	lock_state(false);
+	state_locked = true;
+	if (users == NULL) {
+		throw(NOT_FOUND, "There are no users.");
+	}
+
+	shard = user_store_lock_shard(users, public_signing_key_buffer);
+	user_store_node *user = NULL;
+	status = user_store_find_node(&user, users, public_signing_key_buffer);
+	throw_on_error(NOT_FOUND, "Failed to find user.");
+
 	status = create_prekey_list(
-			public_signing_key_buffer,
+			user,
 			prekey_list,
 			prekey_list_length);
 	throw_on_error(CREATION_ERROR, "Failed to create prekey list.");
 
 cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+	if (state_locked) {
+		unlock_state();
+	}
+
+
+	stats_call_end(MOLCH_STATS_GET_PREKEY_LIST, stats_start, status);
+
 	return status;
 }
 
@@ -1576,6 +3440,23 @@ cleanup:
 return_status molch_update_backup_key(
 		unsigned char * const new_key, //output, BACKUP_KEY_SIZE
 		const size_t new_key_length) {
+	const uint64_t stats_start = stats_call_begin();
+
+	lock_state(true);
+	const return_status status = update_backup_key(new_key, new_key_length);
+	unlock_state();
+
+	stats_call_end(MOLCH_STATS_UPDATE_BACKUP_KEY, stats_start, status);
+
+	return status;
+}
+
+/*
+ * Replace the backup key, the state lock has to be held for writing.
+ */
+static return_status update_backup_key(
+		unsigned char * const new_key, //output, BACKUP_KEY_SIZE
+		const size_t new_key_length) {
 	return_status status = return_status_init();
 
 	buffer_create_with_existing_array(new_key_buffer, new_key, BACKUP_KEY_SIZE);
@@ -1596,20 +3477,20 @@ return_status molch_update_backup_key(
 
 	// create a backup key buffer if it doesnt exist already
 	if (backup_key == NULL) {
-		backup_key = buffer_create_with_custom_allocator(BACKUP_KEY_SIZE, 0, sodium_malloc, sodium_free);
+		backup_key = buffer_create_with_custom_allocator(BACKUP_KEY_SIZE, 0, key_malloc, key_free);
 		throw_on_failed_alloc(backup_key);
 	}
 
 	//make backup key buffer writable
-	if (sodium_mprotect_readwrite(backup_key) != 0) {
+	if (key_protect_readwrite(backup_key) != 0) {
 		throw(GENERIC_ERROR, "Failed to make backup key readwrite.");
 	}
 	//make the content of the backup key writable
-	if (sodium_mprotect_readwrite(backup_key->content) != 0) {
+	if (key_protect_readwrite(backup_key->content) != 0) {
 		throw(GENERIC_ERROR, "Failed to make backup key content readwrite.");
 	}
 
-	if (buffer_fill_random(backup_key, BACKUP_KEY_SIZE) != 0) {
+	if (random_fill_buffer(backup_key, BACKUP_KEY_SIZE) != 0) {
 		throw(KEYGENERATION_FAILED, "Failed to generate new backup key.");
 	}
 
@@ -1619,8 +3500,8 @@ return_status molch_update_backup_key(
 
 cleanup:
 	if (backup_key != NULL) {
-		sodium_mprotect_readonly(backup_key);
-		sodium_mprotect_readonly(backup_key->content);
+		key_protect_readonly(backup_key);
+		key_protect_readonly(backup_key->content);
 	}
 
 	return status;
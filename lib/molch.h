@@ -20,6 +20,10 @@
  */
 
 #include "common.h"
+#include "stats.h"
+#include "trace.h"
+#include "attachment.h"
+#include "async.h"
 
 #ifndef LIB_MOLCH_H
 #define LIB_MOLCH_H
@@ -31,6 +35,25 @@
  * WARNING: ALTHOUGH THIS IMPLEMENTS THE AXOLOTL PROTOCOL, IT ISN't CONSIDERED SECURE ENOUGH TO USE AT THIS POINT
  */
 
+/*
+ * All functions can be called from multiple threads. The users are split
+ * into shards with one lock each, so calls for users in different shards
+ * run in parallel. Calls that replace the whole state (import, destroying
+ * all users, updating the backup key) wait for all other calls.
+ */
+
+/*
+ * How expensive it is to derive random data from the random input
+ * ("spice") when creating users (scrypt). A higher cost makes it harder to
+ * guess weak random input, without any input the cost doesn't matter
+ * because nothing is derived.
+ */
+typedef enum molch_spice_cost {
+	MOLCH_SPICE_COST_INTERACTIVE, //libsodium's interactive limits (16 MiB), the default
+	MOLCH_SPICE_COST_MINIMAL, //the lowest limits libsodium allows, for provisioning lots of users
+	MOLCH_SPICE_COST_SENSITIVE //libsodium's limits for sensitive data (1 GiB, takes seconds)
+} molch_spice_cost;
+
 /*
  * Create a new user. The user is identified by the public master key.
  *
@@ -66,6 +89,51 @@ return_status molch_create_user(
 		const size_t random_data_length
 	) __attribute__((warn_unused_result));
 
+/*
+ * Outcome of one user of molch_create_users.
+ */
+typedef struct molch_created_user {
+	return_status status; //destroy with molch_destroy_return_status() if an error has occurred
+	unsigned char public_master_key[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char *prekey_list; //free after use, NULL if an error has occurred
+	size_t prekey_list_length;
+} molch_created_user;
+
+/*
+ * Create several users at once, e.g. when provisioning service identities.
+ *
+ * Works like calling molch_create_user for every user, but the keys are
+ * generated on 'thread_count' threads, only one new backup key is created
+ * and the state is exported only once at the end.
+ *
+ * 'random_data' can contain random input for every user (see
+ * molch_create_user), 'spice_cost' sets how expensive it is to derive
+ * random data from it. Users without random input don't pay this cost.
+ *
+ * Every user has its own status in 'created_users'. The returned status
+ * is only an error if the batch as a whole failed, no users are created
+ * then (unless only the export failed).
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_create_users(
+		//outputs
+		molch_created_user * const created_users, //'count' long
+		const size_t count,
+		unsigned char * const backup_key, //BACKUP_KEY_SIZE
+		const size_t backup_key_length,
+		//optional input (can be NULL)
+		const unsigned char * const * const random_data, //'count' long, entries can be NULL too
+		const size_t * const random_data_lengths,
+		//inputs
+		const molch_spice_cost spice_cost,
+		const size_t thread_count, //0 for one per processor
+		//optional output (can be NULL)
+		unsigned char ** const backup, //exports the entire library state, free after use, check if NULL before use!
+		size_t * const backup_length
+		) __attribute__((warn_unused_result));
+
 /*
  * Destroy a user.
  *
@@ -104,8 +172,77 @@ return_status molch_list_users(
  */
 void molch_destroy_all_users();
 
+/*
+ * Position of a paged listing (molch_list_users_page, molch_list_conversations_page).
+ * Initialize it with MOLCH_LIST_CURSOR_INIT before fetching the first page.
+ */
+typedef struct molch_list_cursor {
+	uint64_t generation;
+	size_t position;
+	bool done; //set when the last page has been fetched
+} molch_list_cursor;
+#define MOLCH_LIST_CURSOR_INIT {0, 0, false}
+
+/*
+ * Called with every public master key or conversation id by
+ * molch_foreach_user and molch_foreach_conversation. Returning
+ * false stops the iteration.
+ */
+typedef bool (*molch_list_callback)(const unsigned char * const key, const size_t key_length, void * const user_data);
+
+/*
+ * List the users (public master keys) into a buffer of the caller
+ * without allocating anything. Every call fills the page with as many
+ * keys as fit and advances the cursor until cursor->done is set.
+ *
+ * All pages together are a consistent snapshot. If users have been added
+ * or removed since the first page was fetched, this fails with
+ * INVALID_STATE and the listing has to be started again with a new cursor.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_list_users_page(
+		//output
+		unsigned char * const page,
+		const size_t page_length, //in bytes, room for at least one key
+		size_t * const count, //number of keys in the page
+		//input and output
+		molch_list_cursor * const cursor) __attribute__((warn_unused_result));
+
+/*
+ * Call 'callback' with the public master key of every user. All users are
+ * locked while iterating, so the callback sees a consistent snapshot, but
+ * it mustn't call any molch functions and should return quickly.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_foreach_user(
+		const molch_list_callback callback,
+		void * const user_data) __attribute__((warn_unused_result));
+
 typedef enum molch_message_type { PREKEY_MESSAGE, NORMAL_MESSAGE, INVALID } molch_message_type;
 
+/*
+ * How messages are padded before they are encrypted. Padding hides the
+ * exact length of a message at the cost of bandwidth.
+ */
+typedef enum molch_padding {
+	MOLCH_PADDING_BLOCKS, //multiples of 255 bytes, the default, understood by every version of molch
+	MOLCH_PADDING_POWER_OF_TWO, //the next power of two, at least 16 bytes
+	MOLCH_PADDING_PADME, //Padme, at most 12% overhead, only leaks O(log log n) bits of the length
+	MOLCH_PADDING_BUCKETS //64, 256, 1024, 4096 or 16384 bytes, then multiples of 16384
+} molch_padding;
+
+/*
+ * Where the random numbers for keys and nonces come from.
+ */
+typedef enum molch_random_source {
+	MOLCH_RANDOM_BUFFERED, //ChaCha20 per thread, seeded from the OS, the default
+	MOLCH_RANDOM_SYSTEM //libsodium's randombytes, usually a syscall for every call
+} molch_random_source;
+
 /*
  * Get the type of a message.
  *
@@ -146,6 +283,50 @@ return_status molch_start_send_conversation(
 		size_t * const backup_length
 		) __attribute__((warn_unused_result));
 
+/*
+ * Outcome of one receiver of molch_start_send_conversations.
+ */
+typedef struct molch_sent_conversation {
+	return_status status; //destroy with molch_destroy_return_status() if an error has occurred
+	unsigned char conversation_id[CONVERSATION_ID_SIZE];
+	unsigned char *packet; //free after use, NULL if an error has occurred
+	size_t packet_length;
+} molch_sent_conversation;
+
+/*
+ * Start new conversations with several receivers at once and send
+ * them all the same message, e.g. a broadcast to new contacts.
+ *
+ * Works like calling molch_start_send_conversation for every receiver,
+ * but the prekey lists are verified and the key agreements are done on
+ * 'thread_count' threads and the state is exported only once at the end.
+ *
+ * Every receiver has its own status in 'conversations', a receiver with
+ * a bad prekey list doesn't affect the others. The returned status is only
+ * an error if the batch as a whole failed, no conversations are started
+ * then (unless only the export failed).
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_start_send_conversations(
+		//outputs
+		molch_sent_conversation * const conversations, //'receiver_count' long
+		//inputs
+		const unsigned char * const sender_public_master_key, //signing key of the sender (user)
+		const size_t sender_public_master_key_length,
+		const unsigned char * const * const receiver_public_master_keys, //signing keys of the receivers, PUBLIC_MASTER_KEY_SIZE each
+		const unsigned char * const * const prekey_lists, //prekey lists of the receivers
+		const size_t * const prekey_list_lengths,
+		const size_t receiver_count,
+		const unsigned char * const message,
+		const size_t message_length,
+		const size_t thread_count, //0 for one per processor
+		//optional output (can be NULL)
+		unsigned char ** const backup, //exports the entire library state, free after use, check if NULL before use!
+		size_t * const backup_length
+		) __attribute__((warn_unused_result));
+
 /*
  * Start a new conversation. (receiving)
  *
@@ -178,6 +359,50 @@ return_status molch_start_receive_conversation(
 		size_t * const backup_length
 		) __attribute__((warn_unused_result));
 
+/*
+ * Outcome of one prekey message of molch_start_receive_conversations.
+ */
+typedef struct molch_received_conversation {
+	return_status status; //destroy with molch_destroy_return_status() if an error has occurred
+	unsigned char conversation_id[CONVERSATION_ID_SIZE];
+	unsigned char *message; //free after use, NULL if an error has occurred
+	size_t message_length;
+} molch_received_conversation;
+
+/*
+ * Start new conversations from a batch of prekey messages to the same user,
+ * e.g. after a lot of people started a conversation with the user at once.
+ *
+ * Works like calling molch_start_receive_conversation for every packet,
+ * but the key agreements are spread across 'thread_count' threads, the
+ * prekeys used by the batch are replaced once, only one new prekey list
+ * is created and the state is exported only once at the end.
+ *
+ * Every packet has its own status in 'conversations', a packet that
+ * fails doesn't affect the others. The returned status is only an error
+ * if the batch as a whole failed, no conversations are started then
+ * (unless only the export failed).
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_start_receive_conversations(
+		//outputs
+		molch_received_conversation * const conversations, //'packet_count' long
+		unsigned char ** const prekey_list, //free after use
+		size_t * const prekey_list_length,
+		//inputs
+		const unsigned char * const receiver_public_master_key, //signing key of the receiver (user)
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const * const packets, //received prekey packets
+		const size_t * const packet_lengths,
+		const size_t packet_count,
+		const size_t thread_count, //0 for one per processor
+		//optional output (can be NULL)
+		unsigned char ** const backup, //exports the entire library state, free after use, check if NULL before use!
+		size_t * const backup_length
+		) __attribute__((warn_unused_result));
+
 /*
  * Encrypt a message and create a packet that can be sent to the receiver.
  *
@@ -220,6 +445,169 @@ return_status molch_decrypt_message(
 		size_t * const conversation_backup_length
 		) __attribute__((warn_unused_result));
 
+/*
+ * Decrypt a message of one of the conversations of a user without knowing
+ * which one.
+ *
+ * Packets of peers that support routed packets (every version of molch
+ * that has this function) contain a routing tag, which is looked up in a
+ * table of the tags each conversation expects next, so the conversation is
+ * found without trying the header keys of every conversation. Only the
+ * next few messages of each receive chain are in the table, packets that
+ * arrive very late or have no routing tag aren't found (NOT_FOUND), they
+ * have to be decrypted with molch_decrypt_message. Prekey messages start
+ * a new conversation, see molch_start_receive_conversation.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_decrypt_message_any(
+		//outputs
+		unsigned char ** const message, //free after use
+		size_t *message_length,
+		uint32_t * const receive_message_number,
+		uint32_t * const previous_receive_message_number,
+		unsigned char * const conversation_id, //the conversation the packet belongs to
+		const size_t conversation_id_length,
+		//inputs
+		const unsigned char * const receiver_public_master_key,
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const packet, //received packet
+		const size_t packet_length,
+		//optional output (can be NULL)
+		unsigned char ** const conversation_backup, //exports the conversation, free after use, check if NULL before use!
+		size_t * const conversation_backup_length
+		) __attribute__((warn_unused_result));
+
+/*
+ * Start sending an attachment, a message that is too large to be
+ * encrypted in one piece.
+ *
+ * This uses up one message of the conversation, the packet has to be sent
+ * to the receiver like any other packet, followed by the chunks created
+ * with molch_attachment_push. The attachment doesn't depend on the
+ * conversation anymore afterwards, messages can be sent while it is
+ * being pushed.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_start_send_attachment(
+		//outputs
+		attachment_stream ** const attachment, //destroy with molch_destroy_attachment
+		unsigned char ** const packet, //free after use
+		size_t * const packet_length,
+		//inputs
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		//optional output (can be NULL)
+		unsigned char ** const conversation_backup, //exports the conversation, free after use, check if NULL before use!
+		size_t * const conversation_backup_length
+		) __attribute__((warn_unused_result));
+
+/*
+ * Start receiving an attachment from the packet created by
+ * molch_start_send_attachment.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_start_receive_attachment(
+		//outputs
+		attachment_stream ** const attachment, //destroy with molch_destroy_attachment
+		uint32_t * const receive_message_number,
+		uint32_t * const previous_receive_message_number,
+		//inputs
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const unsigned char * const packet, //received packet
+		const size_t packet_length,
+		//optional output (can be NULL)
+		unsigned char ** const conversation_backup, //exports the conversation, free after use, check if NULL before use!
+		size_t * const conversation_backup_length
+		) __attribute__((warn_unused_result));
+
+/*
+ * Encrypt the next chunk of an attachment. The chunk is
+ * data_length + ATTACHMENT_CHUNK_OVERHEAD long.
+ *
+ * Chunks can have any size, but their boundaries have to be preserved
+ * on the way to the receiver, e.g. by using a fixed chunk size. The
+ * last chunk has to be marked with 'last'.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_attachment_push(
+		attachment_stream * const attachment,
+		//output
+		unsigned char * const chunk,
+		const size_t chunk_length, //at least data_length + ATTACHMENT_CHUNK_OVERHEAD
+		//inputs
+		const unsigned char * const data,
+		const size_t data_length,
+		const bool last
+		) __attribute__((warn_unused_result));
+
+/*
+ * Decrypt and verify the next chunk of an attachment. The data is
+ * chunk_length - ATTACHMENT_CHUNK_OVERHEAD long.
+ *
+ * The attachment is only complete after a chunk with 'last' set,
+ * if the chunks end before that, the attachment has been truncated.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_attachment_pull(
+		attachment_stream * const attachment,
+		//outputs
+		unsigned char * const data,
+		const size_t data_length, //at least chunk_length - ATTACHMENT_CHUNK_OVERHEAD
+		bool * const last,
+		//inputs
+		const unsigned char * const chunk,
+		const size_t chunk_length
+		) __attribute__((warn_unused_result));
+
+/*
+ * Destroy an attachment and erase its key.
+ */
+void molch_destroy_attachment(attachment_stream * const attachment);
+
+/*
+ * Set how the messages sent in a conversation are padded.
+ *
+ * The other side has to support the padding policy, until a message from
+ * it has been received that says so, MOLCH_PADDING_BLOCKS is used.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_conversation_set_padding(
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const molch_padding padding) __attribute__((warn_unused_result));
+
+/*
+ * Limit the trial decryptions (attempts to decrypt the header of a received
+ * packet with one of the header keys) of a conversation to 'trial_limit'
+ * per 'window' milliseconds. Packets that arrive when the budget is
+ * exhausted are rejected without being decrypted. A limit of 0 (the
+ * default) removes the budget.
+ *
+ * Every received packet costs at least one trial, out of order packets up
+ * to the number of skipped message keys plus two.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_conversation_set_trial_budget(
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const uint32_t trial_limit,
+		const uint32_t window) __attribute__((warn_unused_result));
+
 /*
  * End a conversation.
  *
@@ -256,6 +644,40 @@ return_status molch_list_conversations(
 		const unsigned char * const user_public_master_key,
 		const size_t user_public_master_key_length) __attribute__((warn_unused_result));
 
+/*
+ * List the conversations (ids) of a user page by page into a buffer of the
+ * caller, like molch_list_users_page.
+ *
+ * Fails with INVALID_STATE if conversations of the user have been started
+ * or ended since the first page was fetched.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_list_conversations_page(
+		//output
+		unsigned char * const page,
+		const size_t page_length, //in bytes, room for at least one id
+		size_t * const count, //number of ids in the page
+		//input and output
+		molch_list_cursor * const cursor,
+		//input
+		const unsigned char * const user_public_master_key,
+		const size_t user_public_master_key_length) __attribute__((warn_unused_result));
+
+/*
+ * Call 'callback' with the id of every conversation of a user. The user is
+ * locked while iterating, so the callback mustn't call any molch functions.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_foreach_conversation(
+		const unsigned char * const user_public_master_key,
+		const size_t user_public_master_key_length,
+		const molch_list_callback callback,
+		void * const user_data) __attribute__((warn_unused_result));
+
 /*
  * Print a return status into a nice looking error message.
  *
@@ -275,6 +697,170 @@ const char *molch_print_status_type(status_type type);
  */
 void molch_destroy_return_status(return_status * const status);
 
+/*
+ * Switch collecting runtime statistics on or off (off by default).
+ */
+void molch_enable_stats(const bool enable);
+
+/*
+ * Get the statistics collected since the start or the last call
+ * to molch_reset_stats. This includes per API call counts and latency
+ * histograms, skipped keys, header trial decryptions, prekey deprecations,
+ * allocations by subsystem and export/import sizes.
+ */
+void molch_get_stats(molch_stats * const stats);
+
+/*
+ * Start counting from zero again. The number of skipped keys isn't
+ * reset, the peak is set to the current number.
+ */
+void molch_reset_stats();
+
+/*
+ * Print statistics as text or JSON.
+ *
+ * Don't forget to free the output after use.
+ */
+char *molch_print_stats(size_t * const output_length, const molch_stats * const stats, const molch_stats_format format) __attribute__((warn_unused_result));
+
+/*
+ * Start recording timestamped events at the tracepoints of the library
+ * (conversation lookup, ratchet steps, key derivation, packet encryption
+ * and decryption, export). Every thread keeps its last TRACE_RING_SIZE events.
+ */
+void molch_start_tracing();
+void molch_stop_tracing();
+
+/*
+ * Print the events recorded since the last call to molch_start_tracing
+ * in the Chrome trace event format (JSON).
+ *
+ * Don't forget to free the output after use.
+ */
+char *molch_print_trace(size_t * const output_length) __attribute__((warn_unused_result));
+
+/*
+ * Choose where the random numbers for keys and nonces come from. The
+ * buffered generator only goes to the OS to seed itself, periodically
+ * and after a fork.
+ */
+void molch_set_random_source(const molch_random_source source);
+
+/*
+ * Route all memory of the library through your own allocators, e.g. to
+ * put it into separate arenas, enforce quotas or count allocations. There
+ * are separate allocators for public data, secret data and long lived key
+ * objects, see lib/allocators.h. A kind of memory whose functions are both
+ * NULL keeps its default, NULL for 'allocators' restores all of them.
+ *
+ * Secret data and key objects from your allocators are erased with zeroes
+ * by the library before they are deallocated. The output of API calls
+ * (packets, prekey lists, backups, ...) comes from the public data
+ * allocator, free it with its deallocate function.
+ *
+ * This has to be called before any other function of the library that
+ * allocates memory, afterwards it fails with INVALID_STATE. Failing calls
+ * don't allocate anything, so the returned status has no error messages
+ * and the call can be repeated with corrected allocators.
+ */
+return_status molch_set_allocators(const molch_allocators * const allocators) __attribute__((warn_unused_result));
+
+/*
+ * Start the worker threads for the asynchronous calls (molch_async_*).
+ * The synchronous API can still be used at the same time.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_async_start(const size_t worker_count) __attribute__((warn_unused_result));
+
+/*
+ * Wait until all submitted calls are done and stop the worker threads.
+ * Results that are still in the completion queue are destroyed. Calls
+ * submitted in the meantime (e.g. from callbacks) are rejected.
+ *
+ * Don't call this from a callback.
+ */
+void molch_async_stop();
+
+/*
+ * File descriptor of the completion queue, -1 if the workers aren't
+ * running. When it is readable, call molch_async_poll until it returns
+ * NULL. Don't read from or close it.
+ */
+int molch_async_get_fd();
+
+/*
+ * Take the next result out of the completion queue, NULL if it is empty.
+ * Doesn't block.
+ *
+ * Destroy the result with molch_async_destroy_result.
+ */
+molch_async_result *molch_async_poll();
+
+/*
+ * Free a result, including its outputs and return status.
+ */
+void molch_async_destroy_result(molch_async_result * const result);
+
+/*
+ * Submit a call to be executed by the workers. The inputs are copied, the
+ * outputs are in the result. If 'callback' is NULL, the result is put into
+ * the completion queue.
+ *
+ * The return status only says if the call could be submitted.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_async_create_user(
+		const unsigned char * const random_data, //optional, can be NULL
+		const size_t random_data_length,
+		const molch_async_callback callback,
+		void * const user_data) __attribute__((warn_unused_result));
+
+return_status molch_async_start_send_conversation(
+		const unsigned char * const sender_public_master_key,
+		const size_t sender_public_master_key_length,
+		const unsigned char * const receiver_public_master_key,
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const prekey_list,
+		const size_t prekey_list_length,
+		const unsigned char * const message,
+		const size_t message_length,
+		const molch_async_callback callback,
+		void * const user_data) __attribute__((warn_unused_result));
+
+return_status molch_async_start_receive_conversation(
+		const unsigned char * const receiver_public_master_key,
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const sender_public_master_key,
+		const size_t sender_public_master_key_length,
+		const unsigned char * const packet,
+		const size_t packet_length,
+		const molch_async_callback callback,
+		void * const user_data) __attribute__((warn_unused_result));
+
+return_status molch_async_encrypt_message(
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const unsigned char * const message,
+		const size_t message_length,
+		const molch_async_callback callback,
+		void * const user_data) __attribute__((warn_unused_result));
+
+return_status molch_async_decrypt_message(
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const unsigned char * const packet,
+		const size_t packet_length,
+		const molch_async_callback callback,
+		void * const user_data) __attribute__((warn_unused_result));
+
+return_status molch_async_export(
+		const molch_async_callback callback,
+		void * const user_data) __attribute__((warn_unused_result));
+
 /*
  * Serialize a conversation.
  *
@@ -320,6 +906,42 @@ return_status molch_conversation_import(
 		const size_t backup_key_length
 		) __attribute__((warn_unused_result));
 
+/*
+ * Serialize a single user with its master keys, prekeys and conversations,
+ * e.g. to persist or migrate it without exporting all the other users.
+ * The output is encrypted with the backup key.
+ *
+ * Don't forget to free the output after use.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_user_export(
+		//output
+		unsigned char ** const backup, //free after use
+		size_t * const backup_length,
+		//input
+		const unsigned char * const public_master_key,
+		const size_t public_master_key_length) __attribute__((warn_unused_result));
+
+/*
+ * Import a user from a backup created with molch_user_export (overwrites
+ * the user if it already exists) and generates a new backup key.
+ *
+ * Don't forget to destroy the return status with molch_destroy_return_status()
+ * if an error has occurred.
+ */
+return_status molch_user_import(
+		//output
+		unsigned char * const new_backup_key, //BACKUP_KEY_SIZE, can be the same pointer as the backup key
+		const size_t new_backup_key_length,
+		//inputs
+		const unsigned char * const backup,
+		const size_t backup_length,
+		const unsigned char * const backup_key, //BACKUP_KEY_SIZE
+		const size_t backup_key_length
+		) __attribute__((warn_unused_result));
+
 /*
  * Import molch's internal state from a backup (overwrites the current state)
  * and generates a new backup key.
@@ -21,9 +21,14 @@
 
 #include <packet.pb-c.h>
 #include <string.h>
+#include <stdint.h>
 #include "packet.h"
 #include "constants.h"
+#include "wire.h"
+#include "trace.h"
+#include "random.h"
 #include "zeroed_malloc.h"
+#include "routing.h"
 
 /*!
  * Convert molch_message_type to PacketHeader__PacketType.
@@ -54,20 +59,15 @@ molch_message_type to_molch_message_type(const PacketHeader__PacketType packet_t
 	}
 }
 
-/*!
- * Unpacks a packet via Protobuf-C into a struct and verifies that all the necessary
- * fields exist.
- *
- * \param packet_struct
- *   The unpacket struct.
- * \param packet
- *   The binary packet.
- *
- * \return
- *   Error status, destroy with return_status_destroy_errors if an error occurs.
+/*
+ * Compact packets of PROTOCOL_VERSION_ROUTED and later have the same layout
+ * as PROTOCOL_VERSION_COMPACT, plus a routing tag.
  */
-return_status packet_unpack(Packet ** const packet_struct, const buffer_t * const packet) __attribute__((warn_unused_result));
-return_status packet_unpack(Packet ** const packet_struct, const buffer_t * const packet) {
+static bool is_compact(const uint32_t protocol_version) {
+	return protocol_version >= PROTOCOL_VERSION_COMPACT;
+}
+
+return_status packet_unpack(packet_view * const packet_struct, const buffer_t * const packet) {
 	return_status status = return_status_init();
 
 	//check input
@@ -75,63 +75,257 @@ return_status packet_unpack(Packet ** const packet_struct, const buffer_t * cons
 		throw(INVALID_INPUT, "Invalid input to packet_unpack.");
 	}
 
-	//unpack the packet
-	*packet_struct = packet__unpack(&protobuf_c_allocators, packet->content_length, packet->content);
-	if (*packet_struct == NULL) {
-		throw(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+	//unpack the packet, compact packets aren't protobuf
+	const bool compact = wire_is_compact_packet(packet);
+	if (compact) {
+		status = wire_compact_packet_unpack(packet_struct, packet);
+	} else {
+		status = wire_packet_unpack(packet_struct, packet);
 	}
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
 
-	if ((*packet_struct)->packet_header->current_protocol_version != 0) {
+	if (packet_struct->packet_header.current_protocol_version > HIGHEST_SUPPORTED_PROTOCOL_VERSION) {
 		throw(UNSUPPORTED_PROTOCOL_VERSION, "The packet has an unsuported protocol version.");
 	}
+	if (compact != is_compact(packet_struct->packet_header.current_protocol_version)) {
+		throw(INVALID_VALUE, "The format of the packet doesn't match its protocol version.");
+	}
+	if ((packet_struct->packet_header.current_protocol_version >= PROTOCOL_VERSION_ROUTED)
+		&& (!packet_struct->packet_header.has_routing_tag || (packet_struct->packet_header.routing_tag.length != ROUTING_TAG_SIZE))) {
+		throw(PROTOBUF_MISSING_ERROR, "The routing tag is missing in the packet.");
+	}
 
-	//check if the packet contains the necessary fields
-	if (!(*packet_struct)->has_encrypted_axolotl_header
-		|| !(*packet_struct)->has_encrypted_message
-		|| !(*packet_struct)->packet_header->has_packet_type
-		|| !(*packet_struct)->packet_header->has_header_nonce
-		|| !(*packet_struct)->packet_header->has_message_nonce) {
+	//check if the packet contains the necessary fields, compact packets have no message nonce
+	if (!packet_struct->has_encrypted_axolotl_header
+		|| !packet_struct->has_encrypted_message
+		|| !packet_struct->packet_header.has_packet_type
+		|| !packet_struct->packet_header.has_header_nonce
+		|| (!compact && !packet_struct->packet_header.has_message_nonce)) {
 		throw(PROTOBUF_MISSING_ERROR, "Some fields are missing in the packet.");
 	}
 
 	//check the size of the nonces
-	if (((*packet_struct)->packet_header->header_nonce.len != HEADER_NONCE_SIZE)
-		|| ((*packet_struct)->packet_header->message_nonce.len != MESSAGE_NONCE_SIZE)) {
+	if ((packet_struct->packet_header.header_nonce.length != HEADER_NONCE_SIZE)
+		|| (!compact && (packet_struct->packet_header.message_nonce.length != MESSAGE_NONCE_SIZE))) {
 		throw(INCORRECT_BUFFER_SIZE, "At least one of the nonces has an incorrect length.");
 	}
 
-	if ((*packet_struct)->packet_header->packet_type == PACKET_HEADER__PACKET_TYPE__PREKEY_MESSAGE) {
+	if (packet_struct->packet_header.packet_type == PACKET_HEADER__PACKET_TYPE__PREKEY_MESSAGE) {
 		//check if the public keys for prekey messages are there
-		if (!(*packet_struct)->packet_header->has_public_identity_key
-			|| !(*packet_struct)->packet_header->has_public_ephemeral_key
-			|| !(*packet_struct)->packet_header->has_public_prekey) {
+		if (!packet_struct->packet_header.has_public_identity_key
+			|| !packet_struct->packet_header.has_public_ephemeral_key
+			|| !packet_struct->packet_header.has_public_prekey) {
 			throw(PROTOBUF_MISSING_ERROR, "The prekey packet misses at least one public key.");
 		}
 
 		//check the sizes of the public keys
-		if (((*packet_struct)->packet_header->public_identity_key.len != PUBLIC_KEY_SIZE)
-			|| ((*packet_struct)->packet_header->public_ephemeral_key.len != PUBLIC_KEY_SIZE)
-			|| ((*packet_struct)->packet_header->public_prekey.len != PUBLIC_KEY_SIZE)) {
+		if ((packet_struct->packet_header.public_identity_key.length != PUBLIC_KEY_SIZE)
+			|| (packet_struct->packet_header.public_ephemeral_key.length != PUBLIC_KEY_SIZE)
+			|| (packet_struct->packet_header.public_prekey.length != PUBLIC_KEY_SIZE)) {
 			throw(INCORRECT_BUFFER_SIZE, "At least one of the public keys of the prekey packet has an incorrect length.");
 		}
 	}
 
 cleanup:
-	on_error {
-		if ((packet_struct != NULL) && (*packet_struct != NULL)) {
-			packet__free_unpacked(*packet_struct, &protobuf_c_allocators);
-			*packet_struct = NULL;
+	return status;
+}
+
+/*
+ * Lay out a packet for in place encryption. All the bytes fields are
+ * only reserved (no data), the public keys are only there for prekey
+ * messages and the message nonce isn't there in compact packets.
+ */
+static void packet_layout(
+		packet_view * const packet_struct,
+		const molch_message_type packet_type,
+		const uint32_t protocol_version,
+		const size_t axolotl_header_length,
+		const size_t padded_message_length) {
+	wire_packet_init(packet_struct);
+	packet_header_view * const packet_header_struct = &packet_struct->packet_header;
+
+	packet_header_struct->current_protocol_version = protocol_version;
+	packet_header_struct->highest_supported_protocol_version = HIGHEST_SUPPORTED_PROTOCOL_VERSION;
+
+	//set the packet type
+	packet_header_struct->has_packet_type = true;
+	packet_header_struct->packet_type = to_packet_header_packet_type(packet_type);
+
+	packet_header_struct->has_header_nonce = true;
+	packet_header_struct->header_nonce.length = HEADER_NONCE_SIZE;
+	if (!is_compact(protocol_version)) {
+		packet_header_struct->has_message_nonce = true;
+		packet_header_struct->message_nonce.length = MESSAGE_NONCE_SIZE;
+	}
+	if (protocol_version >= PROTOCOL_VERSION_ROUTED) {
+		packet_header_struct->has_routing_tag = true;
+		packet_header_struct->routing_tag.length = ROUTING_TAG_SIZE;
+	}
+
+	if (packet_type == PREKEY_MESSAGE) {
+		packet_header_struct->has_public_identity_key = true;
+		packet_header_struct->public_identity_key.length = PUBLIC_KEY_SIZE;
+		packet_header_struct->has_public_ephemeral_key = true;
+		packet_header_struct->public_ephemeral_key.length = PUBLIC_KEY_SIZE;
+		packet_header_struct->has_public_prekey = true;
+		packet_header_struct->public_prekey.length = PUBLIC_KEY_SIZE;
+	}
+
+	packet_struct->has_encrypted_axolotl_header = true;
+	packet_struct->encrypted_axolotl_header.length = axolotl_header_length + crypto_secretbox_MACBYTES;
+	packet_struct->has_encrypted_message = true;
+	packet_struct->encrypted_message.length = padded_message_length + crypto_secretbox_MACBYTES;
+}
+
+//PKCS7 padding to 255 byte blocks, see RFC5652 section 6.3
+static unsigned char padding_length(const size_t message_length) {
+	return (unsigned char)(255 - (message_length % 255));
+}
+
+static unsigned int floor_log2(const size_t number) {
+	return (unsigned int)(sizeof(unsigned long long) * 8 - 1) - (unsigned int)__builtin_clzll(number);
+}
+
+/*
+ * Padme, see "Reducing Metadata Leakage from Encrypted Files and
+ * Communication with PURBs" (Nikitin et al.). Only the topmost
+ * floor(log2(exponent)) + 1 bits of the length are kept.
+ */
+static size_t padme_length(const size_t length) {
+	if (length < 2) {
+		return length;
+	}
+
+	const unsigned int exponent = floor_log2(length);
+	const unsigned int exponent_bits = floor_log2(exponent) + 1;
+	const size_t mask = ((size_t)1 << (exponent - exponent_bits)) - 1;
+
+	return (length + mask) & ~mask;
+}
+
+/*
+ * Length of the padded message including the length prefix
+ * (if there is one).
+ */
+static size_t padded_length(const uint32_t protocol_version, const molch_padding padding, const size_t message_length) {
+	if (protocol_version == PROTOCOL_VERSION_PKCS7_PADDING) {
+		return message_length + padding_length(message_length);
+	}
+
+	const size_t length = message_length + PADDING_PREFIX_SIZE;
+	switch (padding) {
+		case MOLCH_PADDING_BLOCKS:
+			//same block size as PKCS7
+			return length + ((255 - (length % 255)) % 255);
+
+		case MOLCH_PADDING_POWER_OF_TWO: {
+			size_t padded = 16;
+			while ((padded < length) && (padded <= (SIZE_MAX / 2))) {
+				padded *= 2;
+			}
+			return (padded < length) ? length : padded;
+		}
+
+		case MOLCH_PADDING_PADME:
+			return padme_length(length);
+
+		case MOLCH_PADDING_BUCKETS: {
+			static const size_t buckets[] = {64, 256, 1024, 4096, 16384};
+			for (size_t i = 0; i < (sizeof(buckets) / sizeof(*buckets)); i++) {
+				if (length <= buckets[i]) {
+					return buckets[i];
+				}
+			}
+			const size_t largest = buckets[sizeof(buckets) / sizeof(*buckets) - 1];
+			return length + ((largest - (length % largest)) % largest);
+		}
+
+		default:
+			return length;
+	}
+}
+
+/*
+ * Write the padded message in the format of the current protocol version.
+ */
+static void write_padded_message(
+		unsigned char * const padded_message,
+		const size_t padded_message_length,
+		const uint32_t protocol_version,
+		const buffer_t * const message) {
+	//empty buffers have no content
+	if (protocol_version == PROTOCOL_VERSION_PKCS7_PADDING) {
+		const unsigned char padding_byte = padding_length(message->content_length);
+		if (message->content_length != 0) {
+			memcpy(padded_message, message->content, message->content_length);
 		}
+		memset(padded_message + message->content_length, padding_byte, padding_byte);
+		return;
+	}
+
+	const uint32_t length = (uint32_t)message->content_length;
+	padded_message[0] = (unsigned char)(length >> 24);
+	padded_message[1] = (unsigned char)(length >> 16);
+	padded_message[2] = (unsigned char)(length >> 8);
+	padded_message[3] = (unsigned char)length;
+	if (message->content_length != 0) {
+		memcpy(padded_message + PADDING_PREFIX_SIZE, message->content, message->content_length);
+	}
+	memset(
+			padded_message + PADDING_PREFIX_SIZE + message->content_length,
+			0,
+			padded_message_length - PADDING_PREFIX_SIZE - message->content_length);
+}
+
+/*
+ * Writable pointer to a field that was reserved by wire_packet_reserve.
+ */
+static unsigned char *reserved_field(const buffer_t * const packet, const wire_bytes * const field) {
+	return packet->content + (field->data - packet->content);
+}
+
+static size_t packed_size(const packet_view * const packet_struct) {
+	if (is_compact(packet_struct->packet_header.current_protocol_version)) {
+		return wire_compact_packet_get_packed_size(packet_struct);
 	}
 
-	return status;
+	return wire_packet_get_packed_size(packet_struct);
 }
 
-return_status packet_encrypt(
+/*
+ * Message keys are never reused, but the header nonce is mixed in anyway,
+ * so that a message key that is used twice (e.g. after restoring an old
+ * backup) doesn't end up with the same nonce.
+ */
+static int derive_message_nonce(unsigned char * const message_nonce, const unsigned char * const header_nonce, const buffer_t * const message_key) {
+	return crypto_generichash(
+			message_nonce,
+			MESSAGE_NONCE_SIZE,
+			header_nonce,
+			HEADER_NONCE_SIZE,
+			message_key->content,
+			message_key->content_length);
+}
+
+size_t packet_get_encrypted_length(
+		const molch_message_type packet_type,
+		const uint32_t protocol_version,
+		const molch_padding padding,
+		const size_t axolotl_header_length,
+		const size_t message_length) {
+	packet_view packet_struct;
+	packet_layout(&packet_struct, packet_type, protocol_version, axolotl_header_length, padded_length(protocol_version, padding, message_length));
+
+	return packed_size(&packet_struct);
+}
+
+return_status packet_encrypt_into(
 		//output
-		buffer_t ** const packet,
+		buffer_t * const packet,
 		//inputs
 		const molch_message_type packet_type,
+		const uint32_t protocol_version,
+		const molch_padding padding,
 		const buffer_t * const axolotl_header,
 		const buffer_t * const axolotl_header_key, //HEADER_KEY_SIZE
 		const buffer_t * const message,
@@ -139,145 +333,206 @@ return_status packet_encrypt(
 		//optional inputs (prekey messages only)
 		const buffer_t * const public_identity_key,
 		const buffer_t * const public_ephemeral_key,
-		const buffer_t * const public_prekey) {
+		const buffer_t * const public_prekey,
+		//optional input (PROTOCOL_VERSION_ROUTED only)
+		const buffer_t * const routing_tag) {
 	return_status status = return_status_init();
-
-	//initialize the protobuf structs
-	Packet packet_struct = PACKET__INIT;
-	PacketHeader packet_header_struct = PACKET_HEADER__INIT;
-	packet_struct.packet_header = &packet_header_struct;
-
-	//buffers
-	buffer_t *header_nonce = NULL;
-	buffer_t *message_nonce = NULL;
-	buffer_t *encrypted_axolotl_header = NULL;
-	buffer_t *padded_message = NULL;
-	buffer_t *encrypted_message = NULL;
+	const uint64_t trace_start = trace_begin();
 
 	//check the input
-	if ((packet == NULL)
+	if ((packet == NULL) || packet->readonly
 		|| (packet_type == INVALID)
 		|| (axolotl_header == NULL)
 		|| (axolotl_header_key == NULL) || (axolotl_header_key->content_length != HEADER_KEY_SIZE)
 		|| (message == NULL)
 		|| (message_key == NULL) || (message_key->content_length != MESSAGE_KEY_SIZE)) {
-		throw(INVALID_INPUT, "Invalid input to packet_encrypt.");
+		throw(INVALID_INPUT, "Invalid input to packet_encrypt_into.");
 	}
 
-	//set the protocol version
-	packet_header_struct.current_protocol_version = 0;
-	packet_header_struct.highest_supported_protocol_version = 0;
+	if (protocol_version > HIGHEST_SUPPORTED_PROTOCOL_VERSION) {
+		throw(UNSUPPORTED_PROTOCOL_VERSION, "Can't encrypt with an unsupported protocol version.");
+	}
+	if ((protocol_version == PROTOCOL_VERSION_PKCS7_PADDING) && (padding != MOLCH_PADDING_BLOCKS)) {
+		throw(INVALID_INPUT, "Only MOLCH_PADDING_BLOCKS is possible without the length prefix.");
+	}
+	if ((protocol_version != PROTOCOL_VERSION_PKCS7_PADDING) && (message->content_length > (UINT32_MAX - PADDING_PREFIX_SIZE))) {
+		throw(INVALID_INPUT, "Message is too long for the length prefix.");
+	}
+	const bool compact = is_compact(protocol_version);
+	if (compact && ((axolotl_header->content_length + crypto_aead_xchacha20poly1305_ietf_ABYTES) > WIRE_COMPACT_MAX_HEADER_LENGTH)) {
+		throw(INVALID_INPUT, "Axolotl header is too long for a compact packet.");
+	}
 
-	//set the packet type
-	packet_header_struct.has_packet_type = true;
-	packet_header_struct.packet_type = to_packet_header_packet_type(packet_type);
+	if ((packet_type == PREKEY_MESSAGE)
+		&& ((public_identity_key == NULL) || (public_identity_key->content_length != PUBLIC_KEY_SIZE)
+			|| (public_ephemeral_key == NULL) || (public_ephemeral_key->content_length != PUBLIC_KEY_SIZE )
+			|| (public_prekey == NULL) || (public_prekey->content_length != PUBLIC_KEY_SIZE))) {
+		throw(INVALID_INPUT, "Invalid public key to packet_encrypt for prekey message.");
+	}
+	if ((protocol_version >= PROTOCOL_VERSION_ROUTED) != (routing_tag != NULL)) {
+		throw(INVALID_INPUT, "Routed packets need a routing tag, others can't have one.");
+	}
+	if ((routing_tag != NULL) && (routing_tag->content_length != ROUTING_TAG_SIZE)) {
+		throw(INCORRECT_BUFFER_SIZE, "The routing tag has an incorrect length.");
+	}
 
+	//calculate the layout of the packet
+	const size_t padded_message_length = padded_length(protocol_version, padding, message->content_length);
+	packet_view packet_struct;
+	packet_layout(&packet_struct, packet_type, protocol_version, axolotl_header->content_length, padded_message_length);
 	if (packet_type == PREKEY_MESSAGE) {
-		//check input
-		if ((public_identity_key == NULL) || (public_identity_key->content_length != PUBLIC_KEY_SIZE)
-			|| (public_ephemeral_key == NULL) || (public_ephemeral_key->content_length != PUBLIC_KEY_SIZE )
-			|| (public_prekey == NULL) || (public_prekey->content_length != PUBLIC_KEY_SIZE)) {
-			throw(INVALID_INPUT, "Invalid public key to packet_encrypt for prekey message.");
-		}
+		//the public keys are copied by the encoder
+		packet_struct.packet_header.public_identity_key.data = public_identity_key->content;
+		packet_struct.packet_header.public_ephemeral_key.data = public_ephemeral_key->content;
+		packet_struct.packet_header.public_prekey.data = public_prekey->content;
+	}
+	if (routing_tag != NULL) {
+		packet_struct.packet_header.routing_tag.data = routing_tag->content;
+	}
 
-		//set the public identity key
-		packet_header_struct.has_public_identity_key = true;
-		packet_header_struct.public_identity_key.data = public_identity_key->content;
-		packet_header_struct.public_identity_key.len = public_identity_key->content_length;
-
-		//set the public ephemeral key
-		packet_header_struct.has_public_ephemeral_key = true;
-		packet_header_struct.public_ephemeral_key.data = public_ephemeral_key->content;
-		packet_header_struct.public_ephemeral_key.len = public_ephemeral_key->content_length;
-
-		//set the public prekey
-		packet_header_struct.has_public_prekey = true;
-		packet_header_struct.public_prekey.data = public_prekey->content;
-		packet_header_struct.public_prekey.len = public_prekey->content_length;
-	}
-
-	//generate the header nonce and add it to the packet header
-	header_nonce = buffer_create_on_heap(HEADER_NONCE_SIZE, 0);
-	throw_on_failed_alloc(header_nonce);
-	if (buffer_fill_random(header_nonce, HEADER_NONCE_SIZE) != 0) {
-		throw(BUFFER_ERROR, "Failed to generate header nonce.");
-	}
-	packet_header_struct.has_header_nonce = true;
-	packet_header_struct.header_nonce.data = header_nonce->content;
-	packet_header_struct.header_nonce.len = header_nonce->content_length;
-
-	//encrypt the header
-	encrypted_axolotl_header = buffer_create_on_heap(
-			axolotl_header->content_length + crypto_secretbox_MACBYTES,
-			axolotl_header->content_length + crypto_secretbox_MACBYTES);
-	throw_on_failed_alloc(encrypted_axolotl_header);
-	int status_int = crypto_secretbox_easy(
-			encrypted_axolotl_header->content,
-			axolotl_header->content,
-			axolotl_header->content_length,
-			header_nonce->content,
-			axolotl_header_key->content);
-	if (status_int != 0) {
-		throw(ENCRYPT_ERROR, "Failed to encrypt header.");
+	const size_t packed_length = packed_size(&packet_struct);
+	if (packet->buffer_length < packed_length) {
+		throw(INCORRECT_BUFFER_SIZE, "The packet buffer is too short.");
 	}
 
-	//add the encrypted header to the protobuf struct
-	packet_struct.has_encrypted_axolotl_header = true;
-	packet_struct.encrypted_axolotl_header.data = encrypted_axolotl_header->content;
-	packet_struct.encrypted_axolotl_header.len = encrypted_axolotl_header->content_length;
+	//write everything but the nonces and ciphertexts
+	if (compact) {
+		packet->content_length = wire_compact_packet_reserve(&packet_struct, packet->content);
+	} else {
+		packet->content_length = wire_packet_reserve(&packet_struct, packet->content);
+	}
+	if (packet->content_length != packed_length) {
+		throw(PROTOBUF_PACK_ERROR, "Packet packet has incorrect length.");
+	}
 
-	//generate the message nonce and add it to the packet header
-	message_nonce = buffer_create_on_heap(MESSAGE_NONCE_SIZE, 0);
-	throw_on_failed_alloc(message_nonce);
-	if (buffer_fill_random(message_nonce, MESSAGE_NONCE_SIZE) != 0) {
-		throw(BUFFER_ERROR, "Failed to generate message nonce.");
+	unsigned char * const header_nonce = reserved_field(packet, &packet_struct.packet_header.header_nonce);
+	//ciphertexts are MAC followed by the encrypted data, like with crypto_secretbox_easy
+	unsigned char * const encrypted_axolotl_header = reserved_field(packet, &packet_struct.encrypted_axolotl_header);
+	unsigned char * const encrypted_message = reserved_field(packet, &packet_struct.encrypted_message);
+
+	//header keys are used for a whole chain, so the header nonce is always random
+	random_bytes(header_nonce, HEADER_NONCE_SIZE);
+
+	//encrypt the header in place
+	memcpy(encrypted_axolotl_header + crypto_secretbox_MACBYTES, axolotl_header->content, axolotl_header->content_length);
+	int status_int;
+	if (compact) {
+		//authenticates the metadata in front of it as well
+		status_int = crypto_aead_xchacha20poly1305_ietf_encrypt_detached(
+				encrypted_axolotl_header + crypto_aead_xchacha20poly1305_ietf_ABYTES,
+				encrypted_axolotl_header,
+				NULL,
+				encrypted_axolotl_header + crypto_aead_xchacha20poly1305_ietf_ABYTES,
+				axolotl_header->content_length,
+				packet_struct.authenticated_data.data,
+				packet_struct.authenticated_data.length,
+				NULL,
+				header_nonce,
+				axolotl_header_key->content);
+	} else {
+		status_int = crypto_secretbox_detached(
+				encrypted_axolotl_header + crypto_secretbox_MACBYTES,
+				encrypted_axolotl_header,
+				encrypted_axolotl_header + crypto_secretbox_MACBYTES,
+				axolotl_header->content_length,
+				header_nonce,
+				axolotl_header_key->content);
+	}
+	if (status_int != 0) {
+		throw(ENCRYPT_ERROR, "Failed to encrypt header.");
 	}
-	packet_header_struct.has_message_nonce = true;
-	packet_header_struct.message_nonce.data = message_nonce->content;
-	packet_header_struct.message_nonce.len = message_nonce->content_length;
 
-	//pad the message (PKCS7 padding to 255 byte blocks, see RFC5652 section 6.3)
-	unsigned char padding = 255 - (message->content_length % 255);
-	padded_message = buffer_create_on_heap(message->content_length + padding, 0);
-	throw_on_failed_alloc(padded_message);
-	//copy the message
-	if (buffer_clone(padded_message, message) != 0) {
-		throw(BUFFER_ERROR, "Failed to clone message.");
-	}
-	//pad it
-	memset(padded_message->content + padded_message->content_length, padding, padding);
-	padded_message->content_length += padding;
-
-	//encrypt the message
-	encrypted_message = buffer_create_on_heap(
-			padded_message->content_length + crypto_secretbox_MACBYTES,
-			padded_message->content_length + crypto_secretbox_MACBYTES);
-	throw_on_failed_alloc(encrypted_message);
-	status_int = crypto_secretbox_easy(
-			encrypted_message->content,
-			padded_message->content,
-			padded_message->content_length,
-			message_nonce->content,
-			message_key->content);
+	//copy and pad the message, then encrypt it in place
+	write_padded_message(encrypted_message + crypto_secretbox_MACBYTES, padded_message_length, protocol_version, message);
+	if (compact) {
+		unsigned char message_nonce[MESSAGE_NONCE_SIZE];
+		if (derive_message_nonce(message_nonce, header_nonce, message_key) != 0) {
+			throw(GENERIC_ERROR, "Failed to derive message nonce.");
+		}
+		//the MAC of the header ties the message to it
+		status_int = crypto_aead_xchacha20poly1305_ietf_encrypt_detached(
+				encrypted_message + crypto_aead_xchacha20poly1305_ietf_ABYTES,
+				encrypted_message,
+				NULL,
+				encrypted_message + crypto_aead_xchacha20poly1305_ietf_ABYTES,
+				padded_message_length,
+				encrypted_axolotl_header,
+				crypto_aead_xchacha20poly1305_ietf_ABYTES,
+				NULL,
+				message_nonce,
+				message_key->content);
+	} else {
+		unsigned char * const message_nonce = reserved_field(packet, &packet_struct.packet_header.message_nonce);
+		random_bytes(message_nonce, MESSAGE_NONCE_SIZE);
+		status_int = crypto_secretbox_detached(
+				encrypted_message + crypto_secretbox_MACBYTES,
+				encrypted_message,
+				encrypted_message + crypto_secretbox_MACBYTES,
+				padded_message_length,
+				message_nonce,
+				message_key->content);
+	}
 	if (status_int != 0) {
 		throw(ENCRYPT_ERROR, "Failed to encrypt message.");
 	}
 
-	//add the encrypted message to the protobuf struct
-	packet_struct.has_encrypted_message = true;
-	packet_struct.encrypted_message.data = encrypted_message->content;
-	packet_struct.encrypted_message.len = encrypted_message->content_length;
+cleanup:
+	on_error {
+		if ((packet != NULL) && !packet->readonly) {
+			buffer_clear(packet);
+			packet->content_length = 0;
+		}
+	}
+
+	trace_end("packet_encrypt", trace_start);
+
+	return status;
+}
+
+return_status packet_encrypt(
+		//output
+		buffer_t ** const packet,
+		//inputs
+		const molch_message_type packet_type,
+		const uint32_t protocol_version,
+		const molch_padding padding,
+		const buffer_t * const axolotl_header,
+		const buffer_t * const axolotl_header_key, //HEADER_KEY_SIZE
+		const buffer_t * const message,
+		const buffer_t * const message_key, //MESSAGE_KEY_SIZE
+		//optional inputs (prekey messages only)
+		const buffer_t * const public_identity_key,
+		const buffer_t * const public_ephemeral_key,
+		const buffer_t * const public_prekey,
+		//optional input (PROTOCOL_VERSION_ROUTED only)
+		const buffer_t * const routing_tag) {
+	return_status status = return_status_init();
 
-	//calculate the required length
-	const size_t packed_length = packet__get_packed_size(&packet_struct);
+	//check the input
+	if ((packet == NULL) || (axolotl_header == NULL) || (message == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to packet_encrypt.");
+	}
+	*packet = NULL;
 
-	//pack the packet
+	//the only allocation, everything is written in place
+	const size_t packed_length = packet_get_encrypted_length(packet_type, protocol_version, padding, axolotl_header->content_length, message->content_length);
 	*packet = buffer_create_on_heap(packed_length, 0);
 	throw_on_failed_alloc(*packet);
-	(*packet)->content_length = packet__pack(&packet_struct, (*packet)->content);
-	if ((*packet)->content_length != packed_length) {
-		throw(PROTOBUF_PACK_ERROR, "Packet packet has incorrect length.");
-	}
+
+	status = packet_encrypt_into(
+			*packet,
+			packet_type,
+			protocol_version,
+			padding,
+			axolotl_header,
+			axolotl_header_key,
+			message,
+			message_key,
+			public_identity_key,
+			public_ephemeral_key,
+			public_prekey,
+			routing_tag);
+	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt packet.");
 
 cleanup:
 	on_error {
@@ -286,12 +541,6 @@ cleanup:
 		}
 	}
 
-	buffer_destroy_from_heap_and_null_if_valid(header_nonce);
-	buffer_destroy_from_heap_and_null_if_valid(message_nonce);
-	buffer_destroy_from_heap_and_null_if_valid(encrypted_axolotl_header);
-	buffer_destroy_from_heap_and_null_if_valid(padded_message);
-	buffer_destroy_from_heap_and_null_if_valid(encrypted_message);
-
 	return status;
 }
 
@@ -320,28 +569,38 @@ return_status packet_decrypt(
 		*message = NULL;
 	}
 
+	//check input
+	if (packet == NULL) {
+		throw(INVALID_INPUT, "Invalid input to packet_decrypt.");
+	}
+
+	//unpack the packet only once
+	packet_view packet_struct;
+	status = packet_unpack(&packet_struct, packet);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+
 	//get metadata
-	status = packet_get_metadata_without_verification(
+	status = packet_get_metadata_from_view(
 			current_protocol_version,
 			highest_supported_protocol_version,
 			packet_type,
-			packet,
+			&packet_struct,
 			public_identity_key,
 			public_ephemeral_key,
 			public_prekey);
 	throw_on_error(DATA_FETCH_ERROR, "Failed to get metadata from the packet.");
 
 	//decrypt the header
-	status = packet_decrypt_header(
+	status = packet_decrypt_header_from_view(
 			axolotl_header,
-			packet,
+			&packet_struct,
 			axolotl_header_key);
 	throw_on_error(DECRYPT_ERROR, "Failed to decrypt header.");
 
 	//decrypt the message
-	status = packet_decrypt_message(
+	status = packet_decrypt_message_from_view(
 			message,
-			packet,
+			&packet_struct,
 			message_key);
 	throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
 
@@ -375,13 +634,13 @@ cleanup:
 	return status;
 }
 
-return_status packet_get_metadata_without_verification(
+return_status packet_get_metadata_from_view(
 		//outputs
 		uint32_t * const current_protocol_version,
 		uint32_t * const highest_supported_protocol_version,
 		molch_message_type * const packet_type,
 		//input
-		const buffer_t * const packet,
+		const packet_view * const packet,
 		//optional outputs (prekey messages only)
 		buffer_t * const public_identity_key, //PUBLIC_KEY_SIZE
 		buffer_t * const public_ephemeral_key, //PUBLIC_KEY_SIZE
@@ -389,46 +648,37 @@ return_status packet_get_metadata_without_verification(
 		) {
 	return_status status = return_status_init();
 
-	Packet *packet_struct = NULL;
-
 	//check input
 	if ((current_protocol_version == NULL) || (highest_supported_protocol_version == NULL)
 			|| (packet_type == NULL)
 			|| (packet == NULL)) {
-		throw(INVALID_INPUT, "Invalid input to packet_get_metadata_without_verification.");
+		throw(INVALID_INPUT, "Invalid input to packet_get_metadata_from_view.");
 	}
 
-	status = packet_unpack(&packet_struct, packet);
-	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
-
-	if (packet_struct->packet_header->packet_type == PACKET_HEADER__PACKET_TYPE__PREKEY_MESSAGE) {
+	if (packet->packet_header.packet_type == PACKET_HEADER__PACKET_TYPE__PREKEY_MESSAGE) {
 		//copy the public keys
 		if (public_identity_key != NULL) {
-			if (buffer_clone_from_raw(public_identity_key, packet_struct->packet_header->public_identity_key.data, packet_struct->packet_header->public_identity_key.len) != 0) {
+			if (buffer_clone_from_raw(public_identity_key, packet->packet_header.public_identity_key.data, packet->packet_header.public_identity_key.length) != 0) {
 				throw(BUFFER_ERROR, "Failed to copy public identity key.");
 			}
 		}
 		if (public_ephemeral_key != NULL) {
-			if (buffer_clone_from_raw(public_ephemeral_key, packet_struct->packet_header->public_ephemeral_key.data, packet_struct->packet_header->public_ephemeral_key.len) != 0) {
+			if (buffer_clone_from_raw(public_ephemeral_key, packet->packet_header.public_ephemeral_key.data, packet->packet_header.public_ephemeral_key.length) != 0) {
 				throw(BUFFER_ERROR, "Failed to copy public ephemeral key.");
 			}
 		}
 		if (public_prekey != NULL) {
-			if (buffer_clone_from_raw(public_prekey, packet_struct->packet_header->public_prekey.data, packet_struct->packet_header->public_prekey.len) != 0) {
+			if (buffer_clone_from_raw(public_prekey, packet->packet_header.public_prekey.data, packet->packet_header.public_prekey.length) != 0) {
 				throw(BUFFER_ERROR, "Failed to copy public prekey.");
 			}
 		}
 	}
 
-	*current_protocol_version = packet_struct->packet_header->current_protocol_version;
-	*highest_supported_protocol_version = packet_struct->packet_header->highest_supported_protocol_version;
-	*packet_type = to_molch_message_type(packet_struct->packet_header->packet_type);
+	*current_protocol_version = packet->packet_header.current_protocol_version;
+	*highest_supported_protocol_version = packet->packet_header.highest_supported_protocol_version;
+	*packet_type = to_molch_message_type(packet->packet_header.packet_type);
 
 cleanup:
-	if (packet_struct != NULL) {
-		packet__free_unpacked(packet_struct, &protobuf_c_allocators);
-	}
-
 	on_error {
 		//make sure that incomplete data can't be accidentally used
 		if (public_identity_key != NULL) {
@@ -451,69 +701,146 @@ cleanup:
 	return status;
 }
 
-return_status packet_decrypt_header(
+return_status packet_get_metadata_without_verification(
+		//outputs
+		uint32_t * const current_protocol_version,
+		uint32_t * const highest_supported_protocol_version,
+		molch_message_type * const packet_type,
+		//input
+		const buffer_t * const packet,
+		//optional outputs (prekey messages only)
+		buffer_t * const public_identity_key, //PUBLIC_KEY_SIZE
+		buffer_t * const public_ephemeral_key, //PUBLIC_KEY_SIZE
+		buffer_t * const public_prekey //PUBLIC_KEY_SIZE
+		) {
+	return_status status = return_status_init();
+
+	packet_view packet_struct;
+
+	//check input
+	if (packet == NULL) {
+		throw(INVALID_INPUT, "Invalid input to packet_get_metadata_without_verification.");
+	}
+
+	status = packet_unpack(&packet_struct, packet);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+
+	status = packet_get_metadata_from_view(
+			current_protocol_version,
+			highest_supported_protocol_version,
+			packet_type,
+			&packet_struct,
+			public_identity_key,
+			public_ephemeral_key,
+			public_prekey);
+	throw_on_error(DATA_FETCH_ERROR, "Failed to get metadata from the packet.");
+
+cleanup:
+	on_error {
+		if (packet_type != NULL) {
+			*packet_type = INVALID;
+		}
+	}
+
+	return status;
+}
+
+return_status packet_decrypt_header_from_view(
 		//output
 		buffer_t ** const axolotl_header,
 		//inputs
-		const buffer_t * const packet,
+		const packet_view * const packet,
 		const buffer_t * const axolotl_header_key //HEADER_KEY_SIZE
 		) {
 	return_status status = return_status_init();
-
-	Packet *packet_struct = NULL;
+	const uint64_t trace_start = trace_begin();
 
 	//check input
 	if ((axolotl_header == NULL)
 			|| (packet == NULL)
 			|| (axolotl_header_key == NULL) || (axolotl_header_key->content_length != HEADER_KEY_SIZE)) {
-		throw(INVALID_INPUT, "Invalid input to packet_decrypt_header.");
+		throw(INVALID_INPUT, "Invalid input to packet_decrypt_header_from_view.");
 	}
 
-	status = packet_unpack(&packet_struct, packet);
-	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
-
-	if (packet_struct->encrypted_axolotl_header.len < crypto_secretbox_MACBYTES) {
+	if (packet->encrypted_axolotl_header.length < crypto_secretbox_MACBYTES) {
 		throw(INCORRECT_BUFFER_SIZE, "The ciphertext of the axolotl header is too short.")
 	}
 
-	const size_t axolotl_header_length = packet_struct->encrypted_axolotl_header.len - crypto_secretbox_MACBYTES;
+	const size_t axolotl_header_length = packet->encrypted_axolotl_header.length - crypto_secretbox_MACBYTES;
 	*axolotl_header = buffer_create_on_heap(axolotl_header_length, axolotl_header_length);
 	throw_on_failed_alloc(*axolotl_header);
 
-	int status_int = crypto_secretbox_open_easy(
-			(*axolotl_header)->content,
-			packet_struct->encrypted_axolotl_header.data,
-			packet_struct->encrypted_axolotl_header.len,
-			packet_struct->packet_header->header_nonce.data,
-			axolotl_header_key->content);
+	int status_int;
+	if (is_compact(packet->packet_header.current_protocol_version)) {
+		status_int = crypto_aead_xchacha20poly1305_ietf_decrypt_detached(
+				(*axolotl_header)->content,
+				NULL,
+				packet->encrypted_axolotl_header.data + crypto_aead_xchacha20poly1305_ietf_ABYTES,
+				axolotl_header_length,
+				packet->encrypted_axolotl_header.data,
+				packet->authenticated_data.data,
+				packet->authenticated_data.length,
+				packet->packet_header.header_nonce.data,
+				axolotl_header_key->content);
+	} else {
+		status_int = crypto_secretbox_open_easy(
+				(*axolotl_header)->content,
+				packet->encrypted_axolotl_header.data,
+				packet->encrypted_axolotl_header.length,
+				packet->packet_header.header_nonce.data,
+				axolotl_header_key->content);
+	}
 	if (status_int != 0) {
 		throw(DECRYPT_ERROR, "Failed to decrypt axolotl header.");
 	}
 
 cleanup:
-	if (packet_struct != NULL) {
-		packet__free_unpacked(packet_struct, &protobuf_c_allocators);
-	}
-
 	on_error {
 		if (axolotl_header != NULL) {
 			buffer_destroy_from_heap_and_null_if_valid(*axolotl_header);
 		}
 	}
 
+	trace_end("packet_decrypt_header", trace_start);
+
 	return status;
 }
 
-return_status packet_decrypt_message(
+return_status packet_decrypt_header(
 		//output
-		buffer_t ** const message,
+		buffer_t ** const axolotl_header,
 		//inputs
 		const buffer_t * const packet,
-		const buffer_t * const message_key
+		const buffer_t * const axolotl_header_key //HEADER_KEY_SIZE
 		) {
 	return_status status = return_status_init();
 
-	Packet *packet_struct = NULL;
+	packet_view packet_struct;
+
+	//check input
+	if (packet == NULL) {
+		throw(INVALID_INPUT, "Invalid input to packet_decrypt_header.");
+	}
+
+	status = packet_unpack(&packet_struct, packet);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+
+	status = packet_decrypt_header_from_view(axolotl_header, &packet_struct, axolotl_header_key);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt header.");
+
+cleanup:
+	return status;
+}
+
+return_status packet_decrypt_message_from_view(
+		//output
+		buffer_t ** const message,
+		//inputs
+		const packet_view * const packet,
+		const buffer_t * const message_key
+		) {
+	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
 
 	buffer_t *padded_message = NULL;
 
@@ -521,54 +848,85 @@ return_status packet_decrypt_message(
 	if ((message == NULL)
 		|| (packet == NULL)
 		|| (message_key == NULL) || (message_key->content_length != MESSAGE_KEY_SIZE)) {
-		throw(INVALID_INPUT, "Invalid input to packet_decrypt_message.")
+		throw(INVALID_INPUT, "Invalid input to packet_decrypt_message_from_view.")
 	}
 
-	status = packet_unpack(&packet_struct, packet);
-	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
-
-	if (packet_struct->encrypted_message.len < crypto_secretbox_MACBYTES) {
+	if (packet->encrypted_message.length < crypto_secretbox_MACBYTES) {
 		throw(INCORRECT_BUFFER_SIZE, "The ciphertext of the message is too short.");
 	}
 
-	const size_t padded_message_length = packet_struct->encrypted_message.len - crypto_secretbox_MACBYTES;
-	if (padded_message_length < 255) {
+	const bool length_prefix = (packet->packet_header.current_protocol_version != PROTOCOL_VERSION_PKCS7_PADDING);
+	const size_t padded_message_length = packet->encrypted_message.length - crypto_secretbox_MACBYTES;
+	if (padded_message_length < (length_prefix ? PADDING_PREFIX_SIZE : 255)) {
 		throw(INCORRECT_BUFFER_SIZE, "The padded message is too short.")
 	}
-	padded_message = buffer_create_on_heap(padded_message_length, padded_message_length);
+	padded_message = buffer_create_with_custom_allocator(padded_message_length, padded_message_length, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(padded_message);
 
-	int status_int = crypto_secretbox_open_easy(
-			padded_message->content,
-			packet_struct->encrypted_message.data,
-			packet_struct->encrypted_message.len,
-			packet_struct->packet_header->message_nonce.data,
-			message_key->content);
+	int status_int;
+	if (is_compact(packet->packet_header.current_protocol_version)) {
+		if (packet->encrypted_axolotl_header.length < crypto_aead_xchacha20poly1305_ietf_ABYTES) {
+			throw(INCORRECT_BUFFER_SIZE, "The ciphertext of the axolotl header is too short.")
+		}
+		unsigned char message_nonce[MESSAGE_NONCE_SIZE];
+		if (derive_message_nonce(message_nonce, packet->packet_header.header_nonce.data, message_key) != 0) {
+			throw(GENERIC_ERROR, "Failed to derive message nonce.");
+		}
+		status_int = crypto_aead_xchacha20poly1305_ietf_decrypt_detached(
+				padded_message->content,
+				NULL,
+				packet->encrypted_message.data + crypto_aead_xchacha20poly1305_ietf_ABYTES,
+				padded_message_length,
+				packet->encrypted_message.data,
+				packet->encrypted_axolotl_header.data,
+				crypto_aead_xchacha20poly1305_ietf_ABYTES,
+				message_nonce,
+				message_key->content);
+	} else {
+		status_int = crypto_secretbox_open_easy(
+				padded_message->content,
+				packet->encrypted_message.data,
+				packet->encrypted_message.length,
+				packet->packet_header.message_nonce.data,
+				message_key->content);
+	}
 	if (status_int != 0) {
 		throw(DECRYPT_ERROR, "Failed to decrypt message.");
 	}
 
-	//get the padding (last byte)
-	unsigned char padding = padded_message->content[padded_message->content_length - 1];
-	if (padding > padded_message->content_length) {
-		throw(INCORRECT_BUFFER_SIZE, "The padded message is too short.")
+	size_t message_offset = 0;
+	size_t message_length = 0;
+	if (length_prefix) {
+		//big endian length, followed by the message and zeroes
+		const unsigned char * const prefix = padded_message->content;
+		message_length = ((size_t)prefix[0] << 24) | ((size_t)prefix[1] << 16) | ((size_t)prefix[2] << 8) | (size_t)prefix[3];
+		if (message_length > (padded_message->content_length - PADDING_PREFIX_SIZE)) {
+			throw(INCORRECT_BUFFER_SIZE, "The padded message is too short.")
+		}
+		message_offset = PADDING_PREFIX_SIZE;
+		const size_t padding_offset = message_offset + message_length;
+		if (!sodium_is_zero(padded_message->content + padding_offset, padded_message->content_length - padding_offset)) {
+			throw(INVALID_VALUE, "The padding is invalid.");
+		}
+	} else {
+		//get the padding (last byte)
+		unsigned char padding = padded_message->content[padded_message->content_length - 1];
+		if (padding > padded_message->content_length) {
+			throw(INCORRECT_BUFFER_SIZE, "The padded message is too short.")
+		}
+		message_length = padded_message->content_length - padding;
 	}
 
 	//extract the message
-	const size_t message_length = padded_message->content_length - padding;
 	*message = buffer_create_on_heap(message_length, 0);
 	throw_on_failed_alloc(*message);
 	//TODO this doesn't need to be copied, setting the length should be enough
-	if (buffer_copy(*message, 0, padded_message, 0, message_length) != 0) {
+	if ((message_length != 0) && (buffer_copy(*message, 0, padded_message, message_offset, message_length) != 0)) {
 		throw(BUFFER_ERROR, "Failed to copy message from padded message.");
 	}
 
 cleanup:
-	if (packet_struct != NULL) {
-		packet__free_unpacked(packet_struct, &protobuf_c_allocators);
-	}
-
-	buffer_destroy_from_heap_and_null_if_valid(padded_message);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(padded_message, zeroed_free);
 
 	on_error {
 		if (message != NULL) {
@@ -576,5 +934,33 @@ cleanup:
 		}
 	}
 
+	trace_end("packet_decrypt_message", trace_start);
+
+	return status;
+}
+
+return_status packet_decrypt_message(
+		//output
+		buffer_t ** const message,
+		//inputs
+		const buffer_t * const packet,
+		const buffer_t * const message_key
+		) {
+	return_status status = return_status_init();
+
+	packet_view packet_struct;
+
+	//check input
+	if (packet == NULL) {
+		throw(INVALID_INPUT, "Invalid input to packet_decrypt_message.");
+	}
+
+	status = packet_unpack(&packet_struct, packet);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+
+	status = packet_decrypt_message_from_view(message, &packet_struct, message_key);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
+
+cleanup:
 	return status;
 }
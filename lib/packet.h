@@ -25,12 +25,30 @@
 #include "../buffer/buffer.h"
 #include "common.h"
 #include "molch.h"
+#include "wire.h"
 
 /*! \file
  * Theses functions create a packet from a packet header, encryption keys, an azolotl header and a
  * message. Also the other way around extracting data from a packet and decrypting its contents.
  */
 
+/*!
+ * Unpacks a packet into a view and verifies that all the necessary
+ * fields exist. Nothing is copied, the view points into the packet.
+ *
+ * The receive path unpacks a packet once and passes the view to the
+ * *_from_view functions below.
+ *
+ * \param packet_struct
+ *   The unpacked view.
+ * \param packet
+ *   The binary packet.
+ *
+ * \return
+ *   Error status, destroy with return_status_destroy_errors if an error occurs.
+ */
+return_status packet_unpack(packet_view * const packet_struct, const buffer_t * const packet) __attribute__((warn_unused_result));
+
 /*!
  * Construct and encrypt a packet given the keys and metadata.
  *
@@ -38,6 +56,14 @@
  *   The encrypted packet.
  * \param packet_type
  *   The type of the packet (prekey message, normal message ...)
+ * \param protocol_version
+ *   The protocol version of the packet, the receiver has to support it.
+ *   PROTOCOL_VERSION_COMPACT packets have no protobuf framing, a derived
+ *   message nonce and authenticate the unencrypted metadata.
+ *   PROTOCOL_VERSION_ROUTED packets are compact packets with a routing tag.
+ * \param padding
+ *   How the message is padded, PROTOCOL_VERSION_PKCS7_PADDING only
+ *   supports MOLCH_PADDING_BLOCKS.
  * \param axolotl_header
  *   The axolotl header containing all the necessary information for the ratchet.
  * \param axolotl_header_key
@@ -52,6 +78,8 @@
  *   The public ephemeral key of the sender in case of prekey messages. Optional for normal messages.
  * \param public_prekey
  *   The prekey of the receiver that has been selected by the sender in case of prekey messages. Optional for normal messages.
+ * \param routing_tag
+ *   ROUTING_TAG_SIZE bytes, see routing_derive_tags. Only for PROTOCOL_VERSION_ROUTED, NULL otherwise.
  *
  * \return
  *   Error status, destroy with return_status_destroy_errors if an error occurs.
@@ -61,6 +89,55 @@ return_status packet_encrypt(
 		buffer_t ** const packet,
 		//inputs
 		const molch_message_type packet_type,
+		const uint32_t protocol_version,
+		const molch_padding padding,
+		const buffer_t * const axolotl_header,
+		const buffer_t * const axolotl_header_key, //HEADER_KEY_SIZE
+		const buffer_t * const message,
+		const buffer_t * const message_key, //MESSAGE_KEY_SIZE
+		//optional inputs (prekey messages only)
+		const buffer_t * const public_identity_key,
+		const buffer_t * const public_ephemeral_key,
+		const buffer_t * const public_prekey,
+		//optional input (PROTOCOL_VERSION_ROUTED only)
+		const buffer_t * const routing_tag) __attribute__((warn_unused_result));
+
+/*!
+ * Length of the packet that packet_encrypt creates.
+ *
+ * \param packet_type
+ *   The type of the packet (prekey message, normal message ...)
+ * \param protocol_version
+ *   The protocol version of the packet.
+ * \param padding
+ *   How the message is padded.
+ * \param axolotl_header_length
+ *   Length of the unencrypted axolotl header.
+ * \param message_length
+ *   Length of the unpadded message.
+ *
+ * \return
+ *   The length of the packet.
+ */
+size_t packet_get_encrypted_length(
+		const molch_message_type packet_type,
+		const uint32_t protocol_version,
+		const molch_padding padding,
+		const size_t axolotl_header_length,
+		const size_t message_length);
+
+/*!
+ * Same as packet_encrypt, but writes into an existing buffer that is at
+ * least packet_get_encrypted_length long. The message is padded and
+ * encrypted in place inside of the packet, nothing is allocated.
+ */
+return_status packet_encrypt_into(
+		//output
+		buffer_t * const packet,
+		//inputs
+		const molch_message_type packet_type,
+		const uint32_t protocol_version,
+		const molch_padding padding,
 		const buffer_t * const axolotl_header,
 		const buffer_t * const axolotl_header_key, //HEADER_KEY_SIZE
 		const buffer_t * const message,
@@ -68,7 +145,9 @@ return_status packet_encrypt(
 		//optional inputs (prekey messages only)
 		const buffer_t * const public_identity_key,
 		const buffer_t * const public_ephemeral_key,
-		const buffer_t * const public_prekey) __attribute__((warn_unused_result));
+		const buffer_t * const public_prekey,
+		//optional input (PROTOCOL_VERSION_ROUTED only)
+		const buffer_t * const routing_tag) __attribute__((warn_unused_result));
 
 /*!
  * Extract and decrypt a packet and the metadata inside of it.
@@ -95,6 +174,8 @@ return_status packet_encrypt(
  *   The public ephemeral key of the sender in case of prekey messages. Optional for normal messages.
  * \param public_prekey
  *   The prekey of the receiver that has been selected by the sender in case of prekey messages. Optional for normal messages.
+ * \param routing_tag
+ *   ROUTING_TAG_SIZE bytes, see routing_derive_tags. Only for PROTOCOL_VERSION_ROUTED, NULL otherwise.
  *
  * \return
  *   Error status, destroy with return_status_destroy_errors if an error occurs.
@@ -132,6 +213,8 @@ return_status packet_decrypt(
  *   The public ephemeral key of the sender in case of prekey messages. Optional for normal messages.
  * \param public_prekey
  *   The prekey of the receiver that has been selected by the sender in case of prekey messages. Optional for normal messages.
+ * \param routing_tag
+ *   ROUTING_TAG_SIZE bytes, see routing_derive_tags. Only for PROTOCOL_VERSION_ROUTED, NULL otherwise.
  *
  * \return
  *   Error status, destroy with return_status_destroy_errors if an error occurs.
@@ -149,6 +232,22 @@ return_status packet_get_metadata_without_verification(
 		buffer_t * const public_prekey //PUBLIC_KEY_SIZE
 		) __attribute__((warn_unused_result));
 
+/*!
+ * Same as packet_get_metadata_without_verification, but with an already unpacked packet.
+ */
+return_status packet_get_metadata_from_view(
+		//outputs
+		uint32_t * const current_protocol_version,
+		uint32_t * const highest_supported_protocol_version,
+		molch_message_type * const packet_type,
+		//input
+		const packet_view * const packet,
+		//optional outputs (prekey messages only)
+		buffer_t * const public_identity_key, //PUBLIC_KEY_SIZE
+		buffer_t * const public_ephemeral_key, //PUBLIC_KEY_SIZE
+		buffer_t * const public_prekey //PUBLIC_KEY_SIZE
+		) __attribute__((warn_unused_result));
+
 /*!
  * Decrypt the axolotl header part of a packet and thereby authenticate other metadata.
  *
@@ -170,6 +269,17 @@ return_status packet_decrypt_header(
 		const buffer_t * const axolotl_header_key //HEADER_KEY_SIZE
 		) __attribute__((warn_unused_result));
 
+/*!
+ * Same as packet_decrypt_header, but with an already unpacked packet.
+ */
+return_status packet_decrypt_header_from_view(
+		//output
+		buffer_t ** const axolotl_header,
+		//inputs
+		const packet_view * const packet,
+		const buffer_t * const axolotl_header_key //HEADER_KEY_SIZE
+		) __attribute__((warn_unused_result));
+
 /*!
  * Decrypt the message part of a packet.
  *
@@ -191,4 +301,15 @@ return_status packet_decrypt_message(
 		const buffer_t * const message_key
 		) __attribute__((warn_unused_result));
 
+/*!
+ * Same as packet_decrypt_message, but with an already unpacked packet.
+ */
+return_status packet_decrypt_message_from_view(
+		//output
+		buffer_t ** const message,
+		//inputs
+		const packet_view * const packet,
+		const buffer_t * const message_key
+		) __attribute__((warn_unused_result));
+
 #endif
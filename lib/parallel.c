@@ -0,0 +1,84 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "allocators.h"
+
+/*
+ * Shared by the threads of a batch, every thread takes the next
+ * index until all of them are done.
+ */
+typedef struct parallel_batch {
+	size_t count;
+	size_t next; //taken atomically
+	parallel_function function;
+	void *argument;
+} parallel_batch;
+
+static void *work(void *argument) {
+	parallel_batch * const batch = (parallel_batch*)argument;
+
+	for (size_t i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+			i < batch->count;
+			i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) {
+		batch->function(i, batch->argument);
+	}
+
+	return NULL;
+}
+
+void parallel_for(const size_t count, const size_t thread_count, const parallel_function function, void * const argument) {
+	parallel_batch batch = {count, 0, function, argument};
+
+	pthread_t *threads = NULL;
+	size_t started_threads = 0;
+	const size_t helpers = (thread_count < count) ? (thread_count - 1) : (count - 1);
+	if ((count > 1) && (thread_count > 1)) {
+		threads = public_malloc(helpers * sizeof(pthread_t));
+	}
+	if (threads != NULL) {
+		for (; started_threads < helpers; started_threads++) {
+			if (pthread_create(&threads[started_threads], NULL, work, &batch) != 0) {
+				break;
+			}
+		}
+	}
+
+	work(&batch);
+
+	for (size_t i = 0; i < started_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	public_free(threads);
+}
+
+size_t parallel_default_thread_count() {
+	const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (processors > 0) ? (size_t)processors : 1;
+}
@@ -0,0 +1,54 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*! \file
+ * Run independent pieces of work of a batch on several threads.
+ *
+ * Used by the batch calls (e.g. molch_start_receive_conversations) to
+ * spread the public key operations of a batch across cores. The threads
+ * only live for one batch, the calling thread works as well.
+ */
+
+#include <stddef.h>
+
+#ifndef LIB_PARALLEL_H
+#define LIB_PARALLEL_H
+
+/*
+ * Called once for every index of a batch, from any of the threads.
+ */
+typedef void (*parallel_function)(const size_t index, void * const argument);
+
+/*
+ * Call 'function' for every index from 0 to 'count' - 1 on up to
+ * 'thread_count' threads (including the calling one) and wait until
+ * all of them are done. If threads can't be started, the remaining
+ * ones (at least the calling thread) do their share.
+ */
+void parallel_for(const size_t count, const size_t thread_count, const parallel_function function, void * const argument);
+
+/*
+ * Number of threads to use if the caller doesn't choose one,
+ * one per online processor.
+ */
+size_t parallel_default_thread_count();
+
+#endif
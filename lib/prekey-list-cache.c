@@ -0,0 +1,145 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <pthread.h>
+#include <sodium.h>
+
+#include "prekey-list-cache.h"
+
+typedef struct prekey_list_cache_entry {
+	unsigned char hash[PREKEY_LIST_CACHE_HASH_SIZE];
+	unsigned char public_identity_key[PUBLIC_KEY_SIZE];
+	time_t expiration_date;
+	uint64_t last_used; //0 if the entry is empty
+} prekey_list_cache_entry;
+
+static prekey_list_cache_entry entries[PREKEY_LIST_CACHE_SIZE];
+static uint64_t use_counter = 0; //incremented on every use
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int prekey_list_cache_hash(
+		unsigned char * const hash,
+		const buffer_t * const public_signing_key,
+		const unsigned char * const prekey_list,
+		const size_t prekey_list_length) {
+	if ((hash == NULL) || (public_signing_key == NULL) || (prekey_list == NULL)) {
+		return -1;
+	}
+
+	crypto_generichash_state state;
+	if ((crypto_generichash_init(&state, NULL, 0, PREKEY_LIST_CACHE_HASH_SIZE) != 0)
+			|| (crypto_generichash_update(&state, public_signing_key->content, public_signing_key->content_length) != 0)
+			|| (crypto_generichash_update(&state, prekey_list, (unsigned long long)prekey_list_length) != 0)
+			|| (crypto_generichash_final(&state, hash, PREKEY_LIST_CACHE_HASH_SIZE) != 0)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Find the entry with a given hash, NULL if there is none.
+ * The cache has to be locked.
+ */
+static prekey_list_cache_entry *find_entry(const unsigned char * const hash) {
+	for (size_t i = 0; i < PREKEY_LIST_CACHE_SIZE; i++) {
+		if ((entries[i].last_used != 0) && (memcmp(entries[i].hash, hash, PREKEY_LIST_CACHE_HASH_SIZE) == 0)) {
+			return &entries[i];
+		}
+	}
+
+	return NULL;
+}
+
+bool prekey_list_cache_find(
+		buffer_t * const public_identity_key,
+		const unsigned char * const hash,
+		const time_t now) {
+	if ((public_identity_key == NULL) || (hash == NULL)) {
+		return false;
+	}
+
+	bool found = false;
+
+	pthread_mutex_lock(&cache_lock);
+	prekey_list_cache_entry * const entry = find_entry(hash);
+	if (entry == NULL) {
+		goto cleanup;
+	}
+
+	if (entry->expiration_date < now) {
+		//the list has to be verified again, which fails
+		entry->last_used = 0;
+		goto cleanup;
+	}
+
+	if (buffer_copy_from_raw(public_identity_key, 0, entry->public_identity_key, 0, PUBLIC_KEY_SIZE) != 0) {
+		goto cleanup;
+	}
+	entry->last_used = ++use_counter;
+	found = true;
+
+cleanup:
+	pthread_mutex_unlock(&cache_lock);
+
+	return found;
+}
+
+void prekey_list_cache_add(
+		const unsigned char * const hash,
+		const buffer_t * const public_identity_key,
+		const time_t expiration_date) {
+	if ((hash == NULL) || (public_identity_key == NULL) || (public_identity_key->content_length != PUBLIC_KEY_SIZE)) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+
+	//replace the same list or the least recently used one
+	prekey_list_cache_entry *entry = find_entry(hash);
+	if (entry == NULL) {
+		entry = &entries[0];
+		for (size_t i = 1; (i < PREKEY_LIST_CACHE_SIZE) && (entry->last_used != 0); i++) {
+			if (entries[i].last_used < entry->last_used) {
+				entry = &entries[i];
+			}
+		}
+	}
+
+	memcpy(entry->hash, hash, PREKEY_LIST_CACHE_HASH_SIZE);
+	memcpy(entry->public_identity_key, public_identity_key->content, PUBLIC_KEY_SIZE);
+	entry->expiration_date = expiration_date;
+	entry->last_used = ++use_counter;
+
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void prekey_list_cache_clear() {
+	pthread_mutex_lock(&cache_lock);
+	sodium_memzero(entries, sizeof(entries));
+	use_counter = 0;
+	pthread_mutex_unlock(&cache_lock);
+}
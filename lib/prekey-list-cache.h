@@ -0,0 +1,83 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*! \file
+ * Cache of prekey lists whose signature has already been verified.
+ *
+ * Starting a conversation verifies the Ed25519 signature of the receivers
+ * prekey list. When many conversations are started with the same list
+ * (e.g. to a popular receiver), the verification is only done once: the
+ * cache remembers a hash of the receivers public master key and the signed
+ * list together with the public identity key from the list until the list
+ * expires. The prekeys are read from the signed list itself, which is
+ * covered by the hash.
+ *
+ * The cache holds PREKEY_LIST_CACHE_SIZE lists, the least recently used
+ * one is replaced. It can be used from multiple threads.
+ */
+
+#include <time.h>
+
+#include "constants.h"
+#include "common.h"
+#include "../buffer/buffer.h"
+
+#ifndef LIB_PREKEY_LIST_CACHE_H
+#define LIB_PREKEY_LIST_CACHE_H
+
+#define PREKEY_LIST_CACHE_SIZE 64
+#define PREKEY_LIST_CACHE_HASH_SIZE 32
+
+/*
+ * Hash of a signed prekey list and the public master key it was signed with.
+ *
+ * Returns 0 on success.
+ */
+int prekey_list_cache_hash(
+		unsigned char * const hash, //output, PREKEY_LIST_CACHE_HASH_SIZE
+		const buffer_t * const public_signing_key,
+		const unsigned char * const prekey_list,
+		const size_t prekey_list_length) __attribute__((warn_unused_result));
+
+/*
+ * Look up a verified prekey list by its hash. Copies the public identity
+ * key of the list if it was found and hasn't expired yet.
+ */
+bool prekey_list_cache_find(
+		buffer_t * const public_identity_key, //output, PUBLIC_KEY_SIZE
+		const unsigned char * const hash,
+		const time_t now) __attribute__((warn_unused_result));
+
+/*
+ * Remember a prekey list after its signature has been verified.
+ */
+void prekey_list_cache_add(
+		const unsigned char * const hash,
+		const buffer_t * const public_identity_key,
+		const time_t expiration_date);
+
+/*
+ * Forget all prekey lists.
+ */
+void prekey_list_cache_clear();
+
+#endif
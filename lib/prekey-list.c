@@ -0,0 +1,142 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <time.h>
+#include <sodium.h>
+
+#include "prekey-list.h"
+#include "prekey-list-cache.h"
+#include "endianness.h"
+#include "parallel.h"
+
+/*
+ * Verify prekey list and extract the public identity.
+ *
+ * Lists that have been verified before are found in the
+ * prekey list cache and aren't verified again.
+ */
+return_status verify_prekey_list(
+		const unsigned char * const prekey_list,
+		const size_t prekey_list_length,
+		buffer_t * const public_identity_key, //output, PUBLIC_KEY_SIZE
+		const buffer_t * const public_signing_key
+		) {
+	return_status status = return_status_init();
+
+	buffer_t *verified_prekey_list = NULL;
+
+	int status_int = 0;
+
+	unsigned char hash[PREKEY_LIST_CACHE_HASH_SIZE];
+	status_int = prekey_list_cache_hash(hash, public_signing_key, prekey_list, prekey_list_length);
+	if (status_int != 0) {
+		throw(GENERIC_ERROR, "Failed to hash prekey list.");
+	}
+	if (prekey_list_cache_find(public_identity_key, hash, time(NULL))) {
+		goto cleanup;
+	}
+
+	verified_prekey_list = buffer_create_on_heap(prekey_list_length - SIGNATURE_SIZE, prekey_list_length - SIGNATURE_SIZE);
+	throw_on_failed_alloc(verified_prekey_list);
+
+	//verify the signature
+	unsigned long long verified_length;
+	status_int = crypto_sign_open(
+			verified_prekey_list->content,
+			&verified_length,
+			prekey_list,
+			(unsigned long long)prekey_list_length,
+			public_signing_key->content);
+	if (status_int != 0) {
+		throw(VERIFICATION_FAILED, "Failed to verify prekey list signature.");
+	}
+	verified_prekey_list->content_length = verified_length;
+
+	//get the expiration date
+	time_t expiration_date;
+	buffer_create_with_existing_array(big_endian_expiration_date, verified_prekey_list->content + PUBLIC_KEY_SIZE + PREKEY_AMOUNT * PUBLIC_KEY_SIZE, sizeof(int64_t));
+	status = endianness_time_from_big_endian(&expiration_date, big_endian_expiration_date);
+	throw_on_error(CONVERSION_ERROR, "Failed to convert expiration date to big endian.");
+
+	//make sure the prekey list isn't too old
+	time_t current_time = time(NULL);
+	if (expiration_date < current_time) {
+		throw(OUTDATED, "Prekey list has expired (older than 3 months).");
+	}
+
+	//copy the public identity key
+	status_int = buffer_copy(
+			public_identity_key,
+			0,
+			verified_prekey_list,
+			0,
+			PUBLIC_KEY_SIZE);
+	if (status_int != 0) {
+		throw(BUFFER_ERROR, "Failed to copy public identity.");
+	}
+
+	prekey_list_cache_add(hash, public_identity_key, expiration_date);
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(verified_prekey_list);
+
+	return status;
+}
+
+/*
+ * Inputs and outputs of verify_prekey_lists for the threads.
+ */
+typedef struct prekey_list_batch {
+	return_status *statuses;
+	buffer_t * const *public_identity_keys;
+	const unsigned char * const *prekey_lists;
+	const size_t *prekey_list_lengths;
+	const buffer_t * const *public_signing_keys;
+} prekey_list_batch;
+
+static void verify_batch_entry(const size_t index, void * const argument) {
+	prekey_list_batch * const batch = (prekey_list_batch*)argument;
+
+	batch->statuses[index] = verify_prekey_list(
+			batch->prekey_lists[index],
+			batch->prekey_list_lengths[index],
+			batch->public_identity_keys[index],
+			batch->public_signing_keys[index]);
+}
+
+void verify_prekey_lists(
+		return_status * const statuses,
+		buffer_t * const * const public_identity_keys,
+		const unsigned char * const * const prekey_lists,
+		const size_t * const prekey_list_lengths,
+		const buffer_t * const * const public_signing_keys,
+		const size_t count,
+		const size_t thread_count) {
+	prekey_list_batch batch = {
+		statuses,
+		public_identity_keys,
+		prekey_lists,
+		prekey_list_lengths,
+		public_signing_keys
+	};
+
+	parallel_for(count, thread_count, verify_batch_entry, &batch);
+}
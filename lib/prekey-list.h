@@ -0,0 +1,69 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*! \file
+ * Verification of signed prekey lists.
+ *
+ * A prekey list is the receivers public identity key, PREKEY_AMOUNT public
+ * prekeys and a 64 bit big endian expiration date, signed with the
+ * receivers public master key (Ed25519, signature in front).
+ */
+
+#include "constants.h"
+#include "common.h"
+#include "../buffer/buffer.h"
+
+#ifndef LIB_PREKEY_LIST_H
+#define LIB_PREKEY_LIST_H
+
+/*
+ * Verify prekey list and extract the public identity.
+ *
+ * Lists that have been verified before are found in the
+ * prekey list cache and aren't verified again.
+ */
+return_status verify_prekey_list(
+		const unsigned char * const prekey_list,
+		const size_t prekey_list_length,
+		buffer_t * const public_identity_key, //output, PUBLIC_KEY_SIZE
+		const buffer_t * const public_signing_key
+		) __attribute__((warn_unused_result));
+
+/*
+ * Verify the prekey lists of several receivers at once on up to
+ * 'thread_count' threads.
+ *
+ * Every list is verified on its own and has its own status, so a bad
+ * list doesn't affect the others and doesn't have to be searched for.
+ *
+ * Don't forget to destroy the statuses with return_status_destroy_errors()
+ * if an error has occurred.
+ */
+void verify_prekey_lists(
+		return_status * const statuses, //output, 'count' long
+		buffer_t * const * const public_identity_keys, //output, 'count' long, PUBLIC_KEY_SIZE each
+		const unsigned char * const * const prekey_lists,
+		const size_t * const prekey_list_lengths,
+		const buffer_t * const * const public_signing_keys,
+		const size_t count,
+		const size_t thread_count);
+
+#endif
@@ -24,6 +24,8 @@
 #include <string.h>
 #include "prekey-store.h"
 #include "common.h"
+#include "stats.h"
+#include "random.h"
 
 static const time_t PREKEY_EXPIRATION_TIME = 3600 * 24 * 31; //one month
 static const time_t DEPRECATED_PREKEY_EXPIRATION_TIME = 3600; //one hour
@@ -50,8 +52,9 @@ return_status prekey_store_create(prekey_store ** const store) {
 		throw(INVALID_INPUT, "Invalid input to prekey_store_create.");
 	}
 
-	*store = sodium_malloc(sizeof(prekey_store));
+	*store = key_malloc(sizeof(prekey_store));
 	throw_on_failed_alloc(*store);
+	stats_allocation(MOLCH_STATS_PREKEY_STORES, sizeof(prekey_store));
 
 	//set expiration date to the past --> rotate will create new keys
 	(*store)->oldest_expiration_date = 0;
@@ -69,7 +72,7 @@ return_status prekey_store_create(prekey_store ** const store) {
 
 		//generate the keys
 		int status_int = 0;
-		status_int = crypto_box_keypair(
+		status_int = random_box_keypair(
 				(*store)->prekeys[i].public_key->content,
 				(*store)->prekeys[i].private_key->content);
 		if (status_int != 0) {
@@ -84,7 +87,7 @@ return_status prekey_store_create(prekey_store ** const store) {
 cleanup:
 	on_error {
 		if (store != NULL) {
-				sodium_free_and_null_if_valid(*store);
+				key_free_and_null_if_valid(*store);
 		}
 	}
 
@@ -106,11 +109,12 @@ void node_add(prekey_store * const store, prekey_store_node * const node) {
 int deprecate(prekey_store * const store, size_t index) {
 	int status = 0;
 	//create a new node
-	prekey_store_node *deprecated_node = sodium_malloc(sizeof(prekey_store_node));
+	prekey_store_node *deprecated_node = key_malloc(sizeof(prekey_store_node));
 	if (deprecated_node == NULL) {
 		status = -1;
 		goto cleanup;
 	}
+	stats_allocation(MOLCH_STATS_PREKEY_STORES, sizeof(prekey_store_node));
 
 	//initialise the deprecated node
 	node_init(deprecated_node);
@@ -133,22 +137,51 @@ int deprecate(prekey_store * const store, size_t index) {
 	node_add(store, deprecated_node);
 
 	//generate a new key
-	status = crypto_box_keypair(
+	status = random_box_keypair(
 			store->prekeys[index].public_key->content,
-			store->prekeys[index].public_key->content);
+			store->prekeys[index].private_key->content);
 	if (status != 0) {
 		goto cleanup;
 	}
 	store->prekeys[index].expiration_date = time(NULL) + PREKEY_EXPIRATION_TIME;
 
+	stats_prekey_deprecation();
+
 cleanup:
 	if (status != 0) {
-		sodium_free_and_null_if_valid(deprecated_node);
+		key_free_and_null_if_valid(deprecated_node);
 	}
 
 	return status;
 }
 
+/*
+ * Find the prekey that belongs to a public key, either in the current
+ * prekeys ('index' is set to its position) or in the deprecated ones
+ * ('index' is set to PREKEY_AMOUNT). Returns NULL if there is none.
+ */
+static prekey_store_node *find_prekey(prekey_store * const store, const buffer_t * const public_key, size_t * const index) {
+	//search for the prekey
+	for (size_t i = 0; i < PREKEY_AMOUNT; i++) {
+		if (buffer_compare(public_key, store->prekeys[i].public_key) == 0) {
+			*index = i;
+			return &(store->prekeys[i]);
+		}
+	}
+
+	//if not found, search in the list of deprecated keys.
+	*index = PREKEY_AMOUNT;
+	prekey_store_node *next = store->deprecated_prekeys;
+	while (next != NULL) {
+		if (buffer_compare(public_key, next->public_key) == 0) {
+			return next;
+		}
+		next = next->next;
+	}
+
+	return NULL;
+}
+
 /*
  * Get a private prekey from it's public key. This will automatically
  * deprecate the requested prekey put it in the outdated key store and
@@ -161,36 +194,31 @@ return_status prekey_store_get_prekey(
 
 	return_status status = return_status_init();
 
-	//check buffers sizes
-	if ((store == NULL) || (public_key->content_length != PUBLIC_KEY_SIZE) || (private_key->buffer_length < PRIVATE_KEY_SIZE)) {
-		throw(INVALID_INPUT, "Invalid input for prekey_store_get_prekey.");
-	}
+	bool used[PREKEY_AMOUNT] = {false};
+	status = prekey_store_peek_prekey(store, public_key, private_key, used);
+	throw_on_error(DATA_FETCH_ERROR, "Failed to get private prekey.");
 
-	prekey_store_node *found_prekey = NULL;
+	status = prekey_store_deprecate_used(store, used);
+	throw_on_error(GENERIC_ERROR, "Failed to deprecate prekey.");
 
-	//search for the prekey
-	size_t i;
-	for (i = 0; i < PREKEY_AMOUNT; i++) {
-		if (buffer_compare(public_key, store->prekeys[i].public_key) == 0) {
-			found_prekey = &(store->prekeys[i]);
-			break;
-		}
-	}
+cleanup:
+	return status;
+}
 
-	//if not found, search in the list of deprecated keys.
-	bool deprecated = false;
-	if (found_prekey == NULL) {
-		deprecated = true;
-		prekey_store_node *next = store->deprecated_prekeys;
-		while (next != NULL) {
-			if (buffer_compare(public_key, next->public_key) == 0) {
-				found_prekey = next;
-				break;
-			}
-			next = next->next;
-		}
+return_status prekey_store_peek_prekey(
+		prekey_store * const store,
+		const buffer_t * const public_key, //input
+		buffer_t * const private_key, //output
+		bool * const used) { //input and output, PREKEY_AMOUNT long
+	return_status status = return_status_init();
+
+	//check buffers sizes
+	if ((store == NULL) || (used == NULL) || (public_key->content_length != PUBLIC_KEY_SIZE) || (private_key->buffer_length < PRIVATE_KEY_SIZE)) {
+		throw(INVALID_INPUT, "Invalid input for prekey_store_peek_prekey.");
 	}
 
+	size_t index;
+	prekey_store_node * const found_prekey = find_prekey(store, public_key, &index);
 	if (found_prekey == NULL) {
 		private_key->content_length = 0;
 		throw(NOT_FOUND, "No matching prekey found.");
@@ -202,9 +230,24 @@ return_status prekey_store_get_prekey(
 		throw(BUFFER_ERROR, "Failed to copy private key.");
 	}
 
-	//if the key wasn't in the deprectated list already, deprecate it
-	if (!deprecated) {
-		if (deprecate(store, i) != 0) {
+	//if the key isn't in the deprecated list already, it has to be deprecated
+	if (index < PREKEY_AMOUNT) {
+		used[index] = true;
+	}
+
+cleanup:
+	return status;
+}
+
+return_status prekey_store_deprecate_used(prekey_store * const store, const bool * const used) {
+	return_status status = return_status_init();
+
+	if ((store == NULL) || (used == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to prekey_store_deprecate_used.");
+	}
+
+	for (size_t i = 0; i < PREKEY_AMOUNT; i++) {
+		if (used[i] && (deprecate(store, i) != 0)) {
 			throw(GENERIC_ERROR, "Failed to deprecate prekey.");
 		}
 	}
@@ -311,7 +354,7 @@ return_status prekey_store_rotate(prekey_store * const store) {
 		while(next != NULL) {
 			if (next->expiration_date < current_time) {
 				*last_pointer = next->next;
-				sodium_free_and_null_if_valid(next);
+				key_free_and_null_if_valid(next);
 				next = *last_pointer;
 				continue;
 			} else if (next->expiration_date < new_oldest_deprecated_expiration_date) {
@@ -335,8 +378,10 @@ void prekey_store_destroy(prekey_store * const store) {
 	while (store->deprecated_prekeys != NULL) {
 		prekey_store_node *node = store->deprecated_prekeys;
 		store->deprecated_prekeys = node->next;
-		sodium_free_and_null_if_valid(node);
+		key_free_and_null_if_valid(node);
 	}
+
+	key_free(store);
 }
 
 /*!
@@ -574,8 +619,9 @@ return_status prekey_store_import(
 		throw(INVALID_INPUT, "Invalid input to prekey_store_import");
 	}
 
-	*store = sodium_malloc(sizeof(prekey_store));
+	*store = key_malloc(sizeof(prekey_store));
 	throw_on_failed_alloc(*store);
+	stats_allocation(MOLCH_STATS_PREKEY_STORES, sizeof(prekey_store));
 
 	//init the store
 	(*store)->deprecated_prekeys = NULL;
@@ -596,8 +642,9 @@ return_status prekey_store_import(
 
 	//add the deprecated prekeys
 	for (size_t i = 1; i <= deprecated_keypairs_length; i++) {
-		deprecated_keypair = sodium_malloc(sizeof(prekey_store_node));
+		deprecated_keypair = key_malloc(sizeof(prekey_store_node));
 		throw_on_failed_alloc(deprecated_keypair);
+		stats_allocation(MOLCH_STATS_PREKEY_STORES, sizeof(prekey_store_node));
 
 		status = prekey_store_node_import(deprecated_keypair, deprecated_keypairs[deprecated_keypairs_length - i]);
 		throw_on_error(IMPORT_ERROR, "Failed to import deprecated prekey.");
@@ -616,9 +663,10 @@ cleanup:
 	on_error {
 		if ((store != NULL) && (*store != NULL)) {
 			prekey_store_destroy(*store);
+			*store = NULL;
 		}
 
-		sodium_free_and_null_if_valid(deprecated_keypair);
+		key_free_and_null_if_valid(deprecated_keypair);
 	}
 
 	return status;
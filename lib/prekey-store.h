@@ -62,6 +62,24 @@ return_status prekey_store_get_prekey(
 		const buffer_t * const public_key, //input
 		buffer_t * const private_key) __attribute__((warn_unused_result)); //output
 
+/*
+ * Get a private prekey from it's public key like prekey_store_get_prekey,
+ * but only mark it in 'used' instead of deprecating it right away. This way
+ * the prekeys used by a batch of messages are deprecated once with
+ * prekey_store_deprecate_used, even if several messages use the same one.
+ */
+return_status prekey_store_peek_prekey(
+		prekey_store * const store,
+		const buffer_t * const public_key, //input
+		buffer_t * const private_key, //output
+		bool * const used) __attribute__((warn_unused_result)); //input and output, PREKEY_AMOUNT long
+
+/*
+ * Deprecate the prekeys marked in 'used' (PREKEY_AMOUNT long) by
+ * prekey_store_peek_prekey and generate new ones.
+ */
+return_status prekey_store_deprecate_used(prekey_store * const store, const bool * const used) __attribute__((warn_unused_result));
+
 /*
  * Generate a list containing all public prekeys.
  * (this list can then be stored on a public server).
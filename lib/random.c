@@ -0,0 +1,215 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sodium.h>
+
+#include "random.h"
+
+#define RANDOM_KEY_SIZE crypto_stream_chacha20_KEYBYTES
+
+/*
+ * State of the generator of one thread, allocated with key_malloc.
+ * The first RANDOM_KEY_SIZE bytes of every block become the next key,
+ * the rest is handed out.
+ */
+typedef struct random_state {
+	unsigned char key[RANDOM_KEY_SIZE];
+	unsigned char block[RANDOM_KEY_SIZE + RANDOM_BUFFER_SIZE];
+	size_t position; //next unused byte in 'block'
+	size_t since_reseed; //bytes since the last seed from the OS
+	unsigned int fork_generation;
+	bool seeded;
+} random_state;
+
+static molch_random_source random_source = MOLCH_RANDOM_BUFFERED;
+
+//incremented in the child process after every fork
+static unsigned int fork_generation = 0;
+
+static __thread random_state *thread_state = NULL;
+static pthread_once_t initialize_once = PTHREAD_ONCE_INIT;
+static pthread_key_t destroy_key;
+static bool destroy_key_created = false;
+
+static void child_after_fork() {
+	__atomic_add_fetch(&fork_generation, 1, __ATOMIC_RELAXED);
+}
+
+static void destroy_state(void *state) {
+	key_free(state);
+}
+
+static void initialize() {
+	//without the key the states of exited threads would leak, so the buffered generator isn't used
+	destroy_key_created = (pthread_key_create(&destroy_key, destroy_state) == 0)
+		&& (pthread_atfork(NULL, NULL, child_after_fork) == 0);
+}
+
+void random_set_source(const molch_random_source source) {
+	__atomic_store_n(&random_source, source, __ATOMIC_RELAXED);
+}
+
+/*
+ * Get the state of the current thread. Returns NULL if there is none and
+ * none can be created, the OS is used then.
+ */
+static random_state *get_state() {
+	if (thread_state != NULL) {
+		return thread_state;
+	}
+
+	pthread_once(&initialize_once, initialize);
+	if (!destroy_key_created) {
+		return NULL;
+	}
+
+	random_state *state = key_malloc(sizeof(random_state));
+	if (state == NULL) {
+		return NULL;
+	}
+	sodium_memzero(state, sizeof(random_state));
+	state->position = sizeof(state->block); //empty
+
+	if (pthread_setspecific(destroy_key, state) != 0) {
+		key_free(state);
+		return NULL;
+	}
+	thread_state = state;
+
+	return state;
+}
+
+/*
+ * Generate the next block of keystream and replace the key.
+ */
+static void refill(random_state * const state) {
+	static const unsigned char nonce[crypto_stream_chacha20_NONCEBYTES] = {0};
+
+	if (!state->seeded || (state->since_reseed >= RANDOM_RESEED_INTERVAL)) {
+		randombytes_buf(state->key, sizeof(state->key));
+		state->since_reseed = 0;
+		state->seeded = true;
+	}
+
+	//every key is only used once, so the nonce can be constant
+	crypto_stream_chacha20(state->block, sizeof(state->block), nonce, state->key);
+	memcpy(state->key, state->block, RANDOM_KEY_SIZE);
+	sodium_memzero(state->block, RANDOM_KEY_SIZE);
+	state->position = RANDOM_KEY_SIZE;
+}
+
+void random_bytes(unsigned char * const output, const size_t length) {
+	if (__atomic_load_n(&random_source, __ATOMIC_RELAXED) == MOLCH_RANDOM_SYSTEM) {
+		randombytes_buf(output, length);
+		return;
+	}
+
+	random_state * const state = get_state();
+	if (state == NULL) {
+		randombytes_buf(output, length);
+		return;
+	}
+
+	//the child of a fork must not hand out the same bytes as its parent
+	const unsigned int current_fork_generation = __atomic_load_n(&fork_generation, __ATOMIC_RELAXED);
+	if (state->fork_generation != current_fork_generation) {
+		sodium_memzero(state->block, sizeof(state->block));
+		state->position = sizeof(state->block);
+		state->seeded = false;
+		state->fork_generation = current_fork_generation;
+	}
+
+	size_t written = 0;
+	while (written < length) {
+		if (state->position == sizeof(state->block)) {
+			refill(state);
+		}
+
+		size_t available = sizeof(state->block) - state->position;
+		if (available > (length - written)) {
+			available = length - written;
+		}
+		memcpy(output + written, state->block + state->position, available);
+		sodium_memzero(state->block + state->position, available);
+		state->position += available;
+		written += available;
+	}
+	state->since_reseed += length;
+}
+
+int random_fill_buffer(buffer_t * const buffer, const size_t length) {
+	if (length > buffer->buffer_length) {
+		return -6;
+	}
+
+	if (buffer->readonly) {
+		return -5;
+	}
+
+	if (buffer->buffer_length == 0) {
+		return 0;
+	}
+
+	buffer->content_length = length;
+	random_bytes(buffer->content, length);
+
+	return 0;
+}
+
+uint32_t random_uniform(const uint32_t upper_bound) {
+	if (upper_bound < 2) {
+		return 0;
+	}
+
+	//2^32 % upper_bound, numbers below it would make the result biased
+	const uint32_t minimum = (1U + ~upper_bound) % upper_bound;
+	uint32_t number;
+	do {
+		random_bytes((unsigned char*)&number, sizeof(number));
+	} while (number < minimum);
+
+	return number % upper_bound;
+}
+
+int random_box_keypair(unsigned char * const public_key, unsigned char * const private_key) {
+	unsigned char seed[crypto_box_SEEDBYTES];
+	random_bytes(seed, sizeof(seed));
+	const int status = crypto_box_seed_keypair(public_key, private_key, seed);
+	sodium_memzero(seed, sizeof(seed));
+
+	return status;
+}
+
+int random_sign_keypair(unsigned char * const public_key, unsigned char * const private_key) {
+	unsigned char seed[crypto_sign_SEEDBYTES];
+	random_bytes(seed, sizeof(seed));
+	const int status = crypto_sign_seed_keypair(public_key, private_key, seed);
+	sodium_memzero(seed, sizeof(seed));
+
+	return status;
+}
@@ -0,0 +1,75 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*! \file
+ * Random numbers for keys and nonces.
+ *
+ * By default every thread has its own ChaCha20 based generator that is
+ * seeded from the OS (libsodium's randombytes). It hands out a buffer of
+ * keystream at a time and replaces its key with the first bytes of every
+ * block (fast key erasure), so earlier output can't be recovered from the
+ * state. Bytes that have been handed out are erased from the buffer.
+ * The generator is reseeded after RANDOM_RESEED_INTERVAL bytes and in the
+ * child process after a fork.
+ *
+ * With MOLCH_RANDOM_SYSTEM every call goes to libsodium's randombytes.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "molch.h"
+#include "../buffer/buffer.h"
+
+#ifndef LIB_RANDOM_H
+#define LIB_RANDOM_H
+
+//keystream per refill of the buffer
+#define RANDOM_BUFFER_SIZE 1024
+//bytes after which the generator is seeded from the OS again
+#define RANDOM_RESEED_INTERVAL (1024 * 1024)
+
+void random_set_source(const molch_random_source source);
+
+void random_bytes(unsigned char * const output, const size_t length);
+
+/*
+ * Like buffer_fill_random.
+ *
+ * Returns 0 on success.
+ */
+int random_fill_buffer(buffer_t * const buffer, const size_t length) __attribute__((warn_unused_result));
+
+/*
+ * Uniformly distributed number between 0 and 'upper_bound' (excluded).
+ */
+uint32_t random_uniform(const uint32_t upper_bound);
+
+/*
+ * Generate key pairs from a seed out of random_bytes, the
+ * equivalent of crypto_box_keypair and crypto_sign_keypair.
+ *
+ * Returns 0 on success.
+ */
+int random_box_keypair(unsigned char * const public_key, unsigned char * const private_key) __attribute__((warn_unused_result));
+int random_sign_keypair(unsigned char * const public_key, unsigned char * const private_key) __attribute__((warn_unused_result));
+#endif
@@ -27,6 +27,10 @@
 #include "constants.h"
 #include "ratchet.h"
 #include "key-derivation.h"
+#include "stats.h"
+#include "trace.h"
+#include "random.h"
+#include "zeroed_malloc.h"
 
 /*
  * Helper function that checks if a buffer is <none>
@@ -75,8 +79,9 @@ return_status create_ratchet_state(ratchet_state ** const ratchet) {
 		throw(INVALID_INPUT, "Invalid input to create_ratchet_state.");
 	}
 
-	*ratchet = sodium_malloc(sizeof(ratchet_state));
+	*ratchet = key_malloc(sizeof(ratchet_state));
 	throw_on_failed_alloc(*ratchet);
+	stats_allocation(MOLCH_STATS_RATCHETS, sizeof(ratchet_state));
 
 	//initialize the buffers with the storage arrays
 	init_ratchet_state(ratchet);
@@ -188,7 +193,7 @@ return_status ratchet_create(
 cleanup:
 	on_error {
 		if (ratchet != NULL) {
-				sodium_free_and_null_if_valid(*ratchet);
+				key_free_and_null_if_valid(*ratchet);
 		}
 	}
 
@@ -206,13 +211,14 @@ return_status ratchet_send(
 		buffer_t * const our_public_ephemeral, //PUBLIC_KEY_SIZE, DHRs
 		buffer_t * const message_key) { //MESSAGE_KEY_SIZE, MK
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
 
 	//create buffers
 	buffer_t *root_key_backup = NULL;
 	buffer_t *chain_key_backup = NULL;
-	root_key_backup = buffer_create_on_heap(ROOT_KEY_SIZE, 0);
+	root_key_backup = buffer_create_with_custom_allocator(ROOT_KEY_SIZE, 0, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(root_key_backup);
-	chain_key_backup = buffer_create_on_heap(CHAIN_KEY_SIZE, 0);
+	chain_key_backup = buffer_create_with_custom_allocator(CHAIN_KEY_SIZE, 0, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(chain_key_backup);
 
 	//check input
@@ -229,7 +235,7 @@ return_status ratchet_send(
 
 	if (ratchet->ratchet_flag) {
 		//DHRs = generateECDH()
-		status_int = crypto_box_keypair(
+		status_int = random_box_keypair(
 				ratchet->our_public_ephemeral->content,
 				ratchet->our_private_ephemeral->content);
 		ratchet->our_public_ephemeral->content_length = PUBLIC_KEY_SIZE;
@@ -326,8 +332,10 @@ cleanup:
 		}
 	}
 
-	buffer_destroy_from_heap_and_null_if_valid(root_key_backup);
-	buffer_destroy_from_heap_and_null_if_valid(chain_key_backup);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(root_key_backup, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(chain_key_backup, zeroed_free);
+
+	trace_end("ratchet_send", trace_start);
 
 	return status;
 }
@@ -416,11 +424,11 @@ return_status stage_skipped_header_and_message_keys(
 	buffer_t *current_chain_key = NULL;
 	buffer_t *next_chain_key = NULL;
 	buffer_t *current_message_key = NULL;
-	current_chain_key = buffer_create_on_heap(CHAIN_KEY_SIZE, 0);
+	current_chain_key = buffer_create_with_custom_allocator(CHAIN_KEY_SIZE, 0, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(current_chain_key);
-	next_chain_key = buffer_create_on_heap(CHAIN_KEY_SIZE, 0);
+	next_chain_key = buffer_create_with_custom_allocator(CHAIN_KEY_SIZE, 0, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(next_chain_key);
-	current_message_key = buffer_create_on_heap(MESSAGE_KEY_SIZE, 0);
+	current_message_key = buffer_create_with_custom_allocator(MESSAGE_KEY_SIZE, 0, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(current_message_key);
 
 	//check input
@@ -494,9 +502,9 @@ cleanup:
 		}
 	}
 
-	buffer_destroy_from_heap_and_null_if_valid(current_chain_key);
-	buffer_destroy_from_heap_and_null_if_valid(next_chain_key);
-	buffer_destroy_from_heap_and_null_if_valid(current_message_key);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(current_chain_key, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(next_chain_key, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(current_message_key, zeroed_free);
 
 	return status;
 }
@@ -519,6 +527,7 @@ return_status commit_skipped_header_and_message_keys(ratchet_state *state) {
 				state->staged_header_and_message_keys->head->message_key,
 				state->staged_header_and_message_keys->head->header_key);
 		throw_on_error(ADDITION_ERROR, "Failed to add keys to skipped header and message keys.");
+		stats_skipped_keys_changed(1);
 		header_and_message_keystore_remove(
 				state->staged_header_and_message_keys,
 				state->staged_header_and_message_keys->head);
@@ -545,16 +554,17 @@ return_status ratchet_receive(
 		const uint32_t purported_message_number,
 		const uint32_t purported_previous_message_number) {
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
 
 	//create buffers
 	buffer_t *throwaway_chain_key = NULL;
 	buffer_t *throwaway_message_key = NULL;
 	buffer_t *purported_chain_key_backup = NULL;
-	throwaway_chain_key = buffer_create_on_heap(CHAIN_KEY_SIZE, 0);
+	throwaway_chain_key = buffer_create_with_custom_allocator(CHAIN_KEY_SIZE, 0, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(throwaway_chain_key);
-	throwaway_message_key = buffer_create_on_heap(MESSAGE_KEY_SIZE, 0);
+	throwaway_message_key = buffer_create_with_custom_allocator(MESSAGE_KEY_SIZE, 0, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(throwaway_message_key);
-	purported_chain_key_backup = buffer_create_on_heap(CHAIN_KEY_SIZE, 0);
+	purported_chain_key_backup = buffer_create_with_custom_allocator(CHAIN_KEY_SIZE, 0, zeroed_malloc, zeroed_free);
 	throw_on_failed_alloc(purported_chain_key_backup);
 
 	//check input
@@ -658,9 +668,11 @@ cleanup:
 		}
 	}
 
-	buffer_destroy_from_heap_and_null_if_valid(throwaway_chain_key);
-	buffer_destroy_from_heap_and_null_if_valid(throwaway_message_key);
-	buffer_destroy_from_heap_and_null_if_valid(purported_chain_key_backup);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(throwaway_chain_key, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(throwaway_message_key, zeroed_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(purported_chain_key_backup, zeroed_free);
+
+	trace_end("ratchet_receive", trace_start);
 
 	return status;
 }
@@ -738,10 +750,11 @@ cleanup:
  */
 void ratchet_destroy(ratchet_state *state) {
 	//empty message keystores
+	stats_skipped_keys_changed(-(int64_t)state->skipped_header_and_message_keys->length);
 	header_and_message_keystore_clear(state->skipped_header_and_message_keys);
 	header_and_message_keystore_clear(state->staged_header_and_message_keys);
 
-	sodium_free_and_null_if_valid(state); //this also overwrites all the keys with zeroes
+	key_free_and_null_if_valid(state); //this also overwrites all the keys with zeroes
 }
 
 return_status ratchet_export(
@@ -1050,8 +1063,9 @@ return_status ratchet_import(
 		throw(INVALID_INPUT, "Invalid input to ratchet_import.");
 	}
 
-	*ratchet= sodium_malloc(sizeof(ratchet_state));
+	*ratchet= key_malloc(sizeof(ratchet_state));
 	throw_on_failed_alloc(*ratchet);
+	stats_allocation(MOLCH_STATS_RATCHETS, sizeof(ratchet_state));
 
 	init_ratchet_state(ratchet);
 
@@ -1262,6 +1276,8 @@ return_status ratchet_import(
 		(*ratchet)->skipped_header_and_message_keys,
 		conversation->skipped_header_and_message_keys,
 		conversation->n_skipped_header_and_message_keys);
+	//counted even on failure, ratchet_destroy subtracts whatever was imported
+	stats_skipped_keys_changed((int64_t)(*ratchet)->skipped_header_and_message_keys->length);
 	throw_on_error(IMPORT_ERROR, "Failed to import skipped header and message keys.");
 	//staged heeader and message keys
 	status = header_and_message_keystore_import(
@@ -1273,7 +1289,7 @@ return_status ratchet_import(
 cleanup:
 	on_error {
 		if (ratchet != NULL) {
-			sodium_free_and_null_if_valid(*ratchet);
+			key_free_and_null_if_valid(*ratchet);
 		}
 	}
 
@@ -164,6 +164,11 @@ return_status ratchet_set_last_message_authenticity(
 		ratchet_state * const ratchet,
 		bool valid) __attribute__((warn_unused_result));
 
+/*
+ * Check if a buffer is <none> (empty or filled with zeroes) in constant time.
+ */
+bool is_none(const buffer_t * const buffer);
+
 /*
  * End the ratchet chain and free the memory.
  */
@@ -0,0 +1,113 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <sodium.h>
+
+#include "receive-guard.h"
+#include "constants.h"
+#include "stats.h"
+
+void receive_guard_init(receive_guard * const guard) {
+	memset(guard, '\0', sizeof(receive_guard));
+}
+
+void receive_guard_set_budget(receive_guard * const guard, const uint32_t trial_limit, const uint32_t window) {
+	guard->trial_limit = trial_limit;
+	guard->window = window;
+	guard->window_start = stats_now();
+	guard->trials = 0;
+}
+
+/*
+ * Header nonces are random, so their first bytes are as good as a hash.
+ */
+static uint32_t fingerprint(const packet_view * const packet) {
+	uint32_t fingerprint;
+	memcpy(&fingerprint, packet->packet_header.header_nonce.data, sizeof(fingerprint));
+
+	return fingerprint;
+}
+
+static bool is_replay(const receive_guard * const guard, const uint32_t fingerprint) {
+	const size_t count = (guard->nonce_count < RECEIVE_GUARD_NONCES) ? guard->nonce_count : RECEIVE_GUARD_NONCES;
+	bool found = false;
+	for (size_t i = 0; i < count; i++) {
+		found |= (guard->fingerprints[i] == fingerprint);
+	}
+
+	return found;
+}
+
+return_status receive_guard_check(receive_guard * const guard, const packet_view * const packet) {
+	return_status status = return_status_init();
+
+	if ((guard == NULL) || (packet == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to receive_guard_check.");
+	}
+
+	//both header encryptions (secretbox and XChaCha20-Poly1305) have a 16 byte tag
+	if ((packet->encrypted_axolotl_header.length < (crypto_secretbox_MACBYTES + PUBLIC_KEY_SIZE))
+			|| (packet->encrypted_axolotl_header.length > (crypto_secretbox_MACBYTES + RECEIVE_GUARD_MAX_HEADER_SIZE))) {
+		throw(INCORRECT_BUFFER_SIZE, "The encrypted axolotl header has an impossible length.");
+	}
+	//messages are padded to at least one byte
+	if (packet->encrypted_message.length < (crypto_secretbox_MACBYTES + 1)) {
+		throw(INCORRECT_BUFFER_SIZE, "The encrypted message is too short.");
+	}
+
+	if (is_replay(guard, fingerprint(packet))) {
+		throw(INVALID_STATE, "The packet has been received before.");
+	}
+
+	if (guard->trial_limit != 0) {
+		const uint64_t now = stats_now();
+		if ((now - guard->window_start) >= ((uint64_t)guard->window * 1000000)) {
+			guard->window_start = now;
+			guard->trials = 0;
+		}
+		if (guard->trials >= guard->trial_limit) {
+			throw(DECRYPT_ERROR, "The budget of trial decryptions is exhausted.");
+		}
+	}
+
+cleanup:
+	return status;
+}
+
+void receive_guard_charge(receive_guard * const guard, const size_t trials) {
+	if (guard->trial_limit == 0) {
+		return;
+	}
+
+	//saturate, the budget is exhausted anyway
+	if (trials >= (UINT32_MAX - guard->trials)) {
+		guard->trials = UINT32_MAX;
+	} else {
+		guard->trials += (uint32_t)trials;
+	}
+}
+
+void receive_guard_remember(receive_guard * const guard, const packet_view * const packet) {
+	guard->fingerprints[guard->nonce_count & (RECEIVE_GUARD_NONCES - 1)] = fingerprint(packet);
+	guard->nonce_count++;
+}
@@ -0,0 +1,92 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*! \file
+ * Cheap checks that reject packets of a conversation before any trial
+ * decryption is attempted.
+ *
+ * Decrypting a packet tries every skipped header key plus the current and
+ * the next receive header key, so a garbage or replayed packet costs a lot
+ * more to reject than to send. The guard rejects:
+ *
+ * - packets whose encrypted header or message can't have been created by
+ *   molch (size bounds, no allocation),
+ * - replays: the header nonces of the last RECEIVE_GUARD_NONCES packets that
+ *   were decrypted successfully are remembered as 32 bit fingerprints,
+ *   older ones age out. A fingerprint collision is the only way a new packet
+ *   could be rejected wrongly (about RECEIVE_GUARD_NONCES / 2^32),
+ * - packets that exceed the budget of trial decryptions of the conversation
+ *   in the current time window (optional, unlimited by default).
+ *
+ * The guard isn't part of exports, except for the budget.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+#include "wire.h"
+
+#ifndef LIB_RECEIVE_GUARD_H
+#define LIB_RECEIVE_GUARD_H
+
+#define RECEIVE_GUARD_NONCES 128 //has to be a power of two
+#define RECEIVE_GUARD_MAX_HEADER_SIZE 128 //decrypted axolotl header, actual headers are below 50 bytes
+
+typedef struct receive_guard {
+	uint32_t fingerprints[RECEIVE_GUARD_NONCES];
+	size_t nonce_count; //number of nonces ever remembered
+	//budget of trial decryptions
+	uint32_t trial_limit; //per window, 0 is unlimited
+	uint32_t window; //milliseconds
+	uint64_t window_start; //nanoseconds, see stats_now
+	uint32_t trials; //in the current window
+} receive_guard;
+
+void receive_guard_init(receive_guard * const guard);
+
+/*
+ * Set the budget of trial decryptions, 'trial_limit' trials per 'window'
+ * milliseconds. A limit of 0 removes the budget.
+ */
+void receive_guard_set_budget(receive_guard * const guard, const uint32_t trial_limit, const uint32_t window);
+
+/*
+ * Check a packet before trying to decrypt it.
+ *
+ * \return
+ *   INCORRECT_BUFFER_SIZE for packets that are too short or too long,
+ *   INVALID_STATE for replayed packets and DECRYPT_ERROR if the budget is
+ *   exhausted.
+ */
+return_status receive_guard_check(receive_guard * const guard, const packet_view * const packet) __attribute__((warn_unused_result));
+
+/*
+ * Charge trial decryptions (header decryption attempts) to the budget.
+ */
+void receive_guard_charge(receive_guard * const guard, const size_t trials);
+
+/*
+ * Remember the header nonce of a successfully decrypted packet.
+ */
+void receive_guard_remember(receive_guard * const guard, const packet_view * const packet);
+#endif
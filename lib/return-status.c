@@ -19,13 +19,118 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "return-status.h"
+#include "stats.h"
 #include "../buffer/buffer.h"
 
+//'message' has to be the first member, slots are found by casting the message
+typedef struct error_slot {
+	error_message message;
+	bool in_use;
+} error_slot;
+
+/*
+ * Pool of error messages of one thread. Only the thread takes messages
+ * out of it, but any thread can put them back by clearing 'in_use'.
+ *
+ * Pools are never freed, when a thread exits, its pool is handed over
+ * to the next new thread (messages that are still in use stay valid).
+ */
+typedef struct error_pool error_pool;
+struct error_pool {
+	error_slot slots[RETURN_STATUS_POOL_SIZE];
+	size_t next_slot;
+	bool in_use;
+	error_pool *next;
+};
+
+static error_pool *pools = NULL;
+static __thread error_pool *thread_pool = NULL;
+static pthread_once_t release_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t release_key;
+static bool release_key_created = false;
+
+static void release_pool(void *pool) {
+	__atomic_store_n(&((error_pool*)pool)->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void create_release_key() {
+	//if this fails, pools of exited threads aren't reused
+	release_key_created = (pthread_key_create(&release_key, release_pool) == 0);
+}
+
+/*
+ * Get the pool of the current thread, NULL if it couldn't be allocated.
+ */
+static error_pool *get_pool() {
+	if (thread_pool != NULL) {
+		return thread_pool;
+	}
+
+	pthread_once(&release_key_once, create_release_key);
+
+	//reuse the pool of an exited thread
+	error_pool *pool = __atomic_load_n(&pools, __ATOMIC_ACQUIRE);
+	for (; pool != NULL; pool = pool->next) {
+		bool expected = false;
+		if (__atomic_compare_exchange_n(&pool->in_use, &expected, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+
+	if (pool == NULL) {
+		pool = public_calloc(1, sizeof(error_pool));
+		if (pool == NULL) {
+			return NULL;
+		}
+		pool->in_use = true;
+
+		pool->next = __atomic_load_n(&pools, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&pools, &pool->next, pool, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+	}
+
+	if (release_key_created) {
+		pthread_setspecific(release_key, pool);
+	}
+	thread_pool = pool;
+
+	return pool;
+}
+
+/*
+ * Take a free message out of the pool of the current thread.
+ * Returns NULL if there is none.
+ */
+static error_message *take_pooled_message() {
+	error_pool * const pool = get_pool();
+	if (pool == NULL) {
+		return NULL;
+	}
+
+	//messages are mostly put back in the order they were taken, so the next slot is usually free
+	for (size_t i = 0; i < RETURN_STATUS_POOL_SIZE; i++) {
+		const size_t index = (pool->next_slot + i) & (RETURN_STATUS_POOL_SIZE - 1);
+		error_slot * const slot = &pool->slots[index];
+		if (!__atomic_load_n(&slot->in_use, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&slot->in_use, true, __ATOMIC_RELAXED);
+			pool->next_slot = index + 1;
+			slot->message.pooled = true;
+
+			return &slot->message;
+		}
+	}
+
+	return NULL;
+}
+
 inline return_status return_status_init() {
 	return_status status = {
 		SUCCESS,
@@ -46,9 +151,14 @@ status_type return_status_add_error_message(
 		return SUCCESS;
 	}
 
-	error_message *error = malloc(sizeof(error_message));
+	error_message *error = take_pooled_message();
 	if (error == NULL) {
-		return ALLOCATION_FAILED;
+		error = public_malloc(sizeof(error_message));
+		if (error == NULL) {
+			return ALLOCATION_FAILED;
+		}
+		error->pooled = false;
+		stats_allocation(MOLCH_STATS_ERRORS, sizeof(error_message));
 	}
 
 	error->next = status_object->error;
@@ -67,7 +177,11 @@ void return_status_destroy_errors(return_status * const status) {
 
 	while (status->error != NULL) {
 		error_message *next_error = status->error->next;
-		free_and_null_if_valid(status->error);
+		if (status->error->pooled) {
+			__atomic_store_n(&((error_slot*)status->error)->in_use, false, __ATOMIC_RELEASE);
+		} else {
+			free_and_null_if_valid(status->error);
+		}
 		status->error = next_error;
 	}
 }
@@ -22,6 +22,8 @@
 #ifndef LIB_RETURN_STATUS_H
 #define LIB_RETURN_STATUS_H
 
+#include <stdbool.h>
+
 #include "common.h"
 
 // possible status types, either SUCCESS or a variety of error types.
@@ -62,11 +64,20 @@ typedef enum status_type { //TODO add more error types
 	UNSUPPORTED_PROTOCOL_VERSION
 } status_type;
 
+/*
+ * Error messages are taken from a fixed pool of the current thread, so
+ * throwing doesn't allocate. Only when the pool is exhausted (too many
+ * error stacks alive at the same time), they are allocated on the heap.
+ * Error stacks can still be destroyed by any thread.
+ */
+#define RETURN_STATUS_POOL_SIZE 64 //per thread, has to be a power of two
+
 typedef struct error_message error_message;
 struct error_message {
 	const char * message;
 	status_type status;
 	error_message *next;
+	bool pooled; //from the pool of a thread instead of the heap
 };
 
 typedef struct return_status {
@@ -0,0 +1,196 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "routing.h"
+#include "constants.h"
+
+#define ROUTING_TABLE_INITIAL_CAPACITY 64
+
+return_status routing_derive_tags(
+		unsigned char * const tags,
+		const buffer_t * const header_key,
+		const uint32_t first_message_number,
+		const size_t count) {
+	return_status status = return_status_init();
+
+	unsigned char routing_key[crypto_shorthash_KEYBYTES];
+
+	//check input
+	if ((tags == NULL) || (header_key == NULL) || (header_key->content_length != HEADER_KEY_SIZE)) {
+		throw(INVALID_INPUT, "Invalid input to routing_derive_tags.");
+	}
+
+	//the header key is only hashed once per chain, every tag is a single SipHash
+	buffer_create_from_string(personal, "molch routingid");
+	assert(personal->content_length == crypto_generichash_blake2b_PERSONALBYTES);
+	static const unsigned char salt[crypto_generichash_blake2b_SALTBYTES] = {0};
+	int status_int = crypto_generichash_blake2b_salt_personal(
+			routing_key,
+			sizeof(routing_key),
+			NULL, //input
+			0, //input length
+			header_key->content,
+			header_key->content_length,
+			salt,
+			personal->content);
+	if (status_int != 0) {
+		throw(KEYDERIVATION_FAILED, "Failed to derive routing key.");
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		const uint32_t message_number = first_message_number + (uint32_t)i;
+		const unsigned char big_endian_message_number[sizeof(uint32_t)] = {
+			(unsigned char)(message_number >> 24),
+			(unsigned char)(message_number >> 16),
+			(unsigned char)(message_number >> 8),
+			(unsigned char)message_number
+		};
+		if (crypto_shorthash(tags + i * ROUTING_TAG_SIZE, big_endian_message_number, sizeof(big_endian_message_number), routing_key) != 0) {
+			throw(KEYDERIVATION_FAILED, "Failed to derive routing tag.");
+		}
+	}
+
+cleanup:
+	sodium_memzero(routing_key, sizeof(routing_key));
+
+	return status;
+}
+
+void routing_table_init(routing_table * const table) {
+	table->entries = NULL;
+	table->capacity = 0;
+	table->count = 0;
+}
+
+void routing_table_clear(routing_table * const table) {
+	public_free(table->entries);
+	routing_table_init(table);
+}
+
+static uint64_t load_tag(const unsigned char * const tag) {
+	uint64_t value;
+	memcpy(&value, tag, sizeof(value));
+
+	return value;
+}
+
+static void insert(routing_table * const table, const uint64_t tag, struct conversation_t * const conversation) {
+	const size_t mask = table->capacity - 1;
+	size_t index = tag & mask;
+	while (table->entries[index].conversation != NULL) {
+		index = (index + 1) & mask;
+	}
+
+	table->entries[index].tag = tag;
+	table->entries[index].conversation = conversation;
+	table->count++;
+}
+
+int routing_table_reserve(routing_table * const table, const size_t count) {
+	//keep the load factor at or below 1/2, so probe sequences stay short
+	size_t capacity = (table->capacity == 0) ? ROUTING_TABLE_INITIAL_CAPACITY : table->capacity;
+	while ((table->count + count) > (capacity / 2)) {
+		if (capacity > (SIZE_MAX / (2 * sizeof(routing_entry)))) {
+			return -1;
+		}
+		capacity *= 2;
+	}
+	if (capacity == table->capacity) {
+		return 0;
+	}
+
+	routing_entry * const entries = public_calloc(capacity, sizeof(routing_entry));
+	if (entries == NULL) {
+		return -1;
+	}
+
+	routing_table old_table = *table;
+	table->entries = entries;
+	table->capacity = capacity;
+	table->count = 0;
+	for (size_t i = 0; i < old_table.capacity; i++) {
+		if (old_table.entries[i].conversation != NULL) {
+			insert(table, old_table.entries[i].tag, old_table.entries[i].conversation);
+		}
+	}
+	public_free(old_table.entries);
+
+	return 0;
+}
+
+void routing_table_add(routing_table * const table, const unsigned char * const tag, struct conversation_t * const conversation) {
+	assert(((table->count + 1) <= (table->capacity / 2)) && "routing_table_reserve wasn't called.");
+	insert(table, load_tag(tag), conversation);
+}
+
+void routing_table_remove(routing_table * const table, const unsigned char * const tag, const struct conversation_t * const conversation) {
+	if (table->count == 0) {
+		return;
+	}
+
+	const uint64_t value = load_tag(tag);
+	const size_t mask = table->capacity - 1;
+	size_t index = value & mask;
+	for (; table->entries[index].conversation != NULL; index = (index + 1) & mask) {
+		if ((table->entries[index].tag == value) && (table->entries[index].conversation == conversation)) {
+			break;
+		}
+	}
+	if (table->entries[index].conversation == NULL) {
+		return;
+	}
+
+	//shift the following entries back, so no probe sequence is interrupted by the hole
+	size_t hole = index;
+	for (size_t next = (hole + 1) & mask; table->entries[next].conversation != NULL; next = (next + 1) & mask) {
+		const size_t home = table->entries[next].tag & mask;
+		//move the entry if its home isn't cyclically in (hole, next]
+		const bool stays = (hole <= next) ? ((hole < home) && (home <= next)) : ((hole < home) || (home <= next));
+		if (!stays) {
+			table->entries[hole] = table->entries[next];
+			hole = next;
+		}
+	}
+	table->entries[hole].conversation = NULL;
+	table->count--;
+}
+
+struct conversation_t *routing_table_find(const routing_table * const table, const unsigned char * const tag) {
+	if (table->count == 0) {
+		return NULL;
+	}
+
+	const uint64_t value = load_tag(tag);
+	const size_t mask = table->capacity - 1;
+	for (size_t index = value & mask; table->entries[index].conversation != NULL; index = (index + 1) & mask) {
+		if (table->entries[index].tag == value) {
+			return table->entries[index].conversation;
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,108 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*! \file
+ * Routing tags map packets to conversations without trying the header
+ * keys of every conversation.
+ *
+ * Packets of PROTOCOL_VERSION_ROUTED carry a tag that is derived from the
+ * header key and the message number of the packet. Only the two sides of
+ * the conversation know the header key, for anyone else tags are random
+ * and can't be linked to each other.
+ *
+ * Every conversation store has a routing table with the tags of the
+ * messages its conversations expect next (see conversation_update_routes),
+ * so the conversation of a packet is found with a single lookup.
+ */
+
+#include <stdint.h>
+
+#include "common.h"
+#include "../buffer/buffer.h"
+
+#ifndef LIB_ROUTING_H
+#define LIB_ROUTING_H
+
+#define ROUTING_TAG_SIZE 8
+//message numbers before and after the next expected one that are routed
+#define ROUTING_WINDOW 8
+//tags per conversation: both sides of the window in the current receive chain, the start of the next one
+#define ROUTING_TAGS (3 * ROUTING_WINDOW)
+
+struct conversation_t;
+
+typedef struct routing_entry {
+	uint64_t tag;
+	struct conversation_t *conversation; //NULL if the entry is empty
+} routing_entry;
+
+//hash table with linear probing, tags are random so they don't need to be hashed
+typedef struct routing_table {
+	routing_entry *entries;
+	size_t capacity; //power of two, 0 until the first tag is added
+	size_t count;
+} routing_table;
+
+/*
+ * Derive the tags of 'count' consecutive message numbers of a chain,
+ * starting with 'first_message_number'.
+ *
+ * tag = SipHash-2-4(BLAKE2b(header key), big endian message number)
+ */
+return_status routing_derive_tags(
+		unsigned char * const tags, //count * ROUTING_TAG_SIZE
+		const buffer_t * const header_key, //HEADER_KEY_SIZE
+		const uint32_t first_message_number,
+		const size_t count) __attribute__((warn_unused_result));
+
+void routing_table_init(routing_table * const table);
+
+/*
+ * Free the entries, the table is empty afterwards.
+ */
+void routing_table_clear(routing_table * const table);
+
+/*
+ * Make sure that 'count' more tags can be added without allocating.
+ *
+ * Returns 0 on success.
+ */
+int routing_table_reserve(routing_table * const table, const size_t count) __attribute__((warn_unused_result));
+
+/*
+ * Add a tag, there has to be room for it (see routing_table_reserve).
+ * The same tag can be added for multiple conversations.
+ */
+void routing_table_add(routing_table * const table, const unsigned char * const tag, struct conversation_t * const conversation);
+
+/*
+ * Remove the entry of a tag and a conversation if it exists.
+ */
+void routing_table_remove(routing_table * const table, const unsigned char * const tag, const struct conversation_t * const conversation);
+
+/*
+ * Find the conversation of a tag.
+ *
+ * Returns NULL if no conversation expects a packet with this tag.
+ */
+struct conversation_t *routing_table_find(const routing_table * const table, const unsigned char * const tag);
+#endif
@@ -25,6 +25,7 @@
 #include "constants.h"
 #include "spiced-random.h"
 #include "return-status.h"
+#include "random.h"
 
 /*
  * Generate a random number by combining the OSs random number
@@ -37,7 +38,8 @@
 return_status spiced_random(
 		buffer_t * const random_output,
 		const buffer_t * const random_spice,
-		const size_t output_length) {
+		const size_t output_length,
+		const molch_spice_cost cost) {
 	return_status status = return_status_init();
 
 	//buffer to put the random data derived from the random spice into
@@ -45,9 +47,9 @@ return_status spiced_random(
 	//buffer that contains the random data from the OS
 	buffer_t *os_random = NULL;
 	//allocate them
-	spice = buffer_create_with_custom_allocator(output_length, output_length, sodium_malloc, sodium_free);
+	spice = buffer_create_with_custom_allocator(output_length, output_length, key_malloc, key_free);
 	throw_on_failed_alloc(spice);
-	os_random = buffer_create_with_custom_allocator(output_length, output_length, sodium_malloc, sodium_free);
+	os_random = buffer_create_with_custom_allocator(output_length, output_length, key_malloc, key_free);
 	throw_on_failed_alloc(os_random);
 
 	//check buffer length
@@ -55,10 +57,29 @@ return_status spiced_random(
 		throw(INCORRECT_BUFFER_SIZE, "Output buffers is too short.");
 	}
 
-	if (buffer_fill_random(os_random, output_length) != 0) {
+	if (random_fill_buffer(os_random, output_length) != 0) {
 		throw(GENERIC_ERROR, "Failed to fill buffer with random data.");
 	}
 
+	unsigned long long opslimit;
+	size_t memlimit;
+	switch (cost) {
+		case MOLCH_SPICE_COST_INTERACTIVE:
+			opslimit = crypto_pwhash_scryptsalsa208sha256_OPSLIMIT_INTERACTIVE;
+			memlimit = crypto_pwhash_scryptsalsa208sha256_MEMLIMIT_INTERACTIVE;
+			break;
+		case MOLCH_SPICE_COST_MINIMAL:
+			opslimit = crypto_pwhash_scryptsalsa208sha256_OPSLIMIT_MIN;
+			memlimit = crypto_pwhash_scryptsalsa208sha256_MEMLIMIT_MIN;
+			break;
+		case MOLCH_SPICE_COST_SENSITIVE:
+			opslimit = crypto_pwhash_scryptsalsa208sha256_OPSLIMIT_SENSITIVE;
+			memlimit = crypto_pwhash_scryptsalsa208sha256_MEMLIMIT_SENSITIVE;
+			break;
+		default:
+			throw(INVALID_VALUE, "Invalid spice cost.");
+	}
+
 	buffer_create_from_string(salt, " molch: an axolotl ratchet lib ");
 	assert(salt->content_length == crypto_pwhash_scryptsalsa208sha256_SALTBYTES);
 
@@ -70,8 +91,8 @@ return_status spiced_random(
 			(const char*)random_spice->content,
 			random_spice->content_length,
 			salt->content,
-			crypto_pwhash_scryptsalsa208sha256_OPSLIMIT_INTERACTIVE,
-			crypto_pwhash_scryptsalsa208sha256_MEMLIMIT_INTERACTIVE);
+			opslimit,
+			memlimit);
 	if (status_int != 0) {
 		throw(GENERIC_ERROR, "Failed to derive random data from spice.");
 	}
@@ -93,8 +114,8 @@ cleanup:
 			random_output->content_length = 0;
 		}
 	}
-	buffer_destroy_with_custom_deallocator_and_null_if_valid(spice, sodium_free);
-	buffer_destroy_with_custom_deallocator_and_null_if_valid(os_random, sodium_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(spice, key_free);
+	buffer_destroy_with_custom_deallocator_and_null_if_valid(os_random, key_free);
 
 	return status;
 }
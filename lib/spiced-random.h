@@ -21,6 +21,7 @@
 
 #include "../buffer/buffer.h"
 #include "common.h"
+#include "molch.h"
 
 #ifndef LIB_SPICED_RANDOM_H
 #define LIB_SPICED_RANDOM_H
@@ -36,6 +37,7 @@
 return_status spiced_random(
 		buffer_t * const random_output,
 		const buffer_t * const random_spice,
-		const size_t output_length) __attribute__((warn_unused_result));
+		const size_t output_length,
+		const molch_spice_cost cost) __attribute__((warn_unused_result));
 
 #endif
@@ -0,0 +1,516 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+//needed for clock_gettime with -std=c99
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+/*
+ * Counters of one thread. They are only written by their thread, so
+ * an atomic load and store is enough to avoid torn reads by stats_get.
+ *
+ * Blocks are never freed, when a thread exits, its block is handed
+ * over to the next new thread, so no counts are lost.
+ */
+typedef struct stats_block stats_block;
+struct stats_block {
+	molch_stats stats;
+	bool in_use;
+	stats_block *next;
+};
+
+bool stats_enabled = false;
+
+static stats_block *blocks = NULL;
+static __thread stats_block *thread_block = NULL;
+static pthread_once_t release_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t release_key;
+static bool release_key_created = false;
+
+//skipped keys gauge
+static int64_t skipped_keys = 0;
+static int64_t skipped_keys_peak = 0;
+
+//stats_reset stores the totals and stats_get subtracts them
+static pthread_mutex_t baseline_mutex = PTHREAD_MUTEX_INITIALIZER;
+static molch_stats baseline;
+
+#define STATS_FIELD_COUNT (sizeof(molch_stats) / sizeof(uint64_t))
+
+static const char * const api_names[MOLCH_STATS_API_COUNT] = {
+	"create_user",
+	"destroy_user",
+	"list_users",
+	"start_send_conversation",
+	"start_receive_conversation",
+	"encrypt_message",
+	"decrypt_message",
+	"end_conversation",
+	"list_conversations",
+	"conversation_export",
+	"export",
+	"conversation_import",
+	"import",
+	"get_prekey_list",
+	"update_backup_key",
+	"start_send_attachment",
+	"start_receive_attachment",
+	"create_users",
+	"start_send_conversations",
+	"start_receive_conversations",
+	"decrypt_message_any",
+	"user_export",
+	"user_import"
+};
+
+static const char * const subsystem_names[MOLCH_STATS_SUBSYSTEM_COUNT] = {
+	"export_structs",
+	"protobuf",
+	"conversations",
+	"ratchets",
+	"keystores",
+	"prekey_stores",
+	"user_stores",
+	"master_keys",
+	"backups",
+	"errors"
+};
+
+const char *stats_get_api_name(const molch_stats_api api) {
+	if (api >= MOLCH_STATS_API_COUNT) {
+		return "(invalid)";
+	}
+
+	return api_names[api];
+}
+
+const char *stats_get_subsystem_name(const molch_stats_subsystem subsystem) {
+	if (subsystem >= MOLCH_STATS_SUBSYSTEM_COUNT) {
+		return "(invalid)";
+	}
+
+	return subsystem_names[subsystem];
+}
+
+static void release_block(void *block) {
+	__atomic_store_n(&((stats_block*)block)->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void create_release_key() {
+	//if this fails, blocks of exited threads aren't reused, nothing is lost though
+	release_key_created = (pthread_key_create(&release_key, release_block) == 0);
+}
+
+/*
+ * Get the counters of the current thread. Returns NULL if no memory
+ * could be allocated, in which case nothing is counted.
+ */
+static stats_block *get_block() {
+	if (thread_block != NULL) {
+		return thread_block;
+	}
+
+	pthread_once(&release_key_once, create_release_key);
+
+	//reuse the block of an exited thread
+	stats_block *block = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE);
+	for (; block != NULL; block = block->next) {
+		bool expected = false;
+		if (__atomic_compare_exchange_n(&block->in_use, &expected, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+
+	if (block == NULL) {
+		block = public_calloc(1, sizeof(stats_block));
+		if (block == NULL) {
+			return NULL;
+		}
+		block->in_use = true;
+
+		block->next = __atomic_load_n(&blocks, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&blocks, &block->next, block, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+	}
+
+	if (release_key_created) {
+		pthread_setspecific(release_key, block);
+	}
+	thread_block = block;
+
+	return block;
+}
+
+static void add(uint64_t * const counter, const uint64_t amount) {
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+static unsigned int bucket_of(const uint64_t value) {
+	if (value == 0) {
+		return 0;
+	}
+
+	unsigned int bucket = 64 - (unsigned int)__builtin_clzll(value);
+	if (bucket >= MOLCH_STATS_BUCKETS) {
+		bucket = MOLCH_STATS_BUCKETS - 1;
+	}
+
+	return bucket;
+}
+
+static void add_to_histogram(molch_stats_histogram * const histogram, const uint64_t value) {
+	add(&histogram->count, 1);
+	add(&histogram->sum, value);
+	add(&histogram->buckets[bucket_of(value)], 1);
+}
+
+uint64_t stats_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+void stats_record_call(const molch_stats_api api, const uint64_t start, const status_type status) {
+	const uint64_t duration = stats_now() - start;
+	stats_block * const block = get_block();
+	if ((block == NULL) || (api >= MOLCH_STATS_API_COUNT)) {
+		return;
+	}
+
+	molch_stats_call * const call = &block->stats.api[api];
+	add(&call->calls, 1);
+	if (status != SUCCESS) {
+		add(&call->errors, 1);
+	}
+	add_to_histogram(&call->latency, duration);
+}
+
+void stats_record_header_trial(const bool success) {
+	stats_block * const block = get_block();
+	if (block == NULL) {
+		return;
+	}
+
+	add(&block->stats.header_trial_decryptions, 1);
+	if (!success) {
+		add(&block->stats.header_trial_decryption_failures, 1);
+	}
+}
+
+void stats_record_prekey_deprecation() {
+	stats_block * const block = get_block();
+	if (block == NULL) {
+		return;
+	}
+
+	add(&block->stats.prekey_deprecations, 1);
+}
+
+void stats_record_pool_allocation(const bool hit) {
+	stats_block * const block = get_block();
+	if (block == NULL) {
+		return;
+	}
+
+	if (hit) {
+		add(&block->stats.pool_hits, 1);
+	} else {
+		add(&block->stats.pool_misses, 1);
+	}
+}
+
+void stats_record_allocation(const molch_stats_subsystem subsystem, const size_t size) {
+	stats_block * const block = get_block();
+	if ((block == NULL) || (subsystem >= MOLCH_STATS_SUBSYSTEM_COUNT)) {
+		return;
+	}
+
+	add(&block->stats.allocations[subsystem].count, 1);
+	add(&block->stats.allocations[subsystem].bytes, size);
+}
+
+void stats_record_export(const size_t size) {
+	stats_block * const block = get_block();
+	if (block == NULL) {
+		return;
+	}
+
+	add_to_histogram(&block->stats.export_sizes, size);
+}
+
+void stats_record_import(const size_t size) {
+	stats_block * const block = get_block();
+	if (block == NULL) {
+		return;
+	}
+
+	add_to_histogram(&block->stats.import_sizes, size);
+}
+
+void stats_skipped_keys_changed(const int64_t difference) {
+	if (difference == 0) {
+		return;
+	}
+
+	const int64_t current = __atomic_add_fetch(&skipped_keys, difference, __ATOMIC_RELAXED);
+	int64_t peak = __atomic_load_n(&skipped_keys_peak, __ATOMIC_RELAXED);
+	while ((current > peak)
+			&& !__atomic_compare_exchange_n(&skipped_keys_peak, &peak, current, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+void stats_enable(const bool enable) {
+	__atomic_store_n(&stats_enabled, enable, __ATOMIC_RELAXED);
+}
+
+/*
+ * Sum up the counters of all threads.
+ */
+static void get_totals(molch_stats * const totals) {
+	memset(totals, 0, sizeof(molch_stats));
+	uint64_t * const total_fields = (uint64_t*)totals;
+
+	for (stats_block *block = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE);
+			block != NULL;
+			block = block->next) {
+		uint64_t * const fields = (uint64_t*)&block->stats;
+		for (size_t i = 0; i < STATS_FIELD_COUNT; i++) {
+			total_fields[i] += __atomic_load_n(&fields[i], __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static uint64_t gauge_value(int64_t * const gauge) {
+	const int64_t value = __atomic_load_n(gauge, __ATOMIC_RELAXED);
+	if (value < 0) {
+		return 0;
+	}
+
+	return (uint64_t)value;
+}
+
+void stats_get(molch_stats * const stats) {
+	if (stats == NULL) {
+		return;
+	}
+
+	get_totals(stats);
+
+	pthread_mutex_lock(&baseline_mutex);
+	uint64_t * const fields = (uint64_t*)stats;
+	const uint64_t * const baseline_fields = (const uint64_t*)&baseline;
+	for (size_t i = 0; i < STATS_FIELD_COUNT; i++) {
+		fields[i] -= baseline_fields[i];
+	}
+	pthread_mutex_unlock(&baseline_mutex);
+
+	stats->skipped_keys = gauge_value(&skipped_keys);
+	stats->skipped_keys_peak = gauge_value(&skipped_keys_peak);
+}
+
+void stats_reset() {
+	pthread_mutex_lock(&baseline_mutex);
+	get_totals(&baseline);
+	pthread_mutex_unlock(&baseline_mutex);
+
+	__atomic_store_n(&skipped_keys_peak, __atomic_load_n(&skipped_keys, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+uint64_t stats_histogram_percentile(const molch_stats_histogram * const histogram, const double percentile) {
+	if ((histogram == NULL) || (histogram->count == 0)) {
+		return 0;
+	}
+
+	const uint64_t rank = (uint64_t)(percentile * (double)histogram->count);
+	uint64_t seen = 0;
+	for (unsigned int i = 0; i < MOLCH_STATS_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen > rank) {
+			if (i == 0) {
+				return 0;
+			}
+			if (i == (MOLCH_STATS_BUCKETS - 1)) {
+				return UINT64_MAX;
+			}
+
+			return ((uint64_t)1 << i) - 1;
+		}
+	}
+
+	return UINT64_MAX;
+}
+
+/*
+ * Output of stats_print. With 'output' being NULL only the
+ * length is calculated.
+ */
+typedef struct stats_printer {
+	char *output;
+	size_t size;
+	size_t length;
+} stats_printer;
+
+static void print(stats_printer * const printer, const char * const format, ...) __attribute__((format(printf, 2, 3)));
+static void print(stats_printer * const printer, const char * const format, ...) {
+	va_list arguments;
+	va_start(arguments, format);
+
+	char *position = NULL;
+	size_t remaining = 0;
+	if ((printer->output != NULL) && (printer->length < printer->size)) {
+		position = printer->output + printer->length;
+		remaining = printer->size - printer->length;
+	}
+
+	const int written = vsnprintf(position, remaining, format, arguments);
+	if (written > 0) {
+		printer->length += (size_t)written;
+	}
+
+	va_end(arguments);
+}
+
+static void print_histogram_json(stats_printer * const printer, const molch_stats_histogram * const histogram) {
+	print(printer, "{\"count\":%llu,\"sum\":%llu,\"p50\":%llu,\"p99\":%llu,\"buckets\":[",
+			(unsigned long long)histogram->count,
+			(unsigned long long)histogram->sum,
+			(unsigned long long)stats_histogram_percentile(histogram, 0.5),
+			(unsigned long long)stats_histogram_percentile(histogram, 0.99));
+	for (unsigned int i = 0; i < MOLCH_STATS_BUCKETS; i++) {
+		print(printer, (i == 0) ? "%llu" : ",%llu", (unsigned long long)histogram->buckets[i]);
+	}
+	print(printer, "]}");
+}
+
+static void print_json(stats_printer * const printer, const molch_stats * const stats) {
+	print(printer, "{\"api\":{");
+	for (unsigned int i = 0; i < MOLCH_STATS_API_COUNT; i++) {
+		const molch_stats_call * const call = &stats->api[i];
+		print(printer, "%s\"%s\":{\"calls\":%llu,\"errors\":%llu,\"latency_ns\":",
+				(i == 0) ? "" : ",",
+				api_names[i],
+				(unsigned long long)call->calls,
+				(unsigned long long)call->errors);
+		print_histogram_json(printer, &call->latency);
+		print(printer, "}");
+	}
+	print(printer, "},\"header_trial_decryptions\":%llu,\"header_trial_decryption_failures\":%llu,\"prekey_deprecations\":%llu,\"pool_hits\":%llu,\"pool_misses\":%llu,\"skipped_keys\":%llu,\"skipped_keys_peak\":%llu,\"allocations\":{",
+			(unsigned long long)stats->header_trial_decryptions,
+			(unsigned long long)stats->header_trial_decryption_failures,
+			(unsigned long long)stats->prekey_deprecations,
+			(unsigned long long)stats->pool_hits,
+			(unsigned long long)stats->pool_misses,
+			(unsigned long long)stats->skipped_keys,
+			(unsigned long long)stats->skipped_keys_peak);
+	for (unsigned int i = 0; i < MOLCH_STATS_SUBSYSTEM_COUNT; i++) {
+		print(printer, "%s\"%s\":{\"count\":%llu,\"bytes\":%llu}",
+				(i == 0) ? "" : ",",
+				subsystem_names[i],
+				(unsigned long long)stats->allocations[i].count,
+				(unsigned long long)stats->allocations[i].bytes);
+	}
+	print(printer, "},\"export_sizes\":");
+	print_histogram_json(printer, &stats->export_sizes);
+	print(printer, ",\"import_sizes\":");
+	print_histogram_json(printer, &stats->import_sizes);
+	print(printer, "}\n");
+}
+
+static void print_histogram_text(stats_printer * const printer, const char * const name, const molch_stats_histogram * const histogram) {
+	print(printer, "%s: count=%llu mean=%llu p50<=%llu p99<=%llu\n",
+			name,
+			(unsigned long long)histogram->count,
+			(unsigned long long)((histogram->count == 0) ? 0 : (histogram->sum / histogram->count)),
+			(unsigned long long)stats_histogram_percentile(histogram, 0.5),
+			(unsigned long long)stats_histogram_percentile(histogram, 0.99));
+}
+
+static void print_text(stats_printer * const printer, const molch_stats * const stats) {
+	for (unsigned int i = 0; i < MOLCH_STATS_API_COUNT; i++) {
+		const molch_stats_call * const call = &stats->api[i];
+		if (call->calls == 0) {
+			continue;
+		}
+		print(printer, "%s: calls=%llu errors=%llu latency_ns: mean=%llu p50<=%llu p99<=%llu\n",
+				api_names[i],
+				(unsigned long long)call->calls,
+				(unsigned long long)call->errors,
+				(unsigned long long)(call->latency.sum / call->calls),
+				(unsigned long long)stats_histogram_percentile(&call->latency, 0.5),
+				(unsigned long long)stats_histogram_percentile(&call->latency, 0.99));
+	}
+	print(printer, "header trial decryptions: %llu (%llu failed)\n",
+			(unsigned long long)stats->header_trial_decryptions,
+			(unsigned long long)stats->header_trial_decryption_failures);
+	print(printer, "prekey deprecations: %llu\n", (unsigned long long)stats->prekey_deprecations);
+	print(printer, "pool allocations: %llu (%llu needed malloc)\n",
+			(unsigned long long)(stats->pool_hits + stats->pool_misses),
+			(unsigned long long)stats->pool_misses);
+	print(printer, "skipped keys: %llu (peak %llu)\n",
+			(unsigned long long)stats->skipped_keys,
+			(unsigned long long)stats->skipped_keys_peak);
+	for (unsigned int i = 0; i < MOLCH_STATS_SUBSYSTEM_COUNT; i++) {
+		print(printer, "allocations %s: %llu (%llu bytes)\n",
+				subsystem_names[i],
+				(unsigned long long)stats->allocations[i].count,
+				(unsigned long long)stats->allocations[i].bytes);
+	}
+	print_histogram_text(printer, "export sizes", &stats->export_sizes);
+	print_histogram_text(printer, "import sizes", &stats->import_sizes);
+}
+
+char *stats_print(size_t * const output_length, const molch_stats * const stats, const molch_stats_format format) {
+	if (stats == NULL) {
+		return NULL;
+	}
+
+	//first pass only calculates the length, the second one prints
+	stats_printer printer = {NULL, 0, 0};
+	for (unsigned int pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			printer.size = printer.length + 1; //'\0'
+			printer.length = 0;
+			printer.output = public_malloc(printer.size);
+			if (printer.output == NULL) {
+				return NULL;
+			}
+		}
+
+		if (format == MOLCH_STATS_JSON) {
+			print_json(&printer, stats);
+		} else {
+			print_text(&printer, stats);
+		}
+	}
+
+	if (output_length != NULL) {
+		*output_length = printer.length;
+	}
+
+	return printer.output;
+}
@@ -0,0 +1,227 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*! \file
+ * Runtime statistics: Call counts, latency histograms and a few internal
+ * counters of the library.
+ *
+ * Every thread counts into its own block of counters (only written by
+ * that thread, no locks, no atomic read-modify-write), molch_get_stats
+ * sums up the blocks of all threads. Collecting is switched off by
+ * default, every hook then only costs one load and a branch.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "return-status.h"
+
+#ifndef LIB_STATS_H
+#define LIB_STATS_H
+
+//bucket i contains the values in [2^(i-1), 2^i), bucket 0 only contains 0
+#define MOLCH_STATS_BUCKETS 64
+
+typedef enum molch_stats_api {
+	MOLCH_STATS_CREATE_USER,
+	MOLCH_STATS_DESTROY_USER,
+	MOLCH_STATS_LIST_USERS,
+	MOLCH_STATS_START_SEND_CONVERSATION,
+	MOLCH_STATS_START_RECEIVE_CONVERSATION,
+	MOLCH_STATS_ENCRYPT_MESSAGE,
+	MOLCH_STATS_DECRYPT_MESSAGE,
+	MOLCH_STATS_END_CONVERSATION,
+	MOLCH_STATS_LIST_CONVERSATIONS,
+	MOLCH_STATS_CONVERSATION_EXPORT,
+	MOLCH_STATS_EXPORT,
+	MOLCH_STATS_CONVERSATION_IMPORT,
+	MOLCH_STATS_IMPORT,
+	MOLCH_STATS_GET_PREKEY_LIST,
+	MOLCH_STATS_UPDATE_BACKUP_KEY,
+	MOLCH_STATS_START_SEND_ATTACHMENT,
+	MOLCH_STATS_START_RECEIVE_ATTACHMENT,
+	//batches count as one call
+	MOLCH_STATS_CREATE_USERS,
+	MOLCH_STATS_START_SEND_CONVERSATIONS,
+	MOLCH_STATS_START_RECEIVE_CONVERSATIONS,
+	MOLCH_STATS_DECRYPT_MESSAGE_ANY,
+	MOLCH_STATS_USER_EXPORT,
+	MOLCH_STATS_USER_IMPORT,
+	MOLCH_STATS_API_COUNT
+} molch_stats_api;
+
+typedef enum molch_stats_subsystem {
+	MOLCH_STATS_EXPORT_STRUCTS, //zeroed_malloc, protobuf structs created by the export functions and temporary key buffers
+	MOLCH_STATS_PROTOBUF, //protobuf-c when unpacking
+	MOLCH_STATS_CONVERSATIONS,
+	MOLCH_STATS_RATCHETS,
+	MOLCH_STATS_KEYSTORES, //header and message keystore nodes
+	MOLCH_STATS_PREKEY_STORES,
+	MOLCH_STATS_USER_STORES,
+	MOLCH_STATS_MASTER_KEYS,
+	MOLCH_STATS_BACKUPS, //encrypted backups returned to the caller
+	MOLCH_STATS_ERRORS, //error messages of return_status
+	MOLCH_STATS_SUBSYSTEM_COUNT
+} molch_stats_subsystem;
+
+typedef enum molch_stats_format {
+	MOLCH_STATS_TEXT,
+	MOLCH_STATS_JSON
+} molch_stats_format;
+
+typedef struct molch_stats_histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t buckets[MOLCH_STATS_BUCKETS];
+} molch_stats_histogram;
+
+typedef struct molch_stats_call {
+	uint64_t calls;
+	uint64_t errors;
+	molch_stats_histogram latency; //nanoseconds
+} molch_stats_call;
+
+typedef struct molch_stats_allocations {
+	uint64_t count;
+	uint64_t bytes;
+} molch_stats_allocations;
+
+/*
+ * A snapshot of the statistics. Every member has to be an uint64_t,
+ * the per thread blocks are summed up member by member.
+ */
+typedef struct molch_stats {
+	molch_stats_call api[MOLCH_STATS_API_COUNT];
+	//tries to decrypt a header with skipped, current or next header keys in conversation_receive
+	uint64_t header_trial_decryptions;
+	uint64_t header_trial_decryption_failures;
+	uint64_t prekey_deprecations;
+	//zeroed_malloc allocations served from the pools of freed blocks and the ones that needed malloc
+	uint64_t pool_hits;
+	uint64_t pool_misses;
+	molch_stats_allocations allocations[MOLCH_STATS_SUBSYSTEM_COUNT];
+	molch_stats_histogram export_sizes; //bytes, molch_export and molch_conversation_export
+	molch_stats_histogram import_sizes; //bytes, molch_import and molch_conversation_import
+	//skipped header and message keys of all conversations, also counted while disabled
+	uint64_t skipped_keys;
+	uint64_t skipped_keys_peak; //since the last reset
+} molch_stats;
+
+/*
+ * Get the name of an API entry point or subsystem as used in the output
+ * of molch_print_stats.
+ */
+const char *stats_get_api_name(const molch_stats_api api);
+const char *stats_get_subsystem_name(const molch_stats_subsystem subsystem);
+
+/*
+ * Approximate a percentile (0 to 1) from a histogram. Returns the
+ * upper bound of the bucket that contains it.
+ */
+uint64_t stats_histogram_percentile(const molch_stats_histogram * const histogram, const double percentile);
+
+void stats_enable(const bool enable);
+void stats_get(molch_stats * const stats);
+void stats_reset();
+
+/*
+ * Print statistics as text or JSON.
+ *
+ * Returns NULL on failure. Don't forget to free the output after use.
+ */
+char *stats_print(size_t * const output_length, const molch_stats * const stats, const molch_stats_format format) __attribute__((warn_unused_result));
+
+//out of line parts of the hooks below, don't call them directly
+extern bool stats_enabled;
+uint64_t stats_now();
+void stats_record_call(const molch_stats_api api, const uint64_t start, const status_type status);
+void stats_record_header_trial(const bool success);
+void stats_record_prekey_deprecation();
+void stats_record_pool_allocation(const bool hit);
+void stats_record_allocation(const molch_stats_subsystem subsystem, const size_t size);
+void stats_record_export(const size_t size);
+void stats_record_import(const size_t size);
+
+static inline bool stats_are_enabled() {
+	return __builtin_expect(__atomic_load_n(&stats_enabled, __ATOMIC_RELAXED), 0);
+}
+
+/*
+ * Timestamp to be passed to stats_call_end at the beginning of an API call,
+ * 0 if the statistics are disabled.
+ */
+static inline uint64_t stats_call_begin() {
+	if (stats_are_enabled()) {
+		return stats_now();
+	}
+
+	return 0;
+}
+
+static inline void stats_call_end(const molch_stats_api api, const uint64_t start, const return_status status) {
+	if (start != 0) {
+		stats_record_call(api, start, status.status);
+	}
+}
+
+static inline void stats_header_trial(const bool success) {
+	if (stats_are_enabled()) {
+		stats_record_header_trial(success);
+	}
+}
+
+static inline void stats_prekey_deprecation() {
+	if (stats_are_enabled()) {
+		stats_record_prekey_deprecation();
+	}
+}
+
+static inline void stats_pool_allocation(const bool hit) {
+	if (stats_are_enabled()) {
+		stats_record_pool_allocation(hit);
+	}
+}
+
+static inline void stats_allocation(const molch_stats_subsystem subsystem, const size_t size) {
+	if (stats_are_enabled()) {
+		stats_record_allocation(subsystem, size);
+	}
+}
+
+static inline void stats_export(const size_t size) {
+	if (stats_are_enabled()) {
+		stats_record_export(size);
+	}
+}
+
+static inline void stats_import(const size_t size) {
+	if (stats_are_enabled()) {
+		stats_record_import(size);
+	}
+}
+
+/*
+ * Add to the number of skipped header and message keys. This is a gauge
+ * and therefore always counted (it only changes when keys are skipped,
+ * used or thrown away, which isn't the fast path).
+ */
+void stats_skipped_keys_changed(const int64_t difference);
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+typedef struct trace_event {
+	const char *name;
+	uint64_t start; //nanoseconds
+	uint64_t duration;
+} trace_event;
+
+/*
+ * Ring buffer of one thread. Only the thread writes to it, 'head' is
+ * the number of events ever written and published with release semantics
+ * after the event has been written.
+ *
+ * Rings are never freed, when a thread exits, its ring is handed over to
+ * the next new thread.
+ */
+typedef struct trace_ring trace_ring;
+struct trace_ring {
+	trace_event events[TRACE_RING_SIZE];
+	uint64_t head;
+	unsigned int thread_id;
+	bool in_use;
+	trace_ring *next;
+};
+
+bool trace_enabled = false;
+
+static trace_ring *rings = NULL;
+static unsigned int ring_count = 0;
+static __thread trace_ring *thread_ring = NULL;
+static pthread_once_t release_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t release_key;
+static bool release_key_created = false;
+
+//events that started before this are ignored
+static uint64_t trace_epoch = 0;
+
+static void release_ring(void *ring) {
+	__atomic_store_n(&((trace_ring*)ring)->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void create_release_key() {
+	//if this fails, rings of exited threads aren't reused
+	release_key_created = (pthread_key_create(&release_key, release_ring) == 0);
+}
+
+/*
+ * Get the ring of the current thread. Returns NULL if no memory
+ * could be allocated, in which case the event is dropped.
+ */
+static trace_ring *get_ring() {
+	if (thread_ring != NULL) {
+		return thread_ring;
+	}
+
+	pthread_once(&release_key_once, create_release_key);
+
+	//reuse the ring of an exited thread
+	trace_ring *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	for (; ring != NULL; ring = ring->next) {
+		bool expected = false;
+		if (__atomic_compare_exchange_n(&ring->in_use, &expected, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+
+	if (ring == NULL) {
+		ring = public_calloc(1, sizeof(trace_ring));
+		if (ring == NULL) {
+			return NULL;
+		}
+		ring->in_use = true;
+		ring->thread_id = __atomic_add_fetch(&ring_count, 1, __ATOMIC_RELAXED);
+
+		ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+	}
+
+	if (release_key_created) {
+		pthread_setspecific(release_key, ring);
+	}
+	thread_ring = ring;
+
+	return ring;
+}
+
+void trace_record(const char * const name, const uint64_t start) {
+	const uint64_t end = stats_now();
+	trace_ring * const ring = get_ring();
+	if (ring == NULL) {
+		return;
+	}
+
+	const uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	trace_event * const event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+	event->name = name;
+	event->start = start;
+	event->duration = end - start;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_start() {
+	__atomic_store_n(&trace_epoch, stats_now(), __ATOMIC_RELAXED);
+	__atomic_store_n(&trace_enabled, true, __ATOMIC_RELAXED);
+}
+
+void trace_stop() {
+	__atomic_store_n(&trace_enabled, false, __ATOMIC_RELAXED);
+}
+
+/*
+ * Output of trace_print. With 'output' being NULL only the
+ * length is calculated.
+ */
+typedef struct trace_printer {
+	char *output;
+	size_t size;
+	size_t length;
+	size_t events;
+} trace_printer;
+
+static void print(trace_printer * const printer, const char * const format, ...) __attribute__((format(printf, 2, 3)));
+static void print(trace_printer * const printer, const char * const format, ...) {
+	va_list arguments;
+	va_start(arguments, format);
+
+	char *position = NULL;
+	size_t remaining = 0;
+	if ((printer->output != NULL) && (printer->length < printer->size)) {
+		position = printer->output + printer->length;
+		remaining = printer->size - printer->length;
+	}
+
+	const int written = vsnprintf(position, remaining, format, arguments);
+	if (written > 0) {
+		printer->length += (size_t)written;
+	}
+
+	va_end(arguments);
+}
+
+static void print_event(trace_printer * const printer, const trace_event * const event, const unsigned int thread_id, const uint64_t epoch) {
+	//timestamps are in microseconds
+	const uint64_t start = event->start - epoch;
+	print(printer, "%s\n{\"name\":\"%s\",\"cat\":\"molch\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}",
+			(printer->events == 0) ? "" : ",",
+			event->name,
+			thread_id,
+			(unsigned long long)(start / 1000),
+			(unsigned long long)(start % 1000),
+			(unsigned long long)(event->duration / 1000),
+			(unsigned long long)(event->duration % 1000));
+	printer->events++;
+}
+
+/*
+ * Print the events of one ring up to 'head'. If the thread writes while
+ * the ring is being printed, events that might have been overwritten in
+ * the meantime are skipped.
+ */
+static void print_ring(trace_printer * const printer, trace_ring * const ring, const uint64_t head, const uint64_t epoch) {
+	const uint64_t first = (head > TRACE_RING_SIZE) ? (head - TRACE_RING_SIZE) : 0;
+
+	for (uint64_t i = first; i < head; i++) {
+		const trace_event event = ring->events[i & (TRACE_RING_SIZE - 1)];
+
+		//the copy has to be done before 'head' is checked again
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		const uint64_t current_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		//the slot of 'current_head - TRACE_RING_SIZE' might be written right now
+		if ((current_head >= TRACE_RING_SIZE) && (i <= (current_head - TRACE_RING_SIZE))) {
+			continue; //overwritten while copying
+		}
+
+		if (event.start < epoch) {
+			continue;
+		}
+
+		print_event(printer, &event, ring->thread_id, epoch);
+	}
+}
+
+char *trace_print(size_t * const output_length) {
+	const uint64_t epoch = __atomic_load_n(&trace_epoch, __ATOMIC_RELAXED);
+
+	uint64_t *heads = NULL;
+	trace_printer printer = {NULL, 0, 0, 0};
+
+	//new rings are only ever added in front of the list
+	trace_ring * const first_ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	size_t count = 0;
+	for (trace_ring *ring = first_ring; ring != NULL; ring = ring->next) {
+		count++;
+	}
+
+	//both passes print up to the same heads, the second one can only skip more overwritten events
+	heads = public_malloc((count + 1) * sizeof(uint64_t));
+	if (heads == NULL) {
+		goto cleanup;
+	}
+	size_t index = 0;
+	for (trace_ring *ring = first_ring; ring != NULL; ring = ring->next, index++) {
+		heads[index] = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	}
+
+	//first pass only calculates the length, the second one prints
+	for (unsigned int pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			printer.size = printer.length + 1; //'\0'
+			printer.length = 0;
+			printer.events = 0;
+			printer.output = public_malloc(printer.size);
+			if (printer.output == NULL) {
+				goto cleanup;
+			}
+		}
+
+		print(&printer, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+		index = 0;
+		for (trace_ring *ring = first_ring; ring != NULL; ring = ring->next, index++) {
+			print_ring(&printer, ring, heads[index], epoch);
+		}
+		print(&printer, "\n]}\n");
+	}
+
+	//vsnprintf truncates, never report more than was written
+	if (printer.length >= printer.size) {
+		printer.length = printer.size - 1;
+	}
+	if (output_length != NULL) {
+		*output_length = printer.length;
+	}
+
+cleanup:
+	public_free(heads);
+
+	return printer.output;
+}
@@ -0,0 +1,82 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*! \file
+ * Static tracepoints on the hot paths of the library.
+ *
+ * A tracepoint is a pair of trace_begin/trace_end around the code to be
+ * measured. When tracing is on, trace_end writes one timestamped event
+ * into a ring buffer of the current thread (only written by that thread,
+ * no locks), the oldest events are overwritten when the ring is full.
+ * When tracing is off, a tracepoint costs one load and a branch.
+ *
+ * trace_print dumps all rings in the Chrome trace event format, which can
+ * be opened with chrome://tracing or other trace viewers.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stats.h"
+
+#ifndef LIB_TRACE_H
+#define LIB_TRACE_H
+
+//events per thread, has to be a power of two
+#define TRACE_RING_SIZE 65536
+
+/*
+ * Start tracing, events recorded before this call aren't printed anymore.
+ */
+void trace_start();
+void trace_stop();
+
+/*
+ * Print the events of all threads as Chrome trace event JSON.
+ *
+ * Returns NULL on failure. Don't forget to free the output after use.
+ */
+char *trace_print(size_t * const output_length) __attribute__((warn_unused_result));
+
+//out of line part of trace_end, don't call it directly
+extern bool trace_enabled;
+void trace_record(const char * const name, const uint64_t start);
+
+/*
+ * Timestamp to be passed to trace_end, 0 if tracing is off.
+ */
+static inline uint64_t trace_begin() {
+	if (__builtin_expect(__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED), 0)) {
+		return stats_now();
+	}
+
+	return 0;
+}
+
+/*
+ * 'name' has to be a string literal, only the pointer is stored.
+ */
+static inline void trace_end(const char * const name, const uint64_t start) {
+	if (start != 0) {
+		trace_record(name, start);
+	}
+}
+#endif
@@ -19,11 +19,19 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
 #include <string.h>
 #include <assert.h>
 
 #include "constants.h"
 #include "user-store.h"
+#include "stats.h"
+#include "trace.h"
+
+//every store starts at a different generation, so cursors don't match a replaced store
+static uint64_t next_generation = 0;
 
 //create a new user_store
 return_status user_store_create(user_store ** const store) {
@@ -34,13 +42,26 @@ return_status user_store_create(user_store ** const store) {
 		throw(INVALID_INPUT, "Pointer to put new user store into is NULL.");
 	}
 
-	*store = sodium_malloc(sizeof(user_store));
+	*store = key_malloc(sizeof(user_store));
 	throw_on_failed_alloc(*store);
+	stats_allocation(MOLCH_STATS_USER_STORES, sizeof(user_store));
 
 	//initialise
 	(*store)->length = 0;
-	(*store)->head = NULL;
-	(*store)->tail = NULL;
+	(*store)->generation = __atomic_add_fetch(&next_generation, UINT64_C(1) << 32, __ATOMIC_RELAXED);
+	for (size_t i = 0; i < USER_STORE_SHARDS; i++) {
+		user_store_shard * const shard = &(*store)->shards[i];
+		shard->length = 0;
+		shard->head = NULL;
+		shard->tail = NULL;
+		if (pthread_mutex_init(&shard->lock, NULL) != 0) {
+			for (size_t j = 0; j < i; j++) {
+				pthread_mutex_destroy(&(*store)->shards[j].lock);
+			}
+			key_free_and_null_if_valid(*store);
+			throw(INIT_ERROR, "Failed to initialize the lock of a shard.");
+		}
+	}
 
 cleanup:
 	on_error {
@@ -56,52 +77,79 @@ cleanup:
 void user_store_destroy(user_store* store) {
 	if (store != NULL) {
 		user_store_clear(store);
-		sodium_free_and_null_if_valid(store);
+		for (size_t i = 0; i < USER_STORE_SHARDS; i++) {
+			pthread_mutex_destroy(&store->shards[i].lock);
+		}
+		key_free_and_null_if_valid(store);
 	}
 }
 
-/*
- * add a new user node to a user store.
- */
-void add_user_store_node(user_store * const store, user_store_node * const node) {
-	if ((store == NULL) || (node == NULL)) {
-		return;
-	}
+size_t user_store_shard_index(const unsigned char * const public_signing_key) {
+	//public keys are uniformly distributed already, no need to hash them
+	return public_signing_key[0] & (USER_STORE_SHARDS - 1);
+}
+
+user_store_shard *user_store_lock_shard(user_store * const store, const buffer_t * const public_signing_key) {
+	user_store_shard * const shard = &store->shards[user_store_shard_index(public_signing_key->content)];
+	pthread_mutex_lock(&shard->lock);
 
-	if (store->length == 0) { //first node in the list
-		node->previous = NULL;
-		node->next = NULL;
-		store->head = node;
-		store->tail = node;
+	return shard;
+}
 
-		//update length
-		store->length++;
+void user_store_unlock_shard(user_store_shard * const shard) {
+	pthread_mutex_unlock(&shard->lock);
+}
 
+void user_store_lock_all(user_store * const store) {
+	for (size_t i = 0; i < USER_STORE_SHARDS; i++) {
+		pthread_mutex_lock(&store->shards[i].lock);
+	}
+}
+
+void user_store_unlock_all(user_store * const store) {
+	for (size_t i = USER_STORE_SHARDS; i > 0; i--) {
+		pthread_mutex_unlock(&store->shards[i - 1].lock);
+	}
+}
+
+void user_store_add_node(user_store * const store, user_store_node * const node) {
+	if ((store == NULL) || (node == NULL)) {
 		return;
 	}
 
+	user_store_shard * const shard = user_store_lock_shard(store, node->public_signing_key);
+
 	//add the new node to the tail of the list
-	store->tail->next = node;
-	node->previous = store->tail;
+	node->previous = shard->tail;
 	node->next = NULL;
-	store->tail = node;
+	if (shard->tail == NULL) { //first node in the list
+		shard->head = node;
+	} else {
+		shard->tail->next = node;
+	}
+	shard->tail = node;
 
 	//update length
-	store->length++;
+	shard->length++;
+	__atomic_add_fetch(&store->length, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&store->generation, 1, __ATOMIC_RELAXED);
+
+	user_store_unlock_shard(shard);
 }
 
 /*
  * create an empty user_store_node and set up all the pointers.
  */
-return_status create_user_store_node(user_store_node ** const node) {
+static return_status create_user_store_node(user_store_node ** const node) {
 	return_status status = return_status_init();
 
 	if (node == NULL) {
 		throw(INVALID_INPUT, "Pointer to put new user store node into is NULL.");
 	}
 
-	*node = sodium_malloc(sizeof(user_store_node));
+	*node = key_malloc(sizeof(user_store_node));
 	throw_on_failed_alloc(*node);
+	stats_allocation(MOLCH_STATS_USER_STORES, sizeof(user_store_node));
 
 	//initialise pointers
 	(*node)->previous = NULL;
@@ -124,22 +172,20 @@ cleanup:
 	return status;
 }
 
-/*
- * Create a new user and add it to the user store.
- *
- * The seed is optional an can be used to add entropy in addition
- * to the entropy provided by the OS. IMPORTANT: Don't put entropy in
- * here, that was generated by the OSs CPRNG!
- */
-return_status user_store_create_user(
-		user_store *store,
+return_status user_store_create_node(
+		user_store_node ** const node,
 		const buffer_t * const seed, //optional, can be NULL
-		buffer_t * const public_signing_key, //output, optional, can be NULL
+		const molch_spice_cost spice_cost,
 		buffer_t * const public_identity_key) { //output, optional, can be NULL
 
 	return_status status = return_status_init();
 
 	user_store_node *new_node = NULL;
+
+	if (node == NULL) {
+		throw(INVALID_INPUT, "Invalid input to user_store_create_node.");
+	}
+
 	status = create_user_store_node(&new_node);
 	throw_on_error(CREATION_ERROR, "Failed to create new user store node.");
 
@@ -147,6 +193,7 @@ return_status user_store_create_user(
 	status = master_keys_create(
 			&(new_node->master_keys),
 			seed,
+			spice_cost,
 			new_node->public_signing_key,
 			public_identity_key);
 	throw_on_error(CREATION_ERROR, "Failed to create master keys.");
@@ -155,6 +202,50 @@ return_status user_store_create_user(
 	status = prekey_store_create(&(new_node->prekeys));
 	throw_on_error(CREATION_ERROR, "Failed to create prekey store.")
 
+	*node = new_node;
+	new_node = NULL;
+
+cleanup:
+	user_store_destroy_node(new_node);
+
+	return status;
+}
+
+void user_store_destroy_node(user_store_node * const node) {
+	if (node == NULL) {
+		return;
+	}
+
+	conversation_store_clear(node->conversations);
+	if (node->prekeys != NULL) {
+		prekey_store_destroy(node->prekeys);
+	}
+	if (node->master_keys != NULL) {
+		key_free_and_null_if_valid(node->master_keys);
+	}
+
+	key_free(node);
+}
+
+/*
+ * Create a new user and add it to the user store.
+ *
+ * The seed is optional an can be used to add entropy in addition
+ * to the entropy provided by the OS. IMPORTANT: Don't put entropy in
+ * here, that was generated by the OSs CPRNG!
+ */
+return_status user_store_create_user(
+		user_store *store,
+		const buffer_t * const seed, //optional, can be NULL
+		buffer_t * const public_signing_key, //output, optional, can be NULL
+		buffer_t * const public_identity_key) { //output, optional, can be NULL
+
+	return_status status = return_status_init();
+
+	user_store_node *new_node = NULL;
+	status = user_store_create_node(&new_node, seed, MOLCH_SPICE_COST_INTERACTIVE, public_identity_key);
+	throw_on_error(CREATION_ERROR, "Failed to create new user.");
+
 	//copy the public signing key, if requested
 	if (public_signing_key != NULL) {
 		if (public_signing_key->buffer_length < PUBLIC_MASTER_KEY_SIZE) {
@@ -166,21 +257,11 @@ return_status user_store_create_user(
 		}
 	}
 
-	add_user_store_node(store, new_node);
+	user_store_add_node(store, new_node);
+	new_node = NULL;
 
 cleanup:
-	on_error {
-		if (new_node != NULL) {
-			if (new_node->prekeys != NULL) {
-				prekey_store_destroy(new_node->prekeys);
-			}
-			if (new_node->master_keys != NULL) {
-				sodium_free_and_null_if_valid(new_node->master_keys);
-			}
-
-			sodium_free_and_null_if_valid(new_node);
-		}
-	}
+	user_store_destroy_node(new_node);
 
 	return status;
 }
@@ -192,12 +273,13 @@ cleanup:
  */
 return_status user_store_find_node(user_store_node ** const node, user_store * const store, const buffer_t * const public_signing_key) {
 	return_status status = return_status_init();
+	const uint64_t trace_start = trace_begin();
 
 	if ((node == NULL) || (public_signing_key == NULL) || (public_signing_key->content_length != PUBLIC_MASTER_KEY_SIZE)) {
 		throw(INVALID_INPUT, "Invalid input for user_store_find_node.");
 	}
 
-	*node = store->head;
+	*node = store->shards[user_store_shard_index(public_signing_key->content)].head;
 
 	//search for the matching public identity key
 	while (*node != NULL) {
@@ -218,6 +300,8 @@ cleanup:
 		}
 	}
 
+	trace_end("user_store_find_node", trace_start);
+
 	return status;
 }
 
@@ -232,30 +316,38 @@ cleanup:
 return_status user_store_list(buffer_t ** const list, user_store * const store) {
 	return_status status = return_status_init();
 
+	bool locked = false;
+
 	if ((list == NULL) || (store == NULL)) {
 		throw(INVALID_INPUT, "Invalid input to user_store_list.");
 	}
 
+	user_store_lock_all(store);
+	locked = true;
+
 	*list = buffer_create_on_heap(PUBLIC_MASTER_KEY_SIZE * store->length, PUBLIC_MASTER_KEY_SIZE * store->length);
 	throw_on_failed_alloc(*list);
 
-	user_store_node *current_node = store->head;
-	for (size_t i = 0; (i < store->length) && (current_node != NULL); i++) {
-		int status_int = buffer_copy(
-				*list,
-				i * PUBLIC_MASTER_KEY_SIZE,
-				current_node->public_signing_key,
-				0,
-				current_node->public_signing_key->content_length);
-		if (status_int != 0) { //copying went wrong
-			throw(BUFFER_ERROR, "Failed to copy public master key to user list.");
+	size_t i = 0;
+	for (size_t shard = 0; shard < USER_STORE_SHARDS; shard++) {
+		for (user_store_node *current_node = store->shards[shard].head; current_node != NULL; current_node = current_node->next, i++) {
+			int status_int = buffer_copy(
+					*list,
+					i * PUBLIC_MASTER_KEY_SIZE,
+					current_node->public_signing_key,
+					0,
+					current_node->public_signing_key->content_length);
+			if (status_int != 0) { //copying went wrong
+				throw(BUFFER_ERROR, "Failed to copy public master key to user list.");
+			}
 		}
-
-		user_store_node *next_node = current_node->next;
-		current_node = next_node;
 	}
 
 cleanup:
+	if (locked) {
+		user_store_unlock_all(store);
+	}
+
 	on_error {
 		if (list != NULL) {
 				buffer_destroy_from_heap_and_null_if_valid(*list);
@@ -265,6 +357,33 @@ cleanup:
 	return status;
 }
 
+size_t user_store_list_page(
+		const user_store * const store,
+		size_t position,
+		unsigned char * const page,
+		const size_t capacity) {
+	size_t count = 0;
+	for (size_t shard = 0; (shard < USER_STORE_SHARDS) && (count < capacity); shard++) {
+		//skip whole shards
+		if (position >= store->shards[shard].length) {
+			position -= store->shards[shard].length;
+			continue;
+		}
+
+		for (const user_store_node *node = store->shards[shard].head; (node != NULL) && (count < capacity); node = node->next) {
+			if (position > 0) {
+				position--;
+				continue;
+			}
+
+			memcpy(page + count * PUBLIC_MASTER_KEY_SIZE, node->public_signing_key->content, PUBLIC_MASTER_KEY_SIZE);
+			count++;
+		}
+	}
+
+	return count;
+}
+
 /*
  * Remove a user from the user store.
  *
@@ -273,6 +392,14 @@ cleanup:
 return_status user_store_remove_by_key(user_store * const store, const buffer_t * const public_signing_key) {
 	return_status status = return_status_init();
 
+	user_store_shard *shard = NULL;
+
+	if ((store == NULL) || (public_signing_key == NULL) || (public_signing_key->content_length != PUBLIC_MASTER_KEY_SIZE)) {
+		throw(INVALID_INPUT, "Invalid input to user_store_remove_by_key.");
+	}
+
+	shard = user_store_lock_shard(store, public_signing_key);
+
 	user_store_node *node = NULL;
 	status = user_store_find_node(&node, store, public_signing_key);
 	throw_on_error(NOT_FOUND, "Failed to find user to remove.");
@@ -280,6 +407,10 @@ return_status user_store_remove_by_key(user_store * const store, const buffer_t
 	user_store_remove(store, node);
 
 cleanup:
+	if (shard != NULL) {
+		user_store_unlock_shard(shard);
+	}
+
 	return status;
 }
 
@@ -289,24 +420,26 @@ void user_store_remove(user_store *store, user_store_node *node) {
 		return;
 	}
 
-	//clear the conversation store
-	conversation_store_clear(node->conversations);
+	user_store_shard * const shard = &store->shards[user_store_shard_index(node->public_signing_key->content)];
 
 	if (node->next != NULL) { //node is not the tail
 		node->next->previous = node->previous;
 	} else { //node ist the tail
-		store->tail = node->previous;
+		shard->tail = node->previous;
 	}
 	if (node->previous != NULL) { //node ist not the head
 		node->previous->next = node->next;
 	} else { //node is the head
-		store->head = node->next;
+		shard->head = node->next;
 	}
 
-	sodium_free_and_null_if_valid(node);
+	//also frees the conversations, prekeys and master keys
+	user_store_destroy_node(node);
 
 	//update length
-	store->length--;
+	shard->length--;
+	__atomic_sub_fetch(&store->length, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&store->generation, 1, __ATOMIC_RELAXED);
 }
 
 //clear the entire user store
@@ -315,13 +448,17 @@ void user_store_clear(user_store *store){
 		return;
 	}
 
-	while (store->length > 0) {
-		user_store_remove(store, store->head);
+	for (size_t i = 0; i < USER_STORE_SHARDS; i++) {
+		user_store_shard * const shard = &store->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		while (shard->head != NULL) {
+			user_store_remove(store, shard->head);
+		}
+		pthread_mutex_unlock(&shard->lock);
 	}
 
 }
 
-return_status user_store_node_export(user_store_node * const node, User ** const user) __attribute__((warn_unused_result));
 return_status user_store_node_export(user_store_node * const node, User ** const user) {
 	return_status status = return_status_init();
 
@@ -406,39 +543,72 @@ cleanup:
 	return status;
 }
 
+return_status user_store_shard_export(
+		const user_store_shard * const shard,
+		User ** const users) {
+	return_status status = return_status_init();
+
+	//check input
+	if ((shard == NULL) || ((users == NULL) && (shard->length != 0))) {
+		throw(INVALID_INPUT, "Invalid input to user_store_shard_export.");
+	}
+
+	size_t i = 0;
+	user_store_node *node = NULL;
+	for (i = 0, node = shard->head; (i < shard->length) && (node != NULL); i++, node = node->next) {
+		status = user_store_node_export(node, &users[i]);
+		throw_on_error(EXPORT_ERROR, "Failed to export user store node.");
+	}
+
+cleanup:
+	return status;
+}
+
 return_status user_store_export(
-		const user_store * const store,
+		user_store * const store,
 		User *** const users,
 		size_t * const users_length) {
 	return_status status = return_status_init();
 
+	bool locked = false;
+
 	//check input
-	if ((users == NULL) || (users == NULL) || (users_length == NULL)) {
+	if ((store == NULL) || (users == NULL) || (users_length == NULL)) {
 		throw(INVALID_INPUT, "Invalid input to user_store_export.");
 	}
 
+	*users = NULL;
+	user_store_lock_all(store);
+	locked = true;
+
+	*users_length = store->length;
 	if (store->length > 0) {
 		*users = zeroed_malloc(store->length * sizeof(User*));
 		throw_on_failed_alloc(*users);
 		memset(*users, '\0', store->length * sizeof(User*));
 
-		size_t i = 0;
-		user_store_node *node = NULL;
-		for (i = 0, node = store->head; (i < store->length) && (node != NULL); i++, node = node->next) {
-			status = user_store_node_export(node, &((*users)[i]));
-			throw_on_error(EXPORT_ERROR, "Failed to export user store node.");
+		size_t offset = 0;
+		for (size_t i = 0; i < USER_STORE_SHARDS; i++) {
+			status = user_store_shard_export(&store->shards[i], *users + offset);
+			throw_on_error(EXPORT_ERROR, "Failed to export shard.");
+			offset += store->shards[i].length;
 		}
 	} else {
 		*users = NULL;
 	}
 
-	*users_length = store->length;
 cleanup:
+	if (locked) {
+		user_store_unlock_all(store);
+	}
+
 	on_error {
 		if ((users != NULL) && (*users != NULL) && (users_length != 0)) {
 			for (size_t i = 0; i < *users_length; i++) {
-				user__free_unpacked((*users)[i], &protobuf_c_allocators);
-				(*users)[i] = NULL;
+				if ((*users)[i] != NULL) {
+					user__free_unpacked((*users)[i], &protobuf_c_allocators);
+					(*users)[i] = NULL;
+				}
 			}
 			zeroed_free_and_null_if_valid(*users);
 		}
@@ -490,6 +660,13 @@ return_status user_store_node_import(user_store_node ** const node, const User *
 	throw_on_error(IMPORT_ERROR, "Failed to import prekeys.");
 
 cleanup:
+	on_error {
+		if (node != NULL) {
+			user_store_destroy_node(*node);
+			*node = NULL;
+		}
+	}
+
 	return status;
 }
 
@@ -515,7 +692,7 @@ return_status user_store_import(
 		status = user_store_node_import(&node, users[i]);
 		throw_on_error(IMPORT_ERROR, "Failed to import user store node.");
 
-		add_user_store_node(*store, node);
+		user_store_add_node(*store, node);
 	}
 
 cleanup:
@@ -21,6 +21,7 @@
 
 #include <sodium.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "constants.h"
 #include "../buffer/buffer.h"
@@ -32,8 +33,18 @@
 #ifndef LIB_USER_STORE_H
 #define LIB_USER_STORE_H
 
-//The user store stores a linked list of all users identified by their private keys
-//This linked list is supposed to be stored once in a global variable.
+//The user store stores all users identified by their public signing keys.
+//It is supposed to be stored once in a global variable.
+//
+//The users are partitioned into USER_STORE_SHARDS shards by their public
+//signing key, every shard is a linked list with its own lock. Everything
+//that belongs to a user (master keys, prekeys, conversations) is protected
+//by the lock of its shard, so users in different shards can be used and
+//added or removed concurrently. Shards are always locked in ascending order
+//when more than one is needed.
+
+//has to be a power of two
+#define USER_STORE_SHARDS 16U
 
 //node of the linked list
 typedef struct user_store_node user_store_node;
@@ -47,11 +58,18 @@ struct user_store_node {
 	conversation_store conversations[1];
 };
 
-//header of the user store
-typedef struct user_store {
+typedef struct user_store_shard {
+	pthread_mutex_t lock;
 	size_t length;
 	user_store_node *head;
 	user_store_node *tail;
+} user_store_shard;
+
+//header of the user store
+typedef struct user_store {
+	size_t length; //of all shards, use __atomic_load_n if other threads might modify the store
+	uint64_t generation; //changes whenever a user is added or removed
+	user_store_shard shards[USER_STORE_SHARDS];
 } user_store;
 
 //create a new user store
@@ -60,9 +78,51 @@ return_status user_store_create(user_store ** const store) __attribute__((warn_u
 //destroy a user store
 void user_store_destroy(user_store * const store);
 
+/*
+ * Index of the shard a user with the given public signing key belongs to.
+ */
+size_t user_store_shard_index(const unsigned char * const public_signing_key);
+
+/*
+ * Lock and unlock the shard of a user. The user doesn't have to exist.
+ */
+user_store_shard *user_store_lock_shard(user_store * const store, const buffer_t * const public_signing_key);
+void user_store_unlock_shard(user_store_shard * const shard);
+
+//lock or unlock all shards, e.g. for a consistent export
+void user_store_lock_all(user_store * const store);
+void user_store_unlock_all(user_store * const store);
+
+/*
+ * Create the node of a new user (master keys and prekeys) without adding
+ * it to a user store, so several users can be created in parallel. Add
+ * it with user_store_add_node or destroy it with user_store_destroy_node.
+ *
+ * The seed is optional, see user_store_create_user.
+ */
+return_status user_store_create_node(
+		user_store_node ** const node, //output
+		const buffer_t * const seed, //optional, can be NULL
+		const molch_spice_cost spice_cost, //how expensive it is to derive random data from the seed
+		buffer_t * const public_identity_key //output, optional, can be NULL
+		) __attribute__((warn_unused_result));
+
+/*
+ * Add a new user node to a user store, locks the shard of the user.
+ */
+void user_store_add_node(user_store * const store, user_store_node * const node);
+
+/*
+ * Destroy a node that isn't in a user store.
+ */
+void user_store_destroy_node(user_store_node * const node);
+
 /*
  * Create a new user and add it to the user store.
  *
+ * The keys are generated without holding a lock, the shard of the new
+ * user is only locked while it is being added.
+ *
  * The seed is optional an can be used to add entropy in addition
  * to the entropy provided by the OS. IMPORTANT: Don't put entropy in
  * here, that was generated by the OSs CPRNG!
@@ -77,7 +137,8 @@ return_status user_store_create_user(
 /*
  * Find a user for a given public signing key.
  *
- * Returns NULL if no user was found.
+ * Returns NULL if no user was found. The shard of the user has to be
+ * locked while the node is used.
  */
 return_status user_store_find_node(user_store_node ** const node, user_store * const store, const buffer_t * const public_signing_key) __attribute__((warn_unused_result));
 
@@ -88,30 +149,75 @@ return_status user_store_find_node(user_store_node ** const node, user_store * c
  * signing keys of the user.
  *
  * The buffer is heap allocated, so don't forget to free it!
+ *
+ * Locks all shards.
  */
 return_status user_store_list(buffer_t ** const list, user_store * const store) __attribute__((warn_unused_result));
 
+/*
+ * Copy the public signing keys of up to 'capacity' users into 'page',
+ * starting with the user at 'position' in the order of user_store_list.
+ *
+ * Returns the number of copied keys. All shards have to be locked.
+ */
+size_t user_store_list_page(
+		const user_store * const store,
+		size_t position,
+		unsigned char * const page,
+		const size_t capacity);
+
 /*
  * Remove a user from the user store.
  *
- * The user is identified by it's public signing key.
+ * The user is identified by it's public signing key. Locks its shard.
  */
 return_status user_store_remove_by_key(user_store * const store, const buffer_t * const public_signing_key);
 
-//remove a user from the user store
+//remove a user from the user store, the shard has to be locked
 void user_store_remove(user_store * const store, user_store_node *node);
 
-//clear the entire user store
+//clear the entire user store, locks one shard after another
 void user_store_clear(user_store *keystore);
 
+/*! Export the users of one shard to an array of Protobuf-C structs
+ * The shard has to be locked.
+ * \param shard The shard to export.
+ * \param users The array to export to, has to have room for all users of the shard.
+ * \return The status.
+ */
+return_status user_store_shard_export(
+	const user_store_shard * const shard,
+	User ** const users) __attribute__((warn_unused_result));
+
+/*! Export a single user to a Protobuf-C struct.
+ * The shard of the user has to be locked.
+ * \param node The user to export.
+ * \param user The Protobuf-C struct to export to.
+ * \return The status.
+ */
+return_status user_store_node_export(
+	user_store_node * const node,
+	User ** const user) __attribute__((warn_unused_result));
+
+/*! Import a single user from a Protobuf-C struct.
+ * The new node isn't added to any user store.
+ * \param node The imported user.
+ * \param user The Protobuf-C struct to import from.
+ * \return The status.
+ */
+return_status user_store_node_import(
+	user_store_node ** const node,
+	const User * const user) __attribute__((warn_unused_result));
+
 /*! Export a user store to an array of Protobuf-C structs
+ * Locks all shards, so the export is a consistent snapshot.
  * \param store The user store to export
  * \param users The array to export to.
  * \param users_length The length of the exported array.
  * \return The status.
  */
 return_status user_store_export(
-	const user_store * const store,
+	user_store * const store,
 	User *** const users,
 	size_t * const users_length) __attribute__((warn_unused_result));
 
@@ -0,0 +1,650 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "wire.h"
+
+//wire types of the protobuf encoding
+#define WIRE_VARINT 0
+#define WIRE_FIXED64 1
+#define WIRE_LENGTH_DELIMITED 2
+#define WIRE_FIXED32 5
+
+#define TAG(field, wire_type) ((uint32_t)(((field) << 3) | (wire_type)))
+
+/*
+ * Encoding
+ */
+static size_t varint_size(uint64_t value) {
+	size_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		size++;
+	}
+
+	return size;
+}
+
+static unsigned char *write_varint(unsigned char *output, uint64_t value) {
+	while (value >= 0x80) {
+		*output++ = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	*output++ = (unsigned char)value;
+
+	return output;
+}
+
+static unsigned char *write_fixed32(unsigned char *output, const uint32_t value) {
+	output[0] = (unsigned char)value;
+	output[1] = (unsigned char)(value >> 8);
+	output[2] = (unsigned char)(value >> 16);
+	output[3] = (unsigned char)(value >> 24);
+
+	return output + 4;
+}
+
+/*
+ * Bytes without data are only reserved, 'data' is set to the reserved space.
+ */
+static unsigned char *write_bytes(unsigned char *output, const uint32_t field, wire_bytes * const bytes) {
+	output = write_varint(output, TAG(field, WIRE_LENGTH_DELIMITED));
+	output = write_varint(output, bytes->length);
+	if (bytes->data == NULL) {
+		bytes->data = output;
+	} else if (bytes->length != 0) {
+		memcpy(output, bytes->data, bytes->length);
+	}
+
+	return output + bytes->length;
+}
+
+static size_t bytes_size(const uint32_t field, const wire_bytes * const bytes) {
+	return varint_size(TAG(field, WIRE_LENGTH_DELIMITED)) + varint_size(bytes->length) + bytes->length;
+}
+
+//enums are encoded like int32, negative values take 10 bytes
+static uint64_t enum_value(const int32_t value) {
+	return (uint64_t)(int64_t)value;
+}
+
+void wire_packet_init(packet_view * const packet) {
+	memset(packet, 0, sizeof(packet_view));
+	packet->packet_header.packet_type = 1; //NORMAL_MESSAGE is the default
+}
+
+void wire_header_init(header_view * const header) {
+	memset(header, 0, sizeof(header_view));
+}
+
+static size_t packet_header_get_packed_size(const packet_header_view * const header) {
+	size_t size = 1 + varint_size(header->current_protocol_version)
+		+ 1 + varint_size(header->highest_supported_protocol_version);
+	if (header->has_packet_type) {
+		size += 1 + varint_size(enum_value(header->packet_type));
+	}
+	if (header->has_header_nonce) {
+		size += bytes_size(4, &header->header_nonce);
+	}
+	if (header->has_message_nonce) {
+		size += bytes_size(5, &header->message_nonce);
+	}
+	if (header->has_public_identity_key) {
+		size += bytes_size(16, &header->public_identity_key);
+	}
+	if (header->has_public_ephemeral_key) {
+		size += bytes_size(17, &header->public_ephemeral_key);
+	}
+	if (header->has_public_prekey) {
+		size += bytes_size(18, &header->public_prekey);
+	}
+
+	return size;
+}
+
+size_t wire_packet_get_packed_size(const packet_view * const packet) {
+	const size_t header_size = packet_header_get_packed_size(&packet->packet_header);
+	size_t size = 1 + varint_size(header_size) + header_size;
+	if (packet->has_encrypted_axolotl_header) {
+		size += bytes_size(2, &packet->encrypted_axolotl_header);
+	}
+	if (packet->has_encrypted_message) {
+		size += bytes_size(3, &packet->encrypted_message);
+	}
+
+	return size;
+}
+
+size_t wire_header_get_packed_size(const header_view * const header) {
+	size_t size = 0;
+	if (header->has_public_ephemeral_key) {
+		size += bytes_size(1, &header->public_ephemeral_key);
+	}
+	if (header->has_message_number) {
+		size += 1 + 4;
+	}
+	if (header->has_previous_message_number) {
+		size += 1 + 4;
+	}
+	if (header->has_current_protocol_version) {
+		size += 1 + varint_size(header->current_protocol_version);
+	}
+	if (header->has_highest_supported_protocol_version) {
+		size += 1 + varint_size(header->highest_supported_protocol_version);
+	}
+
+	return size;
+}
+
+//fields are written in the order of their field numbers, like Protobuf-C does
+static unsigned char *packet_header_pack(packet_header_view * const header, unsigned char *output) {
+	output = write_varint(output, TAG(1, WIRE_VARINT));
+	output = write_varint(output, header->current_protocol_version);
+	output = write_varint(output, TAG(2, WIRE_VARINT));
+	output = write_varint(output, header->highest_supported_protocol_version);
+	if (header->has_packet_type) {
+		output = write_varint(output, TAG(3, WIRE_VARINT));
+		output = write_varint(output, enum_value(header->packet_type));
+	}
+	if (header->has_header_nonce) {
+		output = write_bytes(output, 4, &header->header_nonce);
+	}
+	if (header->has_message_nonce) {
+		output = write_bytes(output, 5, &header->message_nonce);
+	}
+	if (header->has_public_identity_key) {
+		output = write_bytes(output, 16, &header->public_identity_key);
+	}
+	if (header->has_public_ephemeral_key) {
+		output = write_bytes(output, 17, &header->public_ephemeral_key);
+	}
+	if (header->has_public_prekey) {
+		output = write_bytes(output, 18, &header->public_prekey);
+	}
+
+	return output;
+}
+
+size_t wire_packet_reserve(packet_view * const packet, unsigned char * const output) {
+	unsigned char *position = output;
+
+	position = write_varint(position, TAG(1, WIRE_LENGTH_DELIMITED));
+	position = write_varint(position, packet_header_get_packed_size(&packet->packet_header));
+	position = packet_header_pack(&packet->packet_header, position);
+	if (packet->has_encrypted_axolotl_header) {
+		position = write_bytes(position, 2, &packet->encrypted_axolotl_header);
+	}
+	if (packet->has_encrypted_message) {
+		position = write_bytes(position, 3, &packet->encrypted_message);
+	}
+
+	return (size_t)(position - output);
+}
+
+size_t wire_packet_pack(const packet_view * const packet, unsigned char * const output) {
+	packet_view copy = *packet;
+	return wire_packet_reserve(&copy, output);
+}
+
+size_t wire_header_pack(const header_view * const header, unsigned char * const output) {
+	unsigned char *position = output;
+	header_view copy = *header;
+
+	if (header->has_public_ephemeral_key) {
+		position = write_bytes(position, 1, &copy.public_ephemeral_key);
+	}
+	if (header->has_message_number) {
+		position = write_varint(position, TAG(2, WIRE_FIXED32));
+		position = write_fixed32(position, header->message_number);
+	}
+	if (header->has_previous_message_number) {
+		position = write_varint(position, TAG(3, WIRE_FIXED32));
+		position = write_fixed32(position, header->previous_message_number);
+	}
+	if (header->has_current_protocol_version) {
+		position = write_varint(position, TAG(4, WIRE_VARINT));
+		position = write_varint(position, header->current_protocol_version);
+	}
+	if (header->has_highest_supported_protocol_version) {
+		position = write_varint(position, TAG(5, WIRE_VARINT));
+		position = write_varint(position, header->highest_supported_protocol_version);
+	}
+
+	return (size_t)(position - output);
+}
+
+/*
+ * Decoding
+ */
+typedef struct reader {
+	const unsigned char *position;
+	const unsigned char *end;
+} reader;
+
+/*
+ * Read a varint of at most 'maximum_length' bytes.
+ */
+static bool read_varint(reader * const input, uint64_t * const value, const size_t maximum_length) {
+	*value = 0;
+	for (size_t i = 0; (i < maximum_length) && (input->position < input->end); i++) {
+		const unsigned char byte = *input->position++;
+		if (i < 10) {
+			*value |= ((uint64_t)(byte & 0x7f)) << (7 * i);
+		}
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+
+	return false; //unterminated or too long
+}
+
+static bool read_tag(reader * const input, uint32_t * const field, unsigned int * const wire_type) {
+	uint64_t tag;
+	if (!read_varint(input, &tag, 5)) {
+		return false;
+	}
+	*field = (uint32_t)(tag >> 3);
+	*wire_type = (unsigned int)(tag & 0x7);
+
+	return *field != 0;
+}
+
+//varints of uint32 and enum fields are truncated to 32 bits
+static bool read_uint32(reader * const input, const unsigned int wire_type, uint32_t * const value) {
+	uint64_t varint;
+	if ((wire_type != WIRE_VARINT) || !read_varint(input, &varint, 10)) {
+		return false;
+	}
+	*value = (uint32_t)varint;
+
+	return true;
+}
+
+static bool read_fixed32(reader * const input, const unsigned int wire_type, uint32_t * const value) {
+	if ((wire_type != WIRE_FIXED32) || ((input->end - input->position) < 4)) {
+		return false;
+	}
+	*value = (uint32_t)input->position[0]
+		| ((uint32_t)input->position[1] << 8)
+		| ((uint32_t)input->position[2] << 16)
+		| ((uint32_t)input->position[3] << 24);
+	input->position += 4;
+
+	return true;
+}
+
+static bool read_bytes(reader * const input, const unsigned int wire_type, wire_bytes * const bytes) {
+	uint64_t length;
+	if ((wire_type != WIRE_LENGTH_DELIMITED) || !read_varint(input, &length, 5)) {
+		return false;
+	}
+	length &= 0xffffffff;
+	if (length > (uint64_t)(input->end - input->position)) {
+		return false;
+	}
+	bytes->data = input->position;
+	bytes->length = (size_t)length;
+	input->position += length;
+
+	return true;
+}
+
+static bool skip_field(reader * const input, const unsigned int wire_type) {
+	uint64_t varint;
+	wire_bytes bytes;
+	switch (wire_type) {
+		case WIRE_VARINT:
+			return read_varint(input, &varint, 10);
+
+		case WIRE_FIXED64:
+			if ((input->end - input->position) < 8) {
+				return false;
+			}
+			input->position += 8;
+			return true;
+
+		case WIRE_LENGTH_DELIMITED:
+			return read_bytes(input, wire_type, &bytes);
+
+		case WIRE_FIXED32:
+			if ((input->end - input->position) < 4) {
+				return false;
+			}
+			input->position += 4;
+			return true;
+
+		default: //groups aren't supported
+			return false;
+	}
+}
+
+/*
+ * Decode a PacketHeader on top of 'header'. If the field occurs more than
+ * once in a packet, the occurrences are merged.
+ */
+static bool packet_header_unpack(packet_header_view * const header, reader input) {
+	bool has_current_protocol_version = false;
+	bool has_highest_supported_protocol_version = false;
+
+	while (input.position < input.end) {
+		uint32_t field;
+		unsigned int wire_type;
+		if (!read_tag(&input, &field, &wire_type)) {
+			return false;
+		}
+
+		bool success;
+		uint32_t packet_type;
+		switch (field) {
+			case 1:
+				success = read_uint32(&input, wire_type, &header->current_protocol_version);
+				has_current_protocol_version = true;
+				break;
+
+			case 2:
+				success = read_uint32(&input, wire_type, &header->highest_supported_protocol_version);
+				has_highest_supported_protocol_version = true;
+				break;
+
+			case 3:
+				success = read_uint32(&input, wire_type, &packet_type);
+				header->packet_type = (int32_t)packet_type;
+				header->has_packet_type = true;
+				break;
+
+			case 4:
+				success = read_bytes(&input, wire_type, &header->header_nonce);
+				header->has_header_nonce = true;
+				break;
+
+			case 5:
+				success = read_bytes(&input, wire_type, &header->message_nonce);
+				header->has_message_nonce = true;
+				break;
+
+			case 16:
+				success = read_bytes(&input, wire_type, &header->public_identity_key);
+				header->has_public_identity_key = true;
+				break;
+
+			case 17:
+				success = read_bytes(&input, wire_type, &header->public_ephemeral_key);
+				header->has_public_ephemeral_key = true;
+				break;
+
+			case 18:
+				success = read_bytes(&input, wire_type, &header->public_prekey);
+				header->has_public_prekey = true;
+				break;
+
+			default:
+				success = skip_field(&input, wire_type);
+				break;
+		}
+		if (!success) {
+			return false;
+		}
+	}
+
+	return has_current_protocol_version && has_highest_supported_protocol_version;
+}
+
+return_status wire_packet_unpack(packet_view * const packet, const buffer_t * const input) {
+	return_status status = return_status_init();
+
+	//check input
+	if ((packet == NULL) || (input == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to wire_packet_unpack.");
+	}
+
+	wire_packet_init(packet);
+
+	reader packet_reader = {input->content, input->content + input->content_length};
+	bool has_packet_header = false;
+	while (packet_reader.position < packet_reader.end) {
+		uint32_t field;
+		unsigned int wire_type;
+		if (!read_tag(&packet_reader, &field, &wire_type)) {
+			throw(PROTOBUF_UNPACK_ERROR, "Invalid tag in packet.");
+		}
+
+		bool success;
+		wire_bytes packet_header;
+		switch (field) {
+			case 1:
+				success = read_bytes(&packet_reader, wire_type, &packet_header);
+				if (success) {
+					const reader packet_header_reader = {packet_header.data, packet_header.data + packet_header.length};
+					success = packet_header_unpack(&packet->packet_header, packet_header_reader);
+				}
+				has_packet_header = true;
+				break;
+
+			case 2:
+				success = read_bytes(&packet_reader, wire_type, &packet->encrypted_axolotl_header);
+				packet->has_encrypted_axolotl_header = true;
+				break;
+
+			case 3:
+				success = read_bytes(&packet_reader, wire_type, &packet->encrypted_message);
+				packet->has_encrypted_message = true;
+				break;
+
+			default:
+				success = skip_field(&packet_reader, wire_type);
+				break;
+		}
+		if (!success) {
+			throw(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+		}
+	}
+
+	if (!has_packet_header) {
+		throw(PROTOBUF_UNPACK_ERROR, "The packet has no packet header.");
+	}
+
+cleanup:
+	return status;
+}
+
+return_status wire_header_unpack(header_view * const header, const buffer_t * const input) {
+	return_status status = return_status_init();
+
+	//check input
+	if ((header == NULL) || (input == NULL)) {
+		throw(INVALID_INPUT, "Invalid input to wire_header_unpack.");
+	}
+
+	wire_header_init(header);
+
+	reader header_reader = {input->content, input->content + input->content_length};
+	while (header_reader.position < header_reader.end) {
+		uint32_t field;
+		unsigned int wire_type;
+		if (!read_tag(&header_reader, &field, &wire_type)) {
+			throw(PROTOBUF_UNPACK_ERROR, "Invalid tag in header.");
+		}
+
+		bool success;
+		switch (field) {
+			case 1:
+				success = read_bytes(&header_reader, wire_type, &header->public_ephemeral_key);
+				header->has_public_ephemeral_key = true;
+				break;
+
+			case 2:
+				success = read_fixed32(&header_reader, wire_type, &header->message_number);
+				header->has_message_number = true;
+				break;
+
+			case 3:
+				success = read_fixed32(&header_reader, wire_type, &header->previous_message_number);
+				header->has_previous_message_number = true;
+				break;
+
+			case 4:
+				success = read_uint32(&header_reader, wire_type, &header->current_protocol_version);
+				header->has_current_protocol_version = true;
+				break;
+
+			case 5:
+				success = read_uint32(&header_reader, wire_type, &header->highest_supported_protocol_version);
+				header->has_highest_supported_protocol_version = true;
+				break;
+
+			default:
+				success = skip_field(&header_reader, wire_type);
+				break;
+		}
+		if (!success) {
+			throw(PROTOBUF_UNPACK_ERROR, "Failed to unpack header.");
+		}
+	}
+
+cleanup:
+	return status;
+}
+
+/*
+ * Compact packets
+ */
+#define COMPACT_PREKEY_MESSAGE 0 //PACKET_HEADER__PACKET_TYPE__PREKEY_MESSAGE
+#define COMPACT_ROUTED_VERSION 3 //PROTOCOL_VERSION_ROUTED
+#define COMPACT_FIXED_SIZE (4 + WIRE_COMPACT_NONCE_SIZE + 2)
+
+bool wire_is_compact_packet(const buffer_t * const input) {
+	return (input != NULL) && (input->content_length > 0) && (input->content[0] == WIRE_COMPACT_MARKER);
+}
+
+size_t wire_compact_packet_get_packed_size(const packet_view * const packet) {
+	size_t size = COMPACT_FIXED_SIZE + packet->encrypted_axolotl_header.length + packet->encrypted_message.length;
+	if (packet->packet_header.current_protocol_version >= COMPACT_ROUTED_VERSION) {
+		size += WIRE_COMPACT_TAG_SIZE;
+	}
+	if (packet->packet_header.packet_type == COMPACT_PREKEY_MESSAGE) {
+		size += 3 * WIRE_COMPACT_KEY_SIZE;
+	}
+
+	return size;
+}
+
+static unsigned char *write_fixed(unsigned char *output, wire_bytes * const bytes, const size_t length) {
+	if (bytes->data == NULL) {
+		bytes->data = output;
+	} else {
+		memcpy(output, bytes->data, length);
+	}
+
+	return output + length;
+}
+
+size_t wire_compact_packet_reserve(packet_view * const packet, unsigned char * const output) {
+	packet_header_view * const header = &packet->packet_header;
+	unsigned char *position = output;
+
+	*position++ = WIRE_COMPACT_MARKER;
+	*position++ = (unsigned char)header->current_protocol_version;
+	*position++ = (unsigned char)header->highest_supported_protocol_version;
+	*position++ = (unsigned char)header->packet_type;
+	if (header->current_protocol_version >= COMPACT_ROUTED_VERSION) {
+		position = write_fixed(position, &header->routing_tag, WIRE_COMPACT_TAG_SIZE);
+	}
+	if (header->packet_type == COMPACT_PREKEY_MESSAGE) {
+		position = write_fixed(position, &header->public_identity_key, WIRE_COMPACT_KEY_SIZE);
+		position = write_fixed(position, &header->public_ephemeral_key, WIRE_COMPACT_KEY_SIZE);
+		position = write_fixed(position, &header->public_prekey, WIRE_COMPACT_KEY_SIZE);
+	}
+	position = write_fixed(position, &header->header_nonce, WIRE_COMPACT_NONCE_SIZE);
+	*position++ = (unsigned char)(packet->encrypted_axolotl_header.length >> 8);
+	*position++ = (unsigned char)packet->encrypted_axolotl_header.length;
+
+	packet->authenticated_data.data = output;
+	packet->authenticated_data.length = (size_t)(position - output);
+
+	position = write_fixed(position, &packet->encrypted_axolotl_header, packet->encrypted_axolotl_header.length);
+	position = write_fixed(position, &packet->encrypted_message, packet->encrypted_message.length);
+
+	return (size_t)(position - output);
+}
+
+static const unsigned char *read_fixed(const unsigned char *input, bool * const has_bytes, wire_bytes * const bytes, const size_t length) {
+	*has_bytes = true;
+	bytes->data = input;
+	bytes->length = length;
+
+	return input + length;
+}
+
+return_status wire_compact_packet_unpack(packet_view * const packet, const buffer_t * const input) {
+	return_status status = return_status_init();
+
+	//check input
+	if ((packet == NULL) || !wire_is_compact_packet(input)) {
+		throw(INVALID_INPUT, "Invalid input to wire_compact_packet_unpack.");
+	}
+
+	wire_packet_init(packet);
+	packet_header_view * const header = &packet->packet_header;
+
+	if (input->content_length < COMPACT_FIXED_SIZE) {
+		throw(PROTOBUF_UNPACK_ERROR, "The compact packet is too short.");
+	}
+
+	const unsigned char *position = input->content + 1;
+	header->current_protocol_version = *position++;
+	header->highest_supported_protocol_version = *position++;
+	header->has_packet_type = true;
+	header->packet_type = *position++;
+	size_t fixed_size = COMPACT_FIXED_SIZE;
+	if (header->current_protocol_version >= COMPACT_ROUTED_VERSION) {
+		fixed_size += WIRE_COMPACT_TAG_SIZE;
+		if (input->content_length < fixed_size) {
+			throw(PROTOBUF_UNPACK_ERROR, "The routed compact packet is too short.");
+		}
+		position = read_fixed(position, &header->has_routing_tag, &header->routing_tag, WIRE_COMPACT_TAG_SIZE);
+	}
+	if (header->packet_type == COMPACT_PREKEY_MESSAGE) {
+		if (input->content_length < (fixed_size + 3 * WIRE_COMPACT_KEY_SIZE)) {
+			throw(PROTOBUF_UNPACK_ERROR, "The compact prekey packet is too short.");
+		}
+		position = read_fixed(position, &header->has_public_identity_key, &header->public_identity_key, WIRE_COMPACT_KEY_SIZE);
+		position = read_fixed(position, &header->has_public_ephemeral_key, &header->public_ephemeral_key, WIRE_COMPACT_KEY_SIZE);
+		position = read_fixed(position, &header->has_public_prekey, &header->public_prekey, WIRE_COMPACT_KEY_SIZE);
+	}
+	position = read_fixed(position, &header->has_header_nonce, &header->header_nonce, WIRE_COMPACT_NONCE_SIZE);
+	const size_t header_length = ((size_t)position[0] << 8) | (size_t)position[1];
+	position += 2;
+
+	packet->authenticated_data.data = input->content;
+	packet->authenticated_data.length = (size_t)(position - input->content);
+
+	const size_t remaining = input->content_length - packet->authenticated_data.length;
+	if (header_length > remaining) {
+		throw(PROTOBUF_UNPACK_ERROR, "The encrypted axolotl header is longer than the packet.");
+	}
+	position = read_fixed(position, &packet->has_encrypted_axolotl_header, &packet->encrypted_axolotl_header, header_length);
+	read_fixed(position, &packet->has_encrypted_message, &packet->encrypted_message, remaining - header_length);
+
+cleanup:
+	return status;
+}
@@ -0,0 +1,166 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*! \file
+ * Hand written encoder and decoder for the Packet, PacketHeader and Header
+ * messages (see packet.proto, packet_header.proto and header.proto).
+ *
+ * The encoder produces exactly the same bytes as Protobuf-C. The decoder
+ * doesn't allocate or copy anything, the views it fills in point into the
+ * input buffer, so they are only valid as long as the input isn't modified
+ * or freed. It accepts the same inputs as Protobuf-C: unknown fields are
+ * skipped, missing required fields and wrong wire types are errors and
+ * later occurrences of a field override earlier ones.
+ *
+ * Packets of PROTOCOL_VERSION_COMPACT aren't protobuf, they have a fixed
+ * layout (multi byte integers are big endian):
+ *
+ *   marker                                  1 byte, WIRE_COMPACT_MARKER
+ *   current protocol version                1 byte
+ *   highest supported protocol version      1 byte
+ *   packet type                             1 byte (PacketHeader__PacketType)
+ *   routing tag                             8 bytes (only PROTOCOL_VERSION_ROUTED and later)
+ *   public identity key                     32 bytes (only prekey messages)
+ *   public ephemeral key                    32 bytes (only prekey messages)
+ *   public prekey                           32 bytes (only prekey messages)
+ *   header nonce                            24 bytes
+ *   length of the encrypted axolotl header  2 bytes
+ *   encrypted axolotl header
+ *   encrypted message                       until the end of the packet
+ *
+ * There is no message nonce, it is derived from the message key.
+ */
+
+#ifndef LIB_WIRE_H
+#define LIB_WIRE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+#include "../buffer/buffer.h"
+
+//tag with field number 0, this never starts a protobuf message
+#define WIRE_COMPACT_MARKER 0x00
+#define WIRE_COMPACT_KEY_SIZE 32
+#define WIRE_COMPACT_NONCE_SIZE 24
+#define WIRE_COMPACT_TAG_SIZE 8
+#define WIRE_COMPACT_MAX_HEADER_LENGTH UINT16_MAX
+
+/*
+ * A bytes field, points into the encoded message.
+ */
+typedef struct wire_bytes {
+	const unsigned char *data;
+	size_t length;
+} wire_bytes;
+
+//same layout as the Protobuf-C structs, optional fields have a has_ flag
+typedef struct packet_header_view {
+	uint32_t current_protocol_version;
+	uint32_t highest_supported_protocol_version;
+	bool has_packet_type;
+	int32_t packet_type; //PacketHeader__PacketType
+	bool has_header_nonce;
+	wire_bytes header_nonce;
+	bool has_message_nonce;
+	wire_bytes message_nonce;
+	bool has_public_identity_key;
+	wire_bytes public_identity_key;
+	bool has_public_ephemeral_key;
+	wire_bytes public_ephemeral_key;
+	bool has_public_prekey;
+	wire_bytes public_prekey;
+	//compact packets only
+	bool has_routing_tag;
+	wire_bytes routing_tag;
+} packet_header_view;
+
+typedef struct packet_view {
+	packet_header_view packet_header;
+	bool has_encrypted_axolotl_header;
+	wire_bytes encrypted_axolotl_header;
+	bool has_encrypted_message;
+	wire_bytes encrypted_message;
+	//compact packets only: everything in front of the encrypted axolotl header
+	wire_bytes authenticated_data;
+} packet_view;
+
+typedef struct header_view {
+	bool has_public_ephemeral_key;
+	wire_bytes public_ephemeral_key;
+	bool has_message_number;
+	uint32_t message_number;
+	bool has_previous_message_number;
+	uint32_t previous_message_number;
+	bool has_current_protocol_version;
+	uint32_t current_protocol_version;
+	bool has_highest_supported_protocol_version;
+	uint32_t highest_supported_protocol_version;
+} header_view;
+
+/*
+ * Initialize a view with all optional fields missing.
+ */
+void wire_packet_init(packet_view * const packet);
+void wire_header_init(header_view * const header);
+
+/*
+ * Length of the encoded message.
+ */
+size_t wire_packet_get_packed_size(const packet_view * const packet);
+size_t wire_header_get_packed_size(const header_view * const header);
+
+/*
+ * Encode a message into 'output', which has to be at least as long as
+ * the packed size.
+ *
+ * Returns the number of bytes written.
+ */
+size_t wire_packet_pack(const packet_view * const packet, unsigned char * const output);
+size_t wire_header_pack(const header_view * const header, unsigned char * const output);
+
+/*
+ * Like wire_packet_pack, but bytes fields with a length and NULL data are
+ * only reserved. Their 'data' is set to the reserved space in 'output',
+ * so the content can be written in place afterwards.
+ */
+size_t wire_packet_reserve(packet_view * const packet, unsigned char * const output);
+
+/*
+ * Decode a message without copying it, the view points into 'input'.
+ *
+ * \return
+ *   Error status, destroy with return_status_destroy_errors if an error occurs.
+ */
+return_status wire_packet_unpack(packet_view * const packet, const buffer_t * const input) __attribute__((warn_unused_result));
+return_status wire_header_unpack(header_view * const header, const buffer_t * const input) __attribute__((warn_unused_result));
+
+/*
+ * The same for compact packets. The public keys are only written for
+ * prekey messages, the routing tag only for PROTOCOL_VERSION_ROUTED, the
+ * message nonce is ignored.
+ */
+bool wire_is_compact_packet(const buffer_t * const input);
+size_t wire_compact_packet_get_packed_size(const packet_view * const packet);
+size_t wire_compact_packet_reserve(packet_view * const packet, unsigned char * const output);
+return_status wire_compact_packet_unpack(packet_view * const packet, const buffer_t * const input) __attribute__((warn_unused_result));
+#endif
@@ -22,28 +22,246 @@
 #include <stdlib.h>
 #include <sodium.h>
 #include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
 
 #include "zeroed_malloc.h"
 #include "alignment.h"
 #include "common.h"
+#include "stats.h"
 
 /*! \file
  * The purpose of these functions is to implement a memory allocator that gets memory
- * from malloc and puts it's length and pointer to the start address to the beginning
+ * from the secret data allocator (malloc by default) and puts it's length and pointer to the start address to the beginning
  * of the allocated memory. (or to be precise: In front of the correctly aligned pointer
  * that is returned by the zeroed_malloc function.)
  */
 
-void *zeroed_malloc(size_t size) {
+/*
+ * Small allocations are rounded up to size classes. Freed blocks are erased
+ * and kept in per thread pools (up to POOL_BLOCKS per class), so the
+ * temporary keys, nonces, headers and packets don't need malloc every time.
+ */
+#define POOL_CLASSES 6
+#define POOL_BLOCKS 64
+static const size_t pool_class_sizes[POOL_CLASSES] = {32, 64, 128, 256, 512, 1024};
+
+//a free block in a pool, stored at the address returned by malloc
+typedef struct pool_block pool_block;
+struct pool_block {
+	pool_block *next;
+};
+
+/*
+ * Arena for the current thread, see zeroed_arena_begin. Allocations from the
+ * arena have the same header as the ones from malloc, but with NULL as start
+ * pointer, so zeroed_free knows to leave them alone.
+ */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+//wiped chunks that are kept per thread for the next arena, fresh memory from malloc is expensive to fault in
+#define ARENA_SPARE_CHUNKS 16
+
+typedef struct arena_chunk arena_chunk;
+struct arena_chunk {
+	arena_chunk *next;
+	size_t size; //size of the memory after the chunk header
+	size_t used;
+};
+
+//memory that is kept per thread for reuse
+typedef struct thread_cache {
+	pool_block *blocks[POOL_CLASSES];
+	size_t block_counts[POOL_CLASSES];
+	arena_chunk *spare_chunks;
+	size_t spare_chunk_count;
+} thread_cache;
+
+static __thread arena_chunk *thread_arena = NULL;
+static __thread size_t thread_arena_depth = 0;
+static __thread thread_cache *thread_caches = NULL;
+static pthread_once_t initialize_once = PTHREAD_ONCE_INIT;
+static pthread_key_t destroy_key;
+static bool destroy_key_created = false;
+
+static void destroy_cache(void *pointer) {
+	thread_cache * const cache = pointer;
+	for (size_t i = 0; i < POOL_CLASSES; i++) {
+		while (cache->blocks[i] != NULL) {
+			pool_block * const next = cache->blocks[i]->next;
+			secret_free(cache->blocks[i]);
+			cache->blocks[i] = next;
+		}
+	}
+	while (cache->spare_chunks != NULL) {
+		arena_chunk * const next = cache->spare_chunks->next;
+		secret_free(cache->spare_chunks);
+		cache->spare_chunks = next;
+	}
+	public_free(cache);
+}
+
+static void initialize() {
+	//without the key the caches of exited threads would leak, so nothing is kept
+	destroy_key_created = (pthread_key_create(&destroy_key, destroy_cache) == 0);
+}
+
+/*
+ * Get the cache of the current thread, NULL if nothing can be kept.
+ */
+static thread_cache *get_cache() {
+	if (thread_caches != NULL) {
+		return thread_caches;
+	}
+
+	pthread_once(&initialize_once, initialize);
+	if (!destroy_key_created) {
+		return NULL;
+	}
+
+	thread_cache * const cache = public_calloc(1, sizeof(thread_cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+
+	if (pthread_setspecific(destroy_key, cache) != 0) {
+		public_free(cache);
+		return NULL;
+	}
+	thread_caches = cache;
+
+	return cache;
+}
+
+//index of the smallest size class 'size' fits into, POOL_CLASSES if it's too large
+static size_t pool_class(const size_t size) {
+	size_t class = 0;
+	while ((class < POOL_CLASSES) && (pool_class_sizes[class] < size)) {
+		class++;
+	}
+
+	return class;
+}
+
+static arena_chunk *create_arena_chunk(const size_t size) {
+	if ((size == ARENA_CHUNK_SIZE) && (thread_caches != NULL) && (thread_caches->spare_chunks != NULL)) {
+		arena_chunk * const chunk = thread_caches->spare_chunks;
+		thread_caches->spare_chunks = chunk->next;
+		thread_caches->spare_chunk_count--;
+		chunk->next = NULL;
+
+		return chunk;
+	}
+
+	arena_chunk * const chunk = secret_malloc(sizeof(arena_chunk) + size);
+	if (chunk == NULL) {
+		return NULL;
+	}
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+static void *allocate_from_arena(size_t size) {
+	const size_t needed = size + sizeof(void*) + sizeof(size_t) + (ALIGNMENT_OF(intmax_t) - 1);
+
+	arena_chunk *chunk = thread_arena;
+	if (needed > (ARENA_CHUNK_SIZE / 4)) {
+		//big allocations get a chunk of their own, behind the current one
+		chunk = create_arena_chunk(needed);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		if (thread_arena == NULL) {
+			thread_arena = chunk;
+		} else {
+			chunk->next = thread_arena->next;
+			thread_arena->next = chunk;
+		}
+	} else if ((chunk == NULL) || ((chunk->size - chunk->used) < needed)) {
+		chunk = create_arena_chunk(ARENA_CHUNK_SIZE);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		chunk->next = thread_arena;
+		thread_arena = chunk;
+	}
+
+	char * const memory = (char*)(chunk + 1);
+	char * const aligned_address = next_aligned_address(memory + chunk->used + sizeof(size_t) + sizeof(void*), ALIGNMENT_OF(intmax_t));
+
+	//same header as in allocate, but without a pointer from malloc
+	const void * const no_malloced_address = NULL;
+	memcpy(aligned_address - sizeof(size_t), &size, sizeof(size_t));
+	memcpy(aligned_address - sizeof(size_t) - sizeof(void*), &no_malloced_address, sizeof(void*));
+
+	chunk->used = (size_t)(aligned_address + size - memory);
+
+	return aligned_address;
+}
+
+void zeroed_arena_begin(void) {
+	thread_arena_depth++;
+}
+
+void zeroed_arena_end(void) {
+	if (thread_arena_depth == 0) {
+		return;
+	}
+
+	thread_arena_depth--;
+	if (thread_arena_depth > 0) {
+		return;
+	}
+
+	thread_cache * const cache = get_cache();
+	while (thread_arena != NULL) {
+		arena_chunk * const next = thread_arena->next;
+		sodium_memzero(thread_arena + 1, thread_arena->used);
+		if ((cache != NULL) && (thread_arena->size == ARENA_CHUNK_SIZE) && (cache->spare_chunk_count < ARENA_SPARE_CHUNKS)) {
+			thread_arena->used = 0;
+			thread_arena->next = cache->spare_chunks;
+			cache->spare_chunks = thread_arena;
+			cache->spare_chunk_count++;
+		} else {
+			secret_free(thread_arena);
+		}
+		thread_arena = next;
+	}
+}
+
+static void *allocate(size_t size) {
+	if (thread_arena_depth > 0) {
+		return allocate_from_arena(size);
+	}
+
 	// start_pointer:size:padding:allocated_memory
 	// the size is needed in order to overwrite it with zeroes later
 	// the start_pointer has to be passed to free later
 
-	size_t amount_to_allocate = size + sizeof(void*) + sizeof(size_t) + (ALIGNMENT_OF(intmax_t) - 1);
+	//small allocations take a block of their size class from the pool
+	const size_t class = pool_class(size);
+	char *malloced_address = NULL;
+	if (class < POOL_CLASSES) {
+		if ((thread_caches != NULL) && (thread_caches->blocks[class] != NULL)) {
+			pool_block * const block = thread_caches->blocks[class];
+			thread_caches->blocks[class] = block->next;
+			thread_caches->block_counts[class]--;
+			malloced_address = (char*)block;
+		}
+		stats_pool_allocation(malloced_address != NULL);
+	}
 
-	char * const malloced_address = malloc(amount_to_allocate);
 	if (malloced_address == NULL) {
-		return NULL;
+		const size_t capacity = (class < POOL_CLASSES) ? pool_class_sizes[class] : size;
+		size_t amount_to_allocate = capacity + sizeof(void*) + sizeof(size_t) + (ALIGNMENT_OF(intmax_t) - 1);
+
+		malloced_address = secret_malloc(amount_to_allocate);
+		if (malloced_address == NULL) {
+			return NULL;
+		}
 	}
 
 	char *aligned_address = next_aligned_address(malloced_address + sizeof(size_t) + sizeof(void*), ALIGNMENT_OF(intmax_t));
@@ -56,6 +274,15 @@ void *zeroed_malloc(size_t size) {
 	return aligned_address;
 }
 
+void *zeroed_malloc(size_t size) {
+	void * const pointer = allocate(size);
+	if (pointer != NULL) {
+		stats_allocation(MOLCH_STATS_EXPORT_STRUCTS, size);
+	}
+
+	return pointer;
+}
+
 void zeroed_free(void *pointer) {
 	if (pointer == NULL) {
 		return;
@@ -69,13 +296,36 @@ void zeroed_free(void *pointer) {
 	//get the original pointer
 	memcpy(&malloced_address, ((char*)pointer) - sizeof(size_t) - sizeof(void*), sizeof(void*));
 
+	//allocated from an arena, it is erased when the arena ends
+	if (malloced_address == NULL) {
+		return;
+	}
+
 	sodium_memzero(pointer, size);
 
-	free_and_null_if_valid(malloced_address);
+	//keep small blocks in the pool of their size class
+	const size_t class = pool_class(size);
+	if (class < POOL_CLASSES) {
+		thread_cache * const cache = get_cache();
+		if ((cache != NULL) && (cache->block_counts[class] < POOL_BLOCKS)) {
+			pool_block * const block = malloced_address;
+			block->next = cache->blocks[class];
+			cache->blocks[class] = block;
+			cache->block_counts[class]++;
+			return;
+		}
+	}
+
+	secret_free(malloced_address);
 }
 
 void *protobuf_c_allocator(void *allocator_data __attribute__((unused)), size_t size) {
-	return zeroed_malloc(size);
+	void * const pointer = allocate(size);
+	if (pointer != NULL) {
+		stats_allocation(MOLCH_STATS_PROTOBUF, size);
+	}
+
+	return pointer;
 }
 
 void protobuf_c_free(void *allocator_data __attribute__((unused)), void *pointer) {
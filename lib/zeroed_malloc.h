@@ -34,6 +34,10 @@
 /*!
  * Allocates a buffer of 'size' and stores it's size.
  *
+ * Small allocations (up to 1024 bytes) are rounded up to a size
+ * class and taken from a per-thread free list if possible. Freed
+ * blocks are erased before they are put back on the list.
+ *
  * \param size
  *   The amount of bytes to be allocated.
  * \return
@@ -50,6 +54,23 @@ void *zeroed_malloc(size_t size) __attribute__((warn_unused_result));
  */
 void zeroed_free(void *pointer);
 
+/*!
+ * Start an arena for the current thread, e.g. for an export or import.
+ *
+ * Until the arena ends, zeroed_malloc and the Protobuf-C allocator
+ * bump allocate from large chunks and freeing does nothing. The whole
+ * arena is erased with zeroes and freed at once by zeroed_arena_end.
+ * Nothing allocated in the arena may be used after it has ended.
+ *
+ * Arenas can be nested, only the outermost one is used.
+ */
+void zeroed_arena_begin(void);
+
+/*!
+ * End the arena of the current thread, see zeroed_arena_begin.
+ */
+void zeroed_arena_end(void);
+
 /*!
  * Wrapper around zeroed_malloc that can be used by Protobuf-C.
  *
@@ -25,7 +25,6 @@
 
 #include "../lib/alignment.h"
 #include "utils.h"
-#include "tracing.h"
 
 int main(void) {
 	return_status status = return_status_init();
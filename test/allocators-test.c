@@ -0,0 +1,231 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "utils.h"
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+
+typedef struct counting_allocator {
+	uint64_t allocations;
+	uint64_t deallocations;
+	uint64_t not_wiped; //deallocations of memory that wasn't erased
+	bool wiped; //memory has to be erased before it is deallocated
+} counting_allocator;
+
+//size in front of the memory, with the alignment of malloc
+typedef union allocation_header {
+	size_t size;
+	intmax_t integer;
+	long double floating_point;
+	void *pointer;
+} allocation_header;
+
+static void *allocate(void *context, size_t size) {
+	counting_allocator * const counter = context;
+	allocation_header * const header = malloc(sizeof(allocation_header) + size);
+	if (header == NULL) {
+		return NULL;
+	}
+	header->size = size;
+	counter->allocations++;
+
+	return header + 1;
+}
+
+static void deallocate(void *context, void *pointer) {
+	counting_allocator * const counter = context;
+	allocation_header * const header = ((allocation_header*)pointer) - 1;
+	if (counter->wiped && !sodium_is_zero(pointer, header->size)) {
+		counter->not_wiped++;
+	}
+	counter->deallocations++;
+
+	free(header);
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	counting_allocator public_data = {0, 0, 0, false};
+	counting_allocator secret_data = {0, 0, 0, true};
+	counting_allocator key_objects = {0, 0, 0, true};
+	const molch_allocators allocators = {
+		{allocate, deallocate, &public_data},
+		{allocate, deallocate, &secret_data},
+		{allocate, deallocate, &key_objects}
+	};
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char alice_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char bob_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+	unsigned char *alice_prekeys = NULL;
+	size_t alice_prekeys_length = 0;
+	unsigned char *bob_prekeys = NULL;
+	size_t bob_prekeys_length = 0;
+	unsigned char *prekey_packet = NULL;
+	size_t prekey_packet_length = 0;
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	unsigned char *secret = NULL;
+
+	//only one of the functions, before anything else
+	molch_allocators incomplete = allocators;
+	incomplete.key_objects.deallocate = NULL;
+	status = molch_set_allocators(&incomplete);
+	if (status.status != INVALID_INPUT) {
+		throw(INCORRECT_DATA, "Incomplete allocators were accepted.");
+	}
+	return_status_destroy_errors(&status);
+	status = return_status_init();
+
+	//the failed call didn't allocate anything, so correcting it works
+	status = molch_set_allocators(&allocators);
+	throw_on_error(INIT_ERROR, "Failed to set the allocators.");
+
+	//create the users and start a conversation
+	buffer_create_from_string(alice_head_on_keyboard, "asdfjkl;");
+	status = molch_create_user(
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			&alice_prekeys,
+			&alice_prekeys_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			alice_head_on_keyboard->content,
+			alice_head_on_keyboard->content_length);
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+
+	buffer_create_from_string(bob_head_on_keyboard, "qwertzuiop");
+	status = molch_create_user(
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			bob_head_on_keyboard->content,
+			bob_head_on_keyboard->content_length);
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+
+	buffer_create_from_string(first_message, "Hi Bob!");
+	status = molch_start_send_conversation(
+			alice_conversation,
+			sizeof(alice_conversation),
+			&prekey_packet,
+			&prekey_packet_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			bob_prekeys,
+			bob_prekeys_length,
+			first_message->content,
+			first_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+
+	free_and_null_if_valid(bob_prekeys);
+	status = molch_start_receive_conversation(
+			bob_conversation,
+			sizeof(bob_conversation),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			&message,
+			&message_length,
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			prekey_packet,
+			prekey_packet_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start receive conversation.");
+	if ((message_length != first_message->content_length) || (sodium_memcmp(message, first_message->content, message_length) != 0)) {
+		throw(INCORRECT_DATA, "Received message doesn't match.");
+	}
+
+	//too large for the pools, so it goes straight back to the allocator
+	secret = zeroed_malloc(4096);
+	throw_on_failed_alloc(secret);
+	memset(secret, 0xff, 4096);
+	zeroed_free_and_null_if_valid(secret);
+
+	//too late now
+	status = molch_set_allocators(NULL);
+	if (status.status != INVALID_STATE) {
+		throw(INCORRECT_DATA, "Allocators were replaced after memory was allocated.");
+	}
+	return_status_destroy_errors(&status);
+	status = return_status_init();
+
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(bob_prekeys);
+	free_and_null_if_valid(prekey_packet);
+	free_and_null_if_valid(message);
+	molch_destroy_all_users();
+
+	printf("public data: %llu allocations, %llu deallocations\n", (unsigned long long)public_data.allocations, (unsigned long long)public_data.deallocations);
+	printf("secret data: %llu allocations, %llu deallocations\n", (unsigned long long)secret_data.allocations, (unsigned long long)secret_data.deallocations);
+	printf("key objects: %llu allocations, %llu deallocations\n", (unsigned long long)key_objects.allocations, (unsigned long long)key_objects.deallocations);
+
+	if ((public_data.allocations == 0) || (public_data.deallocations == 0)
+			|| (secret_data.allocations == 0) || (secret_data.deallocations == 0)
+			|| (key_objects.allocations == 0) || (key_objects.deallocations == 0)) {
+		throw(INCORRECT_DATA, "Memory didn't go through the allocators.");
+	}
+	if ((secret_data.not_wiped != 0) || (key_objects.not_wiped != 0)) {
+		throw(INCORRECT_DATA, "Secret memory wasn't erased before it was deallocated.");
+	}
+
+cleanup:
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(bob_prekeys);
+	free_and_null_if_valid(prekey_packet);
+	free_and_null_if_valid(message);
+	zeroed_free_and_null_if_valid(secret);
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
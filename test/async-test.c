@@ -0,0 +1,269 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sched.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "utils.h"
+
+#define WORKERS 4
+#define MESSAGES 50
+#define TIMEOUT 10000 //milliseconds
+
+//written by the callbacks on the worker threads
+static molch_async_result *encrypted[MESSAGES];
+static size_t encrypted_count = 0;
+
+static void encrypt_callback(molch_async_result * const result) {
+	encrypted[(size_t)result->user_data] = result;
+	__atomic_add_fetch(&encrypted_count, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Wait for the next result in the completion queue like an event loop would.
+ */
+static molch_async_result *wait_for_result() {
+	while (true) {
+		molch_async_result * const result = molch_async_poll();
+		if (result != NULL) {
+			return result;
+		}
+
+		struct pollfd descriptor = {molch_async_get_fd(), POLLIN, 0};
+		if (poll(&descriptor, 1, TIMEOUT) != 1) {
+			return NULL;
+		}
+	}
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	molch_async_result *alice = NULL;
+	molch_async_result *bob = NULL;
+	molch_async_result *conversation = NULL;
+	molch_async_result *received = NULL;
+	molch_async_result *decrypted = NULL;
+
+	//nothing can be submitted before the workers are started
+	status = molch_async_export(NULL, NULL);
+	if (status.status == SUCCESS) {
+		throw(INCORRECT_DATA, "Submitted without workers.");
+	}
+	return_status_destroy_errors(&status);
+	status = return_status_init();
+	if (molch_async_get_fd() != -1) {
+		throw(INCORRECT_DATA, "Got a file descriptor without workers.");
+	}
+
+	status = molch_async_start(WORKERS);
+	throw_on_error(INIT_ERROR, "Failed to start the workers.");
+
+	//create the users
+	buffer_create_from_string(alice_head_on_keyboard, "mn ujkhuzn7t5gh");
+	status = molch_async_create_user(alice_head_on_keyboard->content, alice_head_on_keyboard->content_length, NULL, (void*)1);
+	throw_on_error(CREATION_ERROR, "Failed to submit the creation of Alice.");
+	status = molch_async_create_user(NULL, 0, NULL, (void*)2);
+	throw_on_error(CREATION_ERROR, "Failed to submit the creation of Bob.");
+
+	for (size_t i = 0; i < 2; i++) {
+		molch_async_result * const result = wait_for_result();
+		if (result == NULL) {
+			throw(RECEIVE_ERROR, "No user was created.");
+		}
+		if ((result->operation != MOLCH_ASYNC_CREATE_USER) || (result->status.status != SUCCESS) || (result->prekey_list == NULL)) {
+			molch_async_destroy_result(result);
+			throw(CREATION_ERROR, "Failed to create user.");
+		}
+		if (result->user_data == (void*)1) {
+			alice = result;
+		} else {
+			bob = result;
+		}
+	}
+	if ((alice == NULL) || (bob == NULL)) {
+		throw(INCORRECT_DATA, "Got the wrong users.");
+	}
+	if (molch_user_count() != 2) {
+		throw(INCORRECT_DATA, "Wrong number of users.");
+	}
+
+	//start the conversation
+	buffer_create_from_string(first_message, "Hi Bob. Alice here!");
+	status = molch_async_start_send_conversation(
+			alice->public_master_key,
+			sizeof(alice->public_master_key),
+			bob->public_master_key,
+			sizeof(bob->public_master_key),
+			bob->prekey_list,
+			bob->prekey_list_length,
+			first_message->content,
+			first_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(SEND_ERROR, "Failed to submit the start of the send conversation.");
+	conversation = wait_for_result();
+	if ((conversation == NULL) || (conversation->status.status != SUCCESS) || (conversation->packet == NULL)) {
+		throw(SEND_ERROR, "Failed to start send conversation.");
+	}
+
+	status = molch_async_start_receive_conversation(
+			bob->public_master_key,
+			sizeof(bob->public_master_key),
+			alice->public_master_key,
+			sizeof(alice->public_master_key),
+			conversation->packet,
+			conversation->packet_length,
+			NULL,
+			NULL);
+	throw_on_error(RECEIVE_ERROR, "Failed to submit the start of the receive conversation.");
+	received = wait_for_result();
+	if ((received == NULL) || (received->status.status != SUCCESS)) {
+		throw(RECEIVE_ERROR, "Failed to start receive conversation.");
+	}
+	if ((received->message_length != first_message->content_length)
+			|| (sodium_memcmp(received->message, first_message->content, first_message->content_length) != 0)) {
+		throw(INCORRECT_DATA, "Received the wrong message.");
+	}
+
+	//Alice sends a burst of messages, the callbacks get the packets
+	for (size_t i = 0; i < MESSAGES; i++) {
+		unsigned char message[32];
+		const int length = snprintf((char*)message, sizeof(message), "Message %zu", i);
+		status = molch_async_encrypt_message(
+				conversation->conversation_id,
+				sizeof(conversation->conversation_id),
+				message,
+				(size_t)length,
+				encrypt_callback,
+				(void*)i);
+		throw_on_error(ENCRYPT_ERROR, "Failed to submit message.");
+	}
+
+	//Bob decrypts them in the order they were encrypted in
+	for (size_t i = 0; i < MESSAGES; i++) {
+		while (__atomic_load_n(&encrypted_count, __ATOMIC_ACQUIRE) <= i) {
+			sched_yield();
+		}
+		if (encrypted[i]->status.status != SUCCESS) {
+			throw(ENCRYPT_ERROR, "Failed to encrypt message.");
+		}
+		status = molch_async_decrypt_message(
+				received->conversation_id,
+				sizeof(received->conversation_id),
+				encrypted[i]->packet,
+				encrypted[i]->packet_length,
+				NULL,
+				(void*)i);
+		throw_on_error(DECRYPT_ERROR, "Failed to submit packet.");
+	}
+
+	uint32_t previous_message_number = 0;
+	for (size_t i = 0; i < MESSAGES; i++) {
+		decrypted = wait_for_result();
+		if ((decrypted == NULL) || (decrypted->status.status != SUCCESS)) {
+			throw(DECRYPT_ERROR, "Failed to decrypt message.");
+		}
+		if (decrypted->user_data != (void*)i) {
+			throw(INCORRECT_DATA, "Results are out of order.");
+		}
+		//without skipped messages, the message number goes up by one every time
+		if ((i != 0) && (decrypted->receive_message_number != (previous_message_number + 1))) {
+			throw(INCORRECT_DATA, "Messages were encrypted out of order.");
+		}
+		previous_message_number = decrypted->receive_message_number;
+
+		char expected[32];
+		snprintf(expected, sizeof(expected), "Message %zu", i);
+		if ((decrypted->message_length != strlen(expected)) || (memcmp(decrypted->message, expected, strlen(expected)) != 0)) {
+			throw(INCORRECT_DATA, "Decrypted the wrong message.");
+		}
+		molch_async_destroy_result(decrypted);
+		decrypted = NULL;
+	}
+
+	//errors are reported in the result
+	unsigned char unknown_conversation[CONVERSATION_ID_SIZE];
+	memset(unknown_conversation, 0, sizeof(unknown_conversation));
+	status = molch_async_decrypt_message(
+			unknown_conversation,
+			sizeof(unknown_conversation),
+			encrypted[0]->packet,
+			encrypted[0]->packet_length,
+			NULL,
+			NULL);
+	throw_on_error(DECRYPT_ERROR, "Failed to submit packet.");
+	decrypted = wait_for_result();
+	if ((decrypted == NULL) || (decrypted->status.status == SUCCESS) || (decrypted->message != NULL)) {
+		throw(INCORRECT_DATA, "Decrypted with an unknown conversation.");
+	}
+
+	//the queue is empty and so is the pipe
+	{
+		struct pollfd descriptor = {molch_async_get_fd(), POLLIN, 0};
+		if ((molch_async_poll() != NULL) || (poll(&descriptor, 1, 0) != 0)) {
+			throw(INCORRECT_DATA, "The completion queue isn't empty.");
+		}
+	}
+
+	//unpolled results are destroyed when stopping
+	status = molch_async_encrypt_message(
+			conversation->conversation_id,
+			sizeof(conversation->conversation_id),
+			first_message->content,
+			first_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(ENCRYPT_ERROR, "Failed to submit message.");
+
+cleanup:
+	molch_async_stop();
+	molch_async_destroy_result(alice);
+	molch_async_destroy_result(bob);
+	molch_async_destroy_result(conversation);
+	molch_async_destroy_result(received);
+	molch_async_destroy_result(decrypted);
+	for (size_t i = 0; i < MESSAGES; i++) {
+		molch_async_destroy_result(encrypted[i]);
+	}
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
@@ -0,0 +1,310 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "utils.h"
+
+#define ATTACHMENT_SIZE (1024 * 1024 + 123)
+#define CHUNK_SIZE (64 * 1024)
+
+static unsigned char alice_public_identity[PUBLIC_MASTER_KEY_SIZE];
+static unsigned char bob_public_identity[PUBLIC_MASTER_KEY_SIZE];
+static unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+static unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+static return_status create_conversation(void) {
+	return_status status = return_status_init();
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char *alice_prekeys = NULL;
+	size_t alice_prekeys_length = 0;
+	unsigned char *bob_prekeys = NULL;
+	size_t bob_prekeys_length = 0;
+	unsigned char *prekey_packet = NULL;
+	size_t prekey_packet_length = 0;
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+
+	status = molch_create_user(
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			&alice_prekeys,
+			&alice_prekeys_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			NULL,
+			0);
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+
+	status = molch_create_user(
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			NULL,
+			0);
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+
+	buffer_create_from_string(first_message, "Hi Bob!");
+	status = molch_start_send_conversation(
+			alice_conversation,
+			sizeof(alice_conversation),
+			&prekey_packet,
+			&prekey_packet_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			bob_prekeys,
+			bob_prekeys_length,
+			first_message->content,
+			first_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+
+	free_and_null_if_valid(bob_prekeys);
+	status = molch_start_receive_conversation(
+			bob_conversation,
+			sizeof(bob_conversation),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			&message,
+			&message_length,
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			prekey_packet,
+			prekey_packet_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start receive conversation.");
+
+cleanup:
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(bob_prekeys);
+	free_and_null_if_valid(prekey_packet);
+	free_and_null_if_valid(message);
+
+	return status;
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	attachment_stream *sender = NULL;
+	attachment_stream *receiver = NULL;
+	unsigned char *attachment = NULL;
+	unsigned char *received_attachment = NULL;
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+	unsigned char *message_packet = NULL;
+	size_t message_packet_length = 0;
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	unsigned char chunks[2][CHUNK_SIZE + ATTACHMENT_CHUNK_OVERHEAD];
+	size_t chunk_lengths[2] = {0, 0};
+	unsigned char data[CHUNK_SIZE];
+
+	status = create_conversation();
+	throw_on_error(CREATION_ERROR, "Failed to create conversation.");
+
+	attachment = malloc(ATTACHMENT_SIZE);
+	throw_on_failed_alloc(attachment);
+	received_attachment = malloc(ATTACHMENT_SIZE);
+	throw_on_failed_alloc(received_attachment);
+	randombytes_buf(attachment, ATTACHMENT_SIZE);
+
+	//start the attachment
+	status = molch_start_send_attachment(
+			&sender,
+			&packet,
+			&packet_length,
+			alice_conversation,
+			sizeof(alice_conversation),
+			NULL,
+			NULL);
+	throw_on_error(SEND_ERROR, "Failed to start sending the attachment.");
+
+	//the conversation can still be used while the attachment is being sent
+	buffer_create_from_string(normal_message, "Sending you a file.");
+	status = molch_encrypt_message(
+			&message_packet,
+			&message_packet_length,
+			alice_conversation,
+			sizeof(alice_conversation),
+			normal_message->content,
+			normal_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+
+	uint32_t receive_message_number = 0;
+	uint32_t previous_receive_message_number = 0;
+	status = molch_start_receive_attachment(
+			&receiver,
+			&receive_message_number,
+			&previous_receive_message_number,
+			bob_conversation,
+			sizeof(bob_conversation),
+			packet,
+			packet_length,
+			NULL,
+			NULL);
+	throw_on_error(RECEIVE_ERROR, "Failed to start receiving the attachment.");
+
+	status = molch_decrypt_message(
+			&message,
+			&message_length,
+			&receive_message_number,
+			&previous_receive_message_number,
+			bob_conversation,
+			sizeof(bob_conversation),
+			message_packet,
+			message_packet_length,
+			NULL,
+			NULL);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
+	if ((message_length != normal_message->content_length) || (sodium_memcmp(message, normal_message->content, message_length) != 0)) {
+		throw(INVALID_VALUE, "Decrypted message doesn't match.");
+	}
+
+	//push and pull chunk by chunk
+	size_t position = 0;
+	bool last = false;
+	while (!last) {
+		const size_t data_length = ((ATTACHMENT_SIZE - position) > CHUNK_SIZE) ? CHUNK_SIZE : (ATTACHMENT_SIZE - position);
+		const bool last_chunk = (position + data_length) == ATTACHMENT_SIZE;
+		status = molch_attachment_push(
+				sender,
+				chunks[0],
+				sizeof(chunks[0]),
+				attachment + position,
+				data_length,
+				last_chunk);
+		throw_on_error(ENCRYPT_ERROR, "Failed to push chunk.");
+		chunk_lengths[0] = data_length + ATTACHMENT_CHUNK_OVERHEAD;
+
+		status = molch_attachment_pull(
+				receiver,
+				received_attachment + position,
+				ATTACHMENT_SIZE - position,
+				&last,
+				chunks[0],
+				chunk_lengths[0]);
+		throw_on_error(DECRYPT_ERROR, "Failed to pull chunk.");
+		if (last != last_chunk) {
+			throw(INVALID_VALUE, "Last chunk wasn't detected.");
+		}
+
+		position += data_length;
+	}
+	if (sodium_memcmp(attachment, received_attachment, ATTACHMENT_SIZE) != 0) {
+		throw(INVALID_VALUE, "Received attachment doesn't match.");
+	}
+	printf("Received %u bytes in chunks of %u bytes.\n", ATTACHMENT_SIZE, CHUNK_SIZE);
+
+	//both streams are finished
+	status = molch_attachment_push(sender, chunks[0], sizeof(chunks[0]), data, 1, false);
+	if (status.status == SUCCESS) {
+		throw(INVALID_STATE, "Pushed to a finished attachment.");
+	}
+	return_status_destroy_errors(&status);
+	status = molch_attachment_pull(receiver, data, sizeof(data), &last, chunks[0], chunk_lengths[0]);
+	if (status.status == SUCCESS) {
+		throw(INVALID_STATE, "Pulled from a finished attachment.");
+	}
+	return_status_destroy_errors(&status);
+
+	molch_destroy_attachment(sender);
+	sender = NULL;
+	molch_destroy_attachment(receiver);
+	receiver = NULL;
+	free_and_null_if_valid(packet);
+
+	//manipulated and reordered chunks
+	status = molch_start_send_attachment(&sender, &packet, &packet_length, alice_conversation, sizeof(alice_conversation), NULL, NULL);
+	throw_on_error(SEND_ERROR, "Failed to start sending the attachment.");
+	status = molch_start_receive_attachment(&receiver, &receive_message_number, &previous_receive_message_number, bob_conversation, sizeof(bob_conversation), packet, packet_length, NULL, NULL);
+	throw_on_error(RECEIVE_ERROR, "Failed to start receiving the attachment.");
+
+	for (size_t i = 0; i < 2; i++) {
+		status = molch_attachment_push(sender, chunks[i], sizeof(chunks[i]), attachment + i * CHUNK_SIZE, CHUNK_SIZE, i == 1);
+		throw_on_error(ENCRYPT_ERROR, "Failed to push chunk.");
+		chunk_lengths[i] = CHUNK_SIZE + ATTACHMENT_CHUNK_OVERHEAD;
+	}
+
+	status = molch_attachment_pull(receiver, data, sizeof(data), &last, chunks[1], chunk_lengths[1]);
+	if (status.status == SUCCESS) {
+		throw(INVALID_VALUE, "Pulled chunks in the wrong order.");
+	}
+	return_status_destroy_errors(&status);
+
+	chunks[0][CHUNK_SIZE / 2] ^= 0x01;
+	status = molch_attachment_pull(receiver, data, sizeof(data), &last, chunks[0], chunk_lengths[0]);
+	if (status.status == SUCCESS) {
+		throw(INVALID_VALUE, "Pulled a manipulated chunk.");
+	}
+	return_status_destroy_errors(&status);
+
+	chunks[0][CHUNK_SIZE / 2] ^= 0x01;
+	status = molch_attachment_pull(receiver, data, sizeof(data), &last, chunks[0], chunk_lengths[0]);
+	throw_on_error(DECRYPT_ERROR, "Failed to pull chunk.");
+	if (last || (sodium_memcmp(data, attachment, CHUNK_SIZE) != 0)) {
+		throw(INVALID_VALUE, "Chunk doesn't match.");
+	}
+	printf("Detected manipulated and reordered chunks.\n");
+
+cleanup:
+	molch_destroy_attachment(sender);
+	molch_destroy_attachment(receiver);
+	free_and_null_if_valid(attachment);
+	free_and_null_if_valid(received_attachment);
+	free_and_null_if_valid(packet);
+	free_and_null_if_valid(message_packet);
+	free_and_null_if_valid(message);
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
@@ -0,0 +1,281 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "utils.h"
+
+#define SENDERS 4
+#define CONVERSATIONS_PER_SENDER 5
+#define PACKETS (SENDERS * CONVERSATIONS_PER_SENDER + 1)
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char alice_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char sender_public_identities[SENDERS][PUBLIC_MASTER_KEY_SIZE];
+	unsigned char sender_conversations[PACKETS][CONVERSATION_ID_SIZE];
+	molch_received_conversation received[PACKETS];
+	size_t received_count = 0;
+
+	unsigned char *alice_prekeys = NULL;
+	size_t alice_prekeys_length = 0;
+	unsigned char *new_prekeys = NULL;
+	size_t new_prekeys_length = 0;
+	unsigned char *sender_prekeys = NULL;
+	size_t sender_prekeys_length = 0;
+	unsigned char *packets[PACKETS] = {NULL};
+	size_t packet_lengths[PACKETS] = {0};
+	unsigned char *backup = NULL;
+	size_t backup_length = 0;
+	unsigned char *reply = NULL;
+	size_t reply_length = 0;
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+
+	status = molch_create_user(alice_public_identity, sizeof(alice_public_identity), &alice_prekeys, &alice_prekeys_length, backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+
+	//everybody uses the same prekey list, so some prekeys are used more than once
+	for (size_t sender = 0; sender < SENDERS; sender++) {
+		status = molch_create_user(sender_public_identities[sender], PUBLIC_MASTER_KEY_SIZE, &sender_prekeys, &sender_prekeys_length, backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+		throw_on_error(CREATION_ERROR, "Failed to create sender.");
+		free_and_null_if_valid(sender_prekeys);
+
+		for (size_t i = 0; i < CONVERSATIONS_PER_SENDER; i++) {
+			const size_t index = sender * CONVERSATIONS_PER_SENDER + i;
+			unsigned char first_message[] = "Hi Alice, I'm message 00!";
+			first_message[sizeof(first_message) - 4] = (unsigned char)('0' + index / 10);
+			first_message[sizeof(first_message) - 3] = (unsigned char)('0' + index % 10);
+			status = molch_start_send_conversation(
+					sender_conversations[index],
+					CONVERSATION_ID_SIZE,
+					&packets[index],
+					&packet_lengths[index],
+					sender_public_identities[sender],
+					PUBLIC_MASTER_KEY_SIZE,
+					alice_public_identity,
+					sizeof(alice_public_identity),
+					alice_prekeys,
+					alice_prekeys_length,
+					first_message,
+					sizeof(first_message),
+					NULL,
+					NULL);
+			throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+		}
+	}
+
+	//a broken packet in between doesn't stop the others
+	const size_t broken = PACKETS - 1;
+	packet_lengths[broken] = 100;
+	packets[broken] = malloc(packet_lengths[broken]);
+	throw_on_failed_alloc(packets[broken]);
+	randombytes_buf(packets[broken], packet_lengths[broken]);
+
+	status = molch_start_receive_conversations(
+			received,
+			&new_prekeys,
+			&new_prekeys_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			(const unsigned char * const *)packets,
+			packet_lengths,
+			PACKETS,
+			3,
+			&backup,
+			&backup_length);
+	throw_on_error(CREATION_ERROR, "Failed to receive the batch of prekey messages.");
+	received_count = PACKETS;
+
+	if (received[broken].status.status == SUCCESS) {
+		throw(INCORRECT_DATA, "Broken packet was accepted.");
+	}
+	if ((backup == NULL) || (backup_length == 0)) {
+		throw(EXPORT_ERROR, "No backup was exported.");
+	}
+	if ((new_prekeys_length != alice_prekeys_length) || (sodium_memcmp(new_prekeys, alice_prekeys, alice_prekeys_length) == 0)) {
+		throw(INCORRECT_DATA, "Used prekeys weren't replaced.");
+	}
+
+	//check the messages and answer every conversation
+	buffer_create_from_string(answer, "Hi!");
+	for (size_t i = 0; i < broken; i++) {
+		status = received[i].status;
+		received[i].status = return_status_init();
+		throw_on_error(CREATION_ERROR, "Failed to receive a prekey message of the batch.");
+
+		if ((received[i].message_length != 26)
+				|| (received[i].message[22] != (unsigned char)('0' + i / 10))
+				|| (received[i].message[23] != (unsigned char)('0' + i % 10))) {
+			throw(INCORRECT_DATA, "Received message doesn't match.");
+		}
+
+		status = molch_encrypt_message(&reply, &reply_length, received[i].conversation_id, CONVERSATION_ID_SIZE, answer->content, answer->content_length, NULL, NULL);
+		throw_on_error(ENCRYPT_ERROR, "Failed to answer.");
+
+		uint32_t receive_message_number = 0;
+		uint32_t previous_receive_message_number = 0;
+		status = molch_decrypt_message(&message, &message_length, &receive_message_number, &previous_receive_message_number, sender_conversations[i], CONVERSATION_ID_SIZE, reply, reply_length, NULL, NULL);
+		throw_on_error(DECRYPT_ERROR, "Failed to decrypt answer.");
+		if ((message_length != answer->content_length) || (sodium_memcmp(message, answer->content, message_length) != 0)) {
+			throw(INCORRECT_DATA, "Answer doesn't match.");
+		}
+		free_and_null_if_valid(reply);
+		free_and_null_if_valid(message);
+	}
+	printf("Received %d prekey messages at once.\n", PACKETS - 1);
+
+	//the old prekeys are deprecated, but still usable for a while
+	buffer_create_from_string(late_message, "Late!");
+	free_and_null_if_valid(packets[0]);
+	status = molch_start_send_conversation(
+			sender_conversations[0],
+			CONVERSATION_ID_SIZE,
+			&packets[0],
+			&packet_lengths[0],
+			sender_public_identities[0],
+			PUBLIC_MASTER_KEY_SIZE,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			alice_prekeys,
+			alice_prekeys_length,
+			late_message->content,
+			late_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start send conversation with old prekeys.");
+	free_and_null_if_valid(new_prekeys);
+	for (size_t i = 0; i < received_count; i++) {
+		molch_destroy_return_status(&received[i].status);
+		free_and_null_if_valid(received[i].message);
+	}
+	received_count = 0;
+	status = molch_start_receive_conversations(
+			received,
+			&new_prekeys,
+			&new_prekeys_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			(const unsigned char * const *)packets,
+			packet_lengths,
+			1,
+			0,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to receive a batch of one.");
+	received_count = 1;
+	status = received[0].status;
+	received[0].status = return_status_init();
+	throw_on_error(CREATION_ERROR, "Failed to receive prekey message with a deprecated prekey.");
+
+	//unknown user
+	free_and_null_if_valid(new_prekeys);
+	molch_received_conversation unknown[1];
+	return_status unknown_status = molch_start_receive_conversations(
+			unknown,
+			&new_prekeys,
+			&new_prekeys_length,
+			backup_key,
+			PUBLIC_MASTER_KEY_SIZE,
+			(const unsigned char * const *)packets,
+			packet_lengths,
+			1,
+			1,
+			NULL,
+			NULL);
+	molch_destroy_return_status(&unknown_status);
+	if (unknown_status.status != NOT_FOUND) {
+		throw(INCORRECT_DATA, "Batch for an unknown user didn't fail.");
+	}
+
+	//missing packet with a length
+	const unsigned char *missing_packets[1] = {NULL};
+	return_status missing_status = molch_start_receive_conversations(
+			unknown,
+			&new_prekeys,
+			&new_prekeys_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			missing_packets,
+			packet_lengths,
+			1,
+			1,
+			NULL,
+			NULL);
+	molch_destroy_return_status(&missing_status);
+	if (missing_status.status != INVALID_INPUT) {
+		throw(INCORRECT_DATA, "Batch with a NULL packet didn't fail.");
+	}
+
+	//so many packets that the temporary arrays would overflow
+	return_status overflow_status = molch_start_receive_conversations(
+			unknown,
+			&new_prekeys,
+			&new_prekeys_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			(const unsigned char * const *)packets,
+			packet_lengths,
+			SIZE_MAX / 2,
+			1,
+			NULL,
+			NULL);
+	molch_destroy_return_status(&overflow_status);
+	if (overflow_status.status != INVALID_INPUT) {
+		throw(INCORRECT_DATA, "Batch with an overflowing packet count didn't fail.");
+	}
+
+cleanup:
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(new_prekeys);
+	free_and_null_if_valid(sender_prekeys);
+	for (size_t i = 0; i < PACKETS; i++) {
+		free_and_null_if_valid(packets[i]);
+	}
+	for (size_t i = 0; i < received_count; i++) {
+		molch_destroy_return_status(&received[i].status);
+		free_and_null_if_valid(received[i].message);
+	}
+	free_and_null_if_valid(backup);
+	free_and_null_if_valid(reply);
+	free_and_null_if_valid(message);
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
@@ -26,7 +26,6 @@
 
 #include "../lib/key-derivation.h"
 #include "utils.h"
-#include "tracing.h"
 
 int main(void) {
 	if (sodium_init() == -1) {
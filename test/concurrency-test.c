@@ -0,0 +1,230 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "utils.h"
+
+#define THREADS 8
+#define MESSAGES 20
+
+/*
+ * Every thread creates two users and lets them talk to each other
+ * while the other threads do the same.
+ */
+static return_status conversation(void) {
+	return_status status = return_status_init();
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char alice_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char bob_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+	unsigned char *alice_prekeys = NULL;
+	size_t alice_prekeys_length = 0;
+	unsigned char *bob_prekeys = NULL;
+	size_t bob_prekeys_length = 0;
+	unsigned char *prekey_packet = NULL;
+	size_t prekey_packet_length = 0;
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+
+	status = molch_create_user(
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			&alice_prekeys,
+			&alice_prekeys_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			NULL,
+			0);
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	status = molch_create_user(
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			NULL,
+			0);
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+
+	buffer_create_from_string(first_message, "Hi Bob!");
+	status = molch_start_send_conversation(
+			alice_conversation,
+			sizeof(alice_conversation),
+			&prekey_packet,
+			&prekey_packet_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			bob_prekeys,
+			bob_prekeys_length,
+			first_message->content,
+			first_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+
+	free_and_null_if_valid(bob_prekeys);
+	status = molch_start_receive_conversation(
+			bob_conversation,
+			sizeof(bob_conversation),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			&message,
+			&message_length,
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			prekey_packet,
+			prekey_packet_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start receive conversation.");
+	free_and_null_if_valid(message);
+
+	buffer_create_from_string(reply, "Hi Alice!");
+	for (size_t i = 0; i < MESSAGES; i++) {
+		status = molch_encrypt_message(
+				&packet,
+				&packet_length,
+				bob_conversation,
+				sizeof(bob_conversation),
+				reply->content,
+				reply->content_length,
+				NULL,
+				NULL);
+		throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+
+		uint32_t receive_message_number = 0;
+		uint32_t previous_receive_message_number = 0;
+		status = molch_decrypt_message(
+				&message,
+				&message_length,
+				&receive_message_number,
+				&previous_receive_message_number,
+				alice_conversation,
+				sizeof(alice_conversation),
+				packet,
+				packet_length,
+				NULL,
+				NULL);
+		throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
+		if ((receive_message_number != i)
+				|| (message_length != reply->content_length)
+				|| (sodium_memcmp(message, reply->content, message_length) != 0)) {
+			throw(INCORRECT_DATA, "Decrypted the wrong message.");
+		}
+		free_and_null_if_valid(packet);
+		free_and_null_if_valid(message);
+	}
+
+	status = molch_end_conversation(alice_conversation, sizeof(alice_conversation), NULL, NULL);
+	throw_on_error(GENERIC_ERROR, "Failed to end Alice's conversation.");
+	status = molch_destroy_user(alice_public_identity, sizeof(alice_public_identity), NULL, NULL);
+	throw_on_error(REMOVE_ERROR, "Failed to destroy Alice.");
+
+cleanup:
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(bob_prekeys);
+	free_and_null_if_valid(prekey_packet);
+	free_and_null_if_valid(packet);
+	free_and_null_if_valid(message);
+
+	return status;
+}
+
+static void *conversation_thread(void *argument) {
+	*((return_status*)argument) = conversation();
+
+	return NULL;
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	pthread_t threads[THREADS];
+	return_status thread_statuses[THREADS];
+	size_t started = 0;
+
+	for (; started < THREADS; started++) {
+		if (pthread_create(&threads[started], NULL, conversation_thread, &thread_statuses[started]) != 0) {
+			break;
+		}
+	}
+
+	bool joined = true;
+	for (size_t i = 0; i < started; i++) {
+		joined &= (pthread_join(threads[i], NULL) == 0);
+	}
+	if ((started != THREADS) || !joined) {
+		throw(GENERIC_ERROR, "Failed to run the threads.");
+	}
+
+	for (size_t i = 0; i < THREADS; i++) {
+		status = thread_statuses[i];
+		thread_statuses[i] = return_status_init();
+		throw_on_error(GENERIC_ERROR, "Conversation failed.");
+	}
+
+	//every thread destroyed Alice
+	if (molch_user_count() != THREADS) {
+		throw(INCORRECT_DATA, "Wrong number of users.");
+	}
+
+cleanup:
+	for (size_t i = 0; i < started; i++) {
+		return_status_destroy_errors(&thread_statuses[i]);
+	}
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
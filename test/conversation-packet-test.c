@@ -28,6 +28,7 @@
 #include "common.h"
 #include "utils.h"
 #include "../lib/conversation.h"
+#include "../lib/packet.h"
 
 int main(void) {
 	//create buffers
@@ -52,6 +53,10 @@ int main(void) {
 	buffer_t *bob_receive_message2 = NULL;
 	buffer_t *alice_received_response = NULL;
 	buffer_t *bob_received_response = NULL;
+	buffer_t *short_packet = NULL;
+	buffer_t *alice_short_message = NULL;
+	buffer_t *tampered_packet = NULL;
+	buffer_t *alice_tampered_message = NULL;
 
 	//create prekey stores
 	prekey_store *alice_prekeys = NULL;
@@ -334,6 +339,95 @@ int main(void) {
 	}
 	printf("Successfully received Alice' response!\n");
 
+	//short message with power of two padding, Bob knows that Alice supports it now
+	bob_send_conversation->padding = MOLCH_PADDING_POWER_OF_TWO;
+	if ((conversation_get_send_padding(bob_send_conversation) != MOLCH_PADDING_POWER_OF_TWO)
+			|| (conversation_get_send_protocol_version(bob_send_conversation) != PROTOCOL_VERSION_ROUTED)) {
+		throw(INVALID_VALUE, "Padding policy or compact packets aren't used although they're supported.");
+	}
+	buffer_create_from_string(short_message, "ok");
+	status = conversation_send(
+			bob_send_conversation,
+			short_message,
+			&short_packet,
+			NULL,
+			NULL,
+			NULL);
+	throw_on_error(SEND_ERROR, "Failed to send short message.");
+
+	packet_view short_packet_struct;
+	status = packet_unpack(&short_packet_struct, short_packet);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack short packet.");
+	if ((short_packet_struct.packet_header.current_protocol_version != PROTOCOL_VERSION_ROUTED)
+			|| (short_packet_struct.encrypted_message.length != (16 + crypto_secretbox_MACBYTES))) {
+		throw(INCORRECT_DATA, "Short message isn't padded to 16 bytes.");
+	}
+
+	status = conversation_receive(
+			alice_receive_conversation,
+			short_packet,
+			&alice_receive_message_number,
+			&alice_previous_receive_message_number,
+			&alice_short_message);
+	throw_on_error(RECEIVE_ERROR, "Short message from Bob failed to decrypt.");
+	if (buffer_compare(short_message, alice_short_message) != 0) {
+		throw(INVALID_VALUE, "Short message doesn't match.");
+	}
+	printf("Received short message with %zu bytes of ciphertext!\n", short_packet_struct.encrypted_message.length);
+
+	//the protocol versions of a protobuf packet are authenticated by the header
+	bob_send_conversation->their_highest_supported_protocol_version = PROTOCOL_VERSION_LENGTH_PREFIX;
+	buffer_create_from_string(tampered_message, "tampered");
+	status = conversation_send(
+			bob_send_conversation,
+			tampered_message,
+			&tampered_packet,
+			NULL,
+			NULL,
+			NULL);
+	throw_on_error(SEND_ERROR, "Failed to send message to tamper with.");
+	//packet header: tag, length, tag, current_protocol_version, tag, highest_supported_protocol_version
+	if ((tampered_packet->content[0] != 0x0a) || (tampered_packet->content[2] != 0x08) || (tampered_packet->content[4] != 0x10)
+			|| (tampered_packet->content[3] != PROTOCOL_VERSION_LENGTH_PREFIX)) {
+		throw(INCORRECT_DATA, "Unexpected packet header layout.");
+	}
+
+	tampered_packet->content[3] = PROTOCOL_VERSION_PKCS7_PADDING;
+	status = conversation_receive(
+			alice_receive_conversation,
+			tampered_packet,
+			&alice_receive_message_number,
+			&alice_previous_receive_message_number,
+			&alice_tampered_message);
+	bool decrypt_error = false;
+	for (const error_message *error = status.error; error != NULL; error = error->next) {
+		decrypt_error |= (error->status == DECRYPT_ERROR);
+	}
+	if (!decrypt_error) {
+		throw(INCORRECT_DATA, "Packet with a tampered protocol version wasn't rejected.");
+	}
+	return_status_destroy_errors(&status);
+	status = return_status_init();
+	printf("Detected tampered protocol version!\n");
+
+	//lowering the highest supported version doesn't downgrade the conversation
+	tampered_packet->content[3] = PROTOCOL_VERSION_LENGTH_PREFIX;
+	tampered_packet->content[5] = PROTOCOL_VERSION_PKCS7_PADDING;
+	status = conversation_receive(
+			alice_receive_conversation,
+			tampered_packet,
+			&alice_receive_message_number,
+			&alice_previous_receive_message_number,
+			&alice_tampered_message);
+	throw_on_error(RECEIVE_ERROR, "Message from Bob failed to decrypt after tampering.");
+	if (buffer_compare(tampered_message, alice_tampered_message) != 0) {
+		throw(INVALID_VALUE, "Message from Bob doesn't match after tampering.");
+	}
+	if (alice_receive_conversation->their_highest_supported_protocol_version != HIGHEST_SUPPORTED_PROTOCOL_VERSION) {
+		throw(INCORRECT_DATA, "Unauthenticated highest supported protocol version was used.");
+	}
+	printf("Ignored tampered highest supported protocol version!\n");
+
 cleanup:
 	if (alice_prekeys != NULL) {
 		prekey_store_destroy(alice_prekeys);
@@ -351,6 +445,10 @@ cleanup:
 	buffer_destroy_from_heap_and_null_if_valid(alice_received_response);
 	buffer_destroy_from_heap_and_null_if_valid(alice_response_packet);
 	buffer_destroy_from_heap_and_null_if_valid(bob_received_response);
+	buffer_destroy_from_heap_and_null_if_valid(short_packet);
+	buffer_destroy_from_heap_and_null_if_valid(alice_short_message);
+	buffer_destroy_from_heap_and_null_if_valid(tampered_packet);
+	buffer_destroy_from_heap_and_null_if_valid(alice_tampered_message);
 	if (alice_send_conversation != NULL) {
 		conversation_destroy(alice_send_conversation);
 	}
@@ -28,7 +28,6 @@
 
 #include "../lib/conversation-store.h"
 #include "utils.h"
-#include "tracing.h"
 
 return_status protobuf_export(
 		const conversation_store * const store,
@@ -183,6 +182,7 @@ return_status test_add_conversation(conversation_store * const store) {
 	conversation->next = NULL;
 	conversation->previous = NULL;
 	conversation->ratchet = NULL;
+	conversation->routes = NULL;
 
 	//create the conversation id
 	buffer_init_with_pointer(conversation->id, conversation->id_storage, CONVERSATION_ID_SIZE, CONVERSATION_ID_SIZE);
@@ -28,7 +28,6 @@
 #include "common.h"
 #include "utils.h"
 #include "../lib/conversation.h"
-#include "tracing.h"
 
 return_status protobuf_export(const conversation_t * const conversation, buffer_t ** const export_buffer) __attribute__((warn_unused_result));
 return_status protobuf_export(const conversation_t * const conversation, buffer_t ** const export_buffer) {
@@ -135,6 +134,7 @@ return_status create_conversation(
 	(*conversation)->ratchet = NULL;
 	(*conversation)->previous = NULL;
 	(*conversation)->next = NULL;
+	(*conversation)->routes = NULL;
 
 	//create random id
 	if (buffer_fill_random((*conversation)->id, CONVERSATION_ID_SIZE) != 0) {
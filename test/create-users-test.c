@@ -0,0 +1,171 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "utils.h"
+
+#define USERS 8
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	molch_enable_stats(true);
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char sender_public_master_key[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char *sender_prekey_list = NULL;
+	size_t sender_prekey_list_length = 0;
+	unsigned char conversation_id[CONVERSATION_ID_SIZE];
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+
+	molch_created_user created_users[USERS];
+	for (size_t i = 0; i < USERS; i++) {
+		created_users[i].status = return_status_init();
+		created_users[i].prekey_list = NULL;
+	}
+
+	//every other user gets random input
+	buffer_create_from_string(spice, "hjkl;zxcvbnm");
+	const unsigned char *random_data[USERS];
+	size_t random_data_lengths[USERS];
+	for (size_t i = 0; i < USERS; i++) {
+		random_data[i] = ((i % 2) == 0) ? spice->content : NULL;
+		random_data_lengths[i] = ((i % 2) == 0) ? spice->content_length : 0;
+	}
+
+	status = molch_create_user(
+			sender_public_master_key,
+			sizeof(sender_public_master_key),
+			&sender_prekey_list,
+			&sender_prekey_list_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			NULL,
+			0);
+	throw_on_error(CREATION_ERROR, "Failed to create the sender.");
+
+	status = molch_create_users(
+			created_users,
+			USERS,
+			backup_key,
+			sizeof(backup_key),
+			random_data,
+			random_data_lengths,
+			MOLCH_SPICE_COST_MINIMAL,
+			3,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to create the users.");
+
+	if (molch_user_count() != (USERS + 1)) {
+		throw(INCORRECT_DATA, "Wrong number of users.");
+	}
+
+	//the batch is counted separately from single users
+	molch_stats stats;
+	molch_get_stats(&stats);
+	if ((stats.api[MOLCH_STATS_CREATE_USER].calls != 1) || (stats.api[MOLCH_STATS_CREATE_USERS].calls != 1)) {
+		throw(INCORRECT_DATA, "Wrong number of calls in the stats.");
+	}
+
+	for (size_t i = 0; i < USERS; i++) {
+		status = created_users[i].status;
+		created_users[i].status = return_status_init();
+		throw_on_error(CREATION_ERROR, "Failed to create a user.");
+
+		if ((created_users[i].prekey_list == NULL) || (created_users[i].prekey_list_length == 0)) {
+			throw(INCORRECT_DATA, "No prekey list.");
+		}
+
+		//same random input, but still different keys
+		for (size_t j = 0; j < i; j++) {
+			if (sodium_memcmp(created_users[i].public_master_key, created_users[j].public_master_key, PUBLIC_MASTER_KEY_SIZE) == 0) {
+				throw(INCORRECT_DATA, "Two users have the same public master key.");
+			}
+		}
+
+		//the prekey lists can be used to start conversations
+		status = molch_start_send_conversation(
+				conversation_id,
+				sizeof(conversation_id),
+				&packet,
+				&packet_length,
+				sender_public_master_key,
+				sizeof(sender_public_master_key),
+				created_users[i].public_master_key,
+				sizeof(created_users[i].public_master_key),
+				created_users[i].prekey_list,
+				created_users[i].prekey_list_length,
+				spice->content,
+				spice->content_length,
+				NULL,
+				NULL);
+		throw_on_error(CREATION_ERROR, "Failed to start a conversation with a new user.");
+		free_and_null_if_valid(packet);
+	}
+
+	//invalid input
+	status = molch_create_users(
+			created_users,
+			0,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			MOLCH_SPICE_COST_MINIMAL,
+			0,
+			NULL,
+			NULL);
+	if (status.status == SUCCESS) {
+		throw(INCORRECT_DATA, "Created an empty batch of users.");
+	}
+	return_status_destroy_errors(&status);
+	status = return_status_init();
+
+cleanup:
+	free_and_null_if_valid(sender_prekey_list);
+	free_and_null_if_valid(packet);
+	for (size_t i = 0; i < USERS; i++) {
+		free_and_null_if_valid(created_users[i].prekey_list);
+		return_status_destroy_errors(&created_users[i].status);
+	}
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
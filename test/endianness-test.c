@@ -24,7 +24,6 @@
 
 #include "../lib/endianness.h"
 #include "utils.h"
-#include "tracing.h"
 
 int main(void) {
 	return_status status = return_status_init();
@@ -23,9 +23,10 @@
 #include <stdlib.h>
 #include <sodium.h>
 
+#include "../lib/constants.h"
 #include "../lib/header.h"
+#include "../lib/wire.h"
 #include "utils.h"
-#include "tracing.h"
 
 int main(void) {
 	//create buffers
@@ -60,7 +61,9 @@ int main(void) {
 			&header,
 			our_public_ephemeral_key,
 			message_number,
-			previous_message_number);
+			previous_message_number,
+			PROTOCOL_VERSION_LENGTH_PREFIX,
+			HIGHEST_SUPPORTED_PROTOCOL_VERSION);
 	throw_on_error(CREATION_ERROR, "Failed to create header.");
 
 	//print the header
@@ -71,10 +74,14 @@ int main(void) {
 	//get data back out of the header again
 	uint32_t extracted_message_number;
 	uint32_t extracted_previous_message_number;
+	uint32_t extracted_current_protocol_version;
+	uint32_t extracted_highest_supported_protocol_version;
 	status = header_extract(
 			extracted_public_ephemeral_key,
 			&extracted_message_number,
 			&extracted_previous_message_number,
+			&extracted_current_protocol_version,
+			&extracted_highest_supported_protocol_version,
 			header);
 	throw_on_error(DATA_FETCH_ERROR, "Failed to extract data from header.");
 
@@ -100,6 +107,40 @@ int main(void) {
 	}
 	printf("Previous message numbers match.\n");
 
+	if ((extracted_current_protocol_version != PROTOCOL_VERSION_LENGTH_PREFIX)
+			|| (extracted_highest_supported_protocol_version != HIGHEST_SUPPORTED_PROTOCOL_VERSION)) {
+		throw(INVALID_VALUE, "Protocol versions don't match.");
+	}
+	printf("Protocol versions match.\n");
+
+	//headers of old clients don't contain the protocol versions
+	header_view legacy_header;
+	wire_header_init(&legacy_header);
+	legacy_header.has_public_ephemeral_key = true;
+	legacy_header.public_ephemeral_key.data = our_public_ephemeral_key->content;
+	legacy_header.public_ephemeral_key.length = our_public_ephemeral_key->content_length;
+	legacy_header.has_message_number = true;
+	legacy_header.message_number = message_number;
+	legacy_header.has_previous_message_number = true;
+	legacy_header.previous_message_number = previous_message_number;
+	buffer_destroy_from_heap_and_null_if_valid(header);
+	header = buffer_create_on_heap(wire_header_get_packed_size(&legacy_header), 0);
+	throw_on_failed_alloc(header);
+	header->content_length = wire_header_pack(&legacy_header, header->content);
+	status = header_extract(
+			extracted_public_ephemeral_key,
+			&extracted_message_number,
+			&extracted_previous_message_number,
+			&extracted_current_protocol_version,
+			&extracted_highest_supported_protocol_version,
+			header);
+	throw_on_error(DATA_FETCH_ERROR, "Failed to extract data from legacy header.");
+	if ((extracted_current_protocol_version != PROTOCOL_VERSION_PKCS7_PADDING)
+			|| (extracted_highest_supported_protocol_version != PROTOCOL_VERSION_PKCS7_PADDING)) {
+		throw(INVALID_VALUE, "Missing protocol versions weren't treated as PROTOCOL_VERSION_PKCS7_PADDING.");
+	}
+	printf("Legacy header has PROTOCOL_VERSION_PKCS7_PADDING.\n");
+
 cleanup:
 	buffer_destroy_from_heap_and_null_if_valid(our_public_ephemeral_key);
 	buffer_destroy_from_heap_and_null_if_valid(extracted_public_ephemeral_key);
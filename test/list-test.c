@@ -0,0 +1,220 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "utils.h"
+
+#define USERS 5
+
+static unsigned char public_identities[USERS][PUBLIC_MASTER_KEY_SIZE];
+
+static size_t find_user(const unsigned char * const key) {
+	for (size_t i = 0; i < USERS; i++) {
+		if (sodium_memcmp(public_identities[i], key, PUBLIC_MASTER_KEY_SIZE) == 0) {
+			return i;
+		}
+	}
+
+	return USERS;
+}
+
+static bool count_user(const unsigned char * const key, const size_t key_length, void * const user_data) {
+	size_t * const count = user_data;
+	if ((key_length == PUBLIC_MASTER_KEY_SIZE) && (find_user(key) != USERS)) {
+		(*count)++;
+	}
+
+	return true;
+}
+
+static bool stop_after_two(const unsigned char * const key __attribute__((unused)), const size_t key_length __attribute__((unused)), void * const user_data) {
+	size_t * const count = user_data;
+	(*count)++;
+
+	return *count < 2;
+}
+
+static bool copy_conversation(const unsigned char * const key, const size_t key_length, void * const user_data) {
+	if (key_length == CONVERSATION_ID_SIZE) {
+		memcpy(user_data, key, CONVERSATION_ID_SIZE);
+	}
+
+	return true;
+}
+
+static return_status create_user(unsigned char * const public_identity, unsigned char ** const prekey_list, size_t * const prekey_list_length) {
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+
+	return molch_create_user(
+			public_identity,
+			PUBLIC_MASTER_KEY_SIZE,
+			prekey_list,
+			prekey_list_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			NULL,
+			0);
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	unsigned char *prekey_list = NULL;
+	size_t prekey_list_length = 0;
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+	unsigned char extra_identity[PUBLIC_MASTER_KEY_SIZE];
+
+	for (size_t i = 0; i < USERS; i++) {
+		free_and_null_if_valid(prekey_list);
+		status = create_user(public_identities[i], &prekey_list, &prekey_list_length);
+		throw_on_error(CREATION_ERROR, "Failed to create user.");
+	}
+
+	//list the users two at a time
+	unsigned char page[2 * PUBLIC_MASTER_KEY_SIZE + 1];
+	bool listed[USERS] = {false};
+	size_t pages = 0;
+	molch_list_cursor cursor = MOLCH_LIST_CURSOR_INIT;
+	while (!cursor.done) {
+		size_t count = 0;
+		status = molch_list_users_page(page, sizeof(page), &count, &cursor);
+		throw_on_error(DATA_FETCH_ERROR, "Failed to list a page of users.");
+		if ((count == 0) || (count > 2)) {
+			throw(INCORRECT_DATA, "Page has the wrong number of users.");
+		}
+		for (size_t i = 0; i < count; i++) {
+			const size_t user = find_user(page + i * PUBLIC_MASTER_KEY_SIZE);
+			if ((user == USERS) || listed[user]) {
+				throw(INCORRECT_DATA, "Listed a wrong or duplicate user.");
+			}
+			listed[user] = true;
+		}
+		pages++;
+	}
+	if ((pages != 3) || (cursor.position != USERS)) {
+		throw(INCORRECT_DATA, "Listed the wrong number of pages.");
+	}
+	printf("Listed %zu users in %zu pages.\n", cursor.position, pages);
+
+	//adding a user in between invalidates the cursor
+	cursor = (molch_list_cursor)MOLCH_LIST_CURSOR_INIT;
+	size_t count = 0;
+	status = molch_list_users_page(page, sizeof(page), &count, &cursor);
+	throw_on_error(DATA_FETCH_ERROR, "Failed to list the first page of users.");
+	free_and_null_if_valid(prekey_list);
+	status = create_user(extra_identity, &prekey_list, &prekey_list_length);
+	throw_on_error(CREATION_ERROR, "Failed to create another user.");
+	status = molch_list_users_page(page, sizeof(page), &count, &cursor);
+	if (status.status != INVALID_STATE) {
+		throw(INCORRECT_DATA, "Listed users of a different snapshot.");
+	}
+	return_status_destroy_errors(&status);
+	status = return_status_init();
+	status = molch_destroy_user(extra_identity, sizeof(extra_identity), NULL, NULL);
+	throw_on_error(REMOVE_ERROR, "Failed to destroy the other user.");
+
+	//iterate over the users
+	count = 0;
+	status = molch_foreach_user(count_user, &count);
+	throw_on_error(DATA_FETCH_ERROR, "Failed to iterate over the users.");
+	if (count != USERS) {
+		throw(INCORRECT_DATA, "Iterated over the wrong number of users.");
+	}
+	count = 0;
+	status = molch_foreach_user(stop_after_two, &count);
+	throw_on_error(DATA_FETCH_ERROR, "Failed to iterate over the users.");
+	if (count != 2) {
+		throw(INCORRECT_DATA, "Iteration didn't stop.");
+	}
+
+	//conversations
+	free_and_null_if_valid(prekey_list);
+	status = molch_get_prekey_list(&prekey_list, &prekey_list_length, public_identities[USERS - 1], PUBLIC_MASTER_KEY_SIZE);
+	throw_on_error(DATA_FETCH_ERROR, "Failed to get the prekey list.");
+
+	unsigned char conversation_id[CONVERSATION_ID_SIZE];
+	buffer_create_from_string(message, "Hi!");
+	status = molch_start_send_conversation(
+			conversation_id,
+			sizeof(conversation_id),
+			&packet,
+			&packet_length,
+			public_identities[0],
+			PUBLIC_MASTER_KEY_SIZE,
+			public_identities[USERS - 1],
+			PUBLIC_MASTER_KEY_SIZE,
+			prekey_list,
+			prekey_list_length,
+			message->content,
+			message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+
+	unsigned char conversation_page[CONVERSATION_ID_SIZE];
+	cursor = (molch_list_cursor)MOLCH_LIST_CURSOR_INIT;
+	status = molch_list_conversations_page(conversation_page, sizeof(conversation_page), &count, &cursor, public_identities[0], PUBLIC_MASTER_KEY_SIZE);
+	throw_on_error(DATA_FETCH_ERROR, "Failed to list the conversations.");
+	if ((count != 1) || !cursor.done || (sodium_memcmp(conversation_page, conversation_id, sizeof(conversation_id)) != 0)) {
+		throw(INCORRECT_DATA, "Listed the wrong conversations.");
+	}
+
+	memset(conversation_page, '\0', sizeof(conversation_page));
+	status = molch_foreach_conversation(public_identities[0], PUBLIC_MASTER_KEY_SIZE, copy_conversation, conversation_page);
+	throw_on_error(DATA_FETCH_ERROR, "Failed to iterate over the conversations.");
+	if (sodium_memcmp(conversation_page, conversation_id, sizeof(conversation_id)) != 0) {
+		throw(INCORRECT_DATA, "Iterated over the wrong conversations.");
+	}
+
+	//a user without conversations
+	cursor = (molch_list_cursor)MOLCH_LIST_CURSOR_INIT;
+	status = molch_list_conversations_page(conversation_page, sizeof(conversation_page), &count, &cursor, public_identities[1], PUBLIC_MASTER_KEY_SIZE);
+	throw_on_error(DATA_FETCH_ERROR, "Failed to list the conversations.");
+	if ((count != 0) || !cursor.done) {
+		throw(INCORRECT_DATA, "Listed conversations of a user without conversations.");
+	}
+
+cleanup:
+	free_and_null_if_valid(prekey_list);
+	free_and_null_if_valid(packet);
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
@@ -26,7 +26,6 @@
 #include "../lib/master-keys.h"
 #include "../lib/constants.h"
 #include "utils.h"
-#include "tracing.h"
 
 return_status protobuf_export(
 		master_keys * const keys,
@@ -189,7 +188,7 @@ return_status protobuf_import(
 cleanup:
 	on_error {
 		if (keys != NULL) {
-			sodium_free_and_null_if_valid(*keys);
+			key_free_and_null_if_valid(*keys);
 		}
 	}
 
@@ -249,7 +248,7 @@ int main(void) {
 	int status_int = 0;
 
 	//create the unspiced master keys
-	status = master_keys_create(&unspiced_master_keys, NULL, NULL, NULL);
+	status = master_keys_create(&unspiced_master_keys, NULL, MOLCH_SPICE_COST_INTERACTIVE, NULL, NULL);
 	throw_on_error(CREATION_ERROR, "Failed to create unspiced master keys.");
 
 	//get the public keys
@@ -286,7 +285,7 @@ int main(void) {
 
 	//create the spiced master keys
 	buffer_create_from_string(seed, ";a;awoeih]]pquw4t[spdif\\aslkjdf;'ihdg#)%!@))%)#)(*)@)#)h;kuhe[orih;o's':ke';sa'd;kfa';;.calijv;a/orq930u[sd9f0u;09[02;oasijd;adk");
-	status = master_keys_create(&spiced_master_keys, seed, public_signing_key, public_identity_key);
+	status = master_keys_create(&spiced_master_keys, seed, MOLCH_SPICE_COST_INTERACTIVE, public_signing_key, public_identity_key);
 	throw_on_error(CREATION_ERROR, "Failed to create spiced master keys.");
 
 	//print the keys
@@ -369,7 +368,7 @@ int main(void) {
 	print_hex(protobuf_export_private_identity_key);
 	puts("\n\n");
 
-	sodium_free_and_null_if_valid(spiced_master_keys);
+	key_free_and_null_if_valid(spiced_master_keys);
 
 	//import again
 	printf("Import from Protobuf-C:\n");
@@ -407,9 +406,9 @@ int main(void) {
 	printf("Successfully exported to Protobuf-C and imported again.");
 
 cleanup:
-	sodium_free_and_null_if_valid(unspiced_master_keys);
-	sodium_free_and_null_if_valid(spiced_master_keys);
-	sodium_free_and_null_if_valid(imported_master_keys);
+	key_free_and_null_if_valid(unspiced_master_keys);
+	key_free_and_null_if_valid(spiced_master_keys);
+	key_free_and_null_if_valid(imported_master_keys);
 
 	buffer_destroy_from_heap_and_null_if_valid(public_signing_key);
 	buffer_destroy_from_heap_and_null_if_valid(public_identity_key);
@@ -27,7 +27,6 @@
 #include "../lib/molch.h"
 #include "../lib/user-store.h" //for PREKEY_AMOUNT
 #include "../lib/zeroed_malloc.h"
-#include "tracing.h"
 
 #include <encrypted_backup.pb-c.h>
 
@@ -294,9 +293,14 @@ int main(void) {
 	unsigned char *user_list = NULL;
 	status = molch_list_users(&user_list, &user_list_length, &user_count);
 	throw_on_error(CREATION_ERROR, "Failed to list users.");
-	if ((user_count != 2)
-			|| (sodium_memcmp(alice_public_identity->content, user_list, alice_public_identity->content_length) != 0)
-			|| (sodium_memcmp(bob_public_identity->content, user_list + crypto_box_PUBLICKEYBYTES, alice_public_identity->content_length) != 0)) {
+	//the order depends on the shards of the user store
+	bool alice_listed = false;
+	bool bob_listed = false;
+	for (size_t i = 0; i < user_count; i++) {
+		alice_listed |= (sodium_memcmp(alice_public_identity->content, user_list + i * PUBLIC_MASTER_KEY_SIZE, PUBLIC_MASTER_KEY_SIZE) == 0);
+		bob_listed |= (sodium_memcmp(bob_public_identity->content, user_list + i * PUBLIC_MASTER_KEY_SIZE, PUBLIC_MASTER_KEY_SIZE) == 0);
+	}
+	if ((user_count != 2) || !alice_listed || !bob_listed) {
 		free_and_null_if_valid(user_list);
 		throw(INCORRECT_DATA, "User list is incorrect.");
 	}
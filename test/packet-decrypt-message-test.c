@@ -28,7 +28,6 @@
 #include "../lib/constants.h"
 #include "utils.h"
 #include "packet-test-lib.h"
-#include "tracing.h"
 
 int main(void) {
 	buffer_create_from_string(message, "Hello world!\n");
@@ -42,6 +41,7 @@ int main(void) {
 
 	buffer_t *packet = NULL;
 	buffer_t *decrypted_message = NULL;
+	buffer_t *long_message = NULL;
 
 	return_status status = return_status_init();
 
@@ -158,9 +158,67 @@ int main(void) {
 	if (buffer_compare(message, decrypted_message) != 0) {
 		throw(INVALID_VALUE, "Decrypted message doesn't match.");
 	}
-	printf("Decrypted message is the same.\n");
+	printf("Decrypted message is the same.\n\n");
+
+	//PADDING POLICIES
+	printf("PADDING POLICIES\n");
+	long_message = buffer_create_on_heap(70000, 70000);
+	throw_on_failed_alloc(long_message);
+	if (buffer_fill_random(long_message, long_message->buffer_length) != 0) {
+		throw(GENERIC_ERROR, "Failed to generate message.");
+	}
+
+	static const molch_padding policies[] = {MOLCH_PADDING_BLOCKS, MOLCH_PADDING_POWER_OF_TWO, MOLCH_PADDING_PADME, MOLCH_PADDING_BUCKETS};
+	static const size_t lengths[] = {0, 1, 10, 12, 250, 251, 1000, 5000, 70000};
+	//padded lengths (including the length prefix) for every policy and length
+	static const size_t padded_lengths[][9] = {
+		{255, 255, 255, 255, 255, 255, 1020, 5100, 70125},
+		{16, 16, 16, 16, 256, 256, 1024, 8192, 131072},
+		{4, 5, 14, 16, 256, 256, 1024, 5120, 71680},
+		{64, 64, 64, 64, 256, 256, 1024, 16384, 81920}
+	};
+	//blocks are the same size with and without the length prefix
+	static const uint32_t versions[] = {PROTOCOL_VERSION_PKCS7_PADDING, PROTOCOL_VERSION_LENGTH_PREFIX, PROTOCOL_VERSION_COMPACT};
+	for (size_t version = 0; version < (sizeof(versions) / sizeof(*versions)); version++) {
+		for (size_t policy = 0; policy < (sizeof(policies) / sizeof(*policies)); policy++) {
+			if ((versions[version] == PROTOCOL_VERSION_PKCS7_PADDING) && (policies[policy] != MOLCH_PADDING_BLOCKS)) {
+				continue;
+			}
+
+			for (size_t i = 0; i < (sizeof(lengths) / sizeof(*lengths)); i++) {
+				buffer_create_with_existing_array(partial_message, long_message->content, lengths[i]);
+
+				buffer_destroy_from_heap_and_null_if_valid(packet);
+				buffer_destroy_from_heap_and_null_if_valid(decrypted_message);
+				status = packet_encrypt(&packet, NORMAL_MESSAGE, versions[version], policies[policy], header, header_key, partial_message, message_key, NULL, NULL, NULL, NULL);
+				throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+				if (packet->content_length != packet_get_encrypted_length(NORMAL_MESSAGE, versions[version], policies[policy], header->content_length, lengths[i])) {
+					throw(INCORRECT_BUFFER_SIZE, "Packet has an incorrect length.");
+				}
+
+				packet_view packet_struct;
+				status = packet_unpack(&packet_struct, packet);
+				throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+				if ((packet_struct.packet_header.current_protocol_version != versions[version])
+						|| (packet_struct.packet_header.highest_supported_protocol_version != HIGHEST_SUPPORTED_PROTOCOL_VERSION)) {
+					throw(INVALID_VALUE, "Packet has an incorrect protocol version.");
+				}
+				if (packet_struct.encrypted_message.length != (padded_lengths[policy][i] + crypto_secretbox_MACBYTES)) {
+					throw(INCORRECT_BUFFER_SIZE, "Message is padded incorrectly.");
+				}
+
+				status = packet_decrypt_message(&decrypted_message, packet, message_key);
+				throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
+				if (buffer_compare(partial_message, decrypted_message) != 0) {
+					throw(INVALID_VALUE, "Decrypted message doesn't match.");
+				}
+			}
+		}
+	}
+	printf("All padding policies work.\n");
 
 cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(long_message);
 	buffer_destroy_from_heap_and_null_if_valid(header_key);
 	buffer_destroy_from_heap_and_null_if_valid(message_key);
 	buffer_destroy_from_heap_and_null_if_valid(header);
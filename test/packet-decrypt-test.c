@@ -28,7 +28,6 @@
 #include "../lib/molch.h"
 #include "utils.h"
 #include "packet-test-lib.h"
-#include "tracing.h"
 
 int main(void) {
 
@@ -98,7 +97,7 @@ int main(void) {
 
 	if ((packet_type != extracted_packet_type)
 		|| (extracted_current_protocol_version != 0)
-		|| (extracted_highest_supported_protocol_version != 0)) {
+		|| (extracted_highest_supported_protocol_version != HIGHEST_SUPPORTED_PROTOCOL_VERSION)) {
 		throw(DATA_FETCH_ERROR, "Failed to retrieve metadata.");
 	}
 
@@ -176,7 +175,7 @@ int main(void) {
 
 	if ((packet_type != extracted_packet_type)
 			|| (extracted_current_protocol_version != 0)
-			|| (extracted_highest_supported_protocol_version != 0)) {
+			|| (extracted_highest_supported_protocol_version != HIGHEST_SUPPORTED_PROTOCOL_VERSION)) {
 		throw(DATA_FETCH_ERROR, "Failed to retrieve metadata.");
 	}
 
@@ -218,6 +217,139 @@ int main(void) {
 	}
 	printf("Extracted public prekey matches!\n");
 
+	//ENCRYPT INTO AN EXISTING BUFFER
+	printf("ENCRYPT INTO AN EXISTING BUFFER\n");
+	buffer_destroy_from_heap_and_null_if_valid(decrypted_header);
+	buffer_destroy_from_heap_and_null_if_valid(decrypted_message);
+	buffer_destroy_from_heap_and_null_if_valid(packet);
+
+	const size_t packet_length = packet_get_encrypted_length(NORMAL_MESSAGE, PROTOCOL_VERSION_PKCS7_PADDING, MOLCH_PADDING_BLOCKS, header->content_length, message->content_length);
+	packet = buffer_create_on_heap(packet_length, 0);
+	throw_on_failed_alloc(packet);
+
+	//too short
+	buffer_create_with_existing_array(too_short, packet->content, packet_length - 1);
+	status = packet_encrypt_into(too_short, NORMAL_MESSAGE, PROTOCOL_VERSION_PKCS7_PADDING, MOLCH_PADDING_BLOCKS, header, header_key, message, message_key, NULL, NULL, NULL, NULL);
+	if (status.status == SUCCESS) {
+		throw(INCORRECT_BUFFER_SIZE, "Encrypted into a buffer that is too short.");
+	}
+	return_status_destroy_errors(&status);
+
+	status = packet_encrypt_into(packet, NORMAL_MESSAGE, PROTOCOL_VERSION_PKCS7_PADDING, MOLCH_PADDING_BLOCKS, header, header_key, message, message_key, NULL, NULL, NULL, NULL);
+	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt into an existing buffer.");
+	if (packet->content_length != packet_length) {
+		throw(INCORRECT_BUFFER_SIZE, "Packet has an incorrect length.");
+	}
+
+	status = packet_decrypt(
+			&extracted_current_protocol_version,
+			&extracted_highest_supported_protocol_version,
+			&extracted_packet_type,
+			&decrypted_header,
+			&decrypted_message,
+			packet,
+			header_key,
+			message_key,
+			NULL,
+			NULL,
+			NULL);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt the packet.");
+	if ((extracted_packet_type != NORMAL_MESSAGE)
+			|| (buffer_compare(header, decrypted_header) != 0)
+			|| (buffer_compare(message, decrypted_message) != 0)) {
+		throw(INVALID_VALUE, "Packet encrypted into an existing buffer doesn't match.");
+	}
+	printf("Packet encrypted into an existing buffer matches.\n");
+
+	//COMPACT PACKETS
+	printf("COMPACT PACKETS\n");
+	buffer_destroy_from_heap_and_null_if_valid(decrypted_header);
+	buffer_destroy_from_heap_and_null_if_valid(decrypted_message);
+	buffer_destroy_from_heap_and_null_if_valid(packet);
+
+	status = packet_encrypt(
+			&packet,
+			PREKEY_MESSAGE,
+			PROTOCOL_VERSION_COMPACT,
+			MOLCH_PADDING_BUCKETS,
+			header,
+			header_key,
+			message,
+			message_key,
+			public_identity_key,
+			public_ephemeral_key,
+			public_prekey,
+			NULL);
+	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt compact packet.");
+	if (packet->content_length >= packet_get_encrypted_length(PREKEY_MESSAGE, PROTOCOL_VERSION_LENGTH_PREFIX, MOLCH_PADDING_BUCKETS, header->content_length, message->content_length)) {
+		throw(INCORRECT_BUFFER_SIZE, "Compact packet isn't smaller.");
+	}
+	printf("Compact packet (%zu Bytes):\n", packet->content_length);
+	print_hex(packet);
+	putchar('\n');
+
+	status = packet_decrypt(
+			&extracted_current_protocol_version,
+			&extracted_highest_supported_protocol_version,
+			&extracted_packet_type,
+			&decrypted_header,
+			&decrypted_message,
+			packet,
+			header_key,
+			message_key,
+			extracted_public_identity_key,
+			extracted_public_ephemeral_key,
+			extracted_public_prekey);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt compact packet.");
+	if ((extracted_current_protocol_version != PROTOCOL_VERSION_COMPACT)
+			|| (extracted_packet_type != PREKEY_MESSAGE)
+			|| (buffer_compare(header, decrypted_header) != 0)
+			|| (buffer_compare(message, decrypted_message) != 0)
+			|| (buffer_compare(public_identity_key, extracted_public_identity_key) != 0)
+			|| (buffer_compare(public_ephemeral_key, extracted_public_ephemeral_key) != 0)
+			|| (buffer_compare(public_prekey, extracted_public_prekey) != 0)) {
+		throw(INVALID_VALUE, "Decrypted compact packet doesn't match.");
+	}
+	printf("Decrypted compact packet matches.\n");
+
+	//the unencrypted metadata is authenticated with the header
+	buffer_destroy_from_heap_and_null_if_valid(decrypted_header);
+	packet->content[4] ^= 0x01; //public identity key
+	status = packet_decrypt_header(&decrypted_header, packet, header_key);
+	if (status.status == SUCCESS) {
+		throw(INVALID_VALUE, "Decrypted header of compact packet with manipulated metadata.");
+	}
+	return_status_destroy_errors(&status);
+	packet->content[4] ^= 0x01;
+	printf("Manipulated metadata detected.\n");
+
+	//the message can't be moved to another header
+	buffer_destroy_from_heap_and_null_if_valid(decrypted_message);
+	packet_view compact_packet_struct;
+	status = packet_unpack(&compact_packet_struct, packet);
+	throw_on_error(PROTOBUF_UNPACK_ERROR, "Failed to unpack compact packet.");
+	//the encrypted header starts with its MAC, which is the additional data of the message
+	const size_t header_mac_position = (size_t)(compact_packet_struct.encrypted_axolotl_header.data - packet->content);
+	packet->content[header_mac_position] ^= 0x01;
+	status = packet_decrypt_message(&decrypted_message, packet, message_key);
+	if (status.status == SUCCESS) {
+		throw(INVALID_VALUE, "Decrypted message of compact packet with manipulated header.");
+	}
+	return_status_destroy_errors(&status);
+	packet->content[header_mac_position] ^= 0x01;
+	status = packet_decrypt_message(&decrypted_message, packet, message_key);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt message of compact packet after restoring the header.");
+	printf("Manipulated header detected.\n");
+
+	//the padding has to be right for the protocol version
+	buffer_destroy_from_heap_and_null_if_valid(packet);
+	status = packet_encrypt(&packet, NORMAL_MESSAGE, PROTOCOL_VERSION_PKCS7_PADDING, MOLCH_PADDING_PADME, header, header_key, message, message_key, NULL, NULL, NULL, NULL);
+	if (status.status == SUCCESS) {
+		throw(INVALID_INPUT, "Encrypted with a padding policy the protocol version doesn't support.");
+	}
+	return_status_destroy_errors(&status);
+	status = return_status_init();
+
 cleanup:
 	buffer_destroy_from_heap_and_null_if_valid(header_key);
 	buffer_destroy_from_heap_and_null_if_valid(message_key);
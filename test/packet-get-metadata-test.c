@@ -28,7 +28,6 @@
 #include "../lib/constants.h"
 #include "utils.h"
 #include "packet-test-lib.h"
-#include "tracing.h"
 
 int main(void) {
 	//generate keys and message
@@ -98,7 +97,7 @@ int main(void) {
 	}
 	printf("Current protocol version matches!\n");
 
-	if (extracted_highest_supported_protocol_version != 0) {
+	if (extracted_highest_supported_protocol_version != HIGHEST_SUPPORTED_PROTOCOL_VERSION) {
 		throw(INVALID_VALUE, "Extracted highest supported protocol version doesn't match.");
 	}
 	printf("Highest supoorted protocol version matches (%i)!\n", extracted_highest_supported_protocol_version);
@@ -156,7 +155,7 @@ int main(void) {
 	}
 	printf("Current protocol version matches!\n");
 
-	if (extracted_highest_supported_protocol_version != 0) {
+	if (extracted_highest_supported_protocol_version != HIGHEST_SUPPORTED_PROTOCOL_VERSION) {
 		throw(INVALID_VALUE, "Extracted highest supported protocl version doesn't match.");
 	}
 	printf("Highest supoorted protocol version matches (%i)!\n", extracted_highest_supported_protocol_version);
@@ -27,7 +27,6 @@
 #include "../lib/constants.h"
 #include "utils.h"
 #include "packet-test-lib.h"
-#include "tracing.h"
 
 return_status create_and_print_message(
 		//output
@@ -81,13 +80,16 @@ return_status create_and_print_message(
 	status = packet_encrypt(
 			packet,
 			packet_type,
+			PROTOCOL_VERSION_PKCS7_PADDING,
+			MOLCH_PADDING_BLOCKS,
 			header,
 			header_key,
 			message,
 			message_key,
 			public_identity_key,
 			public_ephemeral_key,
-			public_prekey);
+			public_prekey,
+			NULL);
 	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message and header.");
 
 	//print encrypted packet
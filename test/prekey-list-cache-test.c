@@ -0,0 +1,214 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "../lib/prekey-list-cache.h"
+#include "utils.h"
+
+static return_status check_cache(void) {
+	return_status status = return_status_init();
+
+	unsigned char hashes[PREKEY_LIST_CACHE_SIZE + 1][PREKEY_LIST_CACHE_HASH_SIZE];
+	unsigned char list[100];
+	buffer_t *signing_key = NULL;
+	buffer_t *identity_key = NULL;
+	buffer_t *found_identity_key = NULL;
+
+	signing_key = buffer_create_on_heap(PUBLIC_MASTER_KEY_SIZE, PUBLIC_MASTER_KEY_SIZE);
+	throw_on_failed_alloc(signing_key);
+	identity_key = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	throw_on_failed_alloc(identity_key);
+	found_identity_key = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	throw_on_failed_alloc(found_identity_key);
+	if ((buffer_fill_random(signing_key, PUBLIC_MASTER_KEY_SIZE) != 0) || (buffer_fill_random(identity_key, PUBLIC_KEY_SIZE) != 0)) {
+		throw(GENERIC_ERROR, "Failed to create keys.");
+	}
+	randombytes_buf(list, sizeof(list));
+
+	//every list differs in one byte
+	for (size_t i = 0; i < (PREKEY_LIST_CACHE_SIZE + 1); i++) {
+		list[0] = (unsigned char)i;
+		if (prekey_list_cache_hash(hashes[i], signing_key, list, sizeof(list)) != 0) {
+			throw(GENERIC_ERROR, "Failed to hash prekey list.");
+		}
+	}
+
+	const time_t now = time(NULL);
+	prekey_list_cache_clear();
+	prekey_list_cache_add(hashes[0], identity_key, now + 60);
+	if (!prekey_list_cache_find(found_identity_key, hashes[0], now)
+			|| (buffer_compare(found_identity_key, identity_key) != 0)) {
+		throw(NOT_FOUND, "Prekey list wasn't found in the cache.");
+	}
+	if (prekey_list_cache_find(found_identity_key, hashes[1], now)) {
+		throw(INCORRECT_DATA, "Found prekey list that isn't in the cache.");
+	}
+	if (prekey_list_cache_find(found_identity_key, hashes[0], now + 61)) {
+		throw(INCORRECT_DATA, "Found expired prekey list.");
+	}
+	if (prekey_list_cache_find(found_identity_key, hashes[0], now)) {
+		throw(INCORRECT_DATA, "Expired prekey list is still in the cache.");
+	}
+
+	//fill the cache, the least recently used list is replaced
+	for (size_t i = 0; i < PREKEY_LIST_CACHE_SIZE; i++) {
+		prekey_list_cache_add(hashes[i], identity_key, now + 60);
+	}
+	if (!prekey_list_cache_find(found_identity_key, hashes[0], now)) {
+		throw(NOT_FOUND, "Prekey list wasn't found in a full cache.");
+	}
+	prekey_list_cache_add(hashes[PREKEY_LIST_CACHE_SIZE], identity_key, now + 60);
+	if (!prekey_list_cache_find(found_identity_key, hashes[0], now)
+			|| !prekey_list_cache_find(found_identity_key, hashes[PREKEY_LIST_CACHE_SIZE], now)) {
+		throw(NOT_FOUND, "Recently used prekey list was replaced.");
+	}
+	if (prekey_list_cache_find(found_identity_key, hashes[1], now)) {
+		throw(INCORRECT_DATA, "Least recently used prekey list wasn't replaced.");
+	}
+
+	prekey_list_cache_clear();
+	if (prekey_list_cache_find(found_identity_key, hashes[0], now)) {
+		throw(INCORRECT_DATA, "Cache wasn't cleared.");
+	}
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(signing_key);
+	buffer_destroy_from_heap_and_null_if_valid(identity_key);
+	buffer_destroy_from_heap_and_null_if_valid(found_identity_key);
+
+	return status;
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char alice_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char bob_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char conversation_id[CONVERSATION_ID_SIZE];
+
+	unsigned char *alice_prekeys = NULL;
+	size_t alice_prekeys_length = 0;
+	unsigned char *bob_prekeys = NULL;
+	size_t bob_prekeys_length = 0;
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+
+	status = check_cache();
+	throw_on_error(INCORRECT_DATA, "Prekey list cache check failed.");
+	printf("Prekey list cache works.\n");
+
+	status = molch_create_user(alice_public_identity, sizeof(alice_public_identity), &alice_prekeys, &alice_prekeys_length, backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	status = molch_create_user(bob_public_identity, sizeof(bob_public_identity), &bob_prekeys, &bob_prekeys_length, backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+
+	//the second time, the prekey list comes from the cache
+	buffer_create_from_string(message, "Hi Bob!");
+	for (size_t i = 0; i < 2; i++) {
+		status = molch_start_send_conversation(
+				conversation_id,
+				sizeof(conversation_id),
+				&packet,
+				&packet_length,
+				alice_public_identity,
+				sizeof(alice_public_identity),
+				bob_public_identity,
+				sizeof(bob_public_identity),
+				bob_prekeys,
+				bob_prekeys_length,
+				message->content,
+				message->content_length,
+				NULL,
+				NULL);
+		throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+		free_and_null_if_valid(packet);
+	}
+
+	//a modified list isn't found in the cache and fails the verification
+	bob_prekeys[bob_prekeys_length - 20] ^= 1;
+	return_status tampered_status = molch_start_send_conversation(
+			conversation_id,
+			sizeof(conversation_id),
+			&packet,
+			&packet_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			bob_prekeys,
+			bob_prekeys_length,
+			message->content,
+			message->content_length,
+			NULL,
+			NULL);
+	molch_destroy_return_status(&tampered_status);
+	if (tampered_status.status == SUCCESS) {
+		throw(INCORRECT_DATA, "Modified prekey list was accepted.");
+	}
+	bob_prekeys[bob_prekeys_length - 20] ^= 1;
+
+	//the same list with another master key isn't found either
+	tampered_status = molch_start_send_conversation(
+			conversation_id,
+			sizeof(conversation_id),
+			&packet,
+			&packet_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			bob_prekeys,
+			bob_prekeys_length,
+			message->content,
+			message->content_length,
+			NULL,
+			NULL);
+	molch_destroy_return_status(&tampered_status);
+	if (tampered_status.status == SUCCESS) {
+		throw(INCORRECT_DATA, "Prekey list was accepted for the wrong master key.");
+	}
+	printf("Modified prekey lists aren't accepted.\n");
+
+cleanup:
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(bob_prekeys);
+	free_and_null_if_valid(packet);
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
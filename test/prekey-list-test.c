@@ -0,0 +1,261 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "../lib/prekey-list.h"
+#include "../lib/endianness.h"
+#include "utils.h"
+
+#define LISTS 40
+#define UNSIGNED_LIST_SIZE (PUBLIC_KEY_SIZE + PREKEY_AMOUNT * PUBLIC_KEY_SIZE + sizeof(int64_t))
+#define LIST_SIZE (SIGNATURE_SIZE + UNSIGNED_LIST_SIZE)
+#define RECEIVERS 4
+
+/*
+ * Create signed prekey lists, every fifth one is valid, the others have
+ * a broken signature, the wrong signing key, are expired or were modified.
+ */
+static return_status create_lists(
+		unsigned char lists[LISTS][LIST_SIZE],
+		unsigned char signing_keys[LISTS][PUBLIC_MASTER_KEY_SIZE]) {
+	return_status status = return_status_init();
+
+	unsigned char unsigned_list[UNSIGNED_LIST_SIZE];
+	unsigned char private_signing_key[crypto_sign_SECRETKEYBYTES];
+
+	for (size_t i = 0; i < LISTS; i++) {
+		crypto_sign_keypair(signing_keys[i], private_signing_key);
+
+		randombytes_buf(unsigned_list, PUBLIC_KEY_SIZE + PREKEY_AMOUNT * PUBLIC_KEY_SIZE);
+		const time_t expiration_date = time(NULL) + (((i % 5) == 3) ? -3600 : 3600);
+		buffer_create_with_existing_array(big_endian_expiration_date, unsigned_list + PUBLIC_KEY_SIZE + PREKEY_AMOUNT * PUBLIC_KEY_SIZE, sizeof(int64_t));
+		status = endianness_time_to_big_endian(expiration_date, big_endian_expiration_date);
+		throw_on_error(CONVERSION_ERROR, "Failed to convert expiration date to big endian.");
+
+		unsigned long long list_length;
+		crypto_sign(lists[i], &list_length, unsigned_list, sizeof(unsigned_list), private_signing_key);
+
+		switch (i % 5) {
+			case 1:
+				lists[i][0] ^= 1;
+				break;
+			case 2:
+				signing_keys[i][0] ^= 1;
+				break;
+			case 4:
+				lists[i][SIGNATURE_SIZE + PUBLIC_KEY_SIZE + 7] ^= 1;
+				break;
+			default:
+				break;
+		}
+	}
+
+cleanup:
+	sodium_memzero(private_signing_key, sizeof(private_signing_key));
+
+	return status;
+}
+
+/*
+ * Compare the results of verify_prekey_lists with crypto_sign_open.
+ */
+static return_status check_lists(
+		unsigned char lists[LISTS][LIST_SIZE],
+		unsigned char signing_keys[LISTS][PUBLIC_MASTER_KEY_SIZE],
+		const size_t thread_count) {
+	return_status status = return_status_init();
+
+	return_status statuses[LISTS];
+	buffer_t signing_key_buffers[LISTS];
+	const buffer_t *signing_key_pointers[LISTS];
+	buffer_t identity_buffers[LISTS];
+	buffer_t *identity_pointers[LISTS];
+	unsigned char identities[LISTS][PUBLIC_KEY_SIZE];
+	const unsigned char *list_pointers[LISTS];
+	size_t list_lengths[LISTS];
+	unsigned char opened_list[LIST_SIZE];
+
+	for (size_t i = 0; i < LISTS; i++) {
+		buffer_init_with_pointer(&signing_key_buffers[i], signing_keys[i], PUBLIC_MASTER_KEY_SIZE, PUBLIC_MASTER_KEY_SIZE);
+		signing_key_pointers[i] = &signing_key_buffers[i];
+		buffer_init_with_pointer(&identity_buffers[i], identities[i], PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+		identity_pointers[i] = &identity_buffers[i];
+		list_pointers[i] = lists[i];
+		list_lengths[i] = LIST_SIZE;
+	}
+
+	verify_prekey_lists(statuses, identity_pointers, list_pointers, list_lengths, signing_key_pointers, LISTS, thread_count);
+
+	for (size_t i = 0; i < LISTS; i++) {
+		unsigned long long opened_length;
+		const bool signature_valid = (crypto_sign_open(opened_list, &opened_length, lists[i], LIST_SIZE, signing_keys[i]) == 0);
+		const bool valid = signature_valid && ((i % 5) != 3);
+		if (valid != (statuses[i].status == SUCCESS)) {
+			throw(INCORRECT_DATA, "Result of the batch doesn't match crypto_sign_open.");
+		}
+		if (valid && (sodium_memcmp(identities[i], opened_list, PUBLIC_KEY_SIZE) != 0)) {
+			throw(INCORRECT_DATA, "Wrong public identity key.");
+		}
+		if (!signature_valid && (statuses[i].status != VERIFICATION_FAILED)) {
+			throw(INCORRECT_DATA, "Broken signature wasn't detected.");
+		}
+		if (((i % 5) == 3) && (statuses[i].status != OUTDATED)) {
+			throw(INCORRECT_DATA, "Expired prekey list wasn't detected.");
+		}
+	}
+
+cleanup:
+	for (size_t i = 0; i < LISTS; i++) {
+		return_status_destroy_errors(&statuses[i]);
+	}
+
+	return status;
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	static unsigned char lists[LISTS][LIST_SIZE];
+	static unsigned char signing_keys[LISTS][PUBLIC_MASTER_KEY_SIZE];
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char alice_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char receiver_public_identities[RECEIVERS][PUBLIC_MASTER_KEY_SIZE];
+	unsigned char receiver_conversation[CONVERSATION_ID_SIZE];
+	molch_sent_conversation sent[RECEIVERS];
+	size_t sent_count = 0;
+
+	unsigned char *alice_prekeys = NULL;
+	size_t alice_prekeys_length = 0;
+	unsigned char *receiver_prekeys[RECEIVERS] = {NULL};
+	size_t receiver_prekey_lengths[RECEIVERS] = {0};
+	unsigned char *new_prekeys = NULL;
+	size_t new_prekeys_length = 0;
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+
+	status = create_lists(lists, signing_keys);
+	throw_on_error(CREATION_ERROR, "Failed to create prekey lists.");
+
+	//once on a single thread, once on several, the second time from the cache
+	status = check_lists(lists, signing_keys, 1);
+	throw_on_error(VERIFICATION_FAILED, "Failed to verify prekey lists on one thread.");
+	status = check_lists(lists, signing_keys, 4);
+	throw_on_error(VERIFICATION_FAILED, "Failed to verify prekey lists on several threads.");
+	printf("Verified %d prekey lists.\n", LISTS);
+
+	//start conversations with several receivers at once, one prekey list is broken
+	status = molch_create_user(alice_public_identity, sizeof(alice_public_identity), &alice_prekeys, &alice_prekeys_length, backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	const unsigned char *receiver_key_pointers[RECEIVERS];
+	const unsigned char *receiver_prekey_pointers[RECEIVERS];
+	for (size_t i = 0; i < RECEIVERS; i++) {
+		status = molch_create_user(receiver_public_identities[i], PUBLIC_MASTER_KEY_SIZE, &receiver_prekeys[i], &receiver_prekey_lengths[i], backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+		throw_on_error(CREATION_ERROR, "Failed to create receiver.");
+		receiver_key_pointers[i] = receiver_public_identities[i];
+		receiver_prekey_pointers[i] = receiver_prekeys[i];
+	}
+	const size_t broken = 2;
+	receiver_prekeys[broken][SIGNATURE_SIZE] ^= 1;
+
+	buffer_create_from_string(broadcast, "Hi everyone!");
+	status = molch_start_send_conversations(
+			sent,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			receiver_key_pointers,
+			receiver_prekey_pointers,
+			receiver_prekey_lengths,
+			RECEIVERS,
+			broadcast->content,
+			broadcast->content_length,
+			2,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start conversations with several receivers.");
+	sent_count = RECEIVERS;
+
+	for (size_t i = 0; i < RECEIVERS; i++) {
+		if (i == broken) {
+			if (sent[i].status.status != VERIFICATION_FAILED) {
+				throw(INCORRECT_DATA, "Broken prekey list was accepted.");
+			}
+			continue;
+		}
+		status = sent[i].status;
+		sent[i].status = return_status_init();
+		throw_on_error(CREATION_ERROR, "Failed to start a conversation of the batch.");
+
+		free_and_null_if_valid(new_prekeys);
+		status = molch_start_receive_conversation(
+				receiver_conversation,
+				sizeof(receiver_conversation),
+				&new_prekeys,
+				&new_prekeys_length,
+				&message,
+				&message_length,
+				receiver_public_identities[i],
+				PUBLIC_MASTER_KEY_SIZE,
+				alice_public_identity,
+				sizeof(alice_public_identity),
+				sent[i].packet,
+				sent[i].packet_length,
+				NULL,
+				NULL);
+		throw_on_error(CREATION_ERROR, "Failed to receive the broadcast.");
+		if ((message_length != broadcast->content_length) || (sodium_memcmp(message, broadcast->content, message_length) != 0)) {
+			throw(INCORRECT_DATA, "Received broadcast doesn't match.");
+		}
+		free_and_null_if_valid(message);
+	}
+	printf("Started conversations with %d receivers at once.\n", RECEIVERS - 1);
+
+cleanup:
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(new_prekeys);
+	free_and_null_if_valid(message);
+	for (size_t i = 0; i < RECEIVERS; i++) {
+		free_and_null_if_valid(receiver_prekeys[i]);
+	}
+	for (size_t i = 0; i < sent_count; i++) {
+		molch_destroy_return_status(&sent[i].status);
+		free_and_null_if_valid(sent[i].packet);
+	}
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
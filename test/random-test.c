@@ -0,0 +1,194 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+//needed for pthreads and fork with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sodium.h>
+
+#include "../lib/random.h"
+#include "../lib/constants.h"
+#include "utils.h"
+
+#define OUTPUT_SIZE 32
+
+static void *generate_thread(void *argument) {
+	random_bytes(argument, OUTPUT_SIZE);
+
+	return NULL;
+}
+
+/*
+ * Generate random bytes in the parent and in a child process after a fork.
+ */
+static return_status generate_after_fork(unsigned char * const parent_output, unsigned char * const child_output) {
+	return_status status = return_status_init();
+
+	int pipe_ends[2];
+	if (pipe(pipe_ends) != 0) {
+		throw(GENERIC_ERROR, "Failed to create pipe.");
+	}
+
+	const pid_t child = fork();
+	if (child == -1) {
+		close(pipe_ends[0]);
+		close(pipe_ends[1]);
+		throw(GENERIC_ERROR, "Failed to fork.");
+	}
+	if (child == 0) {
+		unsigned char output[OUTPUT_SIZE];
+		random_bytes(output, sizeof(output));
+		const bool written = (write(pipe_ends[1], output, sizeof(output)) == sizeof(output));
+		_exit(written ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	close(pipe_ends[1]);
+	random_bytes(parent_output, OUTPUT_SIZE);
+	const ssize_t received = read(pipe_ends[0], child_output, OUTPUT_SIZE);
+	close(pipe_ends[0]);
+
+	int child_status;
+	if ((waitpid(child, &child_status, 0) != child) || !WIFEXITED(child_status) || (WEXITSTATUS(child_status) != EXIT_SUCCESS)) {
+		throw(GENERIC_ERROR, "Child process failed.");
+	}
+	if (received != OUTPUT_SIZE) {
+		throw(GENERIC_ERROR, "Failed to receive output of the child process.");
+	}
+
+cleanup:
+	return status;
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	unsigned char *large = NULL;
+
+	static const molch_random_source sources[] = {MOLCH_RANDOM_BUFFERED, MOLCH_RANDOM_SYSTEM};
+	for (size_t source = 0; source < (sizeof(sources) / sizeof(*sources)); source++) {
+		random_set_source(sources[source]);
+		printf("Random source %zu\n", source);
+
+		//consecutive outputs differ, also across refills of the buffer
+		unsigned char first[OUTPUT_SIZE];
+		unsigned char second[OUTPUT_SIZE];
+		random_bytes(first, sizeof(first));
+		for (size_t i = 0; i < ((2 * RANDOM_BUFFER_SIZE) / OUTPUT_SIZE); i++) {
+			random_bytes(second, sizeof(second));
+			if (sodium_memcmp(first, second, sizeof(first)) == 0) {
+				throw(INCORRECT_DATA, "Random output repeated.");
+			}
+		}
+
+		//requests larger than the buffer
+		const size_t large_length = 3 * RANDOM_BUFFER_SIZE + 7;
+		free_and_null_if_valid(large);
+		large = calloc(1, large_length);
+		throw_on_failed_alloc(large);
+		random_bytes(large, large_length);
+		if (sodium_is_zero(large + large_length - OUTPUT_SIZE, OUTPUT_SIZE)) {
+			throw(INCORRECT_DATA, "Large request wasn't filled completely.");
+		}
+
+		//uniform numbers stay in range and hit every value
+		bool seen[10] = {false};
+		for (size_t i = 0; i < 1000; i++) {
+			const uint32_t number = random_uniform(10);
+			if (number >= 10) {
+				throw(INCORRECT_DATA, "Uniform number out of range.");
+			}
+			seen[number] = true;
+		}
+		for (size_t i = 0; i < 10; i++) {
+			if (!seen[i]) {
+				throw(INCORRECT_DATA, "Uniform numbers don't cover the range.");
+			}
+		}
+		if ((random_uniform(0) != 0) || (random_uniform(1) != 0)) {
+			throw(INCORRECT_DATA, "Uniform number with a bound below 2 isn't 0.");
+		}
+
+		//key pairs match
+		unsigned char public_key[PUBLIC_KEY_SIZE];
+		unsigned char private_key[PRIVATE_KEY_SIZE];
+		unsigned char derived_public_key[PUBLIC_KEY_SIZE];
+		if ((random_box_keypair(public_key, private_key) != 0)
+				|| (crypto_scalarmult_base(derived_public_key, private_key) != 0)
+				|| (sodium_memcmp(public_key, derived_public_key, sizeof(public_key)) != 0)) {
+			throw(KEYGENERATION_FAILED, "Box key pair doesn't match.");
+		}
+		unsigned char public_signing_key[PUBLIC_MASTER_KEY_SIZE];
+		unsigned char private_signing_key[PRIVATE_MASTER_KEY_SIZE];
+		unsigned char signed_message[SIGNATURE_SIZE + OUTPUT_SIZE];
+		if ((random_sign_keypair(public_signing_key, private_signing_key) != 0)
+				|| (crypto_sign(signed_message, NULL, first, sizeof(first), private_signing_key) != 0)
+				|| (crypto_sign_open(second, NULL, signed_message, sizeof(signed_message), public_signing_key) != 0)) {
+			throw(KEYGENERATION_FAILED, "Signing key pair doesn't match.");
+		}
+
+		//every thread has its own generator
+		unsigned char thread_outputs[2][OUTPUT_SIZE];
+		pthread_t threads[2];
+		for (size_t i = 0; i < 2; i++) {
+			if (pthread_create(&threads[i], NULL, generate_thread, thread_outputs[i]) != 0) {
+				throw(GENERIC_ERROR, "Failed to create thread.");
+			}
+		}
+		for (size_t i = 0; i < 2; i++) {
+			if (pthread_join(threads[i], NULL) != 0) {
+				throw(GENERIC_ERROR, "Failed to join thread.");
+			}
+		}
+		if (sodium_memcmp(thread_outputs[0], thread_outputs[1], OUTPUT_SIZE) == 0) {
+			throw(INCORRECT_DATA, "Threads got the same random output.");
+		}
+
+		//parent and child don't continue with the same output after a fork
+		status = generate_after_fork(first, second);
+		throw_on_error(GENERIC_ERROR, "Failed to generate random output after fork.");
+		if (sodium_memcmp(first, second, sizeof(first)) == 0) {
+			throw(INCORRECT_DATA, "Parent and child got the same random output after fork.");
+		}
+		printf("Random source %zu works.\n", source);
+	}
+
+cleanup:
+	free_and_null_if_valid(large);
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
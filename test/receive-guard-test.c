@@ -0,0 +1,210 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "utils.h"
+
+#define MESSAGES 4
+
+static uint64_t header_trials(void) {
+	molch_stats stats;
+	molch_get_stats(&stats);
+
+	return stats.header_trial_decryptions;
+}
+
+static return_status decrypt(const unsigned char * const conversation_id, const unsigned char * const packet, const size_t packet_length) {
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	uint32_t receive_message_number = 0;
+	uint32_t previous_receive_message_number = 0;
+
+	return_status status = molch_decrypt_message(
+			&message,
+			&message_length,
+			&receive_message_number,
+			&previous_receive_message_number,
+			conversation_id,
+			CONVERSATION_ID_SIZE,
+			packet,
+			packet_length,
+			NULL,
+			NULL);
+	free_and_null_if_valid(message);
+
+	return status;
+}
+
+/*
+ * Check that a packet is rejected without a single trial decryption.
+ */
+static return_status expect_rejection(const unsigned char * const conversation_id, const unsigned char * const packet, const size_t packet_length) {
+	return_status status = return_status_init();
+
+	const uint64_t trials = header_trials();
+	return_status rejected = decrypt(conversation_id, packet, packet_length);
+	return_status_destroy_errors(&rejected);
+	if (rejected.status == SUCCESS) {
+		throw(INCORRECT_DATA, "Packet wasn't rejected.");
+	}
+	if (header_trials() != trials) {
+		throw(INCORRECT_DATA, "Packet was rejected after trial decryption.");
+	}
+
+cleanup:
+	return status;
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char alice_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char bob_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+	unsigned char *alice_prekeys = NULL;
+	size_t alice_prekeys_length = 0;
+	unsigned char *bob_prekeys = NULL;
+	size_t bob_prekeys_length = 0;
+	unsigned char *prekey_packet = NULL;
+	size_t prekey_packet_length = 0;
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	unsigned char *packets[MESSAGES] = {NULL};
+	size_t packet_lengths[MESSAGES] = {0};
+
+	molch_enable_stats(true);
+
+	status = molch_create_user(alice_public_identity, sizeof(alice_public_identity), &alice_prekeys, &alice_prekeys_length, backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	status = molch_create_user(bob_public_identity, sizeof(bob_public_identity), &bob_prekeys, &bob_prekeys_length, backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+
+	buffer_create_from_string(first_message, "Hi Bob!");
+	status = molch_start_send_conversation(
+			alice_conversation,
+			sizeof(alice_conversation),
+			&prekey_packet,
+			&prekey_packet_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			bob_prekeys,
+			bob_prekeys_length,
+			first_message->content,
+			first_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+
+	free_and_null_if_valid(bob_prekeys);
+	status = molch_start_receive_conversation(
+			bob_conversation,
+			sizeof(bob_conversation),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			&message,
+			&message_length,
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			prekey_packet,
+			prekey_packet_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start receive conversation.");
+
+	buffer_create_from_string(reply, "Hi Alice!");
+	for (size_t i = 0; i < MESSAGES; i++) {
+		status = molch_encrypt_message(&packets[i], &packet_lengths[i], bob_conversation, sizeof(bob_conversation), reply->content, reply->content_length, NULL, NULL);
+		throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+	}
+
+	//a replayed packet
+	status = decrypt(alice_conversation, packets[0], packet_lengths[0]);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
+	status = expect_rejection(alice_conversation, packets[0], packet_lengths[0]);
+	throw_on_error(INCORRECT_DATA, "Replayed packet wasn't rejected early.");
+	printf("Rejected replayed packet.\n");
+
+	//garbage
+	unsigned char garbage[200];
+	memset(garbage, 0xff, sizeof(garbage));
+	status = expect_rejection(alice_conversation, garbage, sizeof(garbage));
+	throw_on_error(INCORRECT_DATA, "Garbage wasn't rejected early.");
+	printf("Rejected garbage.\n");
+
+	//a budget of one trial per minute
+	status = molch_conversation_set_trial_budget(alice_conversation, sizeof(alice_conversation), 1, 60000);
+	throw_on_error(DATA_SET_ERROR, "Failed to set the budget.");
+	status = decrypt(alice_conversation, packets[1], packet_lengths[1]);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt message within the budget.");
+	status = expect_rejection(alice_conversation, packets[2], packet_lengths[2]);
+	throw_on_error(INCORRECT_DATA, "Packet over the budget wasn't rejected.");
+	printf("Rejected packet over the budget.\n");
+
+	//without the budget, the packet can still be decrypted
+	status = molch_conversation_set_trial_budget(alice_conversation, sizeof(alice_conversation), 0, 0);
+	throw_on_error(DATA_SET_ERROR, "Failed to remove the budget.");
+	for (size_t i = 2; i < MESSAGES; i++) {
+		status = decrypt(alice_conversation, packets[i], packet_lengths[i]);
+		throw_on_error(DECRYPT_ERROR, "Failed to decrypt message after removing the budget.");
+	}
+
+	status = molch_conversation_set_trial_budget(alice_conversation, sizeof(alice_conversation), 1, 0);
+	if (status.status == SUCCESS) {
+		throw(INCORRECT_DATA, "Accepted a budget without a time window.");
+	}
+	return_status_destroy_errors(&status);
+	status = return_status_init();
+
+cleanup:
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(bob_prekeys);
+	free_and_null_if_valid(prekey_packet);
+	free_and_null_if_valid(message);
+	for (size_t i = 0; i < MESSAGES; i++) {
+		free_and_null_if_valid(packets[i]);
+	}
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
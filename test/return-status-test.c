@@ -19,13 +19,17 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "../lib/return-status.h"
+#include "../lib/stats.h"
 #include "utils.h"
-#include "tracing.h"
 
 return_status second_level() {
 	return_status status = return_status_init();
@@ -46,6 +50,67 @@ cleanup:
 	return status;
 }
 
+static void *destroy_in_thread(void *argument) {
+	return_status_destroy_errors((return_status*)argument);
+
+	return NULL;
+}
+
+/*
+ * Error messages come from the pool of the thread and only go
+ * to the heap when the pool is exhausted.
+ */
+static return_status check_pool() {
+	return_status status = return_status_init();
+
+	return_status statuses[RETURN_STATUS_POOL_SIZE + 1];
+	size_t created = 0;
+
+	molch_stats stats;
+	stats_enable(true);
+	stats_reset();
+
+	for (size_t i = 0; i < 10; i++) {
+		return_status failed = first_level();
+		return_status_destroy_errors(&failed);
+	}
+	stats_get(&stats);
+	if (stats.allocations[MOLCH_STATS_ERRORS].count != 0) {
+		throw(INCORRECT_DATA, "Error messages were allocated on the heap.");
+	}
+
+	//two messages per status, so the pool runs out
+	for (; created < (RETURN_STATUS_POOL_SIZE / 2 + 1); created++) {
+		statuses[created] = first_level();
+	}
+	stats_get(&stats);
+	if (stats.allocations[MOLCH_STATS_ERRORS].count != 2) {
+		throw(INCORRECT_DATA, "Exhausted pool didn't fall back to the heap.");
+	}
+
+	//messages can be put back from another thread
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, destroy_in_thread, &statuses[0]) != 0) {
+		throw(GENERIC_ERROR, "Failed to create thread.");
+	}
+	if (pthread_join(thread, NULL) != 0) {
+		throw(GENERIC_ERROR, "Failed to join thread.");
+	}
+	statuses[0] = first_level();
+	stats_get(&stats);
+	if (stats.allocations[MOLCH_STATS_ERRORS].count != 2) {
+		throw(INCORRECT_DATA, "Messages destroyed in another thread weren't reused.");
+	}
+
+cleanup:
+	for (size_t i = 0; i < created; i++) {
+		return_status_destroy_errors(&statuses[i]);
+	}
+	stats_enable(false);
+
+	return status;
+}
+
 int main(void) {
 	return_status status = return_status_init();
 
@@ -99,6 +164,9 @@ int main(void) {
 		throw(INCORRECT_DATA, "molch_print_status produces incorrect output.");
 	}
 
+	status = check_pool();
+	throw_on_error(GENERIC_ERROR, "Failed to check the pool of error messages.");
+
 cleanup:
 	on_error {
 		print_errors(&status);
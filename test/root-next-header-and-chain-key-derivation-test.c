@@ -27,7 +27,6 @@
 #include "../lib/constants.h"
 #include "utils.h"
 #include "common.h"
-#include "tracing.h"
 
 int main(void) {
 	if (sodium_init() == -1) {
@@ -0,0 +1,458 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "../lib/routing.h"
+#include "../lib/conversation.h"
+#include "utils.h"
+
+#define TABLE_TAGS 1000
+#define REPLIES 4
+#define LATE_MESSAGES (REPLIES + ROUTING_WINDOW + 1)
+#define SEND_ONLY_CONVERSATIONS 200
+
+/*
+ * Fill the table with tags that partly share their position in the
+ * table, remove half of them and check that the rest can still be found.
+ */
+static return_status check_table(void) {
+	return_status status = return_status_init();
+
+	static unsigned char conversations[TABLE_TAGS]; //only the addresses are used
+	unsigned char tags[TABLE_TAGS][ROUTING_TAG_SIZE];
+	routing_table table[1];
+	routing_table_init(table);
+
+	for (size_t i = 0; i < TABLE_TAGS; i++) {
+		randombytes_buf(tags[i], sizeof(tags[i]));
+		if ((i % 2) == 0) {
+			memset(tags[i], 0, 2); //collide
+		}
+	}
+
+	for (size_t i = 0; i < TABLE_TAGS; i++) {
+		if (routing_table_reserve(table, 1) != 0) {
+			throw(ALLOCATION_FAILED, "Failed to grow the routing table.");
+		}
+		routing_table_add(table, tags[i], (struct conversation_t*)&conversations[i]);
+	}
+	//the same tag for another conversation
+	if (routing_table_reserve(table, 1) != 0) {
+		throw(ALLOCATION_FAILED, "Failed to grow the routing table.");
+	}
+	routing_table_add(table, tags[0], (struct conversation_t*)&conversations[1]);
+
+	for (size_t i = 0; i < TABLE_TAGS; i += 3) {
+		routing_table_remove(table, tags[i], (struct conversation_t*)&conversations[i]);
+	}
+
+	for (size_t i = 1; i < TABLE_TAGS; i++) {
+		const struct conversation_t * const expected = ((i % 3) == 0) ? NULL : (struct conversation_t*)&conversations[i];
+		if (routing_table_find(table, tags[i]) != expected) {
+			throw(INCORRECT_DATA, "Wrong conversation for a routing tag.");
+		}
+	}
+	if (routing_table_find(table, tags[0]) != (struct conversation_t*)&conversations[1]) {
+		throw(INCORRECT_DATA, "Duplicate tag was removed with the other conversation.");
+	}
+	if (table->count != (TABLE_TAGS + 1 - (TABLE_TAGS + 2) / 3)) {
+		throw(INCORRECT_DATA, "Wrong number of tags in the routing table.");
+	}
+
+cleanup:
+	routing_table_clear(table);
+
+	return status;
+}
+
+/*
+ * Start many conversations that haven't received anything yet. The
+ * receive chain without a header key mustn't add the same tags for all
+ * of them, every tag has to lead to its own conversation.
+ */
+static return_status check_send_only_conversations(void) {
+	return_status status = return_status_init();
+
+	routing_table table[1];
+	routing_table_init(table);
+	conversation_t *conversations[SEND_ONLY_CONVERSATIONS] = {NULL};
+	buffer_t *packet = NULL;
+	buffer_t *sender_public_identity = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	buffer_t *sender_private_identity = buffer_create_on_heap(PRIVATE_KEY_SIZE, PRIVATE_KEY_SIZE);
+	buffer_t *receiver_public_identity = buffer_create_on_heap(PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE);
+	buffer_t *receiver_prekey_list = buffer_create_on_heap(PREKEY_AMOUNT * PUBLIC_KEY_SIZE, PREKEY_AMOUNT * PUBLIC_KEY_SIZE);
+	throw_on_failed_alloc(sender_public_identity);
+	throw_on_failed_alloc(sender_private_identity);
+	throw_on_failed_alloc(receiver_public_identity);
+	throw_on_failed_alloc(receiver_prekey_list);
+
+	if (crypto_box_keypair(sender_public_identity->content, sender_private_identity->content) != 0) {
+		throw(KEYGENERATION_FAILED, "Failed to generate the sender's identity.");
+	}
+
+	buffer_create_from_string(message, "Hello?");
+	for (size_t i = 0; i < SEND_ONLY_CONVERSATIONS; i++) {
+		if ((buffer_fill_random(receiver_public_identity, PUBLIC_KEY_SIZE) != 0)
+				|| (buffer_fill_random(receiver_prekey_list, receiver_prekey_list->content_length) != 0)) {
+			throw(KEYGENERATION_FAILED, "Failed to generate the receiver's keys.");
+		}
+		//bigger than any curve25519 public key, so the sender isn't Alice and has no receive header key
+		receiver_public_identity->content[PUBLIC_KEY_SIZE - 1] = 0xff;
+
+		status = conversation_start_send_conversation(
+				&conversations[i],
+				message,
+				&packet,
+				sender_public_identity,
+				sender_private_identity,
+				receiver_public_identity,
+				receiver_prekey_list);
+		throw_on_error(CREATION_ERROR, "Failed to start a send conversation.");
+		buffer_destroy_from_heap_and_null_if_valid(packet);
+
+		conversations[i]->routes = table;
+		status = conversation_update_routes(conversations[i]);
+		throw_on_error(DATA_SET_ERROR, "Failed to add the routing tags.");
+		if (conversations[i]->routing_tag_count == 0) {
+			throw(INCORRECT_DATA, "Conversation has no routing tags for its next receive chain.");
+		}
+	}
+
+	for (size_t i = 0; i < SEND_ONLY_CONVERSATIONS; i++) {
+		for (size_t j = 0; j < conversations[i]->routing_tag_count; j++) {
+			if (routing_table_find(table, conversations[i]->routing_tags + j * ROUTING_TAG_SIZE) != conversations[i]) {
+				throw(INCORRECT_DATA, "Routing tag is shared with another conversation.");
+			}
+		}
+	}
+
+cleanup:
+	for (size_t i = 0; i < SEND_ONLY_CONVERSATIONS; i++) {
+		if (conversations[i] != NULL) {
+			conversation_destroy(conversations[i]);
+		}
+	}
+	routing_table_clear(table);
+	buffer_destroy_from_heap_and_null_if_valid(packet);
+	buffer_destroy_from_heap_and_null_if_valid(sender_public_identity);
+	buffer_destroy_from_heap_and_null_if_valid(sender_private_identity);
+	buffer_destroy_from_heap_and_null_if_valid(receiver_public_identity);
+	buffer_destroy_from_heap_and_null_if_valid(receiver_prekey_list);
+
+	return status;
+}
+
+/*
+ * Decrypt a packet of one of the conversations of Alice and check that
+ * it was routed to the expected one.
+ */
+static return_status decrypt_any(
+		const unsigned char * const receiver,
+		const unsigned char * const expected_conversation,
+		const unsigned char * const packet,
+		const size_t packet_length) {
+	return_status status = return_status_init();
+
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	uint32_t receive_message_number = 0;
+	uint32_t previous_receive_message_number = 0;
+	unsigned char conversation[CONVERSATION_ID_SIZE];
+
+	status = molch_decrypt_message_any(
+			&message,
+			&message_length,
+			&receive_message_number,
+			&previous_receive_message_number,
+			conversation,
+			sizeof(conversation),
+			receiver,
+			PUBLIC_MASTER_KEY_SIZE,
+			packet,
+			packet_length,
+			NULL,
+			NULL);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt routed message.");
+
+	if (sodium_memcmp(conversation, expected_conversation, sizeof(conversation)) != 0) {
+		throw(INCORRECT_DATA, "Packet was routed to the wrong conversation.");
+	}
+
+cleanup:
+	free_and_null_if_valid(message);
+
+	return status;
+}
+
+static return_status expect_not_found(
+		const unsigned char * const receiver,
+		const unsigned char * const packet,
+		const size_t packet_length) {
+	return_status status = return_status_init();
+
+	unsigned char conversation[CONVERSATION_ID_SIZE];
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	uint32_t receive_message_number = 0;
+	uint32_t previous_receive_message_number = 0;
+	return_status routed = molch_decrypt_message_any(
+			&message,
+			&message_length,
+			&receive_message_number,
+			&previous_receive_message_number,
+			conversation,
+			sizeof(conversation),
+			receiver,
+			PUBLIC_MASTER_KEY_SIZE,
+			packet,
+			packet_length,
+			NULL,
+			NULL);
+	free_and_null_if_valid(message);
+	return_status_destroy_errors(&routed);
+	if (routed.status != NOT_FOUND) {
+		throw(INCORRECT_DATA, "Packet outside of the routing window was routed.");
+	}
+
+cleanup:
+	return status;
+}
+
+static return_status decrypt(const unsigned char * const conversation_id, const unsigned char * const packet, const size_t packet_length) {
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	uint32_t receive_message_number = 0;
+	uint32_t previous_receive_message_number = 0;
+
+	return_status status = molch_decrypt_message(
+			&message,
+			&message_length,
+			&receive_message_number,
+			&previous_receive_message_number,
+			conversation_id,
+			CONVERSATION_ID_SIZE,
+			packet,
+			packet_length,
+			NULL,
+			NULL);
+	free_and_null_if_valid(message);
+
+	return status;
+}
+
+/*
+ * Alice starts a conversation, the receiver gets the prekey message.
+ */
+static return_status start_conversation(
+		unsigned char * const alice_conversation,
+		unsigned char * const receiver_conversation,
+		const unsigned char * const alice,
+		const unsigned char * const receiver,
+		unsigned char ** const receiver_prekeys,
+		size_t * const receiver_prekeys_length) {
+	return_status status = return_status_init();
+
+	unsigned char *prekey_packet = NULL;
+	size_t prekey_packet_length = 0;
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+
+	buffer_create_from_string(first_message, "Hi!");
+	status = molch_start_send_conversation(
+			alice_conversation,
+			CONVERSATION_ID_SIZE,
+			&prekey_packet,
+			&prekey_packet_length,
+			alice,
+			PUBLIC_MASTER_KEY_SIZE,
+			receiver,
+			PUBLIC_MASTER_KEY_SIZE,
+			*receiver_prekeys,
+			*receiver_prekeys_length,
+			first_message->content,
+			first_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+
+	free_and_null_if_valid(*receiver_prekeys);
+	status = molch_start_receive_conversation(
+			receiver_conversation,
+			CONVERSATION_ID_SIZE,
+			receiver_prekeys,
+			receiver_prekeys_length,
+			&message,
+			&message_length,
+			receiver,
+			PUBLIC_MASTER_KEY_SIZE,
+			alice,
+			PUBLIC_MASTER_KEY_SIZE,
+			prekey_packet,
+			prekey_packet_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start receive conversation.");
+
+cleanup:
+	free_and_null_if_valid(prekey_packet);
+	free_and_null_if_valid(message);
+
+	return status;
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	molch_enable_stats(true);
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char alice_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char bob_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char charlie_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char alice_bob_conversation[CONVERSATION_ID_SIZE];
+	unsigned char alice_charlie_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+	unsigned char charlie_conversation[CONVERSATION_ID_SIZE];
+
+	unsigned char *alice_prekeys = NULL;
+	size_t alice_prekeys_length = 0;
+	unsigned char *bob_prekeys = NULL;
+	size_t bob_prekeys_length = 0;
+	unsigned char *charlie_prekeys = NULL;
+	size_t charlie_prekeys_length = 0;
+	unsigned char *bob_packets[LATE_MESSAGES] = {NULL};
+	size_t bob_packet_lengths[LATE_MESSAGES] = {0};
+	unsigned char *charlie_packets[REPLIES] = {NULL};
+	size_t charlie_packet_lengths[REPLIES] = {0};
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+
+	status = check_table();
+	throw_on_error(INCORRECT_DATA, "Routing table check failed.");
+	printf("Routing table works.\n");
+
+	status = check_send_only_conversations();
+	throw_on_error(INCORRECT_DATA, "Routing tags of send only conversations failed.");
+	printf("Send only conversations don't share routing tags.\n");
+
+	status = molch_create_user(alice_public_identity, sizeof(alice_public_identity), &alice_prekeys, &alice_prekeys_length, backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+	status = molch_create_user(bob_public_identity, sizeof(bob_public_identity), &bob_prekeys, &bob_prekeys_length, backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+	status = molch_create_user(charlie_public_identity, sizeof(charlie_public_identity), &charlie_prekeys, &charlie_prekeys_length, backup_key, sizeof(backup_key), NULL, NULL, NULL, 0);
+	throw_on_error(CREATION_ERROR, "Failed to create Charlie.");
+
+	status = start_conversation(alice_bob_conversation, bob_conversation, alice_public_identity, bob_public_identity, &bob_prekeys, &bob_prekeys_length);
+	throw_on_error(CREATION_ERROR, "Failed to start the conversation with Bob.");
+	status = start_conversation(alice_charlie_conversation, charlie_conversation, alice_public_identity, charlie_public_identity, &charlie_prekeys, &charlie_prekeys_length);
+	throw_on_error(CREATION_ERROR, "Failed to start the conversation with Charlie.");
+
+	//both answer, Alice gets the packets interleaved and out of order
+	buffer_create_from_string(reply, "Hi Alice!");
+	for (size_t i = 0; i < LATE_MESSAGES; i++) {
+		status = molch_encrypt_message(&bob_packets[i], &bob_packet_lengths[i], bob_conversation, sizeof(bob_conversation), reply->content, reply->content_length, NULL, NULL);
+		throw_on_error(ENCRYPT_ERROR, "Failed to encrypt Bob's message.");
+	}
+	for (size_t i = 0; i < REPLIES; i++) {
+		status = molch_encrypt_message(&charlie_packets[i], &charlie_packet_lengths[i], charlie_conversation, sizeof(charlie_conversation), reply->content, reply->content_length, NULL, NULL);
+		throw_on_error(ENCRYPT_ERROR, "Failed to encrypt Charlie's message.");
+	}
+
+	static const size_t order[REPLIES] = {2, 0, 3, 1};
+	for (size_t i = 0; i < REPLIES; i++) {
+		status = decrypt_any(alice_public_identity, alice_charlie_conversation, charlie_packets[order[i]], charlie_packet_lengths[order[i]]);
+		throw_on_error(DECRYPT_ERROR, "Failed to route Charlie's message.");
+		status = decrypt_any(alice_public_identity, alice_bob_conversation, bob_packets[order[i]], bob_packet_lengths[order[i]]);
+		throw_on_error(DECRYPT_ERROR, "Failed to route Bob's message.");
+	}
+	printf("Routed interleaved packets of two conversations.\n");
+
+	//too far ahead of the next expected message
+	const size_t last = LATE_MESSAGES - 1;
+	status = expect_not_found(alice_public_identity, bob_packets[last], bob_packet_lengths[last]);
+	throw_on_error(INCORRECT_DATA, "Packet too far ahead.");
+	status = decrypt(alice_bob_conversation, bob_packets[last], bob_packet_lengths[last]);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt unroutable packet by conversation id.");
+
+	//skipped messages shortly before the next expected one are still routed, older ones aren't
+	status = decrypt_any(alice_public_identity, alice_bob_conversation, bob_packets[last - 1], bob_packet_lengths[last - 1]);
+	throw_on_error(DECRYPT_ERROR, "Failed to route skipped message.");
+	status = expect_not_found(alice_public_identity, bob_packets[REPLIES], bob_packet_lengths[REPLIES]);
+	throw_on_error(INCORRECT_DATA, "Old skipped packet.");
+	status = decrypt(alice_bob_conversation, bob_packets[REPLIES], bob_packet_lengths[REPLIES]);
+	throw_on_error(DECRYPT_ERROR, "Failed to decrypt old skipped packet by conversation id.");
+	printf("Packets outside of the routing window weren't routed.\n");
+
+	//after Alice answers, Bob's next packet is in a new chain
+	buffer_create_from_string(answer, "How are you?");
+	status = molch_encrypt_message(&packet, &packet_length, alice_bob_conversation, sizeof(alice_bob_conversation), answer->content, answer->content_length, NULL, NULL);
+	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt Alice's answer.");
+	status = decrypt_any(bob_public_identity, bob_conversation, packet, packet_length);
+	throw_on_error(DECRYPT_ERROR, "Failed to route Alice's answer.");
+	free_and_null_if_valid(packet);
+	status = molch_encrypt_message(&packet, &packet_length, bob_conversation, sizeof(bob_conversation), reply->content, reply->content_length, NULL, NULL);
+	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt Bob's message in the new chain.");
+	status = decrypt_any(alice_public_identity, alice_bob_conversation, packet, packet_length);
+	throw_on_error(DECRYPT_ERROR, "Failed to route message of the next chain.");
+	printf("Routed packet of the next receive chain.\n");
+
+	//not a user
+	status = expect_not_found(backup_key, packet, packet_length);
+	throw_on_error(INCORRECT_DATA, "Routed packet of an unknown user.");
+
+	//routed decrypts are counted separately from the ones by conversation id
+	molch_stats stats;
+	molch_get_stats(&stats);
+	if ((stats.api[MOLCH_STATS_DECRYPT_MESSAGE].calls != 2) || (stats.api[MOLCH_STATS_DECRYPT_MESSAGE_ANY].calls != 14)) {
+		throw(INCORRECT_DATA, "Wrong number of decrypt calls in the stats.");
+	}
+
+cleanup:
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(bob_prekeys);
+	free_and_null_if_valid(charlie_prekeys);
+	for (size_t i = 0; i < LATE_MESSAGES; i++) {
+		free_and_null_if_valid(bob_packets[i]);
+	}
+	for (size_t i = 0; i < REPLIES; i++) {
+		free_and_null_if_valid(charlie_packets[i]);
+	}
+	free_and_null_if_valid(packet);
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
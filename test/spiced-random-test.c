@@ -25,7 +25,6 @@
 
 #include "../lib/spiced-random.h"
 #include "utils.h"
-#include "tracing.h"
 
 int main(void) {
 	if (sodium_init() == -1) {
@@ -47,7 +46,7 @@ int main(void) {
 	buffer_t *output2 = buffer_create_on_heap(42, 0);
 
 	//fill buffer with spiced random data
-	status = spiced_random(output1, spice, output1->buffer_length);
+	status = spiced_random(output1, spice, output1->buffer_length, MOLCH_SPICE_COST_INTERACTIVE);
 	throw_on_error(GENERIC_ERROR, "Failed to generate spiced random data.");
 
 	printf("Spiced random data 1 (%zu Bytes):\n", output1->content_length);
@@ -56,7 +55,7 @@ int main(void) {
 
 
 	//fill buffer with spiced random data
-	status = spiced_random(output2, spice, output2->buffer_length);
+	status = spiced_random(output2, spice, output2->buffer_length, MOLCH_SPICE_COST_INTERACTIVE);
 	throw_on_error(GENERIC_ERROR, "Failed to generate spiced random data.");
 
 	printf("Spiced random data 2 (%zu Bytes):\n", output2->content_length);
@@ -69,7 +68,7 @@ int main(void) {
 	}
 
 	//don't crash with output length 0
-	status = spiced_random(output1, spice, 0);
+	status = spiced_random(output1, spice, 0, MOLCH_SPICE_COST_INTERACTIVE);
 	throw_on_error(GENERIC_ERROR, "Failed to generate spiced random data of length 0.");
 
 cleanup:
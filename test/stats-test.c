@@ -0,0 +1,296 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sodium.h>
+
+#include "utils.h"
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+
+static unsigned char alice_public_identity[PUBLIC_MASTER_KEY_SIZE];
+
+/*
+ * Make a failing API call from another thread.
+ */
+static void *failing_call(void *argument __attribute__((unused))) {
+	unsigned char *prekey_list = NULL;
+	size_t prekey_list_length = 0;
+	return_status status = molch_get_prekey_list(
+			&prekey_list,
+			&prekey_list_length,
+			alice_public_identity,
+			sizeof(alice_public_identity) - 1);
+	return_status_destroy_errors(&status);
+
+	return NULL;
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char bob_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+	unsigned char *alice_prekeys = NULL;
+	size_t alice_prekeys_length = 0;
+	unsigned char *bob_prekeys = NULL;
+	size_t bob_prekeys_length = 0;
+
+	unsigned char *prekey_packet = NULL;
+	size_t prekey_packet_length = 0;
+	unsigned char *packets[3] = {NULL, NULL, NULL};
+	size_t packet_lengths[3] = {0, 0, 0};
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	unsigned char *backup = NULL;
+	size_t backup_length = 0;
+	char *printed_stats = NULL;
+
+	molch_stats stats;
+
+	molch_enable_stats(true);
+	molch_reset_stats();
+
+	//create the users
+	buffer_create_from_string(alice_head_on_keyboard, "asdfjkl;");
+	status = molch_create_user(
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			&alice_prekeys,
+			&alice_prekeys_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			alice_head_on_keyboard->content,
+			alice_head_on_keyboard->content_length);
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+
+	buffer_create_from_string(bob_head_on_keyboard, "qwertzuiop");
+	status = molch_create_user(
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			bob_head_on_keyboard->content,
+			bob_head_on_keyboard->content_length);
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+
+	//start the conversation
+	buffer_create_from_string(first_message, "Hi Bob!");
+	status = molch_start_send_conversation(
+			alice_conversation,
+			sizeof(alice_conversation),
+			&prekey_packet,
+			&prekey_packet_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			bob_prekeys,
+			bob_prekeys_length,
+			first_message->content,
+			first_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+
+	free_and_null_if_valid(bob_prekeys);
+	status = molch_start_receive_conversation(
+			bob_conversation,
+			sizeof(bob_conversation),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			&message,
+			&message_length,
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			prekey_packet,
+			prekey_packet_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start receive conversation.");
+	free_and_null_if_valid(message);
+
+	//Bob sends three messages, Alice receives the last one first and then the first one
+	buffer_create_from_string(reply, "Hi Alice!");
+	for (size_t i = 0; i < 3; i++) {
+		status = molch_encrypt_message(
+				&packets[i],
+				&packet_lengths[i],
+				bob_conversation,
+				sizeof(bob_conversation),
+				reply->content,
+				reply->content_length,
+				NULL,
+				NULL);
+		throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+	}
+
+	uint32_t receive_message_number = 0;
+	uint32_t previous_receive_message_number = 0;
+	const size_t order[2] = {2, 0};
+	for (size_t i = 0; i < 2; i++) {
+		status = molch_decrypt_message(
+				&message,
+				&message_length,
+				&receive_message_number,
+				&previous_receive_message_number,
+				alice_conversation,
+				sizeof(alice_conversation),
+				packets[order[i]],
+				packet_lengths[order[i]],
+				NULL,
+				NULL);
+		throw_on_error(DECRYPT_ERROR, "Failed to decrypt message.");
+		free_and_null_if_valid(message);
+	}
+
+	status = molch_export(&backup, &backup_length);
+	throw_on_error(EXPORT_ERROR, "Failed to export.");
+
+	//fail from another thread
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, failing_call, NULL) != 0) {
+		throw(GENERIC_ERROR, "Failed to create thread.");
+	}
+	if (pthread_join(thread, NULL) != 0) {
+		throw(GENERIC_ERROR, "Failed to join thread.");
+	}
+
+	molch_get_stats(&stats);
+
+	printed_stats = molch_print_stats(NULL, &stats, MOLCH_STATS_TEXT);
+	if (printed_stats == NULL) {
+		throw(GENERIC_ERROR, "Failed to print statistics as text.");
+	}
+	printf("%s\n", printed_stats);
+	free_and_null_if_valid(printed_stats);
+
+	size_t printed_stats_length = 0;
+	printed_stats = molch_print_stats(&printed_stats_length, &stats, MOLCH_STATS_JSON);
+	if ((printed_stats == NULL) || (printed_stats_length != strlen(printed_stats)) || (printed_stats[0] != '{')) {
+		throw(GENERIC_ERROR, "Failed to print statistics as JSON.");
+	}
+	printf("%s\n", printed_stats);
+	free_and_null_if_valid(printed_stats);
+
+	//check the counters
+	if ((stats.api[MOLCH_STATS_CREATE_USER].calls != 2)
+			|| (stats.api[MOLCH_STATS_START_SEND_CONVERSATION].calls != 1)
+			|| (stats.api[MOLCH_STATS_START_RECEIVE_CONVERSATION].calls != 1)
+			|| (stats.api[MOLCH_STATS_ENCRYPT_MESSAGE].calls != 3)
+			|| (stats.api[MOLCH_STATS_DECRYPT_MESSAGE].calls != 2)
+			|| (stats.api[MOLCH_STATS_DECRYPT_MESSAGE].errors != 0)
+			|| (stats.api[MOLCH_STATS_DECRYPT_MESSAGE].latency.count != 2)
+			|| (stats.api[MOLCH_STATS_EXPORT].calls != 1)) {
+		throw(INCORRECT_DATA, "Incorrect API call counts.");
+	}
+	if ((stats.api[MOLCH_STATS_GET_PREKEY_LIST].calls != 1)
+			|| (stats.api[MOLCH_STATS_GET_PREKEY_LIST].errors != 1)) {
+		throw(INCORRECT_DATA, "Call from another thread wasn't counted.");
+	}
+	if ((stats.skipped_keys != 1) || (stats.skipped_keys_peak != 2)) {
+		throw(INCORRECT_DATA, "Incorrect number of skipped keys.");
+	}
+	if ((stats.header_trial_decryptions < 3) || (stats.header_trial_decryption_failures >= stats.header_trial_decryptions)) {
+		throw(INCORRECT_DATA, "Incorrect number of header trial decryptions.");
+	}
+	if (stats.prekey_deprecations != 1) {
+		throw(INCORRECT_DATA, "Incorrect number of prekey deprecations.");
+	}
+	if ((stats.allocations[MOLCH_STATS_CONVERSATIONS].count != 2)
+			|| (stats.allocations[MOLCH_STATS_RATCHETS].count != 2)
+			|| (stats.allocations[MOLCH_STATS_BACKUPS].count != 1)
+			|| (stats.allocations[MOLCH_STATS_BACKUPS].bytes != backup_length)) {
+		throw(INCORRECT_DATA, "Incorrect allocation counts.");
+	}
+	if ((stats.export_sizes.count != 1) || (stats.export_sizes.sum != backup_length)) {
+		throw(INCORRECT_DATA, "Incorrect export sizes.");
+	}
+
+	//reset
+	molch_reset_stats();
+	molch_get_stats(&stats);
+	if ((stats.api[MOLCH_STATS_ENCRYPT_MESSAGE].calls != 0)
+			|| (stats.allocations[MOLCH_STATS_CONVERSATIONS].count != 0)
+			|| (stats.export_sizes.count != 0)
+			|| (stats.skipped_keys != 1)
+			|| (stats.skipped_keys_peak != 1)) {
+		throw(INCORRECT_DATA, "Statistics weren't reset.");
+	}
+
+	//nothing is counted while disabled
+	molch_enable_stats(false);
+	free_and_null_if_valid(packets[0]);
+	status = molch_encrypt_message(
+			&packets[0],
+			&packet_lengths[0],
+			bob_conversation,
+			sizeof(bob_conversation),
+			reply->content,
+			reply->content_length,
+			NULL,
+			NULL);
+	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+	molch_get_stats(&stats);
+	if (stats.api[MOLCH_STATS_ENCRYPT_MESSAGE].calls != 0) {
+		throw(INCORRECT_DATA, "Counted while disabled.");
+	}
+
+cleanup:
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(bob_prekeys);
+	free_and_null_if_valid(prekey_packet);
+	for (size_t i = 0; i < 3; i++) {
+		free_and_null_if_valid(packets[i]);
+	}
+	free_and_null_if_valid(message);
+	free_and_null_if_valid(backup);
+	free_and_null_if_valid(printed_stats);
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
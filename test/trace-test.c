@@ -0,0 +1,149 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+//needed for pthreads with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/key-derivation.h"
+#include "utils.h"
+
+#define DERIVATIONS 10
+
+static return_status derive_chain(void) {
+	return_status status = return_status_init();
+
+	buffer_t *chain_key = NULL;
+	buffer_t *next_chain_key = NULL;
+
+	chain_key = buffer_create_on_heap(crypto_auth_BYTES, crypto_auth_BYTES);
+	throw_on_failed_alloc(chain_key);
+	next_chain_key = buffer_create_on_heap(crypto_auth_BYTES, crypto_auth_BYTES);
+	throw_on_failed_alloc(next_chain_key);
+	if (buffer_fill_random(chain_key, chain_key->buffer_length) != 0) {
+		throw(KEYGENERATION_FAILED, "Failed to create chain key.");
+	}
+
+	for (size_t i = 0; i < DERIVATIONS; i++) {
+		status = derive_chain_key(next_chain_key, chain_key);
+		throw_on_error(KEYDERIVATION_FAILED, "Failed to derive chain key.");
+		if (buffer_clone(chain_key, next_chain_key) != 0) {
+			throw(BUFFER_ERROR, "Failed to copy chain key.");
+		}
+	}
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(chain_key);
+	buffer_destroy_from_heap_and_null_if_valid(next_chain_key);
+
+	return status;
+}
+
+static void *derive_chain_thread(void *argument) {
+	*((return_status*)argument) = derive_chain();
+
+	return NULL;
+}
+
+static size_t count_occurrences(const char * const string, const char * const substring) {
+	size_t count = 0;
+	for (const char *position = strstr(string, substring); position != NULL; position = strstr(position + 1, substring)) {
+		count++;
+	}
+
+	return count;
+}
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+	return_status thread_status = return_status_init();
+
+	char *trace = NULL;
+	size_t trace_length = 0;
+
+	//not recorded, tracing isn't started yet
+	status = derive_chain();
+	throw_on_error(KEYDERIVATION_FAILED, "Failed to derive chain keys.");
+
+	molch_start_tracing();
+
+	status = derive_chain();
+	throw_on_error(KEYDERIVATION_FAILED, "Failed to derive chain keys.");
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, derive_chain_thread, &thread_status) != 0) {
+		throw(GENERIC_ERROR, "Failed to create thread.");
+	}
+	if (pthread_join(thread, NULL) != 0) {
+		throw(GENERIC_ERROR, "Failed to join thread.");
+	}
+	status = thread_status;
+	throw_on_error(KEYDERIVATION_FAILED, "Failed to derive chain keys in another thread.");
+
+	molch_stop_tracing();
+
+	//not recorded, tracing is stopped
+	status = derive_chain();
+	throw_on_error(KEYDERIVATION_FAILED, "Failed to derive chain keys.");
+
+	trace = molch_print_trace(&trace_length);
+	if ((trace == NULL) || (trace_length != strlen(trace))) {
+		throw(GENERIC_ERROR, "Failed to print the trace.");
+	}
+	printf("%s", trace);
+
+	if (count_occurrences(trace, "\"name\":\"derive_key\"") != (2 * DERIVATIONS)) {
+		throw(INCORRECT_DATA, "Wrong number of events in the trace.");
+	}
+	if ((count_occurrences(trace, "\"tid\":") != (2 * DERIVATIONS))
+			|| (strstr(trace, "\"traceEvents\":[") == NULL)) {
+		throw(INCORRECT_DATA, "Malformed trace.");
+	}
+
+	//a new start drops the old events
+	molch_start_tracing();
+	molch_stop_tracing();
+	free_and_null_if_valid(trace);
+	trace = molch_print_trace(&trace_length);
+	if ((trace == NULL) || (count_occurrences(trace, "\"name\":") != 0)) {
+		throw(INCORRECT_DATA, "Old events are still in the trace.");
+	}
+
+cleanup:
+	free_and_null_if_valid(trace);
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
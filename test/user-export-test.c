@@ -0,0 +1,214 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+
+#include "../lib/molch.h"
+#include "../lib/constants.h"
+#include "utils.h"
+
+int main(void) {
+	if (sodium_init() == -1) {
+		return -1;
+	}
+
+	return_status status = return_status_init();
+
+	molch_enable_stats(true);
+
+	unsigned char backup_key[BACKUP_KEY_SIZE];
+	unsigned char alice_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char bob_public_identity[PUBLIC_MASTER_KEY_SIZE];
+	unsigned char alice_conversation[CONVERSATION_ID_SIZE];
+	unsigned char bob_conversation[CONVERSATION_ID_SIZE];
+
+	unsigned char *alice_prekeys = NULL;
+	size_t alice_prekeys_length = 0;
+	unsigned char *bob_prekeys = NULL;
+	size_t bob_prekeys_length = 0;
+	unsigned char *prekey_packet = NULL;
+	size_t prekey_packet_length = 0;
+	unsigned char *packet = NULL;
+	size_t packet_length = 0;
+	unsigned char *message = NULL;
+	size_t message_length = 0;
+	unsigned char *backup = NULL;
+	size_t backup_length = 0;
+
+	//create the users
+	status = molch_create_user(
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			&alice_prekeys,
+			&alice_prekeys_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			NULL,
+			0);
+	throw_on_error(CREATION_ERROR, "Failed to create Alice.");
+
+	status = molch_create_user(
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			backup_key,
+			sizeof(backup_key),
+			NULL,
+			NULL,
+			NULL,
+			0);
+	throw_on_error(CREATION_ERROR, "Failed to create Bob.");
+
+	//start a conversation, so Alice has some state
+	buffer_create_from_string(first_message, "Hi Bob!");
+	status = molch_start_send_conversation(
+			alice_conversation,
+			sizeof(alice_conversation),
+			&prekey_packet,
+			&prekey_packet_length,
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			bob_prekeys,
+			bob_prekeys_length,
+			first_message->content,
+			first_message->content_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start send conversation.");
+
+	free_and_null_if_valid(bob_prekeys);
+	status = molch_start_receive_conversation(
+			bob_conversation,
+			sizeof(bob_conversation),
+			&bob_prekeys,
+			&bob_prekeys_length,
+			&message,
+			&message_length,
+			bob_public_identity,
+			sizeof(bob_public_identity),
+			alice_public_identity,
+			sizeof(alice_public_identity),
+			prekey_packet,
+			prekey_packet_length,
+			NULL,
+			NULL);
+	throw_on_error(CREATION_ERROR, "Failed to start receive conversation.");
+	free_and_null_if_valid(message);
+
+	//export only Alice and remove her
+	status = molch_user_export(&backup, &backup_length, alice_public_identity, sizeof(alice_public_identity));
+	throw_on_error(EXPORT_ERROR, "Failed to export Alice.");
+
+	status = molch_destroy_user(alice_public_identity, sizeof(alice_public_identity), NULL, NULL);
+	throw_on_error(REMOVE_ERROR, "Failed to destroy Alice.");
+	if (molch_user_count() != 1) {
+		throw(INCORRECT_DATA, "Alice wasn't destroyed.");
+	}
+
+	//a user backup is no full backup
+	status = molch_import(backup_key, sizeof(backup_key), backup, backup_length, backup_key, sizeof(backup_key));
+	if (status.status == SUCCESS) {
+		throw(INCORRECT_DATA, "Imported a user backup as full backup.");
+	}
+	return_status_destroy_errors(&status);
+	status = return_status_init();
+
+	//bring Alice back
+	status = molch_user_import(backup_key, sizeof(backup_key), backup, backup_length, backup_key, sizeof(backup_key));
+	throw_on_error(IMPORT_ERROR, "Failed to import Alice.");
+	if (molch_user_count() != 2) {
+		throw(INCORRECT_DATA, "Alice wasn't imported.");
+	}
+	free_and_null_if_valid(backup);
+
+	//the conversation has been imported with her
+	buffer_create_from_string(reply, "Welcome back Alice!");
+	status = molch_encrypt_message(
+			&packet,
+			&packet_length,
+			bob_conversation,
+			sizeof(bob_conversation),
+			reply->content,
+			reply->content_length,
+			NULL,
+			NULL);
+	throw_on_error(ENCRYPT_ERROR, "Failed to encrypt message.");
+
+	uint32_t receive_message_number = 0;
+	uint32_t previous_receive_message_number = 0;
+	status = molch_decrypt_message(
+			&message,
+			&message_length,
+			&receive_message_number,
+			&previous_receive_message_number,
+			alice_conversation,
+			sizeof(alice_conversation),
+			packet,
+			packet_length,
+			NULL,
+			NULL);
+	throw_on_error(DECRYPT_ERROR, "Imported Alice failed to decrypt the message.");
+	if ((message_length != reply->content_length) || (sodium_memcmp(message, reply->content, message_length) != 0)) {
+		throw(INCORRECT_DATA, "Incorrect message received.");
+	}
+
+	//importing an existing user replaces it
+	status = molch_user_export(&backup, &backup_length, alice_public_identity, sizeof(alice_public_identity));
+	throw_on_error(EXPORT_ERROR, "Failed to export Alice again.");
+	status = molch_user_import(backup_key, sizeof(backup_key), backup, backup_length, backup_key, sizeof(backup_key));
+	throw_on_error(IMPORT_ERROR, "Failed to import Alice again.");
+	if (molch_user_count() != 2) {
+		throw(INCORRECT_DATA, "Alice was imported twice.");
+	}
+
+	//single users are counted separately from the whole library state
+	molch_stats stats;
+	molch_get_stats(&stats);
+	if ((stats.api[MOLCH_STATS_USER_EXPORT].calls != 2)
+			|| (stats.api[MOLCH_STATS_USER_IMPORT].calls != 2)
+			|| (stats.api[MOLCH_STATS_IMPORT].calls != 1)) {
+		throw(INCORRECT_DATA, "Wrong number of export and import calls in the stats.");
+	}
+
+cleanup:
+	free_and_null_if_valid(alice_prekeys);
+	free_and_null_if_valid(bob_prekeys);
+	free_and_null_if_valid(prekey_packet);
+	free_and_null_if_valid(packet);
+	free_and_null_if_valid(message);
+	free_and_null_if_valid(backup);
+	molch_destroy_all_users();
+
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
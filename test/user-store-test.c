@@ -28,14 +28,26 @@
 #include "../lib/user-store.h"
 #include "utils.h"
 #include "common.h"
-#include "tracing.h"
+
+/*
+ * Check if a user is in a user list, the order depends on the shards.
+ */
+static bool list_contains(const buffer_t * const list, const buffer_t * const public_signing_key) {
+	for (size_t offset = 0; (offset + PUBLIC_MASTER_KEY_SIZE) <= list->content_length; offset += PUBLIC_MASTER_KEY_SIZE) {
+		if (buffer_compare_partial(list, offset, public_signing_key, 0, PUBLIC_MASTER_KEY_SIZE) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
 
 return_status protobuf_export(
-		const user_store * const store,
+		user_store * const store,
 		buffer_t *** const export_buffers,
 		size_t * const buffer_count) __attribute__((warn_unused_result));
 return_status protobuf_export(
-		const user_store * const store,
+		user_store * const store,
 		buffer_t *** const export_buffers,
 		size_t * const buffer_count) {
 	return_status status = return_status_init();
@@ -244,8 +256,9 @@ int main(void) {
 	if (list == NULL) {
 		throw(INCORRECT_DATA, "Failed to list users, user list is NULL.");
 	}
-	if ((buffer_compare_partial(list, 0, alice_public_signing_key, 0, PUBLIC_MASTER_KEY_SIZE) != 0)
-			|| (buffer_compare_partial(list, PUBLIC_MASTER_KEY_SIZE, bob_public_signing_key, 0, PUBLIC_MASTER_KEY_SIZE) != 0)) {
+	if ((list->content_length != (2 * PUBLIC_MASTER_KEY_SIZE))
+			|| !list_contains(list, alice_public_signing_key)
+			|| !list_contains(list, bob_public_signing_key)) {
 		throw(INCORRECT_DATA, "Failed to list users.");
 	}
 	buffer_destroy_from_heap_and_null_if_valid(list);
@@ -272,9 +285,10 @@ int main(void) {
 	if (list == NULL) {
 		throw(INCORRECT_DATA, "Failed to list users, user list is NULL.");
 	}
-	if ((buffer_compare_partial(list, 0, alice_public_signing_key, 0, PUBLIC_MASTER_KEY_SIZE) != 0)
-			|| (buffer_compare_partial(list, PUBLIC_MASTER_KEY_SIZE, bob_public_signing_key, 0, PUBLIC_MASTER_KEY_SIZE) != 0)
-			|| (buffer_compare_partial(list, 2 * PUBLIC_MASTER_KEY_SIZE, charlie_public_signing_key, 0, PUBLIC_MASTER_KEY_SIZE) != 0)) {
+	if ((list->content_length != (3 * PUBLIC_MASTER_KEY_SIZE))
+			|| !list_contains(list, alice_public_signing_key)
+			|| !list_contains(list, bob_public_signing_key)
+			|| !list_contains(list, charlie_public_signing_key)) {
 		throw(INCORRECT_DATA, "Failed to list users.");
 	}
 	buffer_destroy_from_heap_and_null_if_valid(list);
@@ -305,8 +319,9 @@ int main(void) {
 	if (list == NULL) {
 		throw(INCORRECT_DATA, "Failed to list users, user list is NULL.");
 	}
-	if ((buffer_compare_partial(list, 0, alice_public_signing_key, 0, PUBLIC_MASTER_KEY_SIZE) != 0)
-			|| (buffer_compare_partial(list, PUBLIC_MASTER_KEY_SIZE, charlie_public_signing_key, 0, PUBLIC_MASTER_KEY_SIZE) != 0)) {
+	if ((list->content_length != (2 * PUBLIC_MASTER_KEY_SIZE))
+			|| !list_contains(list, alice_public_signing_key)
+			|| !list_contains(list, charlie_public_signing_key)) {
 		throw(INCORRECT_DATA, "Removing user failed.");
 	}
 	buffer_destroy_from_heap_and_null_if_valid(list);
@@ -379,8 +394,9 @@ int main(void) {
 	//check the user list
 	status = user_store_list(&list, store);
 	throw_on_error(DATA_FETCH_ERROR, "Failed to list users.");
-	if ((buffer_compare_partial(list, 0, alice_public_signing_key, 0, PUBLIC_MASTER_KEY_SIZE) != 0)
-			|| (buffer_compare_partial(list, PUBLIC_MASTER_KEY_SIZE, charlie_public_signing_key, 0, PUBLIC_MASTER_KEY_SIZE) != 0)) {
+	if ((list->content_length != (2 * PUBLIC_MASTER_KEY_SIZE))
+			|| !list_contains(list, alice_public_signing_key)
+			|| !list_contains(list, charlie_public_signing_key)) {
 		throw(REMOVE_ERROR, "Removing user failed.");
 	}
 	buffer_destroy_from_heap_and_null_if_valid(list);
@@ -393,11 +409,11 @@ int main(void) {
 		throw(INCORRECT_DATA, "User store has incorrect length.");
 		goto cleanup;
 	}
-	//check head and tail pointers
-	if ((store->head != NULL) || (store->tail != NULL)) {
-		throw(INCORRECT_DATA, "Clearing the user store didn't reset head and tail pointers.");
-		status_int = EXIT_FAILURE;
-		goto cleanup;
+	//check head and tail pointers of all shards
+	for (size_t i = 0; i < USER_STORE_SHARDS; i++) {
+		if ((store->shards[i].head != NULL) || (store->shards[i].tail != NULL) || (store->shards[i].length != 0)) {
+			throw(INCORRECT_DATA, "Clearing the user store didn't reset head and tail pointers.");
+		}
 	}
 	printf("Successfully cleared user store.\n");
 
@@ -0,0 +1,394 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2016 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Differential test of the hand written wire codec against Protobuf-C.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sodium.h>
+#include <packet.pb-c.h>
+#include <header.pb-c.h>
+
+#include "../lib/wire.h"
+#include "utils.h"
+
+#define ITERATIONS 1000
+#define MAX_FIELD_LENGTH 300
+
+/*
+ * Random bytes field, set in both the Protobuf-C struct and the view.
+ */
+static void random_bytes(
+		protobuf_c_boolean * const protobuf_has,
+		ProtobufCBinaryData * const protobuf_bytes,
+		bool * const view_has,
+		wire_bytes * const view_bytes,
+		unsigned char * const storage) {
+	*protobuf_has = *view_has = (randombytes_uniform(2) == 1);
+	const size_t length = randombytes_uniform(MAX_FIELD_LENGTH + 1);
+	randombytes_buf(storage, length);
+
+	protobuf_bytes->data = storage;
+	protobuf_bytes->len = length;
+	view_bytes->data = storage;
+	view_bytes->length = length;
+}
+
+//small numbers most of the time, but all varint lengths
+static uint32_t random_number(void) {
+	return randombytes_random() >> randombytes_uniform(32);
+}
+
+static void random_packet(
+		Packet * const protobuf_packet,
+		PacketHeader * const protobuf_header,
+		packet_view * const view,
+		unsigned char storage[7][MAX_FIELD_LENGTH]) {
+	packet__init(protobuf_packet);
+	packet_header__init(protobuf_header);
+	protobuf_packet->packet_header = protobuf_header;
+	wire_packet_init(view);
+
+	protobuf_header->current_protocol_version = view->packet_header.current_protocol_version = random_number();
+	protobuf_header->highest_supported_protocol_version = view->packet_header.highest_supported_protocol_version = random_number();
+
+	protobuf_header->has_packet_type = view->packet_header.has_packet_type = (randombytes_uniform(2) == 1);
+	//includes negative values, which are encoded with 10 bytes
+	const int32_t packet_types[] = {0, 1, (int32_t)randombytes_random()};
+	protobuf_header->packet_type = view->packet_header.packet_type = packet_types[randombytes_uniform(3)];
+
+	random_bytes(&protobuf_header->has_header_nonce, &protobuf_header->header_nonce, &view->packet_header.has_header_nonce, &view->packet_header.header_nonce, storage[0]);
+	random_bytes(&protobuf_header->has_message_nonce, &protobuf_header->message_nonce, &view->packet_header.has_message_nonce, &view->packet_header.message_nonce, storage[1]);
+	random_bytes(&protobuf_header->has_public_identity_key, &protobuf_header->public_identity_key, &view->packet_header.has_public_identity_key, &view->packet_header.public_identity_key, storage[2]);
+	random_bytes(&protobuf_header->has_public_ephemeral_key, &protobuf_header->public_ephemeral_key, &view->packet_header.has_public_ephemeral_key, &view->packet_header.public_ephemeral_key, storage[3]);
+	random_bytes(&protobuf_header->has_public_prekey, &protobuf_header->public_prekey, &view->packet_header.has_public_prekey, &view->packet_header.public_prekey, storage[4]);
+	random_bytes(&protobuf_packet->has_encrypted_axolotl_header, &protobuf_packet->encrypted_axolotl_header, &view->has_encrypted_axolotl_header, &view->encrypted_axolotl_header, storage[5]);
+	random_bytes(&protobuf_packet->has_encrypted_message, &protobuf_packet->encrypted_message, &view->has_encrypted_message, &view->encrypted_message, storage[6]);
+}
+
+static void random_header(Header * const protobuf_header, header_view * const view, unsigned char * const storage) {
+	header__init(protobuf_header);
+	wire_header_init(view);
+
+	random_bytes(&protobuf_header->has_public_ephemeral_key, &protobuf_header->public_ephemeral_key, &view->has_public_ephemeral_key, &view->public_ephemeral_key, storage);
+	protobuf_header->has_message_number = view->has_message_number = (randombytes_uniform(2) == 1);
+	protobuf_header->message_number = view->message_number = random_number();
+	protobuf_header->has_previous_message_number = view->has_previous_message_number = (randombytes_uniform(2) == 1);
+	protobuf_header->previous_message_number = view->previous_message_number = random_number();
+}
+
+/*
+ * Check that a bytes field of a view is the same as in the Protobuf-C struct
+ * and points into the input.
+ */
+static bool bytes_equal(
+		const protobuf_c_boolean protobuf_has,
+		const ProtobufCBinaryData * const protobuf_bytes,
+		const bool view_has,
+		const wire_bytes * const view_bytes,
+		const buffer_t * const input) {
+	if ((bool)protobuf_has != view_has) {
+		return false;
+	}
+	if (!view_has) {
+		return true;
+	}
+
+	if ((view_bytes->length != protobuf_bytes->len)
+			|| (view_bytes->data < input->content)
+			|| ((view_bytes->data + view_bytes->length) > (input->content + input->content_length))) {
+		return false;
+	}
+
+	return (view_bytes->length == 0) || (memcmp(view_bytes->data, protobuf_bytes->data, view_bytes->length) == 0);
+}
+
+static bool packet_equal(const Packet * const protobuf_packet, const packet_view * const view, const buffer_t * const input) {
+	const PacketHeader * const protobuf_header = protobuf_packet->packet_header;
+	const packet_header_view * const header = &view->packet_header;
+
+	return (protobuf_header->current_protocol_version == header->current_protocol_version)
+		&& (protobuf_header->highest_supported_protocol_version == header->highest_supported_protocol_version)
+		&& ((bool)protobuf_header->has_packet_type == header->has_packet_type)
+		&& ((int32_t)protobuf_header->packet_type == header->packet_type)
+		&& bytes_equal(protobuf_header->has_header_nonce, &protobuf_header->header_nonce, header->has_header_nonce, &header->header_nonce, input)
+		&& bytes_equal(protobuf_header->has_message_nonce, &protobuf_header->message_nonce, header->has_message_nonce, &header->message_nonce, input)
+		&& bytes_equal(protobuf_header->has_public_identity_key, &protobuf_header->public_identity_key, header->has_public_identity_key, &header->public_identity_key, input)
+		&& bytes_equal(protobuf_header->has_public_ephemeral_key, &protobuf_header->public_ephemeral_key, header->has_public_ephemeral_key, &header->public_ephemeral_key, input)
+		&& bytes_equal(protobuf_header->has_public_prekey, &protobuf_header->public_prekey, header->has_public_prekey, &header->public_prekey, input)
+		&& bytes_equal(protobuf_packet->has_encrypted_axolotl_header, &protobuf_packet->encrypted_axolotl_header, view->has_encrypted_axolotl_header, &view->encrypted_axolotl_header, input)
+		&& bytes_equal(protobuf_packet->has_encrypted_message, &protobuf_packet->encrypted_message, view->has_encrypted_message, &view->encrypted_message, input);
+}
+
+static bool header_equal(const Header * const protobuf_header, const header_view * const view, const buffer_t * const input) {
+	return bytes_equal(protobuf_header->has_public_ephemeral_key, &protobuf_header->public_ephemeral_key, view->has_public_ephemeral_key, &view->public_ephemeral_key, input)
+		&& ((bool)protobuf_header->has_message_number == view->has_message_number)
+		&& (!view->has_message_number || (protobuf_header->message_number == view->message_number))
+		&& ((bool)protobuf_header->has_previous_message_number == view->has_previous_message_number)
+		&& (!view->has_previous_message_number || (protobuf_header->previous_message_number == view->previous_message_number));
+}
+
+/*
+ * Unpack with both decoders, they have to agree on whether the input is
+ * valid and on its content.
+ */
+static return_status compare_packet_unpack(const buffer_t * const input) {
+	return_status status = return_status_init();
+
+	Packet *protobuf_packet = packet__unpack(NULL, input->content_length, input->content);
+
+	packet_view view;
+	return_status wire_status = wire_packet_unpack(&view, input);
+	const bool wire_success = (wire_status.status == SUCCESS);
+	return_status_destroy_errors(&wire_status);
+
+	if ((protobuf_packet != NULL) != wire_success) {
+		throw(INCORRECT_DATA, "Protobuf-C and the wire codec disagree on the validity of a packet.");
+	}
+	if ((protobuf_packet != NULL) && !packet_equal(protobuf_packet, &view, input)) {
+		throw(INCORRECT_DATA, "Unpacked packets differ.");
+	}
+
+cleanup:
+	if (protobuf_packet != NULL) {
+		packet__free_unpacked(protobuf_packet, NULL);
+	}
+
+	return status;
+}
+
+static return_status compare_header_unpack(const buffer_t * const input) {
+	return_status status = return_status_init();
+
+	Header *protobuf_header = header__unpack(NULL, input->content_length, input->content);
+
+	header_view view;
+	return_status wire_status = wire_header_unpack(&view, input);
+	const bool wire_success = (wire_status.status == SUCCESS);
+	return_status_destroy_errors(&wire_status);
+
+	if ((protobuf_header != NULL) != wire_success) {
+		throw(INCORRECT_DATA, "Protobuf-C and the wire codec disagree on the validity of a header.");
+	}
+	if ((protobuf_header != NULL) && !header_equal(protobuf_header, &view, input)) {
+		throw(INCORRECT_DATA, "Unpacked headers differ.");
+	}
+
+cleanup:
+	if (protobuf_header != NULL) {
+		header__free_unpacked(protobuf_header, NULL);
+	}
+
+	return status;
+}
+
+/*
+ * Unpack every prefix of an encoded message.
+ */
+static return_status compare_truncated(const buffer_t * const input, return_status (*compare)(const buffer_t * const input)) {
+	return_status status = return_status_init();
+
+	for (size_t length = 0; length <= input->content_length; length++) {
+		buffer_create_with_existing_array(truncated, input->content, length);
+		status = compare(truncated);
+		throw_on_error(INCORRECT_DATA, "Truncated message.");
+	}
+
+cleanup:
+	return status;
+}
+
+static return_status test_packets(void) {
+	return_status status = return_status_init();
+
+	buffer_t *protobuf_output = NULL;
+	buffer_t *wire_output = NULL;
+
+	static unsigned char storage[7][MAX_FIELD_LENGTH];
+	for (size_t i = 0; i < ITERATIONS; i++) {
+		Packet protobuf_packet;
+		PacketHeader protobuf_header;
+		packet_view view;
+		random_packet(&protobuf_packet, &protobuf_header, &view, storage);
+
+		const size_t protobuf_length = packet__get_packed_size(&protobuf_packet);
+		const size_t wire_length = wire_packet_get_packed_size(&view);
+		if (protobuf_length != wire_length) {
+			throw(INCORRECT_DATA, "Packed sizes of the packet differ.");
+		}
+
+		buffer_destroy_from_heap_and_null_if_valid(protobuf_output);
+		buffer_destroy_from_heap_and_null_if_valid(wire_output);
+		protobuf_output = buffer_create_on_heap(protobuf_length, protobuf_length);
+		throw_on_failed_alloc(protobuf_output);
+		wire_output = buffer_create_on_heap(wire_length, wire_length);
+		throw_on_failed_alloc(wire_output);
+
+		if ((packet__pack(&protobuf_packet, protobuf_output->content) != protobuf_length)
+				|| (wire_packet_pack(&view, wire_output->content) != wire_length)) {
+			throw(PROTOBUF_PACK_ERROR, "Failed to pack packet.");
+		}
+		if (buffer_compare(protobuf_output, wire_output) != 0) {
+			print_hex(protobuf_output);
+			print_hex(wire_output);
+			throw(INCORRECT_DATA, "Packed packets differ.");
+		}
+
+		status = compare_packet_unpack(wire_output);
+		throw_on_error(INCORRECT_DATA, "Failed to compare unpacked packets.");
+
+		if (i < 10) {
+			status = compare_truncated(wire_output, compare_packet_unpack);
+			throw_on_error(INCORRECT_DATA, "Failed to compare truncated packets.");
+		}
+	}
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(protobuf_output);
+	buffer_destroy_from_heap_and_null_if_valid(wire_output);
+
+	return status;
+}
+
+static return_status test_headers(void) {
+	return_status status = return_status_init();
+
+	buffer_t *protobuf_output = NULL;
+	buffer_t *wire_output = NULL;
+
+	static unsigned char storage[MAX_FIELD_LENGTH];
+	for (size_t i = 0; i < ITERATIONS; i++) {
+		Header protobuf_header;
+		header_view view;
+		random_header(&protobuf_header, &view, storage);
+
+		const size_t protobuf_length = header__get_packed_size(&protobuf_header);
+		const size_t wire_length = wire_header_get_packed_size(&view);
+		if (protobuf_length != wire_length) {
+			throw(INCORRECT_DATA, "Packed sizes of the header differ.");
+		}
+
+		buffer_destroy_from_heap_and_null_if_valid(protobuf_output);
+		buffer_destroy_from_heap_and_null_if_valid(wire_output);
+		//the header can be empty
+		protobuf_output = buffer_create_on_heap(protobuf_length + 1, protobuf_length);
+		throw_on_failed_alloc(protobuf_output);
+		wire_output = buffer_create_on_heap(wire_length + 1, wire_length);
+		throw_on_failed_alloc(wire_output);
+
+		if ((header__pack(&protobuf_header, protobuf_output->content) != protobuf_length)
+				|| (wire_header_pack(&view, wire_output->content) != wire_length)) {
+			throw(PROTOBUF_PACK_ERROR, "Failed to pack header.");
+		}
+		if (buffer_compare(protobuf_output, wire_output) != 0) {
+			throw(INCORRECT_DATA, "Packed headers differ.");
+		}
+
+		status = compare_header_unpack(wire_output);
+		throw_on_error(INCORRECT_DATA, "Failed to compare unpacked headers.");
+
+		if (i < 10) {
+			status = compare_truncated(wire_output, compare_header_unpack);
+			throw_on_error(INCORRECT_DATA, "Failed to compare truncated headers.");
+		}
+	}
+
+cleanup:
+	buffer_destroy_from_heap_and_null_if_valid(protobuf_output);
+	buffer_destroy_from_heap_and_null_if_valid(wire_output);
+
+	return status;
+}
+
+/*
+ * Unknown fields are skipped, unsupported wire types (groups) are rejected
+ * and wire types that don't match the field are rejected.
+ */
+static return_status test_unusual_fields(void) {
+	return_status status = return_status_init();
+
+	//packet header with current_protocol_version = 1, highest_supported_protocol_version = 2
+	static const unsigned char packet_header[] = {0x0a, 0x04, 0x08, 0x01, 0x10, 0x02};
+	static const unsigned char suffixes[][12] = {
+		{0xa0, 0x06, 0x80, 0x80, 0x04}, //unknown varint
+		{0xa9, 0x06, 1, 2, 3, 4, 5, 6, 7, 8}, //unknown fixed64
+		{0xb2, 0x06, 0x02, 0xff, 0xff}, //unknown length delimited
+		{0xbd, 0x06, 1, 2, 3, 4}, //unknown fixed32
+		{0xc3, 0x06, 0xc4, 0x06}, //group
+		{0x10, 0x01}, //encrypted_axolotl_header as varint
+		{0x1a, 0x03, 0x01}, //length beyond the end
+		{0x1a, 0x00, 0x12, 0x01, 0x00}, //empty encrypted_message, encrypted_axolotl_header
+		{0x0a, 0x02, 0x18, 0x00}, //second packet header without required fields
+		{0x0a, 0x04, 0x08, 0x05, 0x10, 0x06}, //second packet header
+		{0x00, 0x00}, //field number 0
+		{0xff, 0xff, 0xff, 0xff, 0xff, 0xff} //unterminated tag
+	};
+	static const size_t suffix_lengths[] = {5, 10, 5, 6, 4, 2, 3, 5, 4, 6, 2, 6};
+
+	unsigned char packet[sizeof(packet_header) + sizeof(suffixes[0])];
+	memcpy(packet, packet_header, sizeof(packet_header));
+	for (size_t i = 0; i < (sizeof(suffix_lengths) / sizeof(*suffix_lengths)); i++) {
+		memcpy(packet + sizeof(packet_header), suffixes[i], suffix_lengths[i]);
+		buffer_create_with_existing_array(input, packet, sizeof(packet_header) + suffix_lengths[i]);
+		status = compare_packet_unpack(input);
+		throw_on_error(INCORRECT_DATA, "Failed to compare packets with unusual fields.");
+	}
+
+	//header with fixed32 message_number encoded as varint
+	unsigned char header[] = {0x10, 0x01};
+	buffer_create_with_existing_array(header_buffer, header, sizeof(header));
+	status = compare_header_unpack(header_buffer);
+	throw_on_error(INCORRECT_DATA, "Failed to compare header with wrong wire type.");
+
+cleanup:
+	return status;
+}
+
+int main(void) {
+	return_status status = return_status_init();
+
+	if (sodium_init() == -1) {
+		throw(INIT_ERROR, "Failed to initialize libsodium.");
+	}
+
+	status = test_packets();
+	throw_on_error(INCORRECT_DATA, "Packets differ.");
+	printf("Packets are the same as with Protobuf-C.\n");
+
+	status = test_headers();
+	throw_on_error(INCORRECT_DATA, "Headers differ.");
+	printf("Headers are the same as with Protobuf-C.\n");
+
+	status = test_unusual_fields();
+	throw_on_error(INCORRECT_DATA, "Unusual fields are handled differently.");
+	printf("Unusual fields are handled like with Protobuf-C.\n");
+
+cleanup:
+	on_error {
+		print_errors(&status);
+	}
+	return_status_destroy_errors(&status);
+
+	return status.status;
+}
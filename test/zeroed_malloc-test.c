@@ -26,7 +26,6 @@
 
 #include "../lib/zeroed_malloc.h"
 #include "utils.h"
-#include "tracing.h"
 
 int main(void) {
 	return_status status = return_status_init();
@@ -49,11 +48,73 @@ int main(void) {
 	memcpy(&pointer_copy, pointer - sizeof(size_t) - sizeof(void*), sizeof(void*));
 	printf("pointer_copy = %p\n", (void*)pointer_copy);
 
+	memset(pointer, 0xff, 100);
 	zeroed_free(pointer);
 
+	//pool
+	printf("Checking pool.\n");
+	char * const pooled_pointer = zeroed_malloc(120); //same size class
+	if (pooled_pointer == NULL) {
+		throw(ALLOCATION_FAILED, "Failed to allocate from the pool.");
+	}
+	if (pooled_pointer != pointer) {
+		throw(INCORRECT_DATA, "Freed block wasn't reused.");
+	}
+	memcpy(&size, pooled_pointer - sizeof(size_t), sizeof(size_t));
+	if (size != 120) {
+		throw(INCORRECT_DATA, "Size stored in front of the pooled block is incorrect.");
+	}
+	for (size_t i = 0; i < 100; i++) {
+		if (pooled_pointer[i] != 0) {
+			throw(INCORRECT_DATA, "Pooled block wasn't erased.");
+		}
+	}
+	memset(pooled_pointer, 0xff, 120);
+	zeroed_free(pooled_pointer);
+
 	void *new_pointer = protobuf_c_allocator(NULL, 20);
 	protobuf_c_free(NULL, new_pointer);
 
+	//arena
+	printf("Checking arena.\n");
+	char *outside_pointer = zeroed_malloc(10);
+	if (outside_pointer == NULL) {
+		throw(ALLOCATION_FAILED, "Failed to allocate with zeroed_malloc.");
+	}
+	zeroed_arena_begin();
+	zeroed_arena_begin(); //nested
+	char *arena_pointers[100];
+	for (size_t i = 0; i < 100; i++) {
+		//some of them don't fit into a chunk
+		const size_t length = ((i % 10) == 9) ? 40000 : (i + 1);
+		arena_pointers[i] = protobuf_c_allocator(NULL, length);
+		if (arena_pointers[i] == NULL) {
+			throw(ALLOCATION_FAILED, "Failed to allocate from the arena.");
+		}
+		if (((uintptr_t)arena_pointers[i] % sizeof(intmax_t)) != 0) {
+			throw(INCORRECT_DATA, "Arena allocation isn't aligned.");
+		}
+		memcpy(&size, arena_pointers[i] - sizeof(size_t), sizeof(size_t));
+		if (size != length) {
+			throw(INCORRECT_DATA, "Size stored in front of the arena allocation is incorrect.");
+		}
+		memset(arena_pointers[i], (int)i, length);
+	}
+	//freeing inside the arena does nothing
+	protobuf_c_free(NULL, arena_pointers[0]);
+	zeroed_free(arena_pointers[1]);
+	for (size_t i = 2; i < 100; i++) {
+		if ((arena_pointers[i][0] != (char)i) || (arena_pointers[i][((i % 10) == 9) ? 39999 : i] != (char)i)) {
+			throw(INCORRECT_DATA, "Arena allocations overlap.");
+		}
+	}
+	//memory from outside of the arena is still freed normally
+	zeroed_free(outside_pointer);
+	zeroed_arena_end();
+	zeroed_arena_end();
+	//ending an arena that doesn't exist does nothing
+	zeroed_arena_end();
+
 cleanup:
 	on_error {
 		print_errors(&status);